@@ -0,0 +1,218 @@
+// Model analyzer, a C++ replacement for scripts/read.py
+//
+// Lists the input / output / all tensors of a model, then places every
+// Conv2D, DepthwiseConv2D and FullyConnected node on a roofline: MACs,
+// weight and activation bytes, arithmetic intensity, and the measured time
+// against the measured memory bandwidth and int8 MAC peak of this machine.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <string>
+
+#include <tensorflow/lite/interpreter.h>
+#include <tensorflow/lite/kernels/register.h>
+#include <tensorflow/lite/kernels/register_ref.h>
+#include <tensorflow/lite/model.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "preprocess.h"
+#include "profiler.h"
+#include "roofline.h"
+
+namespace {
+
+void print_tensor(const tflite::Interpreter* interpreter, int idx)
+{
+  const TfLiteTensor* t = interpreter->tensor(idx);
+  printf("%4d %-48s %-8s %-16s %10zu", idx, t->name ? t->name : "",
+         TfLiteTypeGetName(t->type), shape_string(t->dims).c_str(), t->bytes);
+  if (t->quantization.type == kTfLiteAffineQuantization) {
+    const TfLiteAffineQuantization* q = (const TfLiteAffineQuantization*)t->quantization.params;
+    if (q && q->scale && q->scale->size > 1) {
+      printf(" scale[%d] zero_point %d", q->scale->size, q->zero_point->data[0]);
+    }else {
+      printf(" scale %g zero_point %d", t->params.scale, t->params.zero_point);
+    }
+  }
+  printf("\n");
+}
+
+void print_tensors(const tflite::Interpreter* interpreter)
+{
+  printf("%4s %-48s %-8s %-16s %10s\n", "idx", "name", "type", "shape", "bytes");
+  printf("inputs\n");
+  for (size_t i=0; i<interpreter->inputs().size(); ++i) {
+    print_tensor(interpreter, interpreter->inputs()[i]);
+  }
+  printf("outputs\n");
+  for (size_t i=0; i<interpreter->outputs().size(); ++i) {
+    print_tensor(interpreter, interpreter->outputs()[i]);
+  }
+  printf("tensors\n");
+  for (size_t i=0; i<interpreter->tensors_size(); ++i) {
+    print_tensor(interpreter, (int)i);
+  }
+}
+
+// per node average seconds of iterations Invokes, after a warm-up run
+std::vector<double> time_nodes(tflite::Interpreter* interpreter, int iterations)
+{
+  const size_t num_nodes = interpreter->primary_subgraph().nodes_size();
+  NodeProfiler profiler(num_nodes);
+  interpreter->Invoke();
+  interpreter->SetProfiler(&profiler);
+  for (int i=0; i<iterations; ++i) {
+    interpreter->Invoke();
+  }
+  interpreter->SetProfiler(nullptr);
+  std::vector<double> seconds(num_nodes, 0.0);
+  for (size_t i=0; i<num_nodes; ++i) {
+    if (profiler.count(i)) {
+      seconds[i] = profiler.seconds(i) / profiler.count(i);
+    }
+  }
+  return seconds;
+}
+
+void print_roofline(const tflite::Interpreter* interpreter, const std::vector<double>& seconds, const Roofline& roof)
+{
+  const tflite::Subgraph& graph = interpreter->primary_subgraph();
+  const auto& nodes = graph.nodes_and_registration();
+  const bool timed = !seconds.empty();
+  printf("roofline : peak %.2f GOPS, bandwidth %.2f GB/s, ridge %.2f ops/byte\n",
+         roof.peak_gops, roof.bandwidth_gbps, roof.ridge());
+  printf("%4s %-16s %-16s %12s %10s %10s %10s %8s %7s",
+         "node", "op", "output", "MACs", "weight B", "input B", "output B", "ops/B", "bound");
+  if (timed) {
+    printf(" %9s %7s %7s %6s", "ms", "GOPS", "roof", "%roof");
+  }
+  printf("\n");
+
+  int64_t total_macs = 0;
+  int64_t total_bytes = 0;
+  int num_bound[2] = {0, 0};
+  double seconds_bound[2] = {0, 0};
+  const std::vector<int>& plan = interpreter->execution_plan();
+  for (size_t i=0; i<plan.size(); ++i) {
+    const int idx = plan[i];
+    const TfLiteNode& node = nodes[idx].first;
+    const int32_t code = nodes[idx].second.builtin_code;
+    if (code != kTfLiteBuiltinConv2d && code != kTfLiteBuiltinDepthwiseConv2d
+      && code != kTfLiteBuiltinFullyConnected) {
+      continue;
+    }
+    const LayerTraffic t = node_traffic(interpreter, node, code);
+    const double intensity = t.intensity();
+    const bool compute = roof.compute_bound(intensity);
+    total_macs += t.macs;
+    total_bytes += t.bytes();
+    ++num_bound[compute];
+    printf("%4d %-16s %-16s %12lld %10lld %10lld %10lld %8.2f %7s",
+           idx, builtin_op_name(code), shape_string(interpreter->tensor(node.outputs->data[0])->dims).c_str(),
+           (long long)t.macs, (long long)t.weight_bytes, (long long)t.input_bytes, (long long)t.output_bytes,
+           intensity, compute ? "compute" : "memory");
+    if (timed) {
+      const double s = seconds[idx];
+      const double gops = s > 0 ? 2.0 * t.macs / s * 1e-9 : 0.0;
+      const double attainable = roof.attainable_gops(intensity);
+      seconds_bound[compute] += s;
+      printf(" %9.3f %7.2f %7.2f %6.1f", s * 1e3, gops, attainable,
+             attainable > 0 ? 100.0 * gops / attainable : 0.0);
+    }
+    printf("\n");
+  }
+  printf("total %lld MACs, %lld bytes, %.2f ops/byte\n",
+         (long long)total_macs, (long long)total_bytes,
+         total_bytes ? 2.0 * total_macs / total_bytes : 0.0);
+  printf("compute bound : %d layers", num_bound[1]);
+  if (timed) {
+    printf(", %.3f ms", seconds_bound[1] * 1e3);
+  }
+  printf("\nmemory bound : %d layers", num_bound[0]);
+  if (timed) {
+    printf(", %.3f ms", seconds_bound[0] * 1e3);
+  }
+  printf("\n");
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  // -p iterations : timed runs per node, 0 for the static analysis only
+  // -b GB/s, -g GOPS : roofs to use instead of measuring them
+  int iterations = 10;
+  double bandwidth = 0;
+  double peak = 0;
+  int arg = 1;
+  for (; arg + 1 < argc && argv[arg][0] == '-'; ++arg) {
+    if (strcmp(argv[arg], "-p") == 0) {
+      iterations = atoi(argv[++arg]);
+    }else if (strcmp(argv[arg], "-b") == 0) {
+      bandwidth = atof(argv[++arg]);
+    }else if (strcmp(argv[arg], "-g") == 0) {
+      peak = atof(argv[++arg]);
+    }else {
+      break;
+    }
+  }
+  if (argc - arg < 1) {
+    printf("usage : [-p iterations] [-b GB/s] [-g GOPS] model_file [image_file]\n");
+    return 0;
+  }
+  const char* modelFilePath = argv[arg];
+  const char* imageFilePath = (argc - arg > 1) ? argv[arg + 1] : nullptr;
+
+  auto model = tflite::FlatBufferModel::BuildFromFile(modelFilePath);
+  if (!model) {
+    printf("failed to load model : %s\n", modelFilePath);
+    return 0;
+  }
+  tflite::ops::builtin::BuiltinRefOpResolver resolver;
+  tflite::InterpreterBuilder builder(*model, resolver);
+  std::unique_ptr<tflite::Interpreter> interpreter;
+  builder(&interpreter);
+  if (!interpreter || interpreter->AllocateTensors() != kTfLiteOk) {
+    printf("failed to build interpreter\n");
+    return 0;
+  }
+  print_tensors(interpreter.get());
+  printf("\n");
+
+  std::vector<double> seconds;
+  if (iterations > 0) {
+    // an image gives realistic activations, otherwise the input stays zero
+    TfLiteTensor* input_tensor = interpreter->tensor(interpreter->inputs()[0]);
+    if (imageFilePath) {
+      const TfLiteIntArray* dims = input_tensor->dims;
+      PreprocessParams params(Shape(1, dims->data[1], dims->data[2], dims->data[3]));
+      bool ok;
+      if (input_tensor->type == kTfLiteInt8) {
+        params.offset = -128;
+        ok = preprocess_file(imageFilePath, params, input_tensor->data.int8);
+      }else {
+        ok = preprocess_file(imageFilePath, params, input_tensor->data.uint8);
+      }
+      if (!ok) {
+        printf("failed to load image : %s\n", imageFilePath);
+        return 0;
+      }
+    }else {
+      memset(input_tensor->data.raw, 0, input_tensor->bytes);
+    }
+    seconds = time_nodes(interpreter.get(), iterations);
+  }
+  if (bandwidth <= 0) {
+    bandwidth = measure_bandwidth_gbps();
+  }
+  if (peak <= 0) {
+    peak = measure_peak_int8_gops();
+  }
+  print_roofline(interpreter.get(), seconds, Roofline(peak, bandwidth));
+
+  return 0;
+}
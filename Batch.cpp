@@ -0,0 +1,368 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include <tensorflow/lite/interpreter.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "preprocess.h"
+#include "batch_loader.h"
+#include "spsc_queue.h"
+#include "interpreter_pool.h"
+#include "topk.h"
+#include "profiler.h"
+#include "trace.h"
+
+// Classifies every image under the given files / directories.
+// decode -> infer -> top-k run on their own threads, linked by lock-free
+// queues; jobs flow back from top-k to decode for reuse. Inference runs on
+// one thread per pooled interpreter, job i going to worker i % N, so top-k
+// still sees the images in order.
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+bool has_image_extension(const std::string& name)
+{
+  static const char* const exts[] = { "jpg", "jpeg", "png", "bmp", "tga", "gif", "ppm", "pgm" };
+  size_t dot = name.rfind('.');
+  if (dot == std::string::npos) {
+    return false;
+  }
+  std::string ext = name.substr(dot + 1);
+  for (size_t i=0; i<ext.size(); ++i) {
+    ext[i] = (char)tolower((unsigned char)ext[i]);
+  }
+  for (size_t i=0; i<sizeof(exts)/sizeof(exts[0]); ++i) {
+    if (ext == exts[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool is_directory(const std::string& path)
+{
+#ifdef _WIN32
+  DWORD attr = GetFileAttributesA(path.c_str());
+  return attr != INVALID_FILE_ATTRIBUTES && (attr & FILE_ATTRIBUTE_DIRECTORY);
+#else
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+#endif
+}
+
+// image files directly inside dir, sorted by name
+void list_images(const std::string& dir, std::vector<std::string>& paths)
+{
+  std::vector<std::string> names;
+#ifdef _WIN32
+  WIN32_FIND_DATAA fd;
+  HANDLE h = FindFirstFileA((dir + "\\*").c_str(), &fd);
+  if (h != INVALID_HANDLE_VALUE) {
+    do {
+      if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && has_image_extension(fd.cFileName)) {
+        names.push_back(fd.cFileName);
+      }
+    } while (FindNextFileA(h, &fd));
+    FindClose(h);
+  }
+  const char sep = '\\';
+#else
+  DIR* d = opendir(dir.c_str());
+  if (d) {
+    while (struct dirent* e = readdir(d)) {
+      if (has_image_extension(e->d_name) && !is_directory(dir + "/" + e->d_name)) {
+        names.push_back(e->d_name);
+      }
+    }
+    closedir(d);
+  }
+  const char sep = '/';
+#endif
+  std::sort(names.begin(), names.end());
+  for (size_t i=0; i<names.size(); ++i) {
+    paths.push_back(dir + sep + names[i]);
+  }
+}
+
+template <typename T>
+struct Job
+{
+  size_t index;
+  std::string path;
+  bool ok;
+  const char* error;
+  std::vector<T> input;
+  std::vector<uint8_t> output;  // raw output tensor bytes
+  Clock::time_point start;      // decode start
+};
+
+struct Options
+{
+  size_t decode_threads;  // 0 = hardware threads
+  size_t interpreters;
+  int interpreter_threads; // per interpreter, 0 = hardware threads / interpreters
+  int top_k;
+  size_t depth;           // jobs in flight
+  const char* trace_path; // Chrome trace output, nullptr = off
+
+  Options()
+    :
+    decode_threads(0),
+    interpreters(1),
+    interpreter_threads(0),
+    top_k(5),
+    depth(16),
+    trace_path(nullptr)
+  {
+  }
+};
+
+double percentile(std::vector<double> v, double p)
+{
+  if (v.empty()) {
+    return 0.0;
+  }
+  size_t k = (size_t)(p * (v.size() - 1) + 0.5);
+  std::nth_element(v.begin(), v.begin() + k, v.end());
+  return v[k];
+}
+
+template <typename T>
+void run_batch(
+  InterpreterPool& pool,
+  const std::vector<std::string>& paths,
+  const PreprocessParams& params,
+  const Options& opts,
+  FILE* out)
+{
+  const tflite::Interpreter* front = pool.front();
+  const TfLiteTensor* output_tensor = front->tensor(front->outputs()[0]);
+  const int top_k_count = std::min(opts.top_k, num_classes(output_tensor));
+  const size_t num_workers = pool.size();
+
+  std::vector<Job<T> > jobs(opts.depth);
+  SpscQueue<Job<T>*> free_jobs(opts.depth);   // top-k -> decode
+  std::vector<std::unique_ptr<SpscQueue<Job<T>*> > > decoded(num_workers);  // decode -> infer
+  std::vector<std::unique_ptr<SpscQueue<Job<T>*> > > inferred(num_workers); // infer -> top-k
+  for (size_t i=0; i<num_workers; ++i) {
+    decoded[i].reset(new SpscQueue<Job<T>*>(opts.depth));
+    inferred[i].reset(new SpscQueue<Job<T>*>(opts.depth));
+  }
+  for (size_t i=0; i<jobs.size(); ++i) {
+    free_jobs.push(&jobs[i]);
+  }
+
+  const Clock::time_point begin = Clock::now();
+  double decode_wait = 0;
+  size_t decode_workers = 0;
+  std::thread decode_thread([&]() {
+    BatchLoader<T> loader(paths, params, opts.decode_threads, opts.depth);
+    decode_workers = loader.num_workers();
+    typename BatchLoader<T>::Item item;
+    for (;;) {
+      Job<T>* job;
+      free_jobs.pop(job);
+      if (!loader.next(item)) {
+        break;
+      }
+      job->index = item.index;
+      job->path = item.path;
+      job->ok = item.ok;
+      job->error = item.error;
+      job->input.swap(item.data);
+      job->start = item.load_start;
+      decoded[job->index % num_workers]->push(job);
+    }
+    for (size_t i=0; i<num_workers; ++i) {
+      decoded[i]->push(nullptr);
+    }
+    decode_wait = loader.wait_seconds();
+  });
+
+  std::vector<double> invoke_ms(num_workers, 0.0);
+  std::vector<size_t> invoked(num_workers, 0);
+  std::vector<std::thread> infer_threads;
+  for (size_t w=0; w<num_workers; ++w) {
+    infer_threads.push_back(std::thread([&, w]() {
+      InterpreterPool::Handle interpreter = pool.acquire();
+      // per node events in the trace
+      NodeProfiler profiler(interpreter->nodes_size());
+      if (opts.trace_path) {
+        interpreter->SetProfiler(&profiler);
+      }
+      T* input_data = interpreter->typed_input_tensor<T>(0);
+      const TfLiteTensor* output = interpreter->tensor(interpreter->outputs()[0]);
+      for (;;) {
+        Job<T>* job;
+        decoded[w]->pop(job);
+        if (!job) {
+          break;
+        }
+        if (job->ok) {
+          TRACE_SCOPE_ARG("invoke", job->index);
+          std::copy(job->input.begin(), job->input.end(), input_data);
+          const Clock::time_point t0 = Clock::now();
+          const TfLiteStatus status = interpreter->Invoke();
+          invoke_ms[w] += std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+          ++invoked[w];
+          if (status == kTfLiteOk) {
+            job->output.assign(output->data.uint8, output->data.uint8 + output->bytes);
+          }else {
+            job->ok = false;
+            job->error = "Invoke failed";
+          }
+        }
+        inferred[w]->push(job);
+      }
+      inferred[w]->push(nullptr);
+      interpreter->SetProfiler(nullptr);
+    }));
+  }
+
+  // top-k on this thread, in list order
+  std::vector<double> latencies;
+  latencies.reserve(paths.size());
+  size_t failed = 0;
+  std::vector<int> classes(top_k_count);
+  std::vector<float> scores(top_k_count);
+  for (size_t n=0; ; ++n) {
+    Job<T>* job;
+    inferred[n % num_workers]->pop(job);
+    if (!job) {
+      break;
+    }
+    if (!job->ok) {
+      fprintf(out, "%s\terror: %s\n", job->path.c_str(), job->error ? job->error : "unknown");
+      ++failed;
+    }else {
+      TRACE_SCOPE_ARG("topk", job->index);
+      top_k(output_tensor, top_k_count, &classes[0], &scores[0], &job->output[0]);
+      fprintf(out, "%s", job->path.c_str());
+      for (int i=0; i<top_k_count; ++i) {
+        fprintf(out, "\t%d:%.4f", classes[i], scores[i]);
+      }
+      fprintf(out, "\n");
+    }
+    latencies.push_back(std::chrono::duration<double, std::milli>(Clock::now() - job->start).count());
+    free_jobs.push(job);
+  }
+  for (size_t w=0; w<num_workers; ++w) {
+    infer_threads[w].join();
+  }
+  decode_thread.join();
+
+  const double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+  double total_invoke_ms = 0;
+  size_t total_invoked = 0;
+  for (size_t w=0; w<num_workers; ++w) {
+    total_invoke_ms += invoke_ms[w];
+    total_invoked += invoked[w];
+  }
+  printf("%zu images (%zu failed) in %.2f s : %.1f images/sec\n",
+         paths.size(), failed, seconds, paths.size() / seconds);
+  printf("latency p50 %.1f ms, p99 %.1f ms\n", percentile(latencies, 0.5), percentile(latencies, 0.99));
+  printf("invoke avg %.1f ms on %zu interpreters x %d threads, %zu decode threads, inference waited %.2f s for decoding\n",
+         total_invoked ? total_invoke_ms / total_invoked : 0.0,
+         num_workers, pool.threads_per_interpreter(), decode_workers, decode_wait);
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  Options opts;
+  int arg = 1;
+  for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+    const char* opt = argv[arg];
+    const int value = atoi(argv[arg + 1]);
+    if (strcmp(opt, "-T") == 0) {
+      opts.trace_path = argv[arg + 1];
+    }else if (strcmp(opt, "-j") == 0) {
+      opts.decode_threads = value;
+    }else if (strcmp(opt, "-n") == 0) {
+      opts.interpreters = value;
+    }else if (strcmp(opt, "-t") == 0) {
+      opts.interpreter_threads = value;
+    }else if (strcmp(opt, "-k") == 0) {
+      opts.top_k = value;
+    }else if (strcmp(opt, "-d") == 0) {
+      opts.depth = value;
+    }else {
+      break;
+    }
+  }
+  if (argc - arg < 3 || opts.depth < 1 || opts.top_k < 1 || opts.interpreters < 1) {
+    printf("usage : [-j decode_threads] [-n interpreters] [-t threads_per_interpreter] [-k top_k] [-d depth] [-T trace.json] model_file output_file image_file_or_dir...\n");
+    return 0;
+  }
+
+  const char* modelFilePath = argv[arg];
+  const char* outputFilePath = argv[arg + 1];
+  std::vector<std::string> paths;
+  for (int i=arg+2; i<argc; ++i) {
+    if (is_directory(argv[i])) {
+      list_images(argv[i], paths);
+    }else {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.empty()) {
+    printf("no images\n");
+    return 0;
+  }
+
+  InterpreterPool pool(modelFilePath, opts.interpreters, opts.interpreter_threads);
+  if (!pool.ok()) {
+    printf("failed to load model : %s\n", modelFilePath);
+    return 0;
+  }
+  // keep a job queued for every interpreter
+  opts.depth = std::max(opts.depth, pool.size() * 2);
+
+  const TfLiteTensor* input_tensor = pool.front()->tensor(pool.front()->inputs()[0]);
+  const TfLiteIntArray* input_dim = input_tensor->dims;
+  PreprocessParams params(Shape(1, input_dim->data[1], input_dim->data[2], input_dim->data[3]));
+
+  FILE* out = fopen(outputFilePath, "w");
+  if (!out) {
+    printf("failed to open : %s\n", outputFilePath);
+    return 0;
+  }
+  if (opts.trace_path) {
+    trace_start();
+  }
+  if (input_tensor->type == kTfLiteInt8) {
+    params.offset = -128;
+    run_batch<int8_t>(pool, paths, params, opts, out);
+  }else {
+    run_batch<uint8_t>(pool, paths, params, opts, out);
+  }
+  fclose(out);
+  if (opts.trace_path) {
+    trace_stop();
+    if (!trace_write(opts.trace_path)) {
+      printf("failed to write trace : %s\n", opts.trace_path);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,556 @@
+// Micro-benchmark of the cnn.h kernels over every distinct Conv2D /
+// DepthwiseConv2D shape of EfficientNet-lite0, on random data
+//
+// usage : bench_cnn [-r repetitions] [-w warmup] [-v variant] [-c] [-a autotune_cache]
+//
+// Prints one CSV row per layer and variant (see variants[] below): median
+// and p90 time of the repetitions and GOPS at the median, so runs can be
+// diffed to catch regressions. -v runs a single variant, -c adds the IPC
+// and L1D misses per 1000 instructions, and -a autotunes the layers (or
+// loads their tunings) so the tuned variant runs too.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include <memory>
+#include <random>
+#include <chrono>
+#include <algorithm>
+
+#include "cnn.h"
+#include "perf_counters.h"
+#include "autotune.h"
+#include "conv_plan.h"
+#include "cnn_float.h"
+#include "cnn_int16.h"
+#include "cnn_int4.h"
+#include "cnn_sparse.h"
+
+namespace {
+
+// same padding as TFLite : the excess split evenly, the extra pixel after
+int same_padding(int in_size, int out_size, int filter_size, int stride)
+{
+  return std::max((out_size - 1) * stride + filter_size - in_size, 0) / 2;
+}
+
+ConvLayer_int8 make_layer(LayerType type, int size, int in_ch, int out_ch, int kernel, int stride)
+{
+  ConvLayer_int8 layer;
+  layer.type = type;
+  const int out_size = (size + stride - 1) / stride;
+  layer.input_shape = Shape(1, size, size, in_ch);
+  layer.output_shape = Shape(1, out_size, out_size, out_ch);
+  layer.filter_shape = (type == LayerType::Conv2D)
+    ? Shape(out_ch, kernel, kernel, in_ch)
+    : Shape(1, kernel, kernel, out_ch);
+  layer.stride_height = stride;
+  layer.stride_width = stride;
+  layer.padding_height = same_padding(size, out_size, kernel, stride);
+  layer.padding_width = layer.padding_height;
+  return layer;
+}
+
+bool same_shape(const Shape& a, const Shape& b)
+{
+  return a.number == b.number && a.height == b.height && a.width == b.width && a.channel == b.channel;
+}
+
+bool same_layer(const ConvLayer_int8& a, const ConvLayer_int8& b)
+{
+  return a.type == b.type && a.stride_height == b.stride_height
+    && same_shape(a.input_shape, b.input_shape) && same_shape(a.filter_shape, b.filter_shape);
+}
+
+// EfficientNet-lite0 at 224x224: stem, MBConv blocks (1x1 expand,
+// depthwise, 1x1 project) and the 1x1 head, duplicates removed
+std::vector<ConvLayer_int8> efficientnet_lite0_layers()
+{
+  struct Block
+  {
+    int expand;
+    int kernel;
+    int stride;
+    int channels;
+    int repeats;
+  };
+  static const Block blocks[] = {
+    {1, 3, 1, 16, 1},
+    {6, 3, 2, 24, 2},
+    {6, 5, 2, 40, 2},
+    {6, 3, 2, 80, 3},
+    {6, 5, 1, 112, 3},
+    {6, 5, 2, 192, 4},
+    {6, 3, 1, 320, 1},
+  };
+  std::vector<ConvLayer_int8> all;
+  int size = 224;
+  int ch = 32;
+  all.push_back(make_layer(LayerType::Conv2D, size, 3, ch, 3, 2));
+  size = all.back().output_shape.height;
+  for (size_t i=0; i<sizeof(blocks)/sizeof(blocks[0]); ++i) {
+    const Block& b = blocks[i];
+    for (int r=0; r<b.repeats; ++r) {
+      const int stride = r ? 1 : b.stride;
+      const int mid = ch * b.expand;
+      if (b.expand != 1) {
+        all.push_back(make_layer(LayerType::Conv2D, size, ch, mid, 1, 1));
+      }
+      all.push_back(make_layer(LayerType::DepthwiseConv2D, size, mid, mid, b.kernel, stride));
+      size = all.back().output_shape.height;
+      all.push_back(make_layer(LayerType::Conv2D, size, mid, b.channels, 1, 1));
+      ch = b.channels;
+    }
+  }
+  all.push_back(make_layer(LayerType::Conv2D, size, ch, 1280, 1, 1));
+
+  std::vector<ConvLayer_int8> layers;
+  for (size_t i=0; i<all.size(); ++i) {
+    bool found = false;
+    for (size_t j=0; j<layers.size() && !found; ++j) {
+      found = same_layer(all[i], layers[j]);
+    }
+    if (!found) {
+      layers.push_back(all[i]);
+    }
+  }
+  return layers;
+}
+
+// the layer's values scaled to about [-1, 1], stored as T
+template <typename T>
+struct FloatData
+{
+  std::vector<T> filter;
+  std::vector<T> bias;
+  std::vector<T> input;
+  std::vector<T> output;
+  PackedFilter<T> packed;  // Conv2D layers, packed here rather than per run
+
+  void init(const ConvLayer_int8& layer, const std::vector<int8_t>& filter8,
+            const std::vector<int32_t>& bias32, const std::vector<int8_t>& input8) {
+    filter.resize(filter8.size());
+    for (size_t i=0; i<filter8.size(); ++i) {
+      filter[i] = T(filter8[i] / 128.0f);
+    }
+    bias.resize(bias32.size());
+    for (size_t i=0; i<bias32.size(); ++i) {
+      bias[i] = T(bias32[i] / 1000.0f);
+    }
+    input.resize(layer.input_shape.num_elements());
+    for (size_t i=0; i<input.size(); ++i) {
+      input[i] = T(input8[i] / 128.0f);
+    }
+    output.resize(layer.output_shape.num_elements());
+    if (layer.type == LayerType::Conv2D) {
+      pack_filter_float(layer.filter_shape, &filter[0], &bias[0], packed);
+    }
+  }
+};
+
+// random weights and quantization parameters for a layer, owned here, and
+// how the variants run it
+struct LayerData
+{
+  std::vector<int8_t> filter;
+  std::vector<int32_t> bias;
+  std::vector<int8_t> input;
+  std::vector<int8_t> output;
+  ConvTuning tuning;
+  ConvPlan plans[NUM_CONV_ALGORITHMS];
+  ConvPlan plan;  // selected by the cost model
+  FloatData<float> fp32;
+  PackedFilter<float> fp32_winograd;  // fp32's filter with its F(4x4, 3x3) transform
+  FloatData<float16> fp16;
+  FloatData<bfloat16> bf16;
+  // 16x8 copy : the int8 values scaled up to int16, the bias to int64
+  ConvLayer_int16 layer16;
+  std::vector<int64_t> bias16;
+  std::vector<int16_t> input16;
+  std::vector<int16_t> output16;
+  Int4Filter int4;
+  std::vector<int8_t> pruned;
+  BlockSparseFilter sparse;
+  std::vector<int8_t> sparse_input;  // half the channel groups at the zero point
+  ConvPlan skip_plan;
+
+  LayerData(ConvLayer_int8& layer, int batch, std::mt19937& rng)
+  {
+    std::uniform_int_distribution<int> int8_dist(-128, 127);
+    std::uniform_int_distribution<int> bias_dist(-1000, 1000);
+    const int out_ch = layer.output_shape.channel;
+    filter.resize(layer.filter_shape.num_elements());
+    bias.resize(out_ch);
+    input.resize(layer.input_shape.num_elements() * batch);
+    output.resize(layer.output_shape.num_elements() * batch);
+    for (size_t i=0; i<filter.size(); ++i) {
+      filter[i] = (int8_t)int8_dist(rng);
+    }
+    for (size_t i=0; i<bias.size(); ++i) {
+      bias[i] = bias_dist(rng);
+    }
+    for (size_t i=0; i<input.size(); ++i) {
+      input[i] = (int8_t)int8_dist(rng);
+    }
+    layer.filter_values = &filter[0];
+    layer.bias_values = &bias[0];
+    layer.input_offset = 128;
+    layer.output_offset = -128;
+    layer.output_multiplier.assign(out_ch, 1 << 30);
+    layer.output_shift.assign(out_ch, 8);
+    for (int a=0; a<NUM_CONV_ALGORITHMS; ++a) {
+      if (conv_algorithm_applicable(layer, (ConvAlgorithm)a)) {
+        plans[a] = make_conv_plan(layer, (ConvAlgorithm)a);
+      }
+    }
+    fp32.init(layer, filter, bias, input);
+    if (conv_algorithm_applicable(layer, ConvAlgorithm::winograd)) {
+      fp32_winograd = fp32.packed;
+      pack_filter_winograd(layer.filter_shape, 4, fp32_winograd);
+    }
+    fp16.init(layer, filter, bias, input);
+    bf16.init(layer, filter, bias, input);
+    layer16.type = layer.type;
+    layer16.input_shape = layer.input_shape;
+    layer16.filter_shape = layer.filter_shape;
+    layer16.output_shape = layer.output_shape;
+    layer16.stride_height = layer.stride_height;
+    layer16.stride_width = layer.stride_width;
+    layer16.padding_height = layer.padding_height;
+    layer16.padding_width = layer.padding_width;
+    layer16.output_multiplier = layer.output_multiplier;
+    layer16.output_shift = layer.output_shift;
+    bias16.assign(bias.begin(), bias.end());
+    input16.resize(layer.input_shape.num_elements());
+    for (size_t i=0; i<input16.size(); ++i) {
+      input16[i] = (int16_t)(input[i] * 256);
+    }
+    output16.resize(layer.output_shape.num_elements());
+    layer16.filter_values = &filter[0];
+    layer16.bias_values = &bias16[0];
+    if (layer.type == LayerType::Conv2D) {
+      pack_filter_int4(layer, int4);
+      pruned = filter;
+      prune_blocks(pruned, layer.input_shape.channel, 16, 0.75, rng);
+      make_block_sparse_filter(layer.filter_shape, &pruned[0], 16, sparse);
+    }
+    sparse_input = input;
+    const int depth = layer.input_shape.channel;
+    for (size_t i=0; i<sparse_input.size(); i+=depth) {
+      for (int c0=0; c0<depth; c0+=ZERO_SKIP_GROUP) {
+        if (rng() & 1) {
+          const int len = std::min(ZERO_SKIP_GROUP, depth - c0);
+          memset(&sparse_input[i + c0], -layer.input_offset, len);
+        }
+      }
+    }
+    if (conv_algorithm_applicable(layer, ConvAlgorithm::gemm_1x1)) {
+      skip_plan = make_conv_plan(layer, ConvAlgorithm::gemm_1x1);
+      skip_plan.skip_zero_inputs = true;
+    }
+  }
+};
+
+// a way of running a layer; images is how many inputs one run processes
+struct Variant
+{
+  const char* name;
+  int images;
+  bool tuned;       // needs -a
+  int algorithm;    // ConvAlgorithm it is limited to, -1 for every layer
+  bool floating;    // runs a float, 16x8 or pruned copy, no int8 estimate
+  void (*run)(const ConvLayer_int8& layer, LayerData& data, ThreadPool* pool,
+              const int8_t* input, int8_t* output);
+};
+
+void run_direct(const ConvLayer_int8& layer, LayerData&, ThreadPool*, const int8_t* input, int8_t* output)
+{
+  run_layer(layer, input, output);
+}
+
+void run_batch4(const ConvLayer_int8& layer, LayerData&, ThreadPool*, const int8_t* input, int8_t* output)
+{
+  ConvLayer_int8 batched = layer;
+  batched.input_shape.number = 4;
+  batched.output_shape.number = 4;
+  run_layer(batched, input, output);
+}
+
+void run_tuned(const ConvLayer_int8& layer, LayerData& data, ThreadPool* pool, const int8_t* input, int8_t* output)
+{
+  run_layer_tuned(layer, data.tuning, input, output, pool);
+}
+
+void run_im2col(const ConvLayer_int8& layer, LayerData& data, ThreadPool*, const int8_t* input, int8_t* output)
+{
+  run_conv(layer, data.plans[(int)ConvAlgorithm::im2col_gemm], input, output);
+}
+
+void run_gemm_1x1(const ConvLayer_int8& layer, LayerData& data, ThreadPool*, const int8_t* input, int8_t* output)
+{
+  run_conv(layer, data.plans[(int)ConvAlgorithm::gemm_1x1], input, output);
+}
+
+void run_winograd(const ConvLayer_int8& layer, LayerData& data, ThreadPool*, const int8_t* input, int8_t* output)
+{
+  run_conv(layer, data.plans[(int)ConvAlgorithm::winograd], input, output);
+}
+
+void run_auto(const ConvLayer_int8& layer, LayerData& data, ThreadPool*, const int8_t* input, int8_t* output)
+{
+  run_conv(layer, data.plan, input, output);
+}
+
+template <typename T>
+void run_float_layer(const ConvLayer_int8& layer, FloatData<T>& data, ThreadPool* pool)
+{
+  if (layer.type == LayerType::Conv2D) {
+    Conv2D(layer.input_shape, &data.input[0],
+           layer.filter_shape, data.packed,
+           layer.output_shape, &data.output[0],
+           layer.stride_height, layer.stride_width,
+           layer.padding_height, layer.padding_width,
+           pool);
+  }else {
+    DepthwiseConv2D(layer.input_shape, &data.input[0],
+                    layer.filter_shape, &data.filter[0],
+                    &data.bias[0],
+                    layer.output_shape, &data.output[0],
+                    layer.stride_height, layer.stride_width,
+                    layer.padding_height, layer.padding_width,
+                    pool);
+  }
+}
+
+void run_float(const ConvLayer_int8& layer, LayerData& data, ThreadPool*, const int8_t*, int8_t*)
+{
+  run_float_layer(layer, data.fp32, nullptr);
+}
+
+void run_float_winograd(const ConvLayer_int8& layer, LayerData& data, ThreadPool*, const int8_t*, int8_t*)
+{
+  FloatData<float>& fp32 = data.fp32;
+  Conv2D(layer.input_shape, &fp32.input[0],
+         layer.filter_shape, data.fp32_winograd,
+         layer.output_shape, &fp32.output[0],
+         layer.stride_height, layer.stride_width,
+         layer.padding_height, layer.padding_width,
+         nullptr);
+}
+
+void run_float_mt(const ConvLayer_int8& layer, LayerData& data, ThreadPool* pool, const int8_t*, int8_t*)
+{
+  run_float_layer(layer, data.fp32, pool);
+}
+
+void run_fp16(const ConvLayer_int8& layer, LayerData& data, ThreadPool*, const int8_t*, int8_t*)
+{
+  run_float_layer(layer, data.fp16, nullptr);
+}
+
+void run_bf16(const ConvLayer_int8& layer, LayerData& data, ThreadPool*, const int8_t*, int8_t*)
+{
+  run_float_layer(layer, data.bf16, nullptr);
+}
+
+void run_int16(const ConvLayer_int8&, LayerData& data, ThreadPool*, const int8_t*, int8_t*)
+{
+  run_layer(data.layer16, &data.input16[0], &data.output16[0]);
+}
+
+void run_int4(const ConvLayer_int8& layer, LayerData& data, ThreadPool*, const int8_t* input, int8_t* output)
+{
+  Conv2D_int4(layer, data.int4, input, output);
+}
+
+// DepthwiseConv2D layers run dense
+void run_sparse(const ConvLayer_int8& layer, LayerData& data, ThreadPool*, const int8_t* input, int8_t* output)
+{
+  if (layer.type == LayerType::Conv2D) {
+    run_layer(layer, data.sparse, input, output);
+  }else {
+    run_layer(layer, input, output);
+  }
+}
+
+void run_gemm_1x1_skip(const ConvLayer_int8& layer, LayerData& data, ThreadPool*, const int8_t*, int8_t* output)
+{
+  run_conv(layer, data.skip_plan, &data.sparse_input[0], output);
+}
+
+// direct          run_layer on one image
+// batch4          run_layer on a batch of 4 images
+// tuned           the autotuned tiles and threads, with -a only
+// im2col          the im2col GEMM, on the layers it applies to
+// gemm1x1         the 1x1 GEMM, on the 1x1 layers
+// winograd        int8 Winograd, on the 3x3 stride 1 layers
+// auto            the algorithm a cost model calibrated on these layers picks
+// float           cnn_float.h on a float copy, its filter packed beforehand
+// float_mt        float on every hardware thread
+// float_winograd  float through a Winograd F(4x4, 3x3) filter
+// fp16            cnn_float.h on a float16 copy
+// bf16            cnn_float.h on a bfloat16 copy
+// int16           cnn_int16.h on a 16x8 copy
+// int4            the 1x1 layers with their filter packed to 4 bits
+// sparse75        the Conv2D layers with 3 in 4 blocks of 16 weights pruned
+// gemm1x1_skip    gemm1x1 skipping the groups of 8 channels at the zero point,
+//                 half of them in this input; Classification's profiler
+//                 measures the real fraction
+const Variant variants[] = {
+  {"direct", 1, false, -1, false, run_direct},
+  {"batch4", 4, false, -1, false, run_batch4},
+  {"tuned", 1, true, -1, false, run_tuned},
+  {"im2col", 1, false, (int)ConvAlgorithm::im2col_gemm, false, run_im2col},
+  {"gemm1x1", 1, false, (int)ConvAlgorithm::gemm_1x1, false, run_gemm_1x1},
+  {"winograd", 1, false, (int)ConvAlgorithm::winograd, false, run_winograd},
+  {"auto", 1, false, -1, false, run_auto},
+  {"float", 1, false, -1, true, run_float},
+  {"float_mt", 1, false, -1, true, run_float_mt},
+  {"float_winograd", 1, false, (int)ConvAlgorithm::winograd, true, run_float_winograd},
+  {"fp16", 1, false, -1, true, run_fp16},
+  {"bf16", 1, false, -1, true, run_bf16},
+  {"int16", 1, false, -1, true, run_int16},
+  {"int4", 1, false, (int)ConvAlgorithm::gemm_1x1, true, run_int4},
+  {"sparse75", 1, false, -1, true, run_sparse},
+  {"gemm1x1_skip", 1, false, (int)ConvAlgorithm::gemm_1x1, true, run_gemm_1x1_skip},
+};
+
+double percentile(std::vector<double> v, double p)
+{
+  std::sort(v.begin(), v.end());
+  const size_t i = std::min(v.size() - 1, (size_t)(p * (v.size() - 1) + 0.5));
+  return v[i];
+}
+
+std::string shape_string(const Shape& s)
+{
+  char buff[64];
+  sprintf(buff, "%dx%dx%dx%d", s.number, s.height, s.width, s.channel);
+  return buff;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  // -r repetitions, -w warm-up runs, -v variant, -c hardware counters,
+  // -a autotune cache
+  int repetitions = 20;
+  int warmup = 2;
+  const char* only = nullptr;
+  const char* cache_path = nullptr;
+  bool use_counters = false;
+  int arg = 1;
+  for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+    if (strcmp(argv[arg], "-c") == 0) {
+      use_counters = true;
+    }else if (arg + 1 < argc && strcmp(argv[arg], "-r") == 0) {
+      repetitions = std::max(1, atoi(argv[++arg]));
+    }else if (arg + 1 < argc && strcmp(argv[arg], "-w") == 0) {
+      warmup = std::max(0, atoi(argv[++arg]));
+    }else if (arg + 1 < argc && strcmp(argv[arg], "-v") == 0) {
+      only = argv[++arg];
+    }else if (arg + 1 < argc && strcmp(argv[arg], "-a") == 0) {
+      cache_path = argv[++arg];
+    }else {
+      printf("usage : [-r repetitions] [-w warmup] [-v variant] [-c] [-a autotune_cache]\n");
+      return 0;
+    }
+  }
+
+  PerfCounters perf;
+  PerfCounters* counters = (use_counters && perf.available()) ? &perf : nullptr;
+  if (use_counters && !counters) {
+    fprintf(stderr, "hardware counters unavailable\n");
+  }
+
+  // the caller is the first thread of a tuned run
+  ThreadPool pool(std::max((size_t)1, ThreadPool::hardware_threads() - 1));
+  ConvAutotuner tuner;
+  if (cache_path) {
+    tuner.load(cache_path);
+  }
+
+  std::mt19937 rng(1234);
+  std::vector<ConvLayer_int8> layers = efficientnet_lite0_layers();
+  std::vector<std::unique_ptr<LayerData> > data;
+  for (size_t i=0; i<layers.size(); ++i) {
+    data.push_back(std::unique_ptr<LayerData>(new LayerData(layers[i], 4, rng)));
+    if (cache_path) {
+      data[i]->tuning = tuner.tune(layers[i], &pool);
+    }
+  }
+  if (cache_path) {
+    fprintf(stderr, "%s : %zu layers tuned, %zu cached\n",
+            tuner.cpu().c_str(), tuner.num_tuned(), layers.size() - tuner.num_tuned());
+    if (tuner.num_tuned() && !tuner.save(cache_path)) {
+      fprintf(stderr, "failed to write %s\n", cache_path);
+    }
+  }
+
+  ConvCostModel model;
+  model.calibrate(layers);
+  for (size_t i=0; i<layers.size(); ++i) {
+    data[i]->plan = plan_conv(layers[i], model);
+  }
+
+  printf("layer,type,input,filter,stride,output,variant,algorithm,macs,median_us,p90_us,estimated_us,gops");
+  if (counters) {
+    printf(",ipc,l1d_mpki");
+  }
+  printf("\n");
+  for (size_t i=0; i<layers.size(); ++i) {
+    const ConvLayer_int8& layer = layers[i];
+    const int8_t* input = &data[i]->input[0];
+    int8_t* output = &data[i]->output[0];
+    for (size_t v=0; v<sizeof(variants)/sizeof(variants[0]); ++v) {
+      const Variant& variant = variants[v];
+      if ((only && strcmp(only, variant.name) != 0) || (variant.tuned && !cache_path)
+        || (variant.algorithm >= 0 && !conv_algorithm_applicable(layer, (ConvAlgorithm)variant.algorithm))) {
+        continue;
+      }
+      // what runs, and the cost model's estimate of it
+      ConvAlgorithm algorithm = ConvAlgorithm::direct;
+      if (variant.algorithm >= 0) {
+        algorithm = (ConvAlgorithm)variant.algorithm;
+      }else if (variant.run == run_auto) {
+        algorithm = data[i]->plan.algorithm;
+      }
+      for (int w=0; w<warmup; ++w) {
+        variant.run(layer, *data[i], &pool, input, output);
+      }
+      std::vector<double> seconds(repetitions);
+      PerfSample sample;
+      for (int r=0; r<repetitions; ++r) {
+        const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        if (counters) {
+          counters->start();
+        }
+        variant.run(layer, *data[i], &pool, input, output);
+        if (counters) {
+          counters->stop(sample);
+        }
+        // per image, so variants compare directly
+        seconds[r] = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() / variant.images;
+      }
+      const double median = percentile(seconds, 0.5);
+      const double p90 = percentile(seconds, 0.9);
+      printf("%zu,%s,%s,%s,%d,%s,%s,%s,%lld,%.3f,%.3f,%.3f,%.3f",
+             i, layer.type == LayerType::Conv2D ? "Conv2D" : "DepthwiseConv2D",
+             shape_string(layer.input_shape).c_str(), shape_string(layer.filter_shape).c_str(),
+             layer.stride_height, shape_string(layer.output_shape).c_str(), variant.name,
+             conv_algorithm_name(algorithm), (long long)layer.macs(), median * 1e6, p90 * 1e6,
+             variant.floating ? 0.0 : model.estimate(layer, algorithm) * 1e6,
+             median > 0 ? 2.0 * layer.macs() / median * 1e-9 : 0.0);
+      if (counters) {
+        printf(",%.3f,%.3f", sample.ipc(), sample.mpki(PERF_L1D_MISSES));
+      }
+      printf("\n");
+      fflush(stdout);
+    }
+    data[i].reset();
+  }
+  return 0;
+}
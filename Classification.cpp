@@ -5,23 +5,29 @@
 #include <iostream>
 #include <cstdio>
 #include <vector>
+#include <thread>
+#include <chrono>
 #include <numeric>      // std::iota
 #include <algorithm>    // std::sort, std::stable_sort
 
 #include <tensorflow/lite/interpreter.h>
 #include <tensorflow/lite/kernels/register.h>
 #include <tensorflow/lite/kernels/register_ref.h>
-#include <tensorflow/lite/kernels/internal/tensor_ctypes.h>
-#include <tensorflow/lite/kernels/padding.h>
 #include <tensorflow/lite/model.h>
 #include <tensorflow/lite/optional_debug_tools.h>
-#include <tensorflow/lite/builtin_ops.h>
-#include <tensorflow/lite/builtin_op_data.h>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
 #include "cnn.h"
+#include "tflite_util.h"
+#include "incremental.h"
+#include "preprocess.h"
+#include "batch_loader.h"
+#include "pipeline.h"
+#include "profiler.h"
+#include "autotune.h"
+#include "compressed_activations.h"
 
 void print(const TfLiteIntArray* arr)
 {
@@ -121,117 +127,26 @@ int calc_padding_same_size(int in_size, int stride)
   return (int)ceilf((float)in_size / (float)stride);
 }
 
-Shape toShape(const TfLiteIntArray* arr)
-{
-  assert(arr->size == 4);
-  Shape ret;
-  ret.number = arr->data[0];
-  ret.height = arr->data[1];
-  ret.width = arr->data[2];
-  ret.channel = arr->data[3];
-  return ret;
-}
-
-void quantize_filter_scale(
-  float input_scale,
-  float output_scale,
-  const TfLiteFloatArray* filter_scale,
-  std::vector<int32_t>& output_multiplier,
-  std::vector<int32_t>& output_shift
-  )
-{
-  const size_t sz = filter_scale->size;
-  const float* data = filter_scale->data;
-  output_multiplier.resize(sz);
-  output_shift.resize(sz);
-  double io_scale = (double)input_scale / (double)output_scale;
-  for (size_t i=0; i<sz; ++i) {
-    double f = data[i];
-    f *= io_scale;
-    int shift;
-    double f2 = std::frexp(f, &shift);
-    int m0 = ((1 << 31) - 1) * f2;
-    int n = -shift;
-    output_multiplier[i] = m0;
-    output_shift[i] = n;
-  }
-}
-
 void emulate_node_Conv2D(
   tflite::Interpreter* interpreter,
   size_t node_idx,
   const TfLiteNode& node,
   const TfLiteRegistration& node_reg)
 {
-  const TfLiteConvParams* params = (const TfLiteConvParams*)node.builtin_data;
-  const TfLiteIntArray* node_inputs = node.inputs;
-  const TfLiteIntArray* node_outputs = node.outputs;
-  assert(node_inputs->size == 3);
-  assert(node_outputs->size == 1);
-  TfLiteTensor* input_tensor = interpreter->tensor(node_inputs->data[0]);
-  const TfLiteTensor* filter_tensor = interpreter->tensor(node_inputs->data[1]);
-  const TfLiteTensor* bias_tensor = interpreter->tensor(node_inputs->data[2]);
-  const TfLiteTensor* output_tensor = interpreter->tensor(node_outputs->data[0]);
-  Shape input_shape = toShape(input_tensor->dims);
-  Shape filter_shape = toShape(filter_tensor->dims);
-  assert(bias_tensor->dims->size == 1);
-  int bias_num_elements = bias_tensor->dims->data[0];
-  Shape output_shape = toShape(output_tensor->dims);
-  assert(bias_num_elements == output_shape.channel);
-  assert(input_shape.channel == filter_shape.channel);
-  assert(filter_shape.number == output_shape.channel);
-
-  int stride_width = params->stride_width;
-  int stride_height = params->stride_height;
-  int padding_width_offset;
-  int padding_height_offset;
-  int padding_width = tflite::ComputePaddingWithOffset(params->stride_width, params->dilation_width_factor, input_shape.width, filter_shape.width, output_shape.width, &padding_width_offset);
-  int padding_height = tflite::ComputePaddingWithOffset(params->stride_height, params->dilation_height_factor, input_shape.height, filter_shape.height, output_shape.height, &padding_height_offset);
-
-  const TfLiteAffineQuantization* input_quantization_params = (const TfLiteAffineQuantization*)(input_tensor->quantization.params);
-  const TfLiteAffineQuantization* output_quantization_params = (const TfLiteAffineQuantization*)(output_tensor->quantization.params);
-  assert(input_quantization_params->scale->size == 1);
-  assert(output_quantization_params->scale->size == 1);
-  const TfLiteAffineQuantization* filter_quantization_params = (const TfLiteAffineQuantization*)(filter_tensor->quantization.params);
-  assert(filter_quantization_params->scale->size == output_shape.channel);
-  assert(filter_quantization_params->zero_point->size == output_shape.channel);
-
-  float input_scale = input_quantization_params->scale->data[0];
-  int input_zero_point = input_quantization_params->zero_point->data[0];
-  float output_scale = output_quantization_params->scale->data[0];
-  int output_zero_point = output_quantization_params->zero_point->data[0];
-  
-  int input_offset = -input_zero_point;
-  int output_offset = output_zero_point;
-  int activation_min = -128;
-  int activation_max = 127;
-  std::vector<int32_t> output_multiplier;
-  std::vector<int32_t> output_shift;
-  quantize_filter_scale(
-    input_scale, output_scale,
-    filter_quantization_params->scale,
-    output_multiplier, output_shift);
+  ConvLayer_int8 layer;
+  load_layer(interpreter, node, LayerType::Conv2D, layer);
+  const TfLiteTensor* input_tensor = interpreter->tensor(node.inputs->data[0]);
+  const TfLiteTensor* output_tensor = interpreter->tensor(node.outputs->data[0]);
 
   const int8_t* input_data = tflite::GetTensorData<int8_t>(input_tensor);
-  const int8_t* filter_data = tflite::GetTensorData<int8_t>(filter_tensor);
-  const int32_t* bias_data = tflite::GetTensorData<int32_t>(bias_tensor);
-  std::vector<int8_t> output(output_shape.num_elements());
-  Conv2D_int8_int8(
-    input_shape, input_data,
-    filter_shape, filter_data,
-    bias_data,
-    output_shape, &output[0],
-    stride_height, stride_width,
-    padding_height, padding_width,
-    input_offset, output_offset,
-    &output_multiplier[0], &output_shift[0],
-    activation_min, activation_max);
+  std::vector<int8_t> output(layer.output_shape.num_elements());
+  run_layer(layer, input_data, &output[0]);
 
   char filename[64];
   sprintf(filename, "node%d_output_ref.dat", node_idx);
   write_to_file(filename, output_tensor);
   sprintf(filename, "node%d_output_emu.dat", node_idx);
-  write_to_file(filename, &output[0], output_shape.num_elements());
+  write_to_file(filename, &output[0], layer.output_shape.num_elements());
 }
 
 void emulate_node_DepthwiseConv2d(
@@ -240,77 +155,20 @@ void emulate_node_DepthwiseConv2d(
   const TfLiteNode& node,
   const TfLiteRegistration& node_reg)
 {
-  const TfLiteDepthwiseConvParams* params = (const TfLiteDepthwiseConvParams*)node.builtin_data;
-  const TfLiteIntArray* node_inputs = node.inputs;
-  const TfLiteIntArray* node_outputs = node.outputs;
-  assert(node_inputs->size == 3);
-  assert(node_outputs->size == 1);
-  TfLiteTensor* input_tensor = interpreter->tensor(node_inputs->data[0]);
-  const TfLiteTensor* weights_tensor = interpreter->tensor(node_inputs->data[1]);
-  const TfLiteTensor* bias_tensor = interpreter->tensor(node_inputs->data[2]);
-  const TfLiteTensor* output_tensor = interpreter->tensor(node_outputs->data[0]);
-
-  Shape input_shape = toShape(input_tensor->dims);
-  Shape weights_shape = toShape(weights_tensor->dims);
-  assert(bias_tensor->dims->size == 1);
-  int bias_num_elements = bias_tensor->dims->data[0];
-  Shape output_shape = toShape(output_tensor->dims);
-  assert(bias_num_elements == output_shape.channel);
-  assert(input_shape.channel == weights_shape.channel);
-  assert(weights_shape.number == 1);
-
-  int stride_width = params->stride_width;
-  int stride_height = params->stride_height;
-  int padding_width_offset;
-  int padding_height_offset;
-  int padding_width = tflite::ComputePaddingWithOffset(params->stride_width, params->dilation_width_factor, input_shape.width, weights_shape.width, output_shape.width, &padding_width_offset);
-  int padding_height = tflite::ComputePaddingWithOffset(params->stride_height, params->dilation_height_factor, input_shape.height, weights_shape.height, output_shape.height, &padding_height_offset);
-
-  const TfLiteAffineQuantization* input_quantization_params = (const TfLiteAffineQuantization*)(input_tensor->quantization.params);
-  const TfLiteAffineQuantization* output_quantization_params = (const TfLiteAffineQuantization*)(output_tensor->quantization.params);
-  assert(input_quantization_params->scale->size == 1);
-  assert(output_quantization_params->scale->size == 1);
-  const TfLiteAffineQuantization* weights_quantization_params = (const TfLiteAffineQuantization*)(weights_tensor->quantization.params);
-  assert(weights_quantization_params->scale->size == output_shape.channel);
-  assert(weights_quantization_params->zero_point->size == output_shape.channel);
-
-  float input_scale = input_quantization_params->scale->data[0];
-  int input_zero_point = input_quantization_params->zero_point->data[0];
-  float output_scale = output_quantization_params->scale->data[0];
-  int output_zero_point = output_quantization_params->zero_point->data[0];
-  
-  int input_offset = -input_zero_point;
-  int output_offset = output_zero_point;
-  int activation_min = -128;
-  int activation_max = 127;
-  std::vector<int32_t> output_multiplier;
-  std::vector<int32_t> output_shift;
-  quantize_filter_scale(
-    input_scale, output_scale,
-    weights_quantization_params->scale,
-    output_multiplier, output_shift);
+  ConvLayer_int8 layer;
+  load_layer(interpreter, node, LayerType::DepthwiseConv2D, layer);
+  const TfLiteTensor* input_tensor = interpreter->tensor(node.inputs->data[0]);
+  const TfLiteTensor* output_tensor = interpreter->tensor(node.outputs->data[0]);
 
   const int8_t* input_data = tflite::GetTensorData<int8_t>(input_tensor);
-  const int8_t* weights_data = tflite::GetTensorData<int8_t>(weights_tensor);
-  const int32_t* bias_data = tflite::GetTensorData<int32_t>(bias_tensor);
-  std::vector<int8_t> output(output_shape.num_elements());
-
-  DepthwiseConv2D_int8_int8(
-    input_shape, input_data,
-    weights_shape, weights_data,
-    bias_data,
-    output_shape, &output[0],
-    stride_height, stride_width,
-    padding_height, padding_width,
-    input_offset, output_offset,
-    &output_multiplier[0], &output_shift[0],
-    activation_min, activation_max);
+  std::vector<int8_t> output(layer.output_shape.num_elements());
+  run_layer(layer, input_data, &output[0]);
 
   char filename[64];
   sprintf(filename, "node%d_output_ref.dat", node_idx);
   write_to_file(filename, output_tensor);
   sprintf(filename, "node%d_output_emu.dat", node_idx);
-  write_to_file(filename, &output[0], output_shape.num_elements());
+  write_to_file(filename, &output[0], layer.output_shape.num_elements());
 }
 
 void emulate_node(tflite::Interpreter* interpreter, size_t node_idx)
@@ -342,10 +200,254 @@ void emulate_node(tflite::Interpreter* interpreter, size_t node_idx)
   }
 }
 
+// uint8 pixel -> quantized input of the node first_node, same as the
+// Quantize node feeding it
+void make_chain_input_lut(
+  tflite::Interpreter* interpreter,
+  size_t first_node,
+  int8_t lut[256])
+{
+  const tflite::Subgraph& graph = interpreter->primary_subgraph();
+  const TfLiteNode& node = graph.nodes_and_registration()[first_node].first;
+  const TfLiteTensor* graph_input_tensor = interpreter->tensor(interpreter->inputs()[0]);
+  const TfLiteTensor* chain_input_tensor = interpreter->tensor(node.inputs->data[0]);
+  const TfLiteAffineQuantization* graph_input_params = (const TfLiteAffineQuantization*)graph_input_tensor->quantization.params;
+  const TfLiteAffineQuantization* chain_input_params = (const TfLiteAffineQuantization*)chain_input_tensor->quantization.params;
+  const float in_scale = graph_input_params->scale->data[0];
+  const int in_zero_point = graph_input_params->zero_point->data[0];
+  const float chain_scale = chain_input_params->scale->data[0];
+  const int chain_zero_point = chain_input_params->zero_point->data[0];
+  for (int i=0; i<256; ++i) {
+    int q = (int)std::round((i - in_zero_point) * in_scale / chain_scale) + chain_zero_point;
+    lut[i] = (int8_t)std::min(std::max(q, -128), 127);
+  }
+}
+
+// Runs the Conv2D / DepthwiseConv2D chain after the input Quantize node over
+// a sequence of frames, recomputing only the tiles that changed.
+void stream_frames(
+  tflite::Interpreter* interpreter,
+  const char* const* frame_paths,
+  int num_frames,
+  const std::vector<ConvTuning>& tunings)
+{
+  std::vector<ConvLayer_int8> layers = load_conv_chain(interpreter, 1);
+  if (layers.empty()) {
+    printf("no Conv2D / DepthwiseConv2D chain found\n");
+    return;
+  }
+  // uint8 pixel -> quantized chain input
+  int8_t lut[256];
+  make_chain_input_lut(interpreter, 1, lut);
+
+  const Shape& input_shape = layers[0].input_shape;
+  IncrementalConvChain chain(layers);
+  chain.set_tunings(tunings);
+  printf("streaming %zu layers, %lld MACs per full frame\n", layers.size(), (long long)chain.total_macs());
+  std::vector<int8_t> frame(input_shape.num_elements());
+  // frames are decoded (and resized if needed) ahead on worker threads
+  BatchLoader<uint8_t> loader(std::vector<std::string>(frame_paths, frame_paths + num_frames),
+                              PreprocessParams(input_shape));
+  BatchLoader<uint8_t>::Item item;
+  while (loader.next(item)) {
+    const int i = (int)item.index;
+    if (!item.ok) {
+      printf("failed to load image : %s\n", item.path.c_str());
+      continue;
+    }
+    for (size_t j=0; j<frame.size(); ++j) {
+      frame[j] = lut[item.data[j]];
+    }
+
+    chain.process(&frame[0]);
+    const TileMask& mask = chain.input_mask();
+    printf("frame %d : %d / %d tiles changed, %.1f%% MACs recomputed\n",
+           i, mask.count(), mask.cols() * mask.rows(),
+           100.0 * chain.last_macs() / chain.total_macs());
+  }
+}
+
+// Runs the same chain over the frames as a layer pipeline, one stage per
+// core, and compares its throughput with running the whole chain per frame,
+// with and without its activations compressed, and with its block sparse
+// filters run sparse when the model has some.
+void pipeline_frames(
+  tflite::Interpreter* interpreter,
+  const char* const* frame_paths,
+  int num_frames,
+  size_t num_stages,
+  const std::vector<ConvTuning>& tunings)
+{
+  std::vector<BlockSparseFilter> sparse_filters;
+  std::vector<ConvLayer_int8> layers = load_conv_chain(interpreter, 1, &sparse_filters);
+  if (layers.empty()) {
+    return;
+  }
+  int8_t lut[256];
+  make_chain_input_lut(interpreter, 1, lut);
+
+  // frames are quantized up front so only the chain is timed
+  const Shape& input_shape = layers[0].input_shape;
+  const size_t in_len = input_shape.num_elements();
+  const size_t out_len = layers.back().output_shape.num_elements();
+  std::vector<int8_t> frames;
+  BatchLoader<uint8_t> loader(std::vector<std::string>(frame_paths, frame_paths + num_frames),
+                              PreprocessParams(input_shape));
+  BatchLoader<uint8_t>::Item item;
+  while (loader.next(item)) {
+    if (item.ok) {
+      for (size_t j=0; j<in_len; ++j) {
+        frames.push_back(lut[item.data[j]]);
+      }
+    }
+  }
+  const int n = (int)(frames.size() / in_len);
+  if (n == 0) {
+    return;
+  }
+
+  typedef std::chrono::steady_clock Clock;
+  std::vector<int8_t> output(out_len);
+  std::vector<int8_t> scratch;
+  Clock::time_point t0 = Clock::now();
+  for (int i=0; i<n; ++i) {
+    run_layers(layers, tunings, 1, &frames[i * in_len], &output[0], scratch, nullptr);
+  }
+  const double sequential = std::chrono::duration<double>(Clock::now() - t0).count();
+
+  // the same with the pruned filters of the model run sparse, if it has any,
+  // and the other layers still tuned
+  size_t num_sparse = 0;
+  for (size_t i=0; i<sparse_filters.size(); ++i) {
+    num_sparse += (sparse_filters[i].out_depth > 0);
+  }
+  double sparse_seconds = 0;
+  if (num_sparse) {
+    t0 = Clock::now();
+    for (int i=0; i<n; ++i) {
+      run_layers(layers, 1, &frames[i * in_len], &output[0], scratch,
+                 [&](size_t j, const ConvLayer_int8& layer, const int8_t* layer_input, int8_t* layer_output) {
+        if (sparse_filters[j].out_depth > 0) {
+          run_layer(layer, sparse_filters[j], layer_input, layer_output);
+        }else if (!tunings.empty()) {
+          run_layer_tuned(layer, tunings[j], layer_input, layer_output, nullptr);
+        }else {
+          run_layer(layer, layer_input, layer_output);
+        }
+      });
+    }
+    sparse_seconds = std::chrono::duration<double>(Clock::now() - t0).count();
+  }
+
+  // the same with the activations between layers kept compressed
+  CompressedChainScratch compressed;
+  size_t compressed_bytes = 0;
+  size_t plain_bytes = 0;
+  t0 = Clock::now();
+  for (int i=0; i<n; ++i) {
+    run_layers_compressed(layers, 1, &frames[i * in_len], &output[0], compressed);
+    compressed_bytes += std::accumulate(compressed.compressed_bytes.begin(), compressed.compressed_bytes.end(), (size_t)0);
+    plain_bytes += std::accumulate(compressed.plain_bytes.begin(), compressed.plain_bytes.end(), (size_t)0);
+  }
+  const double compressed_seconds = std::chrono::duration<double>(Clock::now() - t0).count();
+
+  // the stages are balanced on the tuned times, or on a model calibrated
+  // on these layers when untuned
+  ConvCostModel model;
+  if (tunings.empty()) {
+    model.calibrate(layers);
+  }
+  LayerPipeline pipeline(layers, num_stages, 0, true, tunings, &model);
+  t0 = Clock::now();
+  std::thread producer([&]() {
+    for (int i=0; i<n; ++i) {
+      pipeline.push(&frames[i * in_len]);
+    }
+  });
+  for (int i=0; i<n; ++i) {
+    pipeline.pop(&output[0]);
+  }
+  producer.join();
+  const double pipelined = std::chrono::duration<double>(Clock::now() - t0).count();
+
+  printf("pipeline of %zu stages over %zu layers\n", pipeline.num_stages(), layers.size());
+  for (size_t s=0; s<pipeline.num_stages(); ++s) {
+    printf("stage %zu : layers %zu-%zu, %lld MACs, busy %.3f s\n",
+           s, pipeline.stage_begin(s), pipeline.stage_begin(s + 1) - 1, (long long)pipeline.stage_macs(s), pipeline.busy_seconds(s));
+  }
+  printf("%d frames : sequential %.1f frames/sec, pipelined %.1f frames/sec\n",
+         n, n / sequential, n / pipelined);
+  printf("compressed activations : %.1f frames/sec, %.1f%% of the plain activation bytes\n",
+         n / compressed_seconds, plain_bytes ? 100.0 * compressed_bytes / plain_bytes : 0.0);
+  if (num_sparse) {
+    printf("%zu sparse filters run sparse : %.1f frames/sec\n", num_sparse, n / sparse_seconds);
+  }
+}
+
+// Tunes the layers of the chain, reusing and updating the cache file, and
+// compares the tuned layers with the plain kernels. Returns the tunings for
+// the chain runners.
+std::vector<ConvTuning> tune_chain(tflite::Interpreter* interpreter, const char* cache_path)
+{
+  std::vector<ConvLayer_int8> layers = load_conv_chain(interpreter, 1);
+  if (layers.empty()) {
+    return std::vector<ConvTuning>();
+  }
+  ThreadPool pool(std::max((size_t)1, ThreadPool::hardware_threads() - 1));
+  ConvAutotuner tuner;
+  tuner.load(cache_path);
+  double plain_total = 0;
+  double tuned_total = 0;
+  for (size_t i=0; i<layers.size(); ++i) {
+    const ConvLayer_int8& layer = layers[i];
+    const ConvTuning& tuning = tuner.tune(layer, &pool);
+    std::vector<int8_t> input(layer.input_shape.num_elements());
+    std::vector<int8_t> output(layer.output_shape.num_elements());
+    const double plain = time_layer(layer, ConvTuning(), &input[0], &output[0], nullptr, 3);
+    const double tuned = time_layer(layer, tuning, &input[0], &output[0], &pool, 3);
+    plain_total += plain;
+    tuned_total += tuned;
+    printf("%s : tile %dx%d, block %d, %d threads, %.3f ms -> %.3f ms\n",
+           layer_key(layer).c_str(), tuning.tile_height, tuning.tile_width,
+           tuning.channel_block, tuning.threads, plain * 1e3, tuned * 1e3);
+  }
+  printf("%s : %zu layers tuned, %zu cached, chain %.3f ms -> %.3f ms\n",
+         tuner.cpu().c_str(), tuner.num_tuned(), layers.size() - tuner.num_tuned(),
+         plain_total * 1e3, tuned_total * 1e3);
+  if (tuner.num_tuned() && !tuner.save(cache_path)) {
+    printf("failed to write %s\n", cache_path);
+  }
+  return tuner.tunings(layers);
+}
+
 int main(int argc, char* argv[])
 {
+  // -p iterations : per-node profile, TFLite against the cnn.h kernels
+  // -c : hardware counters in the profile
+  // -a cache_file : autotune the conv chain, kept in cache_file across runs,
+  //                and run the frames with the tunings
+  int profile_iterations = 0;
+  bool profile_counters = false;
+  const char* autotune_cache = nullptr;
+  while (argc > 1 && argv[1][0] == '-') {
+    if (strcmp(argv[1], "-c") == 0) {
+      profile_counters = true;
+      argc -= 1;
+      argv += 1;
+    }else if (argc > 2 && strcmp(argv[1], "-p") == 0) {
+      profile_iterations = atoi(argv[2]);
+      argc -= 2;
+      argv += 2;
+    }else if (argc > 2 && strcmp(argv[1], "-a") == 0) {
+      autotune_cache = argv[2];
+      argc -= 2;
+      argv += 2;
+    }else {
+      break;
+    }
+  }
   if (argc < 3) {
-    printf("usage : model_file image_file\n");
+    printf("usage : [-p iterations [-c]] [-a autotune_cache] model_file image_file [frame_file...]\n");
     return 0;
   }
 
@@ -378,33 +480,36 @@ int main(int argc, char* argv[])
   print(input_dim);
   printf("\n");
   auto graph_input_data = interpreter->typed_input_tensor<uint8_t>(0);
-  int input_width = input_dim->data[1];
-  int input_height = input_dim->data[2];
+  int input_height = input_dim->data[1];
+  int input_width = input_dim->data[2];
   int input_channels = input_dim->data[3];
 
-  int x,y,n;
-  unsigned char *data = stbi_load(imageFilePath, &x, &y, &n, input_channels);
-  if (!data) {
+  PreprocessParams params(Shape(1, input_height, input_width, input_channels));
+  if (!preprocess_file(imageFilePath, params, graph_input_data)) {
     printf("failed to load image : %s\n", imageFilePath);
     return 0;
   }
 
-  if (x != input_width || y != input_height || n != input_channels) {
-    stbi_image_free(data);
-    printf("input_width must be %d\n", input_width);
-    printf("input_height must be %d\n", input_height);
-    printf("input_channels must be %d\n", input_channels);
-    return 0;
-  }
-
-  memcpy(graph_input_data, data, input_width * input_height * input_channels);
-  stbi_image_free(data);
-
   status = interpreter->Invoke();
 
+  if (profile_iterations > 0) {
+    print_profile(profile_nodes(interpreter.get(), profile_iterations, profile_counters));
+  }
+
   emulate_node(interpreter.get(), 1);
   emulate_node(interpreter.get(), 2);
 
+  // the frame runners below use the tunings
+  std::vector<ConvTuning> tunings;
+  if (autotune_cache) {
+    tunings = tune_chain(interpreter.get(), autotune_cache);
+  }
+
+  if (argc > 3) {
+    stream_frames(interpreter.get(), argv + 2, argc - 2, tunings);
+    pipeline_frames(interpreter.get(), argv + 2, argc - 2, std::thread::hardware_concurrency(), tunings);
+  }
+
   auto outputs = interpreter->outputs();
   const TfLiteTensor* output_tensor = interpreter->tensor(outputs[0]);
   const TfLiteIntArray* output_dim = output_tensor->dims;
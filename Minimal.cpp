@@ -1,7 +1,11 @@
 
 #include <iostream>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <vector>
+#include <deque>
+#include <future>
 #include <numeric>      // std::iota
 #include <algorithm>    // std::sort, std::stable_sort
 
@@ -14,8 +18,10 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-#define STB_IMAGE_RESIZE_IMPLEMENTATION
-#include "stb_image_resize.h"
+#include "preprocess.h"
+#include "batch_loader.h"
+#include "async_inference.h"
+#include "profiler.h"
 
 void print(TfLiteIntArray* arr)
 {
@@ -39,15 +45,112 @@ void sort_indexes(const T* v, T2* idx, size_t size)
        [&v](T2 i1, T2 i2) {return v[i1] > v[i2];});
 }
 
+// decodes on worker threads while the interpreter runs the previous image,
+// and prints each result while the next one is inferred
+template <typename T>
+void classify_images(
+  tflite::Interpreter* interpreter,
+  const std::vector<std::string>& paths,
+  const PreprocessParams& params)
+{
+  typedef AsyncInference<T, uint8_t> Async;
+  const uint8_t* output_data = interpreter->typed_output_tensor<uint8_t>(0);
+  const int output_len = interpreter->tensor(interpreter->outputs()[0])->dims->data[1];
+  std::vector<int> indexes(output_len);
+  T* input_data = interpreter->typed_input_tensor<T>(0);
+  const size_t input_len = params.output_shape.num_elements();
+
+  // one interpreter, so a single worker
+  Async async(input_len, output_len, 1, [=](const T* input, uint8_t* output) {
+    std::copy(input, input + input_len, input_data);
+    if (interpreter->Invoke() != kTfLiteOk) {
+      return false;
+    }
+    std::copy(output_data, output_data + output_len, output);
+    return true;
+  });
+
+  struct Pending
+  {
+    std::string path;
+    const char* error;
+    std::future<typename Async::Result> result;
+  };
+  std::deque<Pending> pending;
+
+  // prints and drops the oldest request
+  auto print_front = [&]() {
+    Pending& p = pending.front();
+    if (!p.result.valid()) {
+      printf("failed to load image : %s (%s)\n", p.path.c_str(), p.error);
+    }else {
+      const typename Async::Result r = p.result.get();
+      if (r.status != Async::DONE) {
+        printf("failed to invoke : %s\n", p.path.c_str());
+      }else {
+        sort_indexes(&r.output[0], &indexes[0], output_len);
+        if (paths.size() > 1) {
+          printf("%s\n", p.path.c_str());
+        }
+        for (size_t i=0; i<10; ++i) {
+          int idx = indexes[i];
+          uint8_t score = r.output[idx];
+          if (!score)
+            break;
+          printf("[%zu] : %d, %d\n", i, idx, score);
+        }
+      }
+    }
+    pending.pop_front();
+  };
+
+  BatchLoader<T> loader(paths, params);
+  typename BatchLoader<T>::Item item;
+  while (loader.next(item)) {
+    Pending p;
+    p.path = item.path;
+    p.error = item.error;
+    if (item.ok) {
+      p.result = async.submit(&item.data[0]);
+    }
+    pending.push_back(std::move(p));
+    // keep one request queued behind the running one
+    if (pending.size() > 2) {
+      print_front();
+    }
+  }
+  while (!pending.empty()) {
+    print_front();
+  }
+  if (paths.size() > 1) {
+    printf("%zu images, %zu decode threads, waited %.3f s for decoding\n",
+           paths.size(), loader.num_workers(), loader.wait_seconds());
+  }
+}
+
 int main(int argc, char* argv[])
 {
-  if (argc < 3) {
-    printf("usage : model_file image_file\n");
+  // -p iterations : per-node profile of the first image instead of classifying
+  // -c : hardware counters in the profile
+  int profile_iterations = 0;
+  bool profile_counters = false;
+  int arg = 1;
+  for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+    if (strcmp(argv[arg], "-c") == 0) {
+      profile_counters = true;
+    }else if (arg + 1 < argc && strcmp(argv[arg], "-p") == 0) {
+      profile_iterations = atoi(argv[++arg]);
+    }else {
+      break;
+    }
+  }
+  if (argc - arg < 2) {
+    printf("usage : [-p iterations [-c]] model_file image_file [image_file...]\n");
     return 0;
   }
 
-  const char* modelFilePath = argv[1];
-  const char* imageFilePath = argv[2];
+  const char* modelFilePath = argv[arg];
+  std::vector<std::string> imageFilePaths(argv + arg + 1, argv + argc);
 
   auto model = tflite::FlatBufferModel::BuildFromFile(modelFilePath);
 
@@ -60,7 +163,10 @@ int main(int argc, char* argv[])
 
 //  tflite::PrintInterpreterState(interpreter.get());
 
-  TfLiteStatus status = interpreter->AllocateTensors();
+  if (!interpreter || interpreter->AllocateTensors() != kTfLiteOk) {
+    printf("failed to build interpreter\n");
+    return 0;
+  }
   auto inputs = interpreter->inputs();
   auto outputs = interpreter->outputs();
 
@@ -75,35 +181,32 @@ int main(int argc, char* argv[])
   printf("output_dim : ");
   print(output_dim);
   printf("\n");
-  auto input_data = interpreter->typed_input_tensor<uint8_t>(0);
-  auto output_data = interpreter->typed_output_tensor<uint8_t>(0);
-  int input_width = input_dim->data[1];
-  int input_height = input_dim->data[2];
+  int input_height = input_dim->data[1];
+  int input_width = input_dim->data[2];
   int input_channels = input_dim->data[3];
 
-  int x,y,n;
-  unsigned char *data = stbi_load(imageFilePath, &x, &y, &n, input_channels);
-  if (!data) {
-    printf("failed to load image : %s\n", imageFilePath);
+  // decode, resize and shift into the input tensor layout
+  PreprocessParams params(Shape(1, input_height, input_width, input_channels));
+  if (profile_iterations > 0) {
+    bool ok;
+    if (input_tensor->type == kTfLiteInt8) {
+      params.offset = -128;
+      ok = preprocess_file(imageFilePaths[0].c_str(), params, input_tensor->data.int8);
+    }else {
+      ok = preprocess_file(imageFilePaths[0].c_str(), params, input_tensor->data.uint8);
+    }
+    if (!ok) {
+      printf("failed to load image : %s\n", imageFilePaths[0].c_str());
+      return 0;
+    }
+    print_profile(profile_nodes(interpreter.get(), profile_iterations, profile_counters));
     return 0;
   }
-
-  stbir_resize_uint8(data, x, y, 0,
-                     input_data, input_width, input_height, 0, input_channels);
-  stbi_image_free(data);
-
-  status = interpreter->Invoke();
-
-  int output_len = output_dim->data[1];
-  std::vector<int> indexes(output_len);
-  sort_indexes(output_data, &indexes[0], output_len);
-
-  for (size_t i=0; i<10; ++i) {
-    int idx = indexes[i];
-    uint8_t score = output_data[idx];
-    if (!score)
-      break;
-    printf("[%zu] : %d, %d\n", i, idx, score);
+  if (input_tensor->type == kTfLiteInt8) {
+    params.offset = -128;
+    classify_images<int8_t>(interpreter.get(), imageFilePaths, params);
+  }else {
+    classify_images<uint8_t>(interpreter.get(), imageFilePaths, params);
   }
 
   return 0;
@@ -0,0 +1,744 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <cstdio>
+
+#if !defined(__linux__)
+
+int main(int argc, char* argv[])
+{
+  printf("Server needs Linux (Unix domain sockets, POSIX shared memory)\n");
+  return 0;
+}
+
+#else
+
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <tensorflow/lite/interpreter.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "preprocess.h"
+#include "thread_pool.h"
+#include "interpreter_pool.h"
+#include "topk.h"
+#include "batcher.h"
+#include "tflite_util.h"
+
+// Long running classifier on a Unix domain socket.
+//
+// On connect the server creates a shared memory ring of num_slots slots for
+// that client and passes its fd over the socket (SCM_RIGHTS) with a
+// HelloMessage. The client writes an image into a free slot and sends a
+// RequestMessage naming the slot; the server reads the slot in place, into
+// the request's input (resizing pixels on the way), and answers with a
+// ResultMessage carrying the same id. Replies can come back out of order.
+// A slot may be rewritten once its reply arrived.
+//
+// With max_batch above 1 requests go through a DynamicBatcher per
+// interpreter, which runs up to max_batch of them, from any clients, as one
+// batch, each read from its slot straight into the batch. Otherwise a
+// request is read straight into the input tensor of a free interpreter.
+//
+// usage :
+//   Server serve [options] model_file socket_path
+//   Server client [options] socket_path image_file...
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+enum { MAX_TOP_K = 16 };
+const uint32_t PROTOCOL_MAGIC = 0x31534654; // "TFS1"
+
+struct HelloMessage
+{
+  uint32_t magic;
+  uint32_t num_slots;
+  uint64_t slot_bytes;
+  int32_t input_height;
+  int32_t input_width;
+  int32_t input_channels;
+  int32_t input_type;   // TfLiteType, layout of PAYLOAD_TENSOR
+  int32_t top_k;
+};
+
+enum PayloadType {
+  PAYLOAD_TENSOR = 0,   // input tensor bytes, already preprocessed
+  PAYLOAD_PIXELS = 1,   // interleaved 8 bit pixels of any size, resized by the server
+};
+
+struct RequestMessage
+{
+  uint64_t id;
+  uint32_t slot;
+  uint32_t payload;
+  int32_t width;
+  int32_t height;
+  int32_t channels;
+};
+
+enum Status {
+  STATUS_OK = 0,
+  STATUS_BAD_REQUEST = 1,
+  STATUS_FAILED = 2,
+};
+
+struct ResultMessage
+{
+  uint64_t id;
+  int32_t status;
+  int32_t count;
+  int32_t classes[MAX_TOP_K];
+  float scores[MAX_TOP_K];
+};
+
+// top-k of one image of a batch
+struct Scores
+{
+  int32_t count;
+  int32_t classes[MAX_TOP_K];
+  float scores[MAX_TOP_K];
+};
+
+volatile sig_atomic_t g_stop = 0;
+
+void on_signal(int)
+{
+  g_stop = 1;
+}
+
+bool read_full(int fd, void* buf, size_t size)
+{
+  char* p = (char*)buf;
+  while (size) {
+    ssize_t n = recv(fd, p, size, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool write_full(int fd, const void* buf, size_t size)
+{
+  const char* p = (const char*)buf;
+  while (size) {
+    ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+// sends size bytes with fd attached
+bool send_with_fd(int sock, const void* data, size_t size, int fd)
+{
+  struct iovec iov;
+  iov.iov_base = (void*)data;
+  iov.iov_len = size;
+  char control[CMSG_SPACE(sizeof(int))];
+  memset(control, 0, sizeof(control));
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  return sendmsg(sock, &msg, MSG_NOSIGNAL) == (ssize_t)size;
+}
+
+// receives size bytes and the attached fd, -1 on failure
+int recv_with_fd(int sock, void* data, size_t size)
+{
+  struct iovec iov;
+  iov.iov_base = data;
+  iov.iov_len = size;
+  char control[CMSG_SPACE(sizeof(int))];
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  if (recvmsg(sock, &msg, MSG_WAITALL) != (ssize_t)size) {
+    return -1;
+  }
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+    return -1;
+  }
+  int fd;
+  memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+  return fd;
+}
+
+sockaddr_un make_address(const char* path)
+{
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  return addr;
+}
+
+double percentile(std::vector<double> v, double p)
+{
+  if (v.empty()) {
+    return 0.0;
+  }
+  size_t k = (size_t)(p * (v.size() - 1) + 0.5);
+  std::nth_element(v.begin(), v.begin() + k, v.end());
+  return v[k];
+}
+
+// ---------------------------------------------------------------- server
+
+struct Connection
+{
+  int fd;
+  uint8_t* ring;
+  size_t ring_bytes;
+  uint32_t num_slots;
+  size_t slot_bytes;
+  std::mutex write_mutex;
+
+  Connection(int fd)
+    :
+    fd(fd),
+    ring(nullptr),
+    ring_bytes(0),
+    num_slots(0),
+    slot_bytes(0)
+  {
+  }
+
+  ~Connection() {
+    if (ring) {
+      munmap(ring, ring_bytes);
+    }
+    close(fd);
+  }
+};
+
+class Server
+{
+public:
+  Server(InterpreterPool& pool, uint32_t num_slots, size_t slot_bytes, int top_k,
+         size_t max_batch, std::chrono::microseconds max_wait)
+    :
+    pool_(pool),
+    num_slots_(num_slots),
+    slot_bytes_(slot_bytes),
+    top_k_(std::min(top_k, (int)MAX_TOP_K)),
+    max_batch_(max_batch),
+    next_ring_(0),
+    next_batcher_(0),
+    batch_output_(pool.size()),
+    // enough waiting requests to fill a batch on every interpreter
+    workers_(pool.size() * max_batch)
+  {
+    const TfLiteTensor* input = pool_.front()->tensor(pool_.front()->inputs()[0]);
+    input_shape_ = Shape(1, input->dims->data[1], input->dims->data[2], input->dims->data[3]);
+    input_type_ = input->type;
+    input_bytes_ = input->bytes;
+    output_bytes_ = pool_.front()->tensor(pool_.front()->outputs()[0])->bytes;
+    slot_bytes_ = std::max(slot_bytes_, input->bytes);
+    for (size_t i=0; max_batch_>1 && i<pool_.size(); ++i) {
+      batchers_.push_back(std::unique_ptr<Batcher>(new Batcher(
+        input_bytes_, 1, max_batch, max_wait,
+        [this, i](const uint8_t* input, size_t batch_size, Scores* scores) {
+          return run_batch(input, batch_size, scores, batch_output_[i]);
+        })));
+    }
+  }
+
+  // accepts clients until SIGINT / SIGTERM
+  bool serve(const char* socket_path) {
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr = make_address(socket_path);
+    unlink(socket_path);
+    if (listen_fd < 0
+      || bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) != 0
+      || listen(listen_fd, 64) != 0) {
+      printf("failed to listen on %s : %s\n", socket_path, strerror(errno));
+      if (listen_fd >= 0) {
+        close(listen_fd);
+      }
+      return false;
+    }
+    printf("listening on %s, %zu interpreters x %d threads, batches of up to %zu, %u slots of %zu bytes per client\n",
+           socket_path, pool_.size(), pool_.threads_per_interpreter(), max_batch_, num_slots_, slot_bytes_);
+
+    std::vector<Reader> readers;
+    while (!g_stop) {
+      // joins the readers of closed connections
+      for (size_t i=0; i<readers.size(); ) {
+        if (readers[i].done->load()) {
+          readers[i].thread.join();
+          readers[i] = std::move(readers.back());
+          readers.pop_back();
+        }else {
+          ++i;
+        }
+      }
+      pollfd pfd;
+      pfd.fd = listen_fd;
+      pfd.events = POLLIN;
+      if (poll(&pfd, 1, 200) <= 0) {
+        continue;
+      }
+      int fd = accept(listen_fd, nullptr, nullptr);
+      if (fd < 0) {
+        continue;
+      }
+      std::shared_ptr<Connection> conn(new Connection(fd));
+      if (!open_ring(*conn)) {
+        continue;
+      }
+      {
+        std::lock_guard<std::mutex> lock(live_mutex_);
+        live_.insert(fd);
+      }
+      Reader reader;
+      reader.done = std::make_shared<std::atomic<bool> >(false);
+      reader.thread = std::thread(&Server::read_requests, this, conn, reader.done);
+      readers.push_back(std::move(reader));
+    }
+
+    close(listen_fd);
+    unlink(socket_path);
+    {
+      std::lock_guard<std::mutex> lock(live_mutex_);
+      for (std::set<int>::iterator it=live_.begin(); it!=live_.end(); ++it) {
+        shutdown(*it, SHUT_RDWR);
+      }
+    }
+    for (size_t i=0; i<readers.size(); ++i) {
+      readers[i].thread.join();
+    }
+    return true;
+  }
+
+private:
+  struct Reader
+  {
+    std::thread thread;
+    std::shared_ptr<std::atomic<bool> > done;  // set as the thread ends
+  };
+
+  // creates the client's ring and sends it with the hello message
+  bool open_ring(Connection& conn) {
+    char name[64];
+    sprintf(name, "/tflite_server.%d.%u", (int)getpid(), next_ring_++);
+    int shm_fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (shm_fd < 0) {
+      printf("shm_open failed : %s\n", strerror(errno));
+      return false;
+    }
+    // only the fd passed to the client keeps it alive
+    shm_unlink(name);
+    conn.num_slots = num_slots_;
+    conn.slot_bytes = slot_bytes_;
+    conn.ring_bytes = (size_t)num_slots_ * slot_bytes_;
+    bool ok = ftruncate(shm_fd, conn.ring_bytes) == 0;
+    if (ok) {
+      void* p = mmap(nullptr, conn.ring_bytes, PROT_READ, MAP_SHARED, shm_fd, 0);
+      if (p != MAP_FAILED) {
+        conn.ring = (uint8_t*)p;
+      }
+      ok = (p != MAP_FAILED);
+    }
+    if (ok) {
+      HelloMessage hello;
+      memset(&hello, 0, sizeof(hello));
+      hello.magic = PROTOCOL_MAGIC;
+      hello.num_slots = num_slots_;
+      hello.slot_bytes = slot_bytes_;
+      hello.input_height = input_shape_.height;
+      hello.input_width = input_shape_.width;
+      hello.input_channels = input_shape_.channel;
+      hello.input_type = input_type_;
+      hello.top_k = top_k_;
+      ok = send_with_fd(conn.fd, &hello, sizeof(hello), shm_fd);
+    }
+    close(shm_fd);
+    return ok;
+  }
+
+  void read_requests(std::shared_ptr<Connection> conn, std::shared_ptr<std::atomic<bool> > done) {
+    RequestMessage req;
+    while (read_full(conn->fd, &req, sizeof(req))) {
+      workers_.enqueue([this, conn, req]() { process(*conn, req); });
+    }
+    {
+      std::lock_guard<std::mutex> lock(live_mutex_);
+      live_.erase(conn->fd);
+    }
+    done->store(true);
+  }
+
+  bool valid(const Connection& conn, const RequestMessage& req) const {
+    if (req.slot >= conn.num_slots) {
+      return false;
+    }
+    if (req.payload == PAYLOAD_TENSOR) {
+      return true;
+    }
+    return req.payload == PAYLOAD_PIXELS
+      && req.width > 0 && req.height > 0
+      && req.channels == input_shape_.channel
+      && (uint64_t)req.width * req.height * req.channels <= conn.slot_bytes;
+  }
+
+  // the input tensor bytes of the request
+  void read_input(const Connection& conn, const RequestMessage& req, uint8_t* input) const {
+    const uint8_t* src = conn.ring + (size_t)req.slot * conn.slot_bytes;
+    if (req.payload == PAYLOAD_TENSOR) {
+      memcpy(input, src, input_bytes_);
+    }else if (input_type_ == kTfLiteInt8) {
+      preprocess_image(src, req.width, req.height, PreprocessParams(input_shape_, -128), (int8_t*)input);
+    }else {
+      preprocess_image(src, req.width, req.height, PreprocessParams(input_shape_), input);
+    }
+  }
+
+  void process(Connection& conn, const RequestMessage& req) {
+    ResultMessage res;
+    memset(&res, 0, sizeof(res));
+    res.id = req.id;
+    if (!valid(conn, req)) {
+      res.status = STATUS_BAD_REQUEST;
+    }else if (batchers_.empty()) {
+      Scores scores;
+      if (run_single(conn, req, scores)) {
+        res.count = scores.count;
+        memcpy(res.classes, scores.classes, sizeof(res.classes));
+        memcpy(res.scores, scores.scores, sizeof(res.scores));
+      }else {
+        res.status = STATUS_FAILED;
+      }
+    }else {
+      Batcher& batcher = *batchers_[next_batcher_++ % batchers_.size()];
+      try {
+        // the slot stays valid until the reply, so it is read in the batch
+        const Scores scores = batcher.submit([&](uint8_t* input) { read_input(conn, req, input); }).get()[0];
+        res.count = scores.count;
+        memcpy(res.classes, scores.classes, sizeof(res.classes));
+        memcpy(res.scores, scores.scores, sizeof(res.scores));
+      }catch (const std::exception&) {
+        res.status = STATUS_FAILED;
+      }
+    }
+    std::lock_guard<std::mutex> lock(conn.write_mutex);
+    write_full(conn.fd, &res, sizeof(res));
+  }
+
+  // max_batch 1 : the request into a free interpreter's input tensor
+  bool run_single(const Connection& conn, const RequestMessage& req, Scores& scores) {
+    InterpreterPool::Handle interpreter = pool_.acquire();
+    read_input(conn, req, (uint8_t*)interpreter->tensor(interpreter->inputs()[0])->data.raw);
+    if (interpreter->Invoke() != kTfLiteOk) {
+      return false;
+    }
+    scores.count = top_k(interpreter->tensor(interpreter->outputs()[0]), top_k_, scores.classes, scores.scores);
+    return true;
+  }
+
+  // a batcher's runner : the batch through one interpreter, then top-k of
+  // each image on its slice of output
+  bool run_batch(const uint8_t* input, size_t batch_size, Scores* scores, std::vector<uint8_t>& output) {
+    InterpreterPool::Handle interpreter = pool_.acquire();
+    output.resize(batch_size * output_bytes_);
+    if (!invoke_batch(interpreter.get(), input, batch_size, &output[0])) {
+      return false;
+    }
+    const TfLiteTensor* tensor = interpreter->tensor(interpreter->outputs()[0]);
+    for (size_t i=0; i<batch_size; ++i) {
+      scores[i].count = top_k(tensor, top_k_, scores[i].classes, scores[i].scores, &output[i * output_bytes_]);
+    }
+    return true;
+  }
+
+  typedef DynamicBatcher<uint8_t, Scores> Batcher;
+
+  InterpreterPool& pool_;
+  uint32_t num_slots_;
+  size_t slot_bytes_;
+  int top_k_;
+  size_t max_batch_;
+  Shape input_shape_;
+  TfLiteType input_type_;
+  size_t input_bytes_;   // of one image
+  size_t output_bytes_;
+  unsigned next_ring_;
+  std::atomic<unsigned> next_batcher_;
+  std::mutex live_mutex_;
+  std::set<int> live_;
+  std::vector<std::vector<uint8_t> > batch_output_; // per batcher
+  std::vector<std::unique_ptr<Batcher> > batchers_;
+  ThreadPool workers_; // last, finishes pending requests first on destruction
+};
+
+int run_server(int argc, char* argv[])
+{
+  size_t interpreters = 1;
+  int threads = 0;
+  uint32_t num_slots = 16;
+  int max_side = 1024;
+  int top_k_count = 5;
+  size_t max_batch = 1;
+  int max_wait_us = 2000;
+  bool bad_option = false;
+  int arg = 0;
+  for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+    if (strlen(argv[arg]) != 2) {
+      bad_option = true;
+      break;
+    }
+    const int value = atoi(argv[arg + 1]);
+    switch (argv[arg][1]) {
+    case 'n': interpreters = value; break;
+    case 't': threads = value; break;
+    case 's': num_slots = value; break;
+    case 'm': max_side = value; break;
+    case 'k': top_k_count = value; break;
+    case 'b': max_batch = value; break;
+    case 'w': max_wait_us = value; break;
+    default: bad_option = true; break;
+    }
+  }
+  if (bad_option || argc - arg < 2 || interpreters < 1 || num_slots < 1 || max_side < 1 || max_batch < 1 || max_wait_us < 0) {
+    printf("usage : serve [-n interpreters] [-t threads_per_interpreter] [-s slots_per_client] [-m max_image_side] [-k top_k] [-b max_batch] [-w max_wait_us] model_file socket_path\n");
+    return 0;
+  }
+
+  InterpreterPool pool(argv[arg], interpreters, threads);
+  if (!pool.ok()) {
+    printf("failed to load model : %s\n", argv[arg]);
+    return 0;
+  }
+  const int channels = pool.front()->tensor(pool.front()->inputs()[0])->dims->data[3];
+  Server server(pool, num_slots, (size_t)max_side * max_side * channels, top_k_count,
+                max_batch, std::chrono::microseconds(max_wait_us));
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, nullptr);
+  sigaction(SIGTERM, &sa, nullptr);
+  server.serve(argv[arg + 1]);
+  return 0;
+}
+
+// ---------------------------------------------------------------- client
+
+// Sends the images round robin, keeping up to `outstanding` requests in
+// flight, and reports requests/sec and latency. With -r the client does the
+// preprocessing and sends input tensors.
+int run_client(int argc, char* argv[])
+{
+  size_t outstanding = 8;
+  size_t total = 0;
+  bool tensor_payload = false;
+  int arg = 0;
+  for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+    if (strcmp(argv[arg], "-r") == 0) {
+      tensor_payload = true;
+    }else if (arg + 1 < argc && strcmp(argv[arg], "-c") == 0) {
+      outstanding = atoi(argv[++arg]);
+    }else if (arg + 1 < argc && strcmp(argv[arg], "-n") == 0) {
+      total = atoi(argv[++arg]);
+    }else {
+      break;
+    }
+  }
+  if (argc - arg < 2 || outstanding < 1) {
+    printf("usage : client [-c outstanding] [-n requests] [-r] socket_path image_file...\n");
+    return 0;
+  }
+  const char* socket_path = argv[arg];
+  std::vector<std::string> paths(argv + arg + 1, argv + argc);
+  if (total == 0) {
+    total = paths.size();
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un addr = make_address(socket_path);
+  if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+    printf("failed to connect to %s : %s\n", socket_path, strerror(errno));
+    return 0;
+  }
+  HelloMessage hello;
+  int shm_fd = recv_with_fd(fd, &hello, sizeof(hello));
+  if (shm_fd < 0 || hello.magic != PROTOCOL_MAGIC) {
+    printf("bad hello from server\n");
+    return 0;
+  }
+  const size_t ring_bytes = (size_t)hello.num_slots * hello.slot_bytes;
+  void* mapped = mmap(nullptr, ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+  close(shm_fd);
+  if (mapped == MAP_FAILED) {
+    printf("mmap failed : %s\n", strerror(errno));
+    return 0;
+  }
+  uint8_t* ring = (uint8_t*)mapped;
+
+  // payloads are prepared once, each request copies one into its slot
+  struct Payload
+  {
+    std::vector<uint8_t> bytes;
+    int width;
+    int height;
+  };
+  std::vector<Payload> payloads(paths.size());
+  const Shape input_shape(1, hello.input_height, hello.input_width, hello.input_channels);
+  for (size_t i=0; i<paths.size(); ++i) {
+    Payload& p = payloads[i];
+    if (tensor_payload) {
+      PreprocessParams params(input_shape);
+      p.bytes.resize(input_shape.num_elements());
+      bool ok;
+      if (hello.input_type == kTfLiteInt8) {
+        params.offset = -128;
+        ok = preprocess_file(paths[i].c_str(), params, (int8_t*)&p.bytes[0]);
+      }else {
+        ok = preprocess_file(paths[i].c_str(), params, &p.bytes[0]);
+      }
+      if (!ok) {
+        printf("failed to load image : %s\n", paths[i].c_str());
+        return 0;
+      }
+      p.width = input_shape.width;
+      p.height = input_shape.height;
+    }else {
+      int n;
+      unsigned char* data = stbi_load(paths[i].c_str(), &p.width, &p.height, &n, hello.input_channels);
+      if (!data) {
+        printf("failed to load image : %s\n", paths[i].c_str());
+        return 0;
+      }
+      p.bytes.assign(data, data + (size_t)p.width * p.height * hello.input_channels);
+      stbi_image_free(data);
+    }
+    if (p.bytes.size() > hello.slot_bytes) {
+      printf("image larger than a slot (%llu bytes) : %s\n", (unsigned long long)hello.slot_bytes, paths[i].c_str());
+      return 0;
+    }
+  }
+
+  std::vector<uint32_t> free_slots;
+  for (uint32_t i=0; i<hello.num_slots && i<outstanding; ++i) {
+    free_slots.push_back(i);
+  }
+  std::vector<uint32_t> slot_of(total);
+  std::vector<Clock::time_point> sent_at(total);
+  std::vector<double> latencies;
+  latencies.reserve(total);
+  size_t sent = 0;
+  size_t failed = 0;
+  const Clock::time_point begin = Clock::now();
+  while (latencies.size() < total) {
+    while (sent < total && !free_slots.empty()) {
+      const Payload& p = payloads[sent % payloads.size()];
+      RequestMessage req;
+      req.id = sent;
+      req.slot = free_slots.back();
+      req.payload = tensor_payload ? PAYLOAD_TENSOR : PAYLOAD_PIXELS;
+      req.width = p.width;
+      req.height = p.height;
+      req.channels = hello.input_channels;
+      free_slots.pop_back();
+      memcpy(ring + (size_t)req.slot * hello.slot_bytes, &p.bytes[0], p.bytes.size());
+      slot_of[sent] = req.slot;
+      sent_at[sent] = Clock::now();
+      if (!write_full(fd, &req, sizeof(req))) {
+        printf("server closed the connection\n");
+        return 0;
+      }
+      ++sent;
+    }
+    ResultMessage res;
+    if (!read_full(fd, &res, sizeof(res)) || res.id >= sent) {
+      printf("server closed the connection\n");
+      return 0;
+    }
+    latencies.push_back(std::chrono::duration<double, std::milli>(Clock::now() - sent_at[res.id]).count());
+    free_slots.push_back(slot_of[res.id]);
+    if (res.status != STATUS_OK) {
+      ++failed;
+    }
+    // the first round of results
+    if (res.id < paths.size()) {
+      printf("%s", paths[res.id].c_str());
+      if (res.status != STATUS_OK) {
+        printf("\terror %d", res.status);
+      }
+      for (int i=0; i<res.count; ++i) {
+        printf("\t%d:%.4f", res.classes[i], res.scores[i]);
+      }
+      printf("\n");
+    }
+  }
+  const double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+  printf("%zu requests (%zu failed) in %.2f s : %.1f requests/sec\n",
+         total, failed, seconds, total / seconds);
+  printf("latency p50 %.2f ms, p99 %.2f ms\n", percentile(latencies, 0.5), percentile(latencies, 0.99));
+
+  munmap(ring, ring_bytes);
+  close(fd);
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  if (argc >= 2 && strcmp(argv[1], "serve") == 0) {
+    return run_server(argc - 2, argv + 2);
+  }
+  if (argc >= 2 && strcmp(argv[1], "client") == 0) {
+    return run_client(argc - 2, argv + 2);
+  }
+  printf("usage : serve [options] model_file socket_path\n");
+  printf("        client [options] socket_path image_file...\n");
+  return 0;
+}
+
+#endif
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <functional>
+
+#include "thread_pool.h"
+
+// Runs single requests on a thread pool so callers can overlap decoding,
+// inference and post-processing. Each request completes either through the
+// future returned by submit() or through a callback. A request that no
+// worker has picked up yet can be cancelled; the destructor still runs
+// the rest.
+template <typename In, typename Out>
+class AsyncInference
+{
+public:
+  enum Status {
+    DONE,
+    FAILED,     // the runner returned false
+    CANCELLED,
+  };
+
+  struct Result
+  {
+    Status status;
+    std::vector<Out> output;  // output_size elements when DONE
+  };
+
+  typedef uint64_t RequestId;
+
+  // called on a worker thread, or on the thread calling cancel()
+  typedef std::function<void(RequestId id, const Result& result)> Callback;
+
+  // input : input_size elements, output : output_size elements.
+  // Called concurrently from num_workers threads, so each call needs its own
+  // interpreter (e.g. InterpreterPool::acquire).
+  typedef std::function<bool(const In* input, Out* output)> Runner;
+
+  AsyncInference(
+    size_t input_size,
+    size_t output_size,
+    size_t num_workers,
+    const Runner& runner)
+    :
+    input_size_(input_size),
+    output_size_(output_size),
+    runner_(runner),
+    next_id_(0),
+    workers_(num_workers)
+  {
+  }
+
+  // copies input_size elements; thread safe
+  std::future<Result> submit(const In* input, RequestId* id = nullptr) {
+    std::shared_ptr<Request> req = make_request(input);
+    std::future<Result> result = req->promise.get_future();
+    const RequestId req_id = enqueue(req);
+    if (id) {
+      *id = req_id;
+    }
+    return result;
+  }
+
+  RequestId submit(const In* input, const Callback& callback) {
+    std::shared_ptr<Request> req = make_request(input);
+    req->callback = callback;
+    return enqueue(req);
+  }
+
+  // true if the request had not started; it then completes as CANCELLED
+  bool cancel(RequestId id) {
+    std::shared_ptr<Request> req;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      typename std::map<RequestId, std::shared_ptr<Request> >::iterator it = pending_.find(id);
+      if (it == pending_.end()) {
+        return false;
+      }
+      req = it->second;
+      pending_.erase(it);
+    }
+    complete(*req, CANCELLED);
+    return true;
+  }
+
+  // requests not picked up by a worker yet
+  size_t pending() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_.size();
+  }
+
+  size_t num_workers() const { return workers_.size(); }
+
+private:
+  AsyncInference(const AsyncInference&);
+  AsyncInference& operator=(const AsyncInference&);
+
+  struct Request
+  {
+    RequestId id;
+    std::vector<In> input;
+    std::promise<Result> promise;
+    Callback callback;
+  };
+
+  std::shared_ptr<Request> make_request(const In* input) {
+    std::shared_ptr<Request> req(new Request);
+    req->input.assign(input, input + input_size_);
+    return req;
+  }
+
+  RequestId enqueue(const std::shared_ptr<Request>& req) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      req->id = next_id_++;
+      pending_[req->id] = req;
+    }
+    const RequestId id = req->id;
+    workers_.enqueue([this, id]() { run(id); });
+    return id;
+  }
+
+  void run(RequestId id) {
+    std::shared_ptr<Request> req;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      typename std::map<RequestId, std::shared_ptr<Request> >::iterator it = pending_.find(id);
+      if (it == pending_.end()) {
+        return; // cancelled
+      }
+      req = it->second;
+      pending_.erase(it);
+    }
+    Result result;
+    result.output.resize(output_size_);
+    result.status = runner_(&req->input[0], &result.output[0]) ? DONE : FAILED;
+    if (result.status != DONE) {
+      result.output.clear();
+    }
+    finish(*req, result);
+  }
+
+  void complete(Request& req, Status status) {
+    Result result;
+    result.status = status;
+    finish(req, result);
+  }
+
+  void finish(Request& req, Result& result) {
+    if (req.callback) {
+      req.callback(req.id, result);
+    }else {
+      req.promise.set_value(std::move(result));
+    }
+  }
+
+  size_t input_size_;
+  size_t output_size_;
+  Runner runner_;
+  RequestId next_id_;
+  std::map<RequestId, std::shared_ptr<Request> > pending_;
+  mutable std::mutex mutex_;
+  ThreadPool workers_;  // last, so queued requests run before the rest is destroyed
+};
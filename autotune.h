@@ -0,0 +1,392 @@
+#pragma once
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <map>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#endif
+
+#include "cnn.h"
+#include "thread_pool.h"
+
+// How a layer is run: output tiles (0 = whole extent), output channels per
+// pass of the Conv2D kernel (1, 2, 4 or 8) and threads sharing the tiles.
+struct ConvTuning
+{
+  int tile_height;
+  int tile_width;
+  int channel_block;
+  int threads;
+  double seconds;   // measured when tuned, 0 if not
+
+  ConvTuning(int tile_height = 0, int tile_width = 0, int channel_block = 1, int threads = 1)
+    :
+    tile_height(tile_height),
+    tile_width(tile_width),
+    channel_block(channel_block),
+    threads(threads),
+    seconds(0)
+  {
+  }
+};
+
+inline
+void run_tile(
+  const ConvLayer_int8& layer,
+  const ConvTuning& tuning,
+  const int8_t* input_values,
+  int8_t* output_values,
+  const Rect& output_rect)
+{
+  if (layer.type != LayerType::Conv2D || tuning.channel_block <= 1) {
+    run_layer(layer, input_values, output_values, output_rect);
+    return;
+  }
+  void (*kernel)(
+    const Shape, const int8_t*, const Shape, const int8_t*, const int32_t*, const Shape, int8_t*,
+    const int, const int, const int, const int, const int32_t, const int32_t,
+    const int32_t*, const int32_t*, const int32_t, const int32_t, const Rect&);
+  switch (tuning.channel_block) {
+  case 2: kernel = Conv2D_int8_int8_blocked<2>; break;
+  case 4: kernel = Conv2D_int8_int8_blocked<4>; break;
+  default: kernel = Conv2D_int8_int8_blocked<8>; break;
+  }
+  kernel(
+    layer.input_shape, input_values,
+    layer.filter_shape, layer.filter_values,
+    layer.bias_values,
+    layer.output_shape, output_values,
+    layer.stride_height, layer.stride_width,
+    layer.padding_height, layer.padding_width,
+    layer.input_offset, layer.output_offset,
+    &layer.output_multiplier[0], &layer.output_shift[0],
+    layer.activation_min, layer.activation_max,
+    output_rect);
+}
+
+// Runs the layer tile by tile, the tiles dealt round robin to
+// tuning.threads threads: the caller and tasks on pool. Without a pool the
+// caller runs every tile.
+inline
+void run_layer_tuned(
+  const ConvLayer_int8& layer,
+  const ConvTuning& tuning,
+  const int8_t* input_values,
+  int8_t* output_values,
+  ThreadPool* pool)
+{
+  const int height = layer.output_shape.height;
+  const int width = layer.output_shape.width;
+  const int tile_height = tuning.tile_height > 0 ? std::min(tuning.tile_height, height) : height;
+  const int tile_width = tuning.tile_width > 0 ? std::min(tuning.tile_width, width) : width;
+  std::vector<Rect> tiles;
+  for (int y=0; y<height; y+=tile_height) {
+    for (int x=0; x<width; x+=tile_width) {
+      tiles.push_back(Rect(x, y, std::min(x + tile_width, width), std::min(y + tile_height, height)));
+    }
+  }
+  parallel_for(pool, tuning.threads, (int)tiles.size(), [&](int i) {
+    run_tile(layer, tuning, input_values, output_values, tiles[i]);
+  });
+}
+
+// run_layers with each layer run as tunings[i] says. tunings may be empty,
+// which runs the plain kernels.
+inline
+void run_layers(
+  const std::vector<ConvLayer_int8>& layers,
+  const std::vector<ConvTuning>& tunings,
+  int batch,
+  const int8_t* input_values,
+  int8_t* output_values,
+  std::vector<int8_t>& scratch,
+  ThreadPool* pool)
+{
+  if (tunings.empty()) {
+    run_layers(layers, batch, input_values, output_values, scratch);
+    return;
+  }
+  assert(tunings.size() == layers.size());
+  run_layers(layers, batch, input_values, output_values, scratch,
+             [&](size_t i, const ConvLayer_int8& layer, const int8_t* input, int8_t* output) {
+    run_layer_tuned(layer, tunings[i], input, output, pool);
+  });
+}
+
+// CPU brand string and hardware thread count, e.g.
+// "Intel(R) Core(TM) i7-8700 CPU @ 3.20GHz x12"
+inline
+std::string cpu_model()
+{
+  char brand[49] = {0};
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  int regs[4];
+  __cpuid(regs, 0x80000000);
+  if ((unsigned)regs[0] >= 0x80000004) {
+    for (int i=0; i<3; ++i) {
+      __cpuid(regs, 0x80000002 + i);
+      memcpy(brand + 16 * i, regs, 16);
+    }
+  }
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  unsigned regs[4];
+  if (__get_cpuid(0x80000000, &regs[0], &regs[1], &regs[2], &regs[3]) && regs[0] >= 0x80000004) {
+    for (unsigned i=0; i<3; ++i) {
+      __get_cpuid(0x80000002 + i, &regs[0], &regs[1], &regs[2], &regs[3]);
+      memcpy(brand + 16 * i, regs, 16);
+    }
+  }
+#elif defined(__linux__)
+  FILE* f = fopen("/proc/cpuinfo", "r");
+  if (f) {
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+      const char* colon = strchr(line, ':');
+      if (colon && strncmp(line, "model name", 10) == 0) {
+        strncpy(brand, colon + 1, sizeof(brand) - 1);
+        break;
+      }
+    }
+    fclose(f);
+  }
+#endif
+  std::string name;
+  for (const char* p=brand; *p; ++p) {
+    // one space between words, none around, no tabs or newlines
+    if (*p == ' ' || *p == '\t' || *p == '\n') {
+      if (!name.empty() && name.back() != ' ') {
+        name += ' ';
+      }
+    }else {
+      name += *p;
+    }
+  }
+  while (!name.empty() && name.back() == ' ') {
+    name.pop_back();
+  }
+  if (name.empty()) {
+    name = "unknown";
+  }
+  char threads[16];
+  sprintf(threads, " x%zu", ThreadPool::hardware_threads());
+  return name + threads;
+}
+
+// what the tuning depends on : type, shapes, stride and padding
+inline
+std::string layer_key(const ConvLayer_int8& layer)
+{
+  const Shape& i = layer.input_shape;
+  const Shape& f = layer.filter_shape;
+  char buff[128];
+  sprintf(buff, "%s i%dx%dx%dx%d f%dx%dx%dx%d s%dx%d p%dx%d",
+          layer.type == LayerType::Conv2D ? "conv" : "dwconv",
+          i.number, i.height, i.width, i.channel,
+          f.number, f.height, f.width, f.channel,
+          layer.stride_height, layer.stride_width,
+          layer.padding_height, layer.padding_width);
+  return buff;
+}
+
+// best of repetitions after a warm-up run
+inline
+double time_layer(
+  const ConvLayer_int8& layer,
+  const ConvTuning& tuning,
+  const int8_t* input_values,
+  int8_t* output_values,
+  ThreadPool* pool,
+  int repetitions)
+{
+  run_layer_tuned(layer, tuning, input_values, output_values, pool);
+  double best = 0;
+  for (int r=0; r<repetitions; ++r) {
+    const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    run_layer_tuned(layer, tuning, input_values, output_values, pool);
+    const double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    if (r == 0 || s < best) {
+      best = s;
+    }
+  }
+  return best;
+}
+
+// Times candidate configurations of the layer on random input and returns
+// the fastest. The search is staged rather than exhaustive: channel block on
+// one thread, then tile size with that block, then the thread count over
+// tiles, each stage keeping the best of the previous ones.
+inline
+ConvTuning tune_layer(const ConvLayer_int8& layer, ThreadPool* pool, int repetitions = 3)
+{
+  std::vector<int8_t> input(layer.input_shape.num_elements());
+  std::vector<int8_t> output(layer.output_shape.num_elements());
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<int> dist(-128, 127);
+  for (size_t i=0; i<input.size(); ++i) {
+    input[i] = (int8_t)dist(rng);
+  }
+  ConvTuning best;
+  best.seconds = time_layer(layer, best, &input[0], &output[0], pool, repetitions);
+  auto consider = [&](const ConvTuning& candidate) {
+    ConvTuning c = candidate;
+    c.seconds = time_layer(layer, c, &input[0], &output[0], pool, repetitions);
+    if (c.seconds < best.seconds) {
+      best = c;
+    }
+  };
+
+  if (layer.type == LayerType::Conv2D) {
+    static const int blocks[] = {2, 4, 8};
+    const ConvTuning base = best;
+    for (size_t i=0; i<sizeof(blocks)/sizeof(blocks[0]); ++i) {
+      ConvTuning c = base;
+      c.channel_block = blocks[i];
+      consider(c);
+    }
+  }
+
+  const int height = layer.output_shape.height;
+  const int width = layer.output_shape.width;
+  static const int tile_heights[] = {1, 4, 16};
+  static const int tile_widths[] = {0, 16};
+  {
+    const ConvTuning base = best;
+    for (size_t i=0; i<sizeof(tile_heights)/sizeof(tile_heights[0]); ++i) {
+      for (size_t j=0; j<sizeof(tile_widths)/sizeof(tile_widths[0]); ++j) {
+        if (tile_heights[i] >= height || tile_widths[j] >= width) {
+          continue;
+        }
+        ConvTuning c = base;
+        c.tile_height = tile_heights[i];
+        c.tile_width = tile_widths[j];
+        consider(c);
+      }
+    }
+  }
+
+  if (pool) {
+    const int max_threads = (int)pool->size() + 1;
+    const ConvTuning base = best;
+    for (int threads=2; threads<=max_threads; threads*=2) {
+      ConvTuning c = base;
+      c.threads = threads;
+      // parallel runs need several tiles; rows are the natural split
+      if (c.tile_height == 0 || c.tile_height >= height) {
+        c.tile_height = std::max(1, height / (threads * 2));
+      }
+      consider(c);
+    }
+  }
+  return best;
+}
+
+// Tuned configurations keyed by CPU model and layer shape, kept in a text
+// file of tab separated lines
+//
+//   cpu  key  tile_height tile_width channel_block threads  seconds
+//
+// Entries of other CPUs are kept and written back, so one file can serve
+// several machines.
+class ConvAutotuner
+{
+public:
+  explicit ConvAutotuner(const std::string& cpu = cpu_model())
+    :
+    cpu_(cpu),
+    num_tuned_(0)
+  {
+  }
+
+  // adds the entries of path; false if it cannot be read
+  bool load(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+      return false;
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+      char* tab1 = strchr(line, '\t');
+      char* tab2 = tab1 ? strchr(tab1 + 1, '\t') : nullptr;
+      if (!tab2) {
+        continue;
+      }
+      ConvTuning t;
+      if (sscanf(tab2 + 1, "%d %d %d %d %lf", &t.tile_height, &t.tile_width,
+                 &t.channel_block, &t.threads, &t.seconds) < 4) {
+        continue;
+      }
+      entries_[std::string(line, tab2)] = t;
+    }
+    fclose(f);
+    return true;
+  }
+
+  bool save(const char* path) const {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+      return false;
+    }
+    for (auto it=entries_.begin(); it!=entries_.end(); ++it) {
+      const ConvTuning& t = it->second;
+      fprintf(f, "%s\t%d %d %d %d %.9f\n", it->first.c_str(),
+              t.tile_height, t.tile_width, t.channel_block, t.threads, t.seconds);
+    }
+    fclose(f);
+    return true;
+  }
+
+  bool find(const ConvLayer_int8& layer, ConvTuning& tuning) const {
+    auto it = entries_.find(key(layer));
+    if (it == entries_.end()) {
+      return false;
+    }
+    tuning = it->second;
+    return true;
+  }
+
+  // the cached configuration of every layer, the plain one where there is
+  // none, for the chain runners
+  std::vector<ConvTuning> tunings(const std::vector<ConvLayer_int8>& layers) const {
+    std::vector<ConvTuning> result(layers.size());
+    for (size_t i=0; i<layers.size(); ++i) {
+      find(layers[i], result[i]);
+    }
+    return result;
+  }
+
+  // the cached configuration, tuning the layer first if there is none
+  const ConvTuning& tune(const ConvLayer_int8& layer, ThreadPool* pool) {
+    const std::string k = key(layer);
+    auto it = entries_.find(k);
+    if (it == entries_.end()) {
+      it = entries_.insert(std::make_pair(k, tune_layer(layer, pool))).first;
+      ++num_tuned_;
+    }
+    return it->second;
+  }
+
+  const std::string& cpu() const { return cpu_; }
+  size_t size() const { return entries_.size(); }
+  // layers tuned (not found in the cache) since construction
+  size_t num_tuned() const { return num_tuned_; }
+
+private:
+  std::string key(const ConvLayer_int8& layer) const {
+    return cpu_ + '\t' + layer_key(layer);
+  }
+
+  std::string cpu_;
+  std::map<std::string, ConvTuning> entries_;
+  size_t num_tuned_;
+};
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include "thread_pool.h"
+#include "preprocess.h"
+
+// Decodes and preprocesses a list of images on a pool of worker threads,
+// keeping up to `prefetch` finished input tensors ahead of the consumer.
+// Images come out in list order; buffers are recycled between the consumer
+// and the workers, so steady state does no allocation.
+template <typename T>
+class BatchLoader
+{
+public:
+  struct Item
+  {
+    size_t index;
+    std::string path;
+    bool ok;
+    const char* error;    // stb_image failure reason when !ok
+    std::vector<T> data;  // params.output_shape elements
+    std::chrono::steady_clock::time_point load_start; // when decoding began
+  };
+
+  // num_workers : 0 = one per hardware thread
+  // prefetch : images decoded ahead, 0 = twice the number of workers
+  BatchLoader(
+    const std::vector<std::string>& paths,
+    const PreprocessParams& params,
+    size_t num_workers = 0,
+    size_t prefetch = 0)
+    :
+    paths_(paths),
+    params_(params),
+    num_workers_(num_workers ? num_workers : ThreadPool::hardware_threads()),
+    slots_(prefetch ? prefetch : num_workers_ * 2),
+    consumed_(0),
+    submitted_(0),
+    cancelled_(false),
+    wait_time_(0),
+    pool_(num_workers_)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (submitted_ < paths_.size() && submitted_ < slots_.size()) {
+      submit(submitted_++);
+    }
+  }
+
+  ~BatchLoader() {
+    // queued loads return immediately, the pool joins the running ones
+    std::lock_guard<std::mutex> lock(mutex_);
+    cancelled_ = true;
+  }
+
+  size_t size() const { return paths_.size(); }
+  size_t num_workers() const { return num_workers_; }
+
+  // Blocks until the next image in list order is ready. item.data is
+  // swapped with the loader's buffer. Returns false when all are consumed.
+  bool next(Item& item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (consumed_ == paths_.size()) {
+      return false;
+    }
+    const size_t index = consumed_;
+    Slot& slot = slots_[index % slots_.size()];
+    if (!slot.ready) {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      while (!slot.ready) {
+        cv_.wait(lock);
+      }
+      wait_time_ += std::chrono::steady_clock::now() - start;
+    }
+    item.index = index;
+    item.path = paths_[index];
+    item.ok = slot.ok;
+    item.error = slot.error;
+    item.data.swap(slot.data);
+    item.load_start = slot.load_start;
+    slot.ready = false;
+    ++consumed_;
+    if (submitted_ < paths_.size()) {
+      submit(submitted_++);
+    }
+    return true;
+  }
+
+  // total time next() spent blocked on decoding, in seconds
+  double wait_seconds() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::chrono::duration<double>(wait_time_).count();
+  }
+
+private:
+  struct Slot
+  {
+    bool ready;
+    bool ok;
+    const char* error;
+    std::vector<T> data;
+    std::chrono::steady_clock::time_point load_start;
+
+    Slot()
+      :
+      ready(false),
+      ok(false),
+      error(nullptr)
+    {
+    }
+  };
+
+  // called with mutex_ held
+  void submit(size_t index) {
+    pool_.enqueue([this, index]() { load(index); });
+  }
+
+  void load(size_t index) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (cancelled_) {
+        return;
+      }
+    }
+    // the slot belongs to this task until it is marked ready
+    Slot& slot = slots_[index % slots_.size()];
+    slot.load_start = std::chrono::steady_clock::now();
+    slot.data.resize(params_.output_shape.num_elements());
+    TRACE_SCOPE_ARG("decode", index);
+    const bool ok = preprocess_file(paths_[index].c_str(), params_, &slot.data[0]);
+    const char* error = ok ? nullptr : stbi_failure_reason();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      slot.ok = ok;
+      slot.error = error;
+      slot.ready = true;
+    }
+    cv_.notify_all();
+  }
+
+  std::vector<std::string> paths_;
+  PreprocessParams params_;
+  size_t num_workers_;
+  std::vector<Slot> slots_;
+  size_t consumed_;
+  size_t submitted_;
+  bool cancelled_;
+  std::chrono::steady_clock::duration wait_time_;
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  ThreadPool pool_; // last, so it is joined before the slots go away
+};
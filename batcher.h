@@ -0,0 +1,181 @@
+#pragma once
+
+#include <assert.h>
+#include <string.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+
+// Coalesces single-image requests into batches. The oldest request of a batch
+// waits at most max_wait (from submission) for others to arrive; a batch is
+// run as soon as it has max_batch requests. Inputs are packed back to back,
+// either copied at submission or written in place by the caller's Fill as
+// the batch is gathered; the runner fills the outputs of the whole batch,
+// and each caller's future receives its own slice. When the runner fails
+// every future of the batch throws std::runtime_error instead.
+template <typename In, typename Out>
+class DynamicBatcher
+{
+public:
+  // input : batch_size * input_size elements, output : batch_size * output_size,
+  // false when the batch failed
+  typedef std::function<bool(const In* input, size_t batch_size, Out* output)> Runner;
+  // writes the input_size elements of one request at input
+  typedef std::function<void(In* input)> Fill;
+
+  DynamicBatcher(
+    size_t input_size,
+    size_t output_size,
+    size_t max_batch,
+    std::chrono::microseconds max_wait,
+    const Runner& runner)
+    :
+    input_size_(input_size),
+    output_size_(output_size),
+    max_batch_(max_batch),
+    max_wait_(max_wait),
+    runner_(runner),
+    stop_(false),
+    batches_(0),
+    requests_(0)
+  {
+    assert(max_batch_ >= 1);
+    input_.resize(input_size_ * max_batch_);
+    output_.resize(output_size_ * max_batch_);
+    thread_ = std::thread(&DynamicBatcher::dispatch, this);
+  }
+
+  // runs what is queued, then stops
+  ~DynamicBatcher() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+  }
+
+  // copies input_size elements; thread safe
+  std::future<std::vector<Out> > submit(const In* input) {
+    Request req;
+    req.input.assign(input, input + input_size_);
+    req.arrival = std::chrono::steady_clock::now();
+    return enqueue(req);
+  }
+
+  // fill writes the input straight into the request's slot of the batch, on
+  // the dispatch thread, so what it reads must stay valid until the future
+  // is ready; thread safe
+  std::future<std::vector<Out> > submit(const Fill& fill) {
+    Request req;
+    req.fill = fill;
+    req.arrival = std::chrono::steady_clock::now();
+    return enqueue(req);
+  }
+
+  size_t max_batch() const { return max_batch_; }
+
+  // batches run so far and their average size
+  size_t batches() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return batches_;
+  }
+
+  double average_batch() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return batches_ ? (double)requests_ / batches_ : 0.0;
+  }
+
+private:
+  struct Request
+  {
+    std::vector<In> input;  // copied at submission, or
+    Fill fill;              // written in place
+    std::promise<std::vector<Out> > promise;
+    std::chrono::steady_clock::time_point arrival;
+  };
+
+  std::future<std::vector<Out> > enqueue(Request& req) {
+    std::future<std::vector<Out> > result = req.promise.get_future();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      assert(!stop_);
+      queue_.push_back(std::move(req));
+    }
+    cv_.notify_all();
+    return result;
+  }
+
+  void dispatch() {
+    std::vector<Request> batch;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stop_ && queue_.empty()) {
+          cv_.wait(lock);
+        }
+        if (queue_.empty()) {
+          return;
+        }
+        // the oldest request sets the deadline
+        const std::chrono::steady_clock::time_point deadline = queue_.front().arrival + max_wait_;
+        while (!stop_ && queue_.size() < max_batch_) {
+          if (cv_.wait_until(lock, deadline) == std::cv_status::timeout) {
+            break;
+          }
+        }
+        const size_t n = std::min(queue_.size(), max_batch_);
+        for (size_t i=0; i<n; ++i) {
+          batch.push_back(std::move(queue_.front()));
+          queue_.pop_front();
+        }
+        ++batches_;
+        requests_ += n;
+      }
+      run(batch);
+      batch.clear();
+    }
+  }
+
+  void run(std::vector<Request>& batch) {
+    for (size_t i=0; i<batch.size(); ++i) {
+      In* input = &input_[i * input_size_];
+      if (batch[i].fill) {
+        batch[i].fill(input);
+      }else {
+        memcpy(input, &batch[i].input[0], input_size_ * sizeof(In));
+      }
+    }
+    if (!runner_(&input_[0], batch.size(), &output_[0])) {
+      for (size_t i=0; i<batch.size(); ++i) {
+        batch[i].promise.set_exception(std::make_exception_ptr(std::runtime_error("batch failed")));
+      }
+      return;
+    }
+    for (size_t i=0; i<batch.size(); ++i) {
+      const Out* out = &output_[i * output_size_];
+      batch[i].promise.set_value(std::vector<Out>(out, out + output_size_));
+    }
+  }
+
+  size_t input_size_;
+  size_t output_size_;
+  size_t max_batch_;
+  std::chrono::microseconds max_wait_;
+  Runner runner_;
+  std::vector<In> input_;
+  std::vector<Out> output_;
+  std::deque<Request> queue_;
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_;
+  size_t batches_;
+  size_t requests_;
+  std::thread thread_;
+};
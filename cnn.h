@@ -3,6 +3,10 @@
 #include <stdint.h>
 #include <assert.h>
 #include <algorithm>
+#include <vector>
+
+#include "trace.h"
+#include "float16.h"
 
 enum class Padding {
   same,
@@ -53,6 +57,54 @@ struct Shape
   }
 };
 
+// [x0, x1) x [y0, y1)
+struct Rect
+{
+  int x0;
+  int y0;
+  int x1;
+  int y1;
+
+  Rect(int x0 = 0, int y0 = 0, int x1 = 0, int y1 = 0)
+    :
+    x0(x0),
+    y0(y0),
+    x1(x1),
+    y1(y1)
+  {
+  }
+
+  int width() const { return x1 - x0; }
+  int height() const { return y1 - y0; }
+  bool empty() const { return x0 >= x1 || y0 >= y1; }
+};
+
+inline
+Rect intersect(const Rect& a, const Rect& b)
+{
+  return Rect(std::max(a.x0, b.x0), std::max(a.y0, b.y0),
+              std::min(a.x1, b.x1), std::min(a.y1, b.y1));
+}
+
+inline
+int8_t requantize(
+  int32_t sum,
+  const int32_t m0, const int32_t n,
+  const int32_t output_offset,
+  const int32_t activation_min, const int32_t activation_max)
+{
+  assert(n >= 0);
+  int64_t half = 1LL << (30 + n);
+  sum = (int32_t)(((int64_t)sum * m0 + half) >> (31 + n));
+  sum += output_offset;
+  sum = std::max(sum, activation_min);
+  sum = std::min(sum, activation_max);
+  return (int8_t)sum;
+}
+
+// runs every image of the batch (shape.number), computing only the outputs
+// inside output_rect. Sums are kept in Accumulator<T>::type, float for the
+// 16 bit types.
 template <typename T>
 void Conv2D(
   const Shape input_shape, const T* input_values,
@@ -60,47 +112,145 @@ void Conv2D(
   const T* bias_values,
   const Shape output_shape, T* output_values,
   const int stride_height, const int stride_width,
-  const int padding_height, const int padding_width
+  const int padding_height, const int padding_width,
+  const Rect& output_rect
   )
 {
   const int input_width = input_shape.width;
   const int input_height = input_shape.height;
   const int input_depth = input_shape.channel;
-  const int output_height = output_shape.height;
-  const int output_width = output_shape.width;
   const int output_depth = output_shape.channel;
   const int filter_width = filter_shape.width;
   const int filter_height = filter_shape.height;
+  assert(input_shape.number == output_shape.number);
+  assert(output_rect.x0 >= 0 && output_rect.x1 <= output_shape.width);
+  assert(output_rect.y0 >= 0 && output_rect.y1 <= output_shape.height);
 
-  for (int out_y=0; out_y<output_height; ++out_y) {
-    const int in_y_start = out_y * stride_height - padding_height;
-    for (int out_x=0; out_x<output_width; ++out_x) {
-      const int in_x_start = out_x * stride_width - padding_width;
-      for (int out_ch=0; out_ch<output_depth; ++out_ch) {
-        T sum = 0;
-        for (int filter_y=0; filter_y<filter_height; ++filter_y) {
-          const int in_y = in_y_start + filter_y;
-          if (in_y < 0 || in_y >= input_height)
-            continue;
-          for (int filter_x=0; filter_x<filter_width; ++filter_x) {
-            const int in_x = in_x_start + filter_x;
-            if (in_x < 0 || in_x >= input_width)
+  typedef typename Accumulator<T>::type Acc;
+  for (int b=0; b<output_shape.number; ++b) {
+    for (int out_y=output_rect.y0; out_y<output_rect.y1; ++out_y) {
+      const int in_y_start = out_y * stride_height - padding_height;
+      for (int out_x=output_rect.x0; out_x<output_rect.x1; ++out_x) {
+        const int in_x_start = out_x * stride_width - padding_width;
+        for (int out_ch=0; out_ch<output_depth; ++out_ch) {
+          Acc sum = 0;
+          for (int filter_y=0; filter_y<filter_height; ++filter_y) {
+            const int in_y = in_y_start + filter_y;
+            if (in_y < 0 || in_y >= input_height)
               continue;
-            for (int in_ch=0; in_ch<input_depth; ++in_ch) {
-              T input_value = input_values[input_shape.offset(0, in_y, in_x, in_ch)];
-              T filter_value = filter_values[filter_shape.offset(out_ch, filter_y, filter_x, in_ch)];
-              sum += filter_value * input_value;
+            for (int filter_x=0; filter_x<filter_width; ++filter_x) {
+              const int in_x = in_x_start + filter_x;
+              if (in_x < 0 || in_x >= input_width)
+                continue;
+              for (int in_ch=0; in_ch<input_depth; ++in_ch) {
+                Acc input_value = input_values[input_shape.offset(b, in_y, in_x, in_ch)];
+                Acc filter_value = filter_values[filter_shape.offset(out_ch, filter_y, filter_x, in_ch)];
+                sum += filter_value * input_value;
+              }
             }
           }
+          Acc bias = bias_values[out_ch];
+          sum += bias;
+          output_values[output_shape.offset(b, out_y, out_x, out_ch)] = T(sum);
         }
-        T bias = bias_values[out_ch];
-        sum += bias;
-        output_values[output_shape.offset(0, out_y, out_x, out_ch)] = sum;
       }
     }
   }
 }
 
+template <typename T>
+void Conv2D(
+  const Shape input_shape, const T* input_values,
+  const Shape filter_shape, const T* filter_values,
+  const T* bias_values,
+  const Shape output_shape, T* output_values,
+  const int stride_height, const int stride_width,
+  const int padding_height, const int padding_width
+  )
+{
+  Conv2D(
+    input_shape, input_values,
+    filter_shape, filter_values,
+    bias_values,
+    output_shape, output_values,
+    stride_height, stride_width,
+    padding_height, padding_width,
+    Rect(0, 0, output_shape.width, output_shape.height));
+}
+
+// weights_shape is 1 x height x width x channel, sums as in Conv2D
+template <typename T>
+void DepthwiseConv2D(
+  const Shape input_shape, const T* input_values,
+  const Shape weights_shape, const T* weights_values,
+  const T* bias_values,
+  const Shape output_shape, T* output_values,
+  const int stride_height, const int stride_width,
+  const int padding_height, const int padding_width,
+  const Rect& output_rect
+  )
+{
+  const int input_width = input_shape.width;
+  const int input_height = input_shape.height;
+  const int input_depth = input_shape.channel;
+  const int weight_width = weights_shape.width;
+  const int weight_height = weights_shape.height;
+  assert(output_shape.channel == input_depth);
+  assert(input_shape.number == output_shape.number);
+  assert(output_rect.x0 >= 0 && output_rect.x1 <= output_shape.width);
+  assert(output_rect.y0 >= 0 && output_rect.y1 <= output_shape.height);
+
+  typedef typename Accumulator<T>::type Acc;
+  for (int b=0; b<output_shape.number; ++b) {
+    for (int out_y=output_rect.y0; out_y<output_rect.y1; ++out_y) {
+      const int in_y_start = out_y * stride_height - padding_height;
+      for (int out_x=output_rect.x0; out_x<output_rect.x1; ++out_x) {
+        const int in_x_start = out_x * stride_width - padding_width;
+        for (int ch=0; ch<input_depth; ++ch) {
+          Acc sum = 0;
+          for (int weight_y=0; weight_y<weight_height; ++weight_y) {
+            const int in_y = in_y_start + weight_y;
+            if (in_y < 0 || in_y >= input_height)
+              continue;
+            for (int weight_x=0; weight_x<weight_width; ++weight_x) {
+              const int in_x = in_x_start + weight_x;
+              if (in_x < 0 || in_x >= input_width)
+                continue;
+              Acc input_value = input_values[input_shape.offset(b, in_y, in_x, ch)];
+              Acc weight_value = weights_values[weights_shape.offset(0, weight_y, weight_x, ch)];
+              sum += weight_value * input_value;
+            }
+          }
+          Acc bias = bias_values[ch];
+          output_values[output_shape.offset(b, out_y, out_x, ch)] = T(sum + bias);
+        }
+      }
+    }
+  }
+}
+
+template <typename T>
+void DepthwiseConv2D(
+  const Shape input_shape, const T* input_values,
+  const Shape weights_shape, const T* weights_values,
+  const T* bias_values,
+  const Shape output_shape, T* output_values,
+  const int stride_height, const int stride_width,
+  const int padding_height, const int padding_width
+  )
+{
+  DepthwiseConv2D(
+    input_shape, input_values,
+    weights_shape, weights_values,
+    bias_values,
+    output_shape, output_values,
+    stride_height, stride_width,
+    padding_height, padding_width,
+    Rect(0, 0, output_shape.width, output_shape.height));
+}
+
+// runs every image of the batch (shape.number), computing only the outputs
+// inside output_rect
 inline
 void Conv2D_int8_int8(
   const Shape input_shape, const int8_t* input_values,
@@ -111,7 +261,8 @@ void Conv2D_int8_int8(
   const int padding_height, const int padding_width,
   const int32_t input_offset, const int32_t output_offset,
   const int32_t* output_multiplier, const int32_t* output_shift,
-  const int32_t activation_min, const int32_t activation_max
+  const int32_t activation_min, const int32_t activation_max,
+  const Rect& output_rect
   )
 {
   assert(input_shape.num_elements() > 0);
@@ -130,43 +281,141 @@ void Conv2D_int8_int8(
   const int input_width = input_shape.width;
   const int input_height = input_shape.height;
   const int input_depth = input_shape.channel;
-  const int output_height = output_shape.height;
-  const int output_width = output_shape.width;
   const int output_depth = output_shape.channel;
   const int filter_width = filter_shape.width;
   const int filter_height = filter_shape.height;
+  assert(input_shape.number == output_shape.number);
+  assert(output_rect.x0 >= 0 && output_rect.x1 <= output_shape.width);
+  assert(output_rect.y0 >= 0 && output_rect.y1 <= output_shape.height);
 
-  for (int out_y=0; out_y<output_height; ++out_y) {
-    const int in_y_start = out_y * stride_height - padding_height;
-    for (int out_x=0; out_x<output_width; ++out_x) {
-      const int in_x_start = out_x * stride_width - padding_width;
-      for (int out_ch=0; out_ch<output_depth; ++out_ch) {
-        int32_t sum = 0;
-        const int32_t m0 = output_multiplier[out_ch];
-        const int32_t n = output_shift[out_ch];
-        assert(n >= 0);
-        for (int filter_y=0; filter_y<filter_height; ++filter_y) {
-          const int in_y = in_y_start + filter_y;
-          if (in_y < 0 || in_y >= input_height)
-            continue;
-          for (int filter_x=0; filter_x<filter_width; ++filter_x) {
-            const int in_x = in_x_start + filter_x;
-            if (in_x < 0 || in_x >= input_width)
+  for (int b=0; b<output_shape.number; ++b) {
+    for (int out_y=output_rect.y0; out_y<output_rect.y1; ++out_y) {
+      const int in_y_start = out_y * stride_height - padding_height;
+      for (int out_x=output_rect.x0; out_x<output_rect.x1; ++out_x) {
+        const int in_x_start = out_x * stride_width - padding_width;
+        for (int out_ch=0; out_ch<output_depth; ++out_ch) {
+          int32_t sum = 0;
+          const int32_t m0 = output_multiplier[out_ch];
+          const int32_t n = output_shift[out_ch];
+          assert(n >= 0);
+          for (int filter_y=0; filter_y<filter_height; ++filter_y) {
+            const int in_y = in_y_start + filter_y;
+            if (in_y < 0 || in_y >= input_height)
               continue;
-            for (int in_ch=0; in_ch<input_depth; ++in_ch) {
-              int32_t input_value = input_values[input_shape.offset(0, in_y, in_x, in_ch)];
-              int32_t filter_value = filter_values[filter_shape.offset(out_ch, filter_y, filter_x, in_ch)];
-              sum += filter_value * (input_value + input_offset);
+            for (int filter_x=0; filter_x<filter_width; ++filter_x) {
+              const int in_x = in_x_start + filter_x;
+              if (in_x < 0 || in_x >= input_width)
+                continue;
+              for (int in_ch=0; in_ch<input_depth; ++in_ch) {
+                int32_t input_value = input_values[input_shape.offset(b, in_y, in_x, in_ch)];
+                int32_t filter_value = filter_values[filter_shape.offset(out_ch, filter_y, filter_x, in_ch)];
+                sum += filter_value * (input_value + input_offset);
+              }
+            }
+          }
+          sum += bias_values[out_ch];
+          output_values[output_shape.offset(b, out_y, out_x, out_ch)] =
+            requantize(sum, m0, n, output_offset, activation_min, activation_max);
+        }
+      }
+    }
+  }
+}
+
+inline
+void Conv2D_int8_int8(
+  const Shape input_shape, const int8_t* input_values,
+  const Shape filter_shape, const int8_t* filter_values,
+  const int32_t* bias_values,
+  const Shape output_shape, int8_t* output_values,
+  const int stride_height, const int stride_width,
+  const int padding_height, const int padding_width,
+  const int32_t input_offset, const int32_t output_offset,
+  const int32_t* output_multiplier, const int32_t* output_shift,
+  const int32_t activation_min, const int32_t activation_max
+  )
+{
+  Conv2D_int8_int8(
+    input_shape, input_values,
+    filter_shape, filter_values,
+    bias_values,
+    output_shape, output_values,
+    stride_height, stride_width,
+    padding_height, padding_width,
+    input_offset, output_offset,
+    output_multiplier, output_shift,
+    activation_min, activation_max,
+    Rect(0, 0, output_shape.width, output_shape.height));
+}
+
+// Conv2D_int8_int8 computing Block output channels per pass over the
+// receptive field, so each input value is loaded once per block. NHWC only.
+template <int Block>
+void Conv2D_int8_int8_blocked(
+  const Shape input_shape, const int8_t* input_values,
+  const Shape filter_shape, const int8_t* filter_values,
+  const int32_t* bias_values,
+  const Shape output_shape, int8_t* output_values,
+  const int stride_height, const int stride_width,
+  const int padding_height, const int padding_width,
+  const int32_t input_offset, const int32_t output_offset,
+  const int32_t* output_multiplier, const int32_t* output_shift,
+  const int32_t activation_min, const int32_t activation_max,
+  const Rect& output_rect
+  )
+{
+  assert(input_shape.layout == TensorLayout::NHWC);
+  assert(output_shape.layout == TensorLayout::NHWC);
+  assert(filter_shape.layout == TensorLayout::NHWC);
+  assert(input_shape.number == output_shape.number);
+  assert(output_rect.x0 >= 0 && output_rect.x1 <= output_shape.width);
+  assert(output_rect.y0 >= 0 && output_rect.y1 <= output_shape.height);
+
+  const int input_width = input_shape.width;
+  const int input_height = input_shape.height;
+  const int input_depth = input_shape.channel;
+  const int output_depth = output_shape.channel;
+  const int filter_width = filter_shape.width;
+  const int filter_height = filter_shape.height;
+  const int filter_size = filter_height * filter_width * input_depth;
+
+  for (int b=0; b<output_shape.number; ++b) {
+    for (int out_y=output_rect.y0; out_y<output_rect.y1; ++out_y) {
+      const int in_y_start = out_y * stride_height - padding_height;
+      const int filter_y0 = std::max(0, -in_y_start);
+      const int filter_y1 = std::min(filter_height, input_height - in_y_start);
+      for (int out_x=output_rect.x0; out_x<output_rect.x1; ++out_x) {
+        const int in_x_start = out_x * stride_width - padding_width;
+        const int filter_x0 = std::max(0, -in_x_start);
+        const int filter_x1 = std::min(filter_width, input_width - in_x_start);
+        int8_t* out = &output_values[output_shape.offset(b, out_y, out_x, 0)];
+        for (int out_ch=0; out_ch<output_depth; out_ch+=Block) {
+          const int n = std::min(Block, output_depth - out_ch);
+          // a short last block repeats its last channel and drops the result
+          const int8_t* filters[Block];
+          int32_t sums[Block];
+          for (int k=0; k<Block; ++k) {
+            filters[k] = &filter_values[(out_ch + std::min(k, n - 1)) * filter_size];
+            sums[k] = 0;
+          }
+          for (int filter_y=filter_y0; filter_y<filter_y1; ++filter_y) {
+            for (int filter_x=filter_x0; filter_x<filter_x1; ++filter_x) {
+              const int8_t* in = &input_values[input_shape.offset(b, in_y_start + filter_y, in_x_start + filter_x, 0)];
+              const int filter_offset = (filter_y * filter_width + filter_x) * input_depth;
+              for (int in_ch=0; in_ch<input_depth; ++in_ch) {
+                const int32_t input_value = in[in_ch] + input_offset;
+                for (int k=0; k<Block; ++k) {
+                  sums[k] += filters[k][filter_offset + in_ch] * input_value;
+                }
+              }
             }
           }
+          for (int k=0; k<n; ++k) {
+            const int ch = out_ch + k;
+            out[ch] = requantize(sums[k] + bias_values[ch], output_multiplier[ch], output_shift[ch],
+                                 output_offset, activation_min, activation_max);
+          }
         }
-        sum += bias_values[out_ch];
-        int64_t half = 1LL << (30 + n);
-        sum = (int32_t)(((int64_t)sum * m0 + half) >> (31 + n));
-        sum += output_offset;
-        sum = std::max(sum, activation_min);
-        sum = std::min(sum, activation_max);
-        output_values[output_shape.offset(0, out_y, out_x, out_ch)] = (int8_t)sum;
       }
     }
   }
@@ -182,7 +431,8 @@ void DepthwiseConv2D_int8_int8(
   const int padding_height, const int padding_width,
   const int32_t input_offset, const int32_t output_offset,
   const int32_t* output_multiplier, const int32_t* output_shift,
-  const int32_t activation_min, const int32_t activation_max
+  const int32_t activation_min, const int32_t activation_max,
+  const Rect& output_rect
   )
 {
   assert(input_shape.num_elements() > 0);
@@ -201,43 +451,212 @@ void DepthwiseConv2D_int8_int8(
   const int input_width = input_shape.width;
   const int input_height = input_shape.height;
   const int input_depth = input_shape.channel;
-  const int output_height = output_shape.height;
-  const int output_width = output_shape.width;
-  const int output_depth = output_shape.channel;
   const int weight_width = weights_shape.width;
   const int weight_height = weights_shape.height;
-  assert(output_depth == input_depth);
-
-  for (int out_y=0; out_y<output_height; ++out_y) {
-    const int in_y_start = out_y * stride_height - padding_height;
-    for (int out_x=0; out_x<output_width; ++out_x) {
-      const int in_x_start = out_x * stride_width - padding_width;
-      for (int ch=0; ch<input_depth; ++ch) {
-        int32_t sum = 0;
-        const int32_t m0 = output_multiplier[ch];
-        const int32_t n = output_shift[ch];
-        assert(n >= 0);
-        for (int weight_y=0; weight_y<weight_height; ++weight_y) {
-          const int in_y = in_y_start + weight_y;
-          if (in_y < 0 || in_y >= input_height)
-            continue;
-          for (int weight_x=0; weight_x<weight_width; ++weight_x) {
-            const int in_x = in_x_start + weight_x;
-            if (in_x < 0 || in_x >= input_width)
+  assert(output_shape.channel == input_depth);
+  assert(input_shape.number == output_shape.number);
+  assert(output_rect.x0 >= 0 && output_rect.x1 <= output_shape.width);
+  assert(output_rect.y0 >= 0 && output_rect.y1 <= output_shape.height);
+
+  for (int b=0; b<output_shape.number; ++b) {
+    for (int out_y=output_rect.y0; out_y<output_rect.y1; ++out_y) {
+      const int in_y_start = out_y * stride_height - padding_height;
+      for (int out_x=output_rect.x0; out_x<output_rect.x1; ++out_x) {
+        const int in_x_start = out_x * stride_width - padding_width;
+        for (int ch=0; ch<input_depth; ++ch) {
+          int32_t sum = 0;
+          const int32_t m0 = output_multiplier[ch];
+          const int32_t n = output_shift[ch];
+          assert(n >= 0);
+          for (int weight_y=0; weight_y<weight_height; ++weight_y) {
+            const int in_y = in_y_start + weight_y;
+            if (in_y < 0 || in_y >= input_height)
               continue;
-            int32_t input_value = input_values[input_shape.offset(0, in_y, in_x, ch)];
-            int32_t filter_value = weights_values[weights_shape.offset(0, weight_y, weight_x, ch)];
-            sum += filter_value * (input_value + input_offset);
+            for (int weight_x=0; weight_x<weight_width; ++weight_x) {
+              const int in_x = in_x_start + weight_x;
+              if (in_x < 0 || in_x >= input_width)
+                continue;
+              int32_t input_value = input_values[input_shape.offset(b, in_y, in_x, ch)];
+              int32_t filter_value = weights_values[weights_shape.offset(0, weight_y, weight_x, ch)];
+              sum += filter_value * (input_value + input_offset);
+            }
           }
-        }
-        sum += bias_values[ch];
-        int64_t half = 1LL << (30 + n);
-        sum = (int32_t)(((int64_t)sum * m0 + half) >> (31 + n));
-        sum += output_offset;
-        sum = std::max(sum, activation_min);
-        sum = std::min(sum, activation_max);
-        output_values[output_shape.offset(0, out_y, out_x, ch)] = (int8_t)sum;
+          sum += bias_values[ch];
+          output_values[output_shape.offset(b, out_y, out_x, ch)] =
+            requantize(sum, m0, n, output_offset, activation_min, activation_max);
+        } // for
       } // for
     } // for
-  } // for
-}
\ No newline at end of file
+  }
+}
+
+inline
+void DepthwiseConv2D_int8_int8(
+  const Shape input_shape, const int8_t* input_values,
+  const Shape weights_shape, const int8_t* weights_values,
+  const int32_t* bias_values,
+  const Shape output_shape, int8_t* output_values,
+  const int stride_height, const int stride_width,
+  const int padding_height, const int padding_width,
+  const int32_t input_offset, const int32_t output_offset,
+  const int32_t* output_multiplier, const int32_t* output_shift,
+  const int32_t activation_min, const int32_t activation_max
+  )
+{
+  DepthwiseConv2D_int8_int8(
+    input_shape, input_values,
+    weights_shape, weights_values,
+    bias_values,
+    output_shape, output_values,
+    stride_height, stride_width,
+    padding_height, padding_width,
+    input_offset, output_offset,
+    output_multiplier, output_shift,
+    activation_min, activation_max,
+    Rect(0, 0, output_shape.width, output_shape.height));
+}
+
+enum class LayerType {
+  Conv2D,
+  DepthwiseConv2D,
+};
+
+// parameters of a quantized Conv2D / DepthwiseConv2D node
+struct ConvLayer_int8
+{
+  LayerType type;
+  Shape input_shape;
+  Shape filter_shape;
+  Shape output_shape;
+  const int8_t* filter_values;
+  const int32_t* bias_values;
+  int stride_height;
+  int stride_width;
+  int padding_height;
+  int padding_width;
+  int32_t input_offset;
+  int32_t output_offset;
+  std::vector<int32_t> output_multiplier;
+  std::vector<int32_t> output_shift;
+  int32_t activation_min;
+  int32_t activation_max;
+
+  ConvLayer_int8()
+    :
+    type(LayerType::Conv2D),
+    filter_values(nullptr),
+    bias_values(nullptr),
+    stride_height(1),
+    stride_width(1),
+    padding_height(0),
+    padding_width(0),
+    input_offset(0),
+    output_offset(0),
+    activation_min(-128),
+    activation_max(127)
+  {
+  }
+
+  // number of multiply-accumulates to produce the whole output
+  int64_t macs() const {
+    int64_t per_output = (int64_t)filter_shape.height * filter_shape.width;
+    if (type == LayerType::Conv2D) {
+      per_output *= filter_shape.channel;
+    }
+    return per_output * output_shape.num_elements();
+  }
+};
+
+inline
+void run_layer(
+  const ConvLayer_int8& layer,
+  const int8_t* input_values,
+  int8_t* output_values,
+  const Rect& output_rect)
+{
+  switch (layer.type) {
+  case LayerType::Conv2D:
+    Conv2D_int8_int8(
+      layer.input_shape, input_values,
+      layer.filter_shape, layer.filter_values,
+      layer.bias_values,
+      layer.output_shape, output_values,
+      layer.stride_height, layer.stride_width,
+      layer.padding_height, layer.padding_width,
+      layer.input_offset, layer.output_offset,
+      &layer.output_multiplier[0], &layer.output_shift[0],
+      layer.activation_min, layer.activation_max,
+      output_rect);
+    break;
+  case LayerType::DepthwiseConv2D:
+    DepthwiseConv2D_int8_int8(
+      layer.input_shape, input_values,
+      layer.filter_shape, layer.filter_values,
+      layer.bias_values,
+      layer.output_shape, output_values,
+      layer.stride_height, layer.stride_width,
+      layer.padding_height, layer.padding_width,
+      layer.input_offset, layer.output_offset,
+      &layer.output_multiplier[0], &layer.output_shift[0],
+      layer.activation_min, layer.activation_max,
+      output_rect);
+    break;
+  }
+}
+
+inline
+void run_layer(
+  const ConvLayer_int8& layer,
+  const int8_t* input_values,
+  int8_t* output_values)
+{
+  run_layer(layer, input_values, output_values,
+            Rect(0, 0, layer.output_shape.width, layer.output_shape.height));
+}
+
+// runs consecutive layers on `batch` images, ping-ponging the intermediate
+// activations through scratch. run(i, layer, input, output) runs layer i,
+// a copy of layers[i] with the batch set in its shapes.
+template <typename RunLayer>
+void run_layers(
+  const std::vector<ConvLayer_int8>& layers,
+  int batch,
+  const int8_t* input_values,
+  int8_t* output_values,
+  std::vector<int8_t>& scratch,
+  const RunLayer& run)
+{
+  assert(!layers.empty());
+  assert(batch >= 1);
+  size_t max_elements = 0;
+  for (size_t i=0; i+1<layers.size(); ++i) {
+    max_elements = std::max(max_elements, (size_t)layers[i].output_shape.num_elements());
+  }
+  scratch.resize(max_elements * batch * 2);
+  const int8_t* input = input_values;
+  for (size_t i=0; i<layers.size(); ++i) {
+    ConvLayer_int8 layer = layers[i];
+    layer.input_shape.number = batch;
+    layer.output_shape.number = batch;
+    int8_t* output = (i + 1 == layers.size())
+      ? output_values
+      : &scratch[(i % 2) * max_elements * batch];
+    TRACE_SCOPE_ARG("layer", i);
+    run(i, layer, input, output);
+    input = output;
+  }
+}
+
+inline
+void run_layers(
+  const std::vector<ConvLayer_int8>& layers,
+  int batch,
+  const int8_t* input_values,
+  int8_t* output_values,
+  std::vector<int8_t>& scratch)
+{
+  run_layers(layers, batch, input_values, output_values, scratch,
+             [](size_t, const ConvLayer_int8& layer, const int8_t* input, int8_t* output) {
+    run_layer(layer, input, output);
+  });
+}
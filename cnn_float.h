@@ -0,0 +1,704 @@
+#pragma once
+
+#include <assert.h>
+#include <vector>
+#include <algorithm>
+
+#if defined(__AVX512F__)
+#define CNN_AVX512
+#include <immintrin.h>
+#elif defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+#define CNN_AVX2
+#include <immintrin.h>
+#endif
+
+#include "cnn.h"
+#include "cnn_winograd.h"
+#include "thread_pool.h"
+
+// float, float16 and bfloat16 Conv2D / DepthwiseConv2D overloads of the
+// cnn.h templates, picked by overload resolution once this file is
+// included. With AVX-512 or AVX2 + FMA (-mavx512f, -mavx2 -mfma,
+// /arch:AVX2) and NHWC tensors they run FMA microkernels, otherwise the
+// templates. 16 bit values are widened to float as they are loaded (F16C,
+// a shift for bfloat16) and rounded once when stored, so the 16 bit types
+// halve the memory traffic while summing in float.
+//
+// Conv2D packs the filter into blocks of 2 vectors of output channels, each
+// holding [filter_y][filter_x][in_ch][2 * width], then accumulates 4 output
+// pixels x 2 vectors per pass over the receptive field : 8 FMAs for 2 filter
+// loads and 4 broadcasts. Padding reads come from a zero row so edge pixels
+// run the same loop. DepthwiseConv2D runs 4 pixels per weight vector load.
+// The ThreadPool overloads split the output rows over the pool like
+// run_layer_tuned, packing the filter once; pack_filter_float and the
+// PackedFilter overloads move the packing out of the call altogether. A
+// float filter can also carry a Winograd transform (cnn_winograd.h), used
+// for the 3x3 stride 1 layers.
+
+// filter and bias regrouped for conv_float_rows, output channels padded with
+// zeros up to a multiple of CONV_FLOAT_CHANNELS. The filter keeps the
+// storage type, the bias is widened. Without the microkernels only the
+// caller's arrays are kept, for the templates. winograd.m is 0 unless
+// pack_filter_winograd prepared the float filter for Conv2D_winograd.
+template <typename T>
+struct PackedFilter
+{
+  const T* filter_values;
+  const T* bias_values;
+  int blocks;
+  std::vector<T> filter;
+  std::vector<float> bias;
+  WinogradFilter<T> winograd;
+};
+
+#if defined(CNN_AVX512) || defined(CNN_AVX2)
+#define CNN_FLOAT_SIMD
+
+struct FloatVector
+{
+#ifdef CNN_AVX512
+  typedef __m512 type;
+  static const int width = 16;
+  static type zero() { return _mm512_setzero_ps(); }
+  static type load(const float* p) { return _mm512_loadu_ps(p); }
+  static type broadcast(float v) { return _mm512_set1_ps(v); }
+  static type fmadd(type a, type b, type c) { return _mm512_fmadd_ps(a, b, c); }
+  static void store(float* p, type v) { _mm512_storeu_ps(p, v); }
+
+  static type load(const float16* p) {
+    return _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)p));
+  }
+  static void store(float16* p, type v) {
+    _mm256_storeu_si256((__m256i*)p, _mm512_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+  }
+  static type load(const bfloat16* p) {
+    const __m512i x = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)p));
+    return _mm512_castsi512_ps(_mm512_slli_epi32(x, 16));
+  }
+  static void store(bfloat16* p, type v) {
+#ifdef __AVX512BF16__
+    _mm256_storeu_si256((__m256i*)p, (__m256i)_mm512_cvtneps_pbh(v));
+#else
+    // as float_to_bfloat16_bits
+    const __m512i x = _mm512_castps_si512(v);
+    const __m512i odd = _mm512_and_si512(_mm512_srli_epi32(x, 16), _mm512_set1_epi32(1));
+    __m512i r = _mm512_add_epi32(x, _mm512_add_epi32(odd, _mm512_set1_epi32(0x7fff)));
+    r = _mm512_mask_blend_epi32(_mm512_cmp_ps_mask(v, v, _CMP_UNORD_Q),
+                                r, _mm512_or_si512(x, _mm512_set1_epi32(0x400000)));
+    _mm256_storeu_si256((__m256i*)p, _mm512_cvtepi32_epi16(_mm512_srli_epi32(r, 16)));
+#endif
+  }
+#else
+  typedef __m256 type;
+  static const int width = 8;
+  static type zero() { return _mm256_setzero_ps(); }
+  static type load(const float* p) { return _mm256_loadu_ps(p); }
+  static type broadcast(float v) { return _mm256_set1_ps(v); }
+  static type fmadd(type a, type b, type c) { return _mm256_fmadd_ps(a, b, c); }
+  static void store(float* p, type v) { _mm256_storeu_ps(p, v); }
+
+  static type load(const float16* p) {
+#ifdef FLOAT16_F16C
+    return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)p));
+#else
+    float f[8];
+    for (int i=0; i<8; ++i) {
+      f[i] = half_bits_to_float(p[i].bits);
+    }
+    return _mm256_loadu_ps(f);
+#endif
+  }
+  static void store(float16* p, type v) {
+#ifdef FLOAT16_F16C
+    _mm_storeu_si128((__m128i*)p, _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+#else
+    float f[8];
+    _mm256_storeu_ps(f, v);
+    for (int i=0; i<8; ++i) {
+      p[i].bits = float_to_half_bits(f[i]);
+    }
+#endif
+  }
+  static type load(const bfloat16* p) {
+    const __m256i x = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)p));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(x, 16));
+  }
+  static void store(bfloat16* p, type v) {
+    // as float_to_bfloat16_bits
+    const __m256i x = _mm256_castps_si256(v);
+    const __m256i odd = _mm256_and_si256(_mm256_srli_epi32(x, 16), _mm256_set1_epi32(1));
+    __m256i r = _mm256_add_epi32(x, _mm256_add_epi32(odd, _mm256_set1_epi32(0x7fff)));
+    r = _mm256_blendv_epi8(r, _mm256_or_si256(x, _mm256_set1_epi32(0x400000)),
+                           _mm256_castps_si256(_mm256_cmp_ps(v, v, _CMP_UNORD_Q)));
+    r = _mm256_srli_epi32(r, 16);
+    // packus works per 128 bit lane, the permute puts the halves together
+    r = _mm256_permute4x64_epi64(_mm256_packus_epi32(r, r), 0xd8);
+    _mm_storeu_si128((__m128i*)p, _mm256_castsi256_si128(r));
+  }
+#endif
+};
+
+const int CONV_FLOAT_PIXELS = 4;
+const int CONV_FLOAT_CHANNELS = 2 * FloatVector::width;
+
+template <typename T>
+void conv_float_rows(
+  const Shape input_shape, const T* input_values,
+  const Shape filter_shape, const PackedFilter<T>& packed,
+  const Shape output_shape, T* output_values,
+  const int stride_height, const int stride_width,
+  const int padding_height, const int padding_width,
+  const Rect& output_rect)
+{
+  typedef FloatVector V;
+  const int W = V::width;
+  const int P = CONV_FLOAT_PIXELS;
+  const int input_width = input_shape.width;
+  const int input_height = input_shape.height;
+  const int input_depth = input_shape.channel;
+  const int output_depth = output_shape.channel;
+  const int filter_width = filter_shape.width;
+  const int filter_height = filter_shape.height;
+  const size_t block_size = (size_t)filter_height * filter_width * input_depth * CONV_FLOAT_CHANNELS;
+  const std::vector<T> zeros(input_depth);
+  float tail[CONV_FLOAT_PIXELS][CONV_FLOAT_CHANNELS];
+
+  for (int b=0; b<output_shape.number; ++b) {
+    const T* input = input_values + (size_t)b * input_height * input_width * input_depth;
+    for (int out_y=output_rect.y0; out_y<output_rect.y1; ++out_y) {
+      const int in_y_start = out_y * stride_height - padding_height;
+      const int filter_y0 = std::max(0, -in_y_start);
+      const int filter_y1 = std::min(filter_height, input_height - in_y_start);
+      T* out_row = &output_values[output_shape.offset(b, out_y, 0, 0)];
+      for (int block=0; block<packed.blocks; ++block) {
+        const int out_ch = block * CONV_FLOAT_CHANNELS;
+        const int n = std::min(CONV_FLOAT_CHANNELS, output_depth - out_ch);
+        const T* filter = &packed.filter[block * block_size];
+        const V::type bias0 = V::load(&packed.bias[out_ch]);
+        const V::type bias1 = V::load(&packed.bias[out_ch + W]);
+        for (int out_x=output_rect.x0; out_x<output_rect.x1; out_x+=P) {
+          // a short last group repeats its last pixel and drops the result
+          const int np = std::min(P, output_rect.x1 - out_x);
+          V::type acc0[CONV_FLOAT_PIXELS];
+          V::type acc1[CONV_FLOAT_PIXELS];
+          for (int p=0; p<P; ++p) {
+            acc0[p] = bias0;
+            acc1[p] = bias1;
+          }
+          for (int filter_y=filter_y0; filter_y<filter_y1; ++filter_y) {
+            const T* in_row = input + (size_t)(in_y_start + filter_y) * input_width * input_depth;
+            for (int filter_x=0; filter_x<filter_width; ++filter_x) {
+              const T* in[CONV_FLOAT_PIXELS];
+              for (int p=0; p<P; ++p) {
+                const int in_x = (out_x + std::min(p, np - 1)) * stride_width - padding_width + filter_x;
+                in[p] = (in_x < 0 || in_x >= input_width) ? &zeros[0] : in_row + (size_t)in_x * input_depth;
+              }
+              const T* f = filter + (size_t)(filter_y * filter_width + filter_x) * input_depth * CONV_FLOAT_CHANNELS;
+              for (int in_ch=0; in_ch<input_depth; ++in_ch) {
+                const V::type w0 = V::load(f);
+                const V::type w1 = V::load(f + W);
+                f += CONV_FLOAT_CHANNELS;
+                for (int p=0; p<P; ++p) {
+                  const V::type x = V::broadcast((float)in[p][in_ch]);
+                  acc0[p] = V::fmadd(x, w0, acc0[p]);
+                  acc1[p] = V::fmadd(x, w1, acc1[p]);
+                }
+              }
+            }
+          }
+          for (int p=0; p<np; ++p) {
+            T* out = out_row + (size_t)(out_x + p) * output_depth + out_ch;
+            if (n == CONV_FLOAT_CHANNELS) {
+              V::store(out, acc0[p]);
+              V::store(out + W, acc1[p]);
+            }else {
+              V::store(tail[p], acc0[p]);
+              V::store(tail[p] + W, acc1[p]);
+              for (int k=0; k<n; ++k) {
+                out[k] = T(tail[p][k]);
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename T>
+void depthwise_float_rows(
+  const Shape input_shape, const T* input_values,
+  const Shape weights_shape, const T* weights_values,
+  const T* bias_values,
+  const Shape output_shape, T* output_values,
+  const int stride_height, const int stride_width,
+  const int padding_height, const int padding_width,
+  const Rect& output_rect)
+{
+  typedef FloatVector V;
+  const int W = V::width;
+  const int P = CONV_FLOAT_PIXELS;
+  const int input_width = input_shape.width;
+  const int input_height = input_shape.height;
+  const int depth = input_shape.channel;
+  const int weight_width = weights_shape.width;
+  const int weight_height = weights_shape.height;
+  const int vector_depth = depth / W * W;
+  const std::vector<T> zeros(depth);
+  // input pointers of every (weight_y, weight_x, pixel), set per pixel group
+  std::vector<const T*> in((size_t)weight_height * weight_width * P);
+
+  for (int b=0; b<output_shape.number; ++b) {
+    const T* input = input_values + (size_t)b * input_height * input_width * depth;
+    for (int out_y=output_rect.y0; out_y<output_rect.y1; ++out_y) {
+      const int in_y_start = out_y * stride_height - padding_height;
+      const int weight_y0 = std::max(0, -in_y_start);
+      const int weight_y1 = std::min(weight_height, input_height - in_y_start);
+      T* out_row = &output_values[output_shape.offset(b, out_y, 0, 0)];
+      for (int out_x=output_rect.x0; out_x<output_rect.x1; out_x+=P) {
+        const int np = std::min(P, output_rect.x1 - out_x);
+        for (int weight_y=weight_y0; weight_y<weight_y1; ++weight_y) {
+          const T* in_row = input + (size_t)(in_y_start + weight_y) * input_width * depth;
+          for (int weight_x=0; weight_x<weight_width; ++weight_x) {
+            const T** dst = &in[(size_t)(weight_y * weight_width + weight_x) * P];
+            for (int p=0; p<P; ++p) {
+              const int in_x = (out_x + std::min(p, np - 1)) * stride_width - padding_width + weight_x;
+              dst[p] = (in_x < 0 || in_x >= input_width) ? &zeros[0] : in_row + (size_t)in_x * depth;
+            }
+          }
+        }
+        T* out = out_row + (size_t)out_x * depth;
+        for (int ch=0; ch<vector_depth; ch+=W) {
+          V::type acc[CONV_FLOAT_PIXELS];
+          const V::type bias = V::load(bias_values + ch);
+          for (int p=0; p<P; ++p) {
+            acc[p] = bias;
+          }
+          for (int weight_y=weight_y0; weight_y<weight_y1; ++weight_y) {
+            for (int weight_x=0; weight_x<weight_width; ++weight_x) {
+              const int k = weight_y * weight_width + weight_x;
+              const V::type w = V::load(weights_values + (size_t)k * depth + ch);
+              const T* const* src = &in[(size_t)k * P];
+              for (int p=0; p<P; ++p) {
+                acc[p] = V::fmadd(V::load(src[p] + ch), w, acc[p]);
+              }
+            }
+          }
+          for (int p=0; p<np; ++p) {
+            V::store(out + (size_t)p * depth + ch, acc[p]);
+          }
+        }
+        for (int ch=vector_depth; ch<depth; ++ch) {
+          for (int p=0; p<np; ++p) {
+            float sum = bias_values[ch];
+            for (int weight_y=weight_y0; weight_y<weight_y1; ++weight_y) {
+              for (int weight_x=0; weight_x<weight_width; ++weight_x) {
+                const int k = weight_y * weight_width + weight_x;
+                sum += (float)in[(size_t)k * P + p][ch] * (float)weights_values[(size_t)k * depth + ch];
+              }
+            }
+            out[(size_t)p * depth + ch] = T(sum);
+          }
+        }
+      }
+    }
+  }
+}
+
+#endif // CNN_FLOAT_SIMD
+
+inline
+bool conv_float_simd(const Shape& input_shape, const Shape& filter_shape, const Shape& output_shape)
+{
+#ifdef CNN_FLOAT_SIMD
+  return input_shape.layout == TensorLayout::NHWC && filter_shape.layout == TensorLayout::NHWC
+    && output_shape.layout == TensorLayout::NHWC;
+#else
+  return false;
+#endif
+}
+
+// output row bands, several per thread so uneven rows even out
+inline
+std::vector<Rect> conv_float_bands(const Shape& output_shape, int threads)
+{
+  const int height = output_shape.height;
+  const int rows = std::max(1, height / (threads * 4));
+  std::vector<Rect> bands;
+  for (int y=0; y<height; y+=rows) {
+    bands.push_back(Rect(0, y, output_shape.width, std::min(y + rows, height)));
+  }
+  return bands;
+}
+
+// packs once, so callers running the same layer again pass the result to
+// the PackedFilter overloads instead of the filter arrays
+template <typename T>
+void pack_filter_float(
+  const Shape filter_shape, const T* filter_values,
+  const T* bias_values,
+  PackedFilter<T>& packed)
+{
+  packed.filter_values = filter_values;
+  packed.bias_values = bias_values;
+  packed.blocks = 0;
+  packed.filter.clear();
+  packed.bias.clear();
+  packed.winograd.m = 0;
+  packed.winograd.values.clear();
+#ifdef CNN_FLOAT_SIMD
+  if (filter_shape.layout != TensorLayout::NHWC) {
+    return;
+  }
+  const int output_depth = filter_shape.number;
+  const int size = filter_shape.height * filter_shape.width * filter_shape.channel;
+  packed.blocks = (output_depth + CONV_FLOAT_CHANNELS - 1) / CONV_FLOAT_CHANNELS;
+  packed.filter.assign((size_t)packed.blocks * size * CONV_FLOAT_CHANNELS, T());
+  packed.bias.assign((size_t)packed.blocks * CONV_FLOAT_CHANNELS, 0.0f);
+  for (int out_ch=0; out_ch<output_depth; ++out_ch) {
+    const int block = out_ch / CONV_FLOAT_CHANNELS;
+    const int lane = out_ch % CONV_FLOAT_CHANNELS;
+    T* dst = &packed.filter[(size_t)block * size * CONV_FLOAT_CHANNELS + lane];
+    const T* src = filter_values + (size_t)out_ch * size;
+    for (int i=0; i<size; ++i) {
+      dst[(size_t)i * CONV_FLOAT_CHANNELS] = src[i];
+    }
+    packed.bias[out_ch] = bias_values[out_ch];
+  }
+#endif
+}
+
+// adds the F(m x m, 3x3) transform of a packed float filter : conv_float
+// then runs the layers it applies to through Conv2D_winograd
+inline
+void pack_filter_winograd(const Shape filter_shape, int m, PackedFilter<float>& packed)
+{
+  assert(filter_shape.height == 3 && filter_shape.width == 3);
+  winograd_transform_filter_float(filter_shape, packed.filter_values, m, packed.winograd);
+}
+
+// Winograd is float only, the 16 bit types never have a transform
+template <typename T>
+bool conv_float_winograd(
+  const Shape, const T*,
+  const Shape, const PackedFilter<T>&,
+  const Shape, T*,
+  const int, const int,
+  const int, const int,
+  const Rect&)
+{
+  return false;
+}
+
+inline
+bool conv_float_winograd(
+  const Shape input_shape, const float* input_values,
+  const Shape filter_shape, const PackedFilter<float>& packed,
+  const Shape output_shape, float* output_values,
+  const int stride_height, const int stride_width,
+  const int padding_height, const int padding_width,
+  const Rect& output_rect)
+{
+  if (packed.winograd.m == 0
+      || !winograd_applicable(filter_shape, stride_height, stride_width)
+      || input_shape.layout != TensorLayout::NHWC || output_shape.layout != TensorLayout::NHWC) {
+    return false;
+  }
+  Conv2D_winograd(
+    input_shape, input_values,
+    packed.winograd,
+    packed.bias_values,
+    output_shape, output_values,
+    padding_height, padding_width,
+    output_rect);
+  return true;
+}
+
+template <typename T>
+void conv_float(
+  const Shape input_shape, const T* input_values,
+  const Shape filter_shape, const PackedFilter<T>& packed,
+  const Shape output_shape, T* output_values,
+  const int stride_height, const int stride_width,
+  const int padding_height, const int padding_width,
+  const Rect& output_rect
+  )
+{
+  assert(input_shape.number == output_shape.number);
+  assert(output_rect.x0 >= 0 && output_rect.x1 <= output_shape.width);
+  assert(output_rect.y0 >= 0 && output_rect.y1 <= output_shape.height);
+  if (conv_float_winograd(
+        input_shape, input_values,
+        filter_shape, packed,
+        output_shape, output_values,
+        stride_height, stride_width,
+        padding_height, padding_width,
+        output_rect)) {
+    return;
+  }
+#ifdef CNN_FLOAT_SIMD
+  if (conv_float_simd(input_shape, filter_shape, output_shape)) {
+    assert(packed.blocks * CONV_FLOAT_CHANNELS >= output_shape.channel);
+    conv_float_rows(
+      input_shape, input_values,
+      filter_shape, packed,
+      output_shape, output_values,
+      stride_height, stride_width,
+      padding_height, padding_width,
+      output_rect);
+    return;
+  }
+#endif
+  Conv2D<T>(
+    input_shape, input_values,
+    filter_shape, packed.filter_values,
+    packed.bias_values,
+    output_shape, output_values,
+    stride_height, stride_width,
+    padding_height, padding_width,
+    output_rect);
+}
+
+// the pool's workers and the calling thread share the output rows
+template <typename T>
+void conv_float(
+  const Shape input_shape, const T* input_values,
+  const Shape filter_shape, const PackedFilter<T>& packed,
+  const Shape output_shape, T* output_values,
+  const int stride_height, const int stride_width,
+  const int padding_height, const int padding_width,
+  ThreadPool* pool
+  )
+{
+  const int threads = pool ? (int)pool->size() + 1 : 1;
+  const std::vector<Rect> bands = conv_float_bands(output_shape, threads);
+  parallel_for(pool, threads, (int)bands.size(), [&](int i) {
+    conv_float(
+      input_shape, input_values,
+      filter_shape, packed,
+      output_shape, output_values,
+      stride_height, stride_width,
+      padding_height, padding_width,
+      bands[i]);
+  });
+}
+
+template <typename T>
+void conv_float(
+  const Shape input_shape, const T* input_values,
+  const Shape filter_shape, const T* filter_values,
+  const T* bias_values,
+  const Shape output_shape, T* output_values,
+  const int stride_height, const int stride_width,
+  const int padding_height, const int padding_width,
+  const Rect& output_rect
+  )
+{
+  PackedFilter<T> packed;
+  pack_filter_float(filter_shape, filter_values, bias_values, packed);
+  conv_float(
+    input_shape, input_values,
+    filter_shape, packed,
+    output_shape, output_values,
+    stride_height, stride_width,
+    padding_height, padding_width,
+    output_rect);
+}
+
+template <typename T>
+void conv_float(
+  const Shape input_shape, const T* input_values,
+  const Shape filter_shape, const T* filter_values,
+  const T* bias_values,
+  const Shape output_shape, T* output_values,
+  const int stride_height, const int stride_width,
+  const int padding_height, const int padding_width,
+  ThreadPool* pool
+  )
+{
+  PackedFilter<T> packed;
+  pack_filter_float(filter_shape, filter_values, bias_values, packed);
+  conv_float(
+    input_shape, input_values,
+    filter_shape, packed,
+    output_shape, output_values,
+    stride_height, stride_width,
+    padding_height, padding_width,
+    pool);
+}
+
+template <typename T>
+void depthwise_float(
+  const Shape input_shape, const T* input_values,
+  const Shape weights_shape, const T* weights_values,
+  const T* bias_values,
+  const Shape output_shape, T* output_values,
+  const int stride_height, const int stride_width,
+  const int padding_height, const int padding_width,
+  const Rect& output_rect
+  )
+{
+  assert(output_shape.channel == input_shape.channel);
+  assert(input_shape.number == output_shape.number);
+  assert(output_rect.x0 >= 0 && output_rect.x1 <= output_shape.width);
+  assert(output_rect.y0 >= 0 && output_rect.y1 <= output_shape.height);
+#ifdef CNN_FLOAT_SIMD
+  if (conv_float_simd(input_shape, weights_shape, output_shape)) {
+    depthwise_float_rows(
+      input_shape, input_values,
+      weights_shape, weights_values,
+      bias_values,
+      output_shape, output_values,
+      stride_height, stride_width,
+      padding_height, padding_width,
+      output_rect);
+    return;
+  }
+#endif
+  DepthwiseConv2D<T>(
+    input_shape, input_values,
+    weights_shape, weights_values,
+    bias_values,
+    output_shape, output_values,
+    stride_height, stride_width,
+    padding_height, padding_width,
+    output_rect);
+}
+
+template <typename T>
+void depthwise_float(
+  const Shape input_shape, const T* input_values,
+  const Shape weights_shape, const T* weights_values,
+  const T* bias_values,
+  const Shape output_shape, T* output_values,
+  const int stride_height, const int stride_width,
+  const int padding_height, const int padding_width,
+  ThreadPool* pool
+  )
+{
+  const int threads = pool ? (int)pool->size() + 1 : 1;
+  const std::vector<Rect> bands = conv_float_bands(output_shape, threads);
+  parallel_for(pool, threads, (int)bands.size(), [&](int i) {
+    depthwise_float(
+      input_shape, input_values,
+      weights_shape, weights_values,
+      bias_values,
+      output_shape, output_values,
+      stride_height, stride_width,
+      padding_height, padding_width,
+      bands[i]);
+  });
+}
+
+// the Conv2D / DepthwiseConv2D overloads, whole output, output_rect or on a
+// pool, the same for each storage type. The PackedFilter Conv2D overloads
+// skip the packing of a filter packed beforehand.
+#define CNN_FLOAT_OVERLOADS(T) \
+  inline void Conv2D( \
+    const Shape input_shape, const T* input_values, \
+    const Shape filter_shape, const T* filter_values, \
+    const T* bias_values, \
+    const Shape output_shape, T* output_values, \
+    const int stride_height, const int stride_width, \
+    const int padding_height, const int padding_width, \
+    const Rect& output_rect) \
+  { \
+    conv_float(input_shape, input_values, filter_shape, filter_values, bias_values, \
+               output_shape, output_values, stride_height, stride_width, \
+               padding_height, padding_width, output_rect); \
+  } \
+  inline void Conv2D( \
+    const Shape input_shape, const T* input_values, \
+    const Shape filter_shape, const T* filter_values, \
+    const T* bias_values, \
+    const Shape output_shape, T* output_values, \
+    const int stride_height, const int stride_width, \
+    const int padding_height, const int padding_width) \
+  { \
+    conv_float(input_shape, input_values, filter_shape, filter_values, bias_values, \
+               output_shape, output_values, stride_height, stride_width, \
+               padding_height, padding_width, \
+               Rect(0, 0, output_shape.width, output_shape.height)); \
+  } \
+  inline void Conv2D( \
+    const Shape input_shape, const T* input_values, \
+    const Shape filter_shape, const T* filter_values, \
+    const T* bias_values, \
+    const Shape output_shape, T* output_values, \
+    const int stride_height, const int stride_width, \
+    const int padding_height, const int padding_width, \
+    ThreadPool* pool) \
+  { \
+    conv_float(input_shape, input_values, filter_shape, filter_values, bias_values, \
+               output_shape, output_values, stride_height, stride_width, \
+               padding_height, padding_width, pool); \
+  } \
+  inline void Conv2D( \
+    const Shape input_shape, const T* input_values, \
+    const Shape filter_shape, const PackedFilter<T>& filter, \
+    const Shape output_shape, T* output_values, \
+    const int stride_height, const int stride_width, \
+    const int padding_height, const int padding_width, \
+    const Rect& output_rect) \
+  { \
+    conv_float(input_shape, input_values, filter_shape, filter, \
+               output_shape, output_values, stride_height, stride_width, \
+               padding_height, padding_width, output_rect); \
+  } \
+  inline void Conv2D( \
+    const Shape input_shape, const T* input_values, \
+    const Shape filter_shape, const PackedFilter<T>& filter, \
+    const Shape output_shape, T* output_values, \
+    const int stride_height, const int stride_width, \
+    const int padding_height, const int padding_width, \
+    ThreadPool* pool) \
+  { \
+    conv_float(input_shape, input_values, filter_shape, filter, \
+               output_shape, output_values, stride_height, stride_width, \
+               padding_height, padding_width, pool); \
+  } \
+  inline void DepthwiseConv2D( \
+    const Shape input_shape, const T* input_values, \
+    const Shape weights_shape, const T* weights_values, \
+    const T* bias_values, \
+    const Shape output_shape, T* output_values, \
+    const int stride_height, const int stride_width, \
+    const int padding_height, const int padding_width, \
+    const Rect& output_rect) \
+  { \
+    depthwise_float(input_shape, input_values, weights_shape, weights_values, bias_values, \
+                    output_shape, output_values, stride_height, stride_width, \
+                    padding_height, padding_width, output_rect); \
+  } \
+  inline void DepthwiseConv2D( \
+    const Shape input_shape, const T* input_values, \
+    const Shape weights_shape, const T* weights_values, \
+    const T* bias_values, \
+    const Shape output_shape, T* output_values, \
+    const int stride_height, const int stride_width, \
+    const int padding_height, const int padding_width) \
+  { \
+    depthwise_float(input_shape, input_values, weights_shape, weights_values, bias_values, \
+                    output_shape, output_values, stride_height, stride_width, \
+                    padding_height, padding_width, \
+                    Rect(0, 0, output_shape.width, output_shape.height)); \
+  } \
+  inline void DepthwiseConv2D( \
+    const Shape input_shape, const T* input_values, \
+    const Shape weights_shape, const T* weights_values, \
+    const T* bias_values, \
+    const Shape output_shape, T* output_values, \
+    const int stride_height, const int stride_width, \
+    const int padding_height, const int padding_width, \
+    ThreadPool* pool) \
+  { \
+    depthwise_float(input_shape, input_values, weights_shape, weights_values, bias_values, \
+                    output_shape, output_values, stride_height, stride_width, \
+                    padding_height, padding_width, pool); \
+  }
+
+CNN_FLOAT_OVERLOADS(float)
+CNN_FLOAT_OVERLOADS(float16)
+CNN_FLOAT_OVERLOADS(bfloat16)
+
+#undef CNN_FLOAT_OVERLOADS
@@ -0,0 +1,380 @@
+#pragma once
+
+#include <stdint.h>
+#include <assert.h>
+#include <algorithm>
+#include <vector>
+
+#if defined(__AVX2__)
+#define CNN_INT16_AVX2
+#include <immintrin.h>
+#endif
+
+#include "cnn.h"
+
+// 16x8 quantization : int16 activations with zero point 0, int8 weights,
+// int64 bias. Products are at most 2^22, so the kernels sum in int32 lanes
+// (vpmaddwd adds pairs) and widen to int64 before a lane can overflow.
+
+// TFLite's 16x8 rescale : the multiplier is reduced to 16 bits so sums up to
+// 2^47 cannot overflow the int64 product
+inline
+int16_t requantize_int16(
+  int64_t sum,
+  const int32_t m0, const int32_t n,
+  const int32_t activation_min, const int32_t activation_max)
+{
+  assert(m0 >= 0);
+  assert(n >= 0);
+  const int64_t reduced = (m0 < 0x7fff0000) ? ((m0 + (1 << 15)) >> 16) : 0x7fff;
+  const int shift = 15 + n;
+  int64_t result = (sum * reduced + ((int64_t)1 << (shift - 1))) >> shift;
+  result = std::max(result, (int64_t)activation_min);
+  result = std::min(result, (int64_t)activation_max);
+  return (int16_t)result;
+}
+
+#ifdef CNN_INT16_AVX2
+inline
+int64_t sum_epi32(__m256i v)
+{
+  const __m256i wide = _mm256_add_epi64(_mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)),
+                                        _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+  int64_t lanes[4];
+  _mm256_storeu_si256((__m256i*)lanes, wide);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+#endif
+
+// sums[k] += sum of a[i] * b[k][i] for i in [0, n), for 4 int8 rows
+inline
+void dot4_int16_int8(const int16_t* a, const int8_t* const* b, int n, int64_t* sums)
+{
+  int i = 0;
+#ifdef CNN_INT16_AVX2
+  // a vpmaddwd lane gains at most 2^23, 255 of them stay below 2^31
+  while (i + 16 <= n) {
+    const int end = i + std::min((n - i) / 16, 255) * 16;
+    __m256i acc[4];
+    for (int k=0; k<4; ++k) {
+      acc[k] = _mm256_setzero_si256();
+    }
+    for (; i<end; i+=16) {
+      const __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+      for (int k=0; k<4; ++k) {
+        const __m256i w = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(b[k] + i)));
+        acc[k] = _mm256_add_epi32(acc[k], _mm256_madd_epi16(x, w));
+      }
+    }
+    for (int k=0; k<4; ++k) {
+      sums[k] += sum_epi32(acc[k]);
+    }
+  }
+#endif
+  for (; i<n; ++i) {
+    const int32_t x = a[i];
+    for (int k=0; k<4; ++k) {
+      sums[k] += x * b[k][i];
+    }
+  }
+}
+
+// Conv2D for 16x8 : 4 output channels per pass over the receptive field,
+// each filter row a contiguous dot product. Runs every image of the batch,
+// computing only the outputs inside output_rect. NHWC only.
+inline
+void Conv2D_int16_int8(
+  const Shape input_shape, const int16_t* input_values,
+  const Shape filter_shape, const int8_t* filter_values,
+  const int64_t* bias_values,
+  const Shape output_shape, int16_t* output_values,
+  const int stride_height, const int stride_width,
+  const int padding_height, const int padding_width,
+  const int32_t* output_multiplier, const int32_t* output_shift,
+  const int32_t activation_min, const int32_t activation_max,
+  const Rect& output_rect
+  )
+{
+  assert(input_shape.layout == TensorLayout::NHWC);
+  assert(output_shape.layout == TensorLayout::NHWC);
+  assert(filter_shape.layout == TensorLayout::NHWC);
+  assert(input_shape.number == output_shape.number);
+  assert(input_shape.channel == filter_shape.channel);
+  assert(output_rect.x0 >= 0 && output_rect.x1 <= output_shape.width);
+  assert(output_rect.y0 >= 0 && output_rect.y1 <= output_shape.height);
+
+  const int input_width = input_shape.width;
+  const int input_height = input_shape.height;
+  const int input_depth = input_shape.channel;
+  const int output_depth = output_shape.channel;
+  const int filter_width = filter_shape.width;
+  const int filter_height = filter_shape.height;
+  const int filter_size = filter_height * filter_width * input_depth;
+
+  for (int b=0; b<output_shape.number; ++b) {
+    for (int out_y=output_rect.y0; out_y<output_rect.y1; ++out_y) {
+      const int in_y_start = out_y * stride_height - padding_height;
+      const int filter_y0 = std::max(0, -in_y_start);
+      const int filter_y1 = std::min(filter_height, input_height - in_y_start);
+      for (int out_x=output_rect.x0; out_x<output_rect.x1; ++out_x) {
+        const int in_x_start = out_x * stride_width - padding_width;
+        const int filter_x0 = std::max(0, -in_x_start);
+        const int filter_x1 = std::min(filter_width, input_width - in_x_start);
+        // the padding is zero, so only the overlapping part of each row counts
+        const int row_length = (filter_x1 - filter_x0) * input_depth;
+        int16_t* out = &output_values[output_shape.offset(b, out_y, out_x, 0)];
+        for (int out_ch=0; out_ch<output_depth; out_ch+=4) {
+          // a short last block repeats its last channel and drops the result
+          const int n = std::min(4, output_depth - out_ch);
+          int64_t sums[4] = {0, 0, 0, 0};
+          for (int filter_y=filter_y0; filter_y<filter_y1; ++filter_y) {
+            const int16_t* in = &input_values[input_shape.offset(b, in_y_start + filter_y, in_x_start + filter_x0, 0)];
+            const int filter_offset = (filter_y * filter_width + filter_x0) * input_depth;
+            const int8_t* filters[4];
+            for (int k=0; k<4; ++k) {
+              filters[k] = &filter_values[(out_ch + std::min(k, n - 1)) * filter_size + filter_offset];
+            }
+            dot4_int16_int8(in, filters, row_length, sums);
+          }
+          for (int k=0; k<n; ++k) {
+            const int ch = out_ch + k;
+            out[ch] = requantize_int16(sums[k] + bias_values[ch], output_multiplier[ch], output_shift[ch],
+                                       activation_min, activation_max);
+          }
+        }
+      }
+    }
+  }
+}
+
+inline
+void Conv2D_int16_int8(
+  const Shape input_shape, const int16_t* input_values,
+  const Shape filter_shape, const int8_t* filter_values,
+  const int64_t* bias_values,
+  const Shape output_shape, int16_t* output_values,
+  const int stride_height, const int stride_width,
+  const int padding_height, const int padding_width,
+  const int32_t* output_multiplier, const int32_t* output_shift,
+  const int32_t activation_min, const int32_t activation_max
+  )
+{
+  Conv2D_int16_int8(
+    input_shape, input_values,
+    filter_shape, filter_values,
+    bias_values,
+    output_shape, output_values,
+    stride_height, stride_width,
+    padding_height, padding_width,
+    output_multiplier, output_shift,
+    activation_min, activation_max,
+    Rect(0, 0, output_shape.width, output_shape.height));
+}
+
+// DepthwiseConv2D for 16x8. With AVX2, 16 channels at a time : the inputs
+// and weights of two taps are interleaved so one vpmaddwd sums both taps of
+// a channel. Up to 511 taps fit an int32 sum. NHWC only.
+inline
+void DepthwiseConv2D_int16_int8(
+  const Shape input_shape, const int16_t* input_values,
+  const Shape weights_shape, const int8_t* weights_values,
+  const int64_t* bias_values,
+  const Shape output_shape, int16_t* output_values,
+  const int stride_height, const int stride_width,
+  const int padding_height, const int padding_width,
+  const int32_t* output_multiplier, const int32_t* output_shift,
+  const int32_t activation_min, const int32_t activation_max,
+  const Rect& output_rect
+  )
+{
+  assert(input_shape.layout == TensorLayout::NHWC);
+  assert(output_shape.layout == TensorLayout::NHWC);
+  assert(weights_shape.layout == TensorLayout::NHWC);
+  assert(output_shape.channel == input_shape.channel);
+  assert(input_shape.number == output_shape.number);
+  assert(weights_shape.height * weights_shape.width < 512);
+  assert(output_rect.x0 >= 0 && output_rect.x1 <= output_shape.width);
+  assert(output_rect.y0 >= 0 && output_rect.y1 <= output_shape.height);
+
+  const int input_width = input_shape.width;
+  const int input_height = input_shape.height;
+  const int depth = input_shape.channel;
+  const int weight_width = weights_shape.width;
+  const int weight_height = weights_shape.height;
+  // inputs and weights of the taps inside the input, per output pixel
+  std::vector<const int16_t*> in(weight_height * weight_width);
+  std::vector<const int8_t*> w(weight_height * weight_width);
+
+  for (int b=0; b<output_shape.number; ++b) {
+    for (int out_y=output_rect.y0; out_y<output_rect.y1; ++out_y) {
+      const int in_y_start = out_y * stride_height - padding_height;
+      for (int out_x=output_rect.x0; out_x<output_rect.x1; ++out_x) {
+        const int in_x_start = out_x * stride_width - padding_width;
+        int taps = 0;
+        for (int weight_y=0; weight_y<weight_height; ++weight_y) {
+          const int in_y = in_y_start + weight_y;
+          if (in_y < 0 || in_y >= input_height)
+            continue;
+          for (int weight_x=0; weight_x<weight_width; ++weight_x) {
+            const int in_x = in_x_start + weight_x;
+            if (in_x < 0 || in_x >= input_width)
+              continue;
+            in[taps] = &input_values[input_shape.offset(b, in_y, in_x, 0)];
+            w[taps] = &weights_values[weights_shape.offset(0, weight_y, weight_x, 0)];
+            ++taps;
+          }
+        }
+        int16_t* out = &output_values[output_shape.offset(b, out_y, out_x, 0)];
+        int ch = 0;
+#ifdef CNN_INT16_AVX2
+        for (; ch+16<=depth; ch+=16) {
+          __m256i acc_lo = _mm256_setzero_si256();
+          __m256i acc_hi = _mm256_setzero_si256();
+          for (int k=0; k<taps; k+=2) {
+            const __m256i x0 = _mm256_loadu_si256((const __m256i*)(in[k] + ch));
+            const __m256i w0 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(w[k] + ch)));
+            __m256i x1 = _mm256_setzero_si256();
+            __m256i w1 = _mm256_setzero_si256();
+            if (k + 1 < taps) {
+              x1 = _mm256_loadu_si256((const __m256i*)(in[k + 1] + ch));
+              w1 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(w[k + 1] + ch)));
+            }
+            acc_lo = _mm256_add_epi32(acc_lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(x0, x1),
+                                                                _mm256_unpacklo_epi16(w0, w1)));
+            acc_hi = _mm256_add_epi32(acc_hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(x0, x1),
+                                                                _mm256_unpackhi_epi16(w0, w1)));
+          }
+          // unpack works per 128 bit lane : lo holds channels 0-3, 8-11, hi 4-7, 12-15
+          int32_t sums[16];
+          _mm256_storeu_si256((__m256i*)sums, _mm256_permute2x128_si256(acc_lo, acc_hi, 0x20));
+          _mm256_storeu_si256((__m256i*)(sums + 8), _mm256_permute2x128_si256(acc_lo, acc_hi, 0x31));
+          for (int i=0; i<16; ++i) {
+            const int c = ch + i;
+            out[c] = requantize_int16(sums[i] + bias_values[c], output_multiplier[c], output_shift[c],
+                                      activation_min, activation_max);
+          }
+        }
+#endif
+        for (; ch<depth; ++ch) {
+          int32_t sum = 0;
+          for (int k=0; k<taps; ++k) {
+            sum += in[k][ch] * w[k][ch];
+          }
+          out[ch] = requantize_int16(sum + bias_values[ch], output_multiplier[ch], output_shift[ch],
+                                     activation_min, activation_max);
+        }
+      }
+    }
+  }
+}
+
+inline
+void DepthwiseConv2D_int16_int8(
+  const Shape input_shape, const int16_t* input_values,
+  const Shape weights_shape, const int8_t* weights_values,
+  const int64_t* bias_values,
+  const Shape output_shape, int16_t* output_values,
+  const int stride_height, const int stride_width,
+  const int padding_height, const int padding_width,
+  const int32_t* output_multiplier, const int32_t* output_shift,
+  const int32_t activation_min, const int32_t activation_max
+  )
+{
+  DepthwiseConv2D_int16_int8(
+    input_shape, input_values,
+    weights_shape, weights_values,
+    bias_values,
+    output_shape, output_values,
+    stride_height, stride_width,
+    padding_height, padding_width,
+    output_multiplier, output_shift,
+    activation_min, activation_max,
+    Rect(0, 0, output_shape.width, output_shape.height));
+}
+
+// parameters of a 16x8 Conv2D / DepthwiseConv2D node
+struct ConvLayer_int16
+{
+  LayerType type;
+  Shape input_shape;
+  Shape filter_shape;
+  Shape output_shape;
+  const int8_t* filter_values;
+  const int64_t* bias_values;
+  int stride_height;
+  int stride_width;
+  int padding_height;
+  int padding_width;
+  std::vector<int32_t> output_multiplier;
+  std::vector<int32_t> output_shift;
+  int32_t activation_min;
+  int32_t activation_max;
+
+  ConvLayer_int16()
+    :
+    type(LayerType::Conv2D),
+    filter_values(nullptr),
+    bias_values(nullptr),
+    stride_height(1),
+    stride_width(1),
+    padding_height(0),
+    padding_width(0),
+    activation_min(-32768),
+    activation_max(32767)
+  {
+  }
+
+  // number of multiply-accumulates to produce the whole output
+  int64_t macs() const {
+    int64_t per_output = (int64_t)filter_shape.height * filter_shape.width;
+    if (type == LayerType::Conv2D) {
+      per_output *= filter_shape.channel;
+    }
+    return per_output * output_shape.num_elements();
+  }
+};
+
+inline
+void run_layer(
+  const ConvLayer_int16& layer,
+  const int16_t* input_values,
+  int16_t* output_values,
+  const Rect& output_rect)
+{
+  switch (layer.type) {
+  case LayerType::Conv2D:
+    Conv2D_int16_int8(
+      layer.input_shape, input_values,
+      layer.filter_shape, layer.filter_values,
+      layer.bias_values,
+      layer.output_shape, output_values,
+      layer.stride_height, layer.stride_width,
+      layer.padding_height, layer.padding_width,
+      &layer.output_multiplier[0], &layer.output_shift[0],
+      layer.activation_min, layer.activation_max,
+      output_rect);
+    break;
+  case LayerType::DepthwiseConv2D:
+    DepthwiseConv2D_int16_int8(
+      layer.input_shape, input_values,
+      layer.filter_shape, layer.filter_values,
+      layer.bias_values,
+      layer.output_shape, output_values,
+      layer.stride_height, layer.stride_width,
+      layer.padding_height, layer.padding_width,
+      &layer.output_multiplier[0], &layer.output_shift[0],
+      layer.activation_min, layer.activation_max,
+      output_rect);
+    break;
+  }
+}
+
+inline
+void run_layer(
+  const ConvLayer_int16& layer,
+  const int16_t* input_values,
+  int16_t* output_values)
+{
+  run_layer(layer, input_values, output_values,
+            Rect(0, 0, layer.output_shape.width, layer.output_shape.height));
+}
@@ -0,0 +1,278 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <vector>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#define CNN_INT4_AVX2
+#include <immintrin.h>
+#endif
+
+#include "cnn.h"
+#include "conv_plan.h"
+
+// Conv2D weights as signed 4 bit values, two per byte, for layers whose
+// filter reads dominate (1x1 layers at batch 1). Each output channel gets its
+// own scale : int8 weight ~ int4 weight * scale, which is folded into the
+// bias and the requantization so the kernels see plain integers.
+//
+// A row of 32 values takes 16 bytes, byte j holding value j in its low
+// nibble and value j + 16 in its high one, so one 16 byte load unpacks to
+// two runs of 16 consecutive values. Rows are padded to whole blocks.
+struct Int4Filter
+{
+  int out_depth;
+  int depth;            // filter height * width * input channels
+  int row_bytes;
+  std::vector<uint8_t> values;
+  std::vector<float> scales;
+  std::vector<int32_t> bias;              // bias / scale + input_offset * sum of the row
+  std::vector<int32_t> output_multiplier; // the layer's multiplied by scale
+  std::vector<int32_t> output_shift;
+
+  Int4Filter()
+    :
+    out_depth(0),
+    depth(0),
+    row_bytes(0)
+  {
+  }
+
+  const uint8_t* row(int n) const {
+    return &values[(size_t)n * row_bytes];
+  }
+};
+
+inline
+int int4_value(const uint8_t* row, int k)
+{
+  const uint8_t byte = row[(k >> 5) * 16 + (k & 15)];
+  const int nibble = (k & 16) ? (byte >> 4) : (byte & 15);
+  return (nibble ^ 8) - 8;
+}
+
+// Packs the layer's filter. Rows whose weights all fit in [-8, 7] are kept
+// as they are (scale 1), others are divided by max |weight| / 7 and rounded.
+// The scaled requantization multiplier must stay below 1 for requantize, so
+// the scale is clamped to just under 1 / multiplier (never below 1) and the
+// largest weights of such a row saturate instead.
+inline
+void pack_filter_int4(const ConvLayer_int8& layer, Int4Filter& filter)
+{
+  assert(layer.type == LayerType::Conv2D);
+  const Shape& f = layer.filter_shape;
+  filter.out_depth = f.number;
+  filter.depth = f.height * f.width * f.channel;
+  filter.row_bytes = (filter.depth + 31) / 32 * 16;
+  filter.values.assign((size_t)filter.out_depth * filter.row_bytes, 0);
+  filter.scales.resize(filter.out_depth);
+  filter.bias.resize(filter.out_depth);
+  filter.output_multiplier.resize(filter.out_depth);
+  filter.output_shift.resize(filter.out_depth);
+  for (int n=0; n<filter.out_depth; ++n) {
+    const int8_t* w = &layer.filter_values[(size_t)n * filter.depth];
+    int max_abs = 0;
+    bool fits = true;
+    for (int k=0; k<filter.depth; ++k) {
+      max_abs = std::max(max_abs, std::abs((int)w[k]));
+      fits = fits && w[k] >= -8 && w[k] <= 7;
+    }
+    const double multiplier = ldexp((double)layer.output_multiplier[n], -31 - layer.output_shift[n]);
+    assert(multiplier < 1.0);
+    const float max_scale = std::max(1.0f, (float)((1.0 - 1.0 / (1 << 20)) / multiplier));
+    const float scale = fits ? 1.0f : std::min(max_abs / 7.0f, max_scale);
+    filter.scales[n] = scale;
+    uint8_t* row = &filter.values[(size_t)n * filter.row_bytes];
+    int32_t sum = 0;
+    for (int k=0; k<filter.depth; ++k) {
+      int q = (int)lrintf(w[k] / scale);
+      q = std::max(-8, std::min(7, q));
+      sum += q;
+      const int shift = (k & 16) ? 4 : 0;
+      row[(k >> 5) * 16 + (k & 15)] |= (uint8_t)((q & 15) << shift);
+    }
+    filter.bias[n] = (int32_t)lrint(layer.bias_values[n] / (double)scale) + layer.input_offset * sum;
+    // m0 * 2^-(31 + n) * scale, as a new m0 and n
+    int exponent;
+    const double m = frexp(multiplier * scale, &exponent);
+    int64_t m0 = llrint(m * (1LL << 31));
+    if (m0 == (1LL << 31)) {
+      m0 = 1 << 30;
+      ++exponent;
+    }
+    assert(exponent <= 0);
+    filter.output_multiplier[n] = (int32_t)m0;
+    filter.output_shift[n] = -exponent;
+  }
+}
+
+#ifdef CNN_INT4_AVX2
+// the 32 values of a block as 16 bit lanes : values 0-15 and 16-31
+inline
+void unpack_int4_block(const uint8_t* block, __m256i& lo, __m256i& hi)
+{
+  const __m128i mask = _mm_set1_epi8(15);
+  const __m128i eight = _mm_set1_epi8(8);
+  const __m128i packed = _mm_loadu_si128((const __m128i*)block);
+  // (x ^ 8) - 8 sign extends a nibble
+  const __m128i l = _mm_sub_epi8(_mm_xor_si128(_mm_and_si128(packed, mask), eight), eight);
+  const __m128i h = _mm_sub_epi8(_mm_xor_si128(_mm_and_si128(_mm_srli_epi16(packed, 4), mask), eight), eight);
+  lo = _mm256_cvtepi8_epi16(l);
+  hi = _mm256_cvtepi8_epi16(h);
+}
+
+inline
+int32_t horizontal_sum_epi32(__m256i v)
+{
+  __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(s);
+}
+
+// acc[r][j] += x[r] . the block of 32 weights at k of f[j]
+inline
+void dot_int4_block(const int8_t* const* x, int rows, const uint8_t* const* f, int k, __m256i acc[2][4])
+{
+  __m256i x_lo[2];
+  __m256i x_hi[2];
+  for (int r=0; r<rows; ++r) {
+    x_lo[r] = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)x[r]));
+    x_hi[r] = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(x[r] + 16)));
+  }
+  for (int j=0; j<4; ++j) {
+    __m256i w_lo, w_hi;
+    unpack_int4_block(f[j] + k / 2, w_lo, w_hi);
+    for (int r=0; r<rows; ++r) {
+      acc[r][j] = _mm256_add_epi32(acc[r][j], _mm256_add_epi32(_mm256_madd_epi16(x_lo[r], w_lo),
+                                                               _mm256_madd_epi16(x_hi[r], w_hi)));
+    }
+  }
+}
+#endif
+
+// sums[r][j] = a[r] . filter row f[j] for rows rows (1 or 2) of a and 4
+// filter rows. Each block of weights is unpacked once for all rows.
+inline
+void dot_int4(const int8_t* const* a, int rows, const uint8_t* const* f, int depth, int32_t sums[2][4])
+{
+  for (int r=0; r<2; ++r) {
+    for (int j=0; j<4; ++j) {
+      sums[r][j] = 0;
+    }
+  }
+  int k = 0;
+#ifdef CNN_INT4_AVX2
+  __m256i acc[2][4];
+  for (int r=0; r<2; ++r) {
+    for (int j=0; j<4; ++j) {
+      acc[r][j] = _mm256_setzero_si256();
+    }
+  }
+  const int8_t* x[2];
+  for (; k+32<=depth; k+=32) {
+    for (int r=0; r<rows; ++r) {
+      x[r] = a[r] + k;
+    }
+    dot_int4_block(x, rows, f, k, acc);
+  }
+  if (k < depth) {
+    // the last, partial block : the weights past depth are packed as zeros,
+    // the activations go through a zero padded copy so no load runs past a
+    int8_t tail[2][32] = {};
+    for (int r=0; r<rows; ++r) {
+      memcpy(tail[r], a[r] + k, depth - k);
+      x[r] = tail[r];
+    }
+    dot_int4_block(x, rows, f, k, acc);
+    k = depth;
+  }
+  for (int r=0; r<rows; ++r) {
+    for (int j=0; j<4; ++j) {
+      sums[r][j] = horizontal_sum_epi32(acc[r][j]);
+    }
+  }
+#endif
+  for (; k<depth; ++k) {
+    for (int j=0; j<4; ++j) {
+      const int w = int4_value(f[j], k);
+      for (int r=0; r<rows; ++r) {
+        sums[r][j] += a[r][k] * w;
+      }
+    }
+  }
+}
+
+// out[m][n] = requantize(a[m] . filter[n] + bias[n]) for rows rows of a,
+// the int4 counterpart of gemm_int8_requantize
+inline
+void gemm_int4_requantize(
+  const ConvLayer_int8& layer,
+  const Int4Filter& filter,
+  const int8_t* a, int rows,
+  int8_t* out)
+{
+  const int out_depth = filter.out_depth;
+  const int depth = filter.depth;
+  // blocks of filter rows as in gemm_int8_requantize, sized by the packed rows
+  const int block = std::max(4, (64 * 1024) / std::max(filter.row_bytes, 1));
+  for (int n0=0; n0<out_depth; n0+=block) {
+    const int n1 = std::min(out_depth, n0 + block);
+    for (int m=0; m<rows; m+=2) {
+      const int8_t* am[2] = {&a[(size_t)m * depth], &a[(size_t)std::min(m + 1, rows - 1) * depth]};
+      const int nrows = std::min(2, rows - m);
+      for (int n=n0; n<n1; n+=4) {
+        // a short last block repeats its last row and drops the result
+        const int nf = std::min(4, n1 - n);
+        const uint8_t* f[4];
+        for (int j=0; j<4; ++j) {
+          f[j] = filter.row(n + std::min(j, nf - 1));
+        }
+        int32_t sums[2][4];
+        dot_int4(am, nrows, f, depth, sums);
+        for (int r=0; r<nrows; ++r) {
+          int8_t* om = &out[(size_t)(m + r) * out_depth];
+          for (int j=0; j<nf; ++j) {
+            om[n + j] = requantize(sums[r][j] + filter.bias[n + j],
+                                   filter.output_multiplier[n + j], filter.output_shift[n + j],
+                                   layer.output_offset, layer.activation_min, layer.activation_max);
+          }
+        }
+      }
+    }
+  }
+}
+
+// Conv2D with the packed filter : a GEMM straight on the input for 1x1
+// stride 1 layers, on the patches of an output row otherwise
+inline
+void Conv2D_int4(const ConvLayer_int8& layer, const Int4Filter& filter, const int8_t* input_values, int8_t* output_values)
+{
+  assert(layer.type == LayerType::Conv2D);
+  assert(layer.input_shape.layout == TensorLayout::NHWC);
+  assert(filter.out_depth == layer.output_shape.channel);
+  const Shape& in = layer.input_shape;
+  const Shape& out = layer.output_shape;
+  const int fh = layer.filter_shape.height;
+  const int fw = layer.filter_shape.width;
+  if (fh == 1 && fw == 1 && layer.stride_height == 1 && layer.stride_width == 1
+    && layer.padding_height == 0 && layer.padding_width == 0) {
+    for (int b=0; b<out.number; ++b) {
+      gemm_int4_requantize(layer, filter, &input_values[in.offset(b, 0, 0, 0)], out.height * out.width,
+                           &output_values[out.offset(b, 0, 0, 0)]);
+    }
+    return;
+  }
+  std::vector<int8_t> patches((size_t)out.width * filter.depth);
+  for (int b=0; b<out.number; ++b) {
+    for (int out_y=0; out_y<out.height; ++out_y) {
+      im2col_row(layer, input_values, b, out_y, &patches[0]);
+      gemm_int4_requantize(layer, filter, &patches[0], out.width, &output_values[out.offset(b, out_y, 0, 0)]);
+    }
+  }
+}
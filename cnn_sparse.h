@@ -0,0 +1,311 @@
+#pragma once
+
+#include <stdint.h>
+#include <assert.h>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#define CNN_SPARSE_AVX2
+#include <immintrin.h>
+#endif
+
+#include "cnn.h"
+
+// Block sparse Conv2D filters : each output channel keeps only the blocks
+// of 4 or 16 consecutive input channels (1x4 / 1x16 blocks, as in TFLite's
+// sparsity format) that hold a nonzero weight, so the kernels' work scales
+// with the weights left after pruning. Blocks never cross a filter tap; the
+// last block of a tap is zero padded when the depth is not a multiple.
+struct BlockSparseFilter
+{
+  int out_depth;
+  int taps;             // filter height * width
+  int input_depth;
+  int block;
+  std::vector<int32_t> row_start;      // blocks of channel n : [row_start[n], row_start[n + 1])
+  std::vector<int32_t> block_tap;      // filter_y * filter_width + filter_x
+  std::vector<int32_t> block_channel;  // first input channel
+  std::vector<int8_t> values;          // block values, block after block
+
+  BlockSparseFilter()
+    :
+    out_depth(0),
+    taps(0),
+    input_depth(0),
+    block(0)
+  {
+  }
+
+  int num_blocks() const {
+    return row_start.empty() ? 0 : row_start.back();
+  }
+
+  // fraction of the dense filter's blocks kept
+  double density() const {
+    const int blocks_per_tap = (input_depth + block - 1) / block;
+    return num_blocks() / (double)((int64_t)out_depth * taps * blocks_per_tap);
+  }
+};
+
+// the nonzero blocks of a dense OHWI filter
+inline
+void make_block_sparse_filter(
+  const Shape& filter_shape, const int8_t* filter_values,
+  int block,
+  BlockSparseFilter& filter)
+{
+  assert(block > 0);
+  filter.out_depth = filter_shape.number;
+  filter.taps = filter_shape.height * filter_shape.width;
+  filter.input_depth = filter_shape.channel;
+  filter.block = block;
+  filter.row_start.assign(1, 0);
+  filter.block_tap.clear();
+  filter.block_channel.clear();
+  filter.values.clear();
+  const int depth = filter.input_depth;
+  for (int n=0; n<filter.out_depth; ++n) {
+    for (int tap=0; tap<filter.taps; ++tap) {
+      const int8_t* w = &filter_values[((size_t)n * filter.taps + tap) * depth];
+      for (int c0=0; c0<depth; c0+=block) {
+        const int len = std::min(block, depth - c0);
+        bool zero = true;
+        for (int i=0; i<len; ++i) {
+          zero = zero && w[c0 + i] == 0;
+        }
+        if (zero)
+          continue;
+        filter.block_tap.push_back(tap);
+        filter.block_channel.push_back(c0);
+        filter.values.insert(filter.values.end(), w + c0, w + c0 + len);
+        filter.values.resize(filter.values.size() + block - len, 0);
+      }
+    }
+    filter.row_start.push_back((int32_t)filter.block_tap.size());
+  }
+}
+
+// zeroes each block of `block` consecutive input channels of a dense
+// filter of depth input channels with probability sparsity, the way block
+// pruning leaves a model
+inline
+void prune_blocks(
+  std::vector<int8_t>& filter,
+  int depth, int block, double sparsity,
+  std::mt19937& rng)
+{
+  assert(depth > 0 && block > 0);
+  std::bernoulli_distribution pruned(sparsity);
+  for (size_t row=0; row<filter.size()/depth; ++row) {
+    for (int c0=0; c0<depth; c0+=block) {
+      if (pruned(rng)) {
+        const int len = std::min(block, depth - c0);
+        std::fill(&filter[row * depth + c0], &filter[row * depth + c0] + len, (int8_t)0);
+      }
+    }
+  }
+}
+
+#ifdef CNN_SPARSE_AVX2
+inline
+int32_t sparse_sum_epi32(__m256i v)
+{
+  __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(s);
+}
+#endif
+
+// Conv2D_int8_int8 on a block sparse filter, same parameters otherwise.
+// Output pixels go 4 at a time so every block is read once for them; a
+// tap outside the input reads a row of -input_offset, which adds nothing.
+// Runs every image of the batch, computing only the outputs inside
+// output_rect. NHWC only.
+inline
+void Conv2D_int8_int8(
+  const Shape input_shape, const int8_t* input_values,
+  const Shape filter_shape, const BlockSparseFilter& filter,
+  const int32_t* bias_values,
+  const Shape output_shape, int8_t* output_values,
+  const int stride_height, const int stride_width,
+  const int padding_height, const int padding_width,
+  const int32_t input_offset, const int32_t output_offset,
+  const int32_t* output_multiplier, const int32_t* output_shift,
+  const int32_t activation_min, const int32_t activation_max,
+  const Rect& output_rect
+  )
+{
+  assert(input_shape.layout == TensorLayout::NHWC);
+  assert(output_shape.layout == TensorLayout::NHWC);
+  assert(input_shape.number == output_shape.number);
+  assert(filter.out_depth == output_shape.channel);
+  assert(filter.input_depth == input_shape.channel);
+  assert(filter.taps == filter_shape.height * filter_shape.width);
+  assert(input_offset >= -127 && input_offset <= 128);
+  assert(output_rect.x0 >= 0 && output_rect.x1 <= output_shape.width);
+  assert(output_rect.y0 >= 0 && output_rect.y1 <= output_shape.height);
+
+  const int input_width = input_shape.width;
+  const int input_height = input_shape.height;
+  const int depth = input_shape.channel;
+  const int output_depth = output_shape.channel;
+  const int filter_width = filter_shape.width;
+  const int filter_height = filter_shape.height;
+  const int block = filter.block;
+  const std::vector<int8_t> pad(depth, (int8_t)(-input_offset));
+  // input pixel of every tap, for 4 output pixels
+  std::vector<const int8_t*> tap_input(4 * filter.taps);
+
+  for (int b=0; b<output_shape.number; ++b) {
+    for (int out_y=output_rect.y0; out_y<output_rect.y1; ++out_y) {
+      const int in_y_start = out_y * stride_height - padding_height;
+      for (int out_x=output_rect.x0; out_x<output_rect.x1; out_x+=4) {
+        // a short last group repeats its last pixel and drops the result
+        const int pixels = std::min(4, output_rect.x1 - out_x);
+        for (int p=0; p<4; ++p) {
+          const int in_x_start = (out_x + std::min(p, pixels - 1)) * stride_width - padding_width;
+          for (int fy=0; fy<filter_height; ++fy) {
+            const int in_y = in_y_start + fy;
+            for (int fx=0; fx<filter_width; ++fx) {
+              const int in_x = in_x_start + fx;
+              const bool inside = in_y >= 0 && in_y < input_height && in_x >= 0 && in_x < input_width;
+              tap_input[p * filter.taps + fy * filter_width + fx] =
+                inside ? &input_values[input_shape.offset(b, in_y, in_x, 0)] : &pad[0];
+            }
+          }
+        }
+        const int8_t* const* taps[4];
+        for (int p=0; p<4; ++p) {
+          taps[p] = &tap_input[p * filter.taps];
+        }
+        for (int out_ch=0; out_ch<output_depth; ++out_ch) {
+          int32_t sums[4] = {0, 0, 0, 0};
+#ifdef CNN_SPARSE_AVX2
+          __m256i acc[4];
+          for (int p=0; p<4; ++p) {
+            acc[p] = _mm256_setzero_si256();
+          }
+          const __m256i offset = _mm256_set1_epi16((int16_t)input_offset);
+#endif
+          for (int i=filter.row_start[out_ch]; i<filter.row_start[out_ch + 1]; ++i) {
+            const int tap = filter.block_tap[i];
+            const int c0 = filter.block_channel[i];
+            const int len = std::min(block, depth - c0);
+            const int8_t* w = &filter.values[(size_t)i * block];
+#ifdef CNN_SPARSE_AVX2
+            if (len == 16) {
+              const __m256i w16 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)w));
+              for (int p=0; p<4; ++p) {
+                const __m256i x = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(taps[p][tap] + c0)));
+                acc[p] = _mm256_add_epi32(acc[p], _mm256_madd_epi16(_mm256_add_epi16(x, offset), w16));
+              }
+              continue;
+            }
+#endif
+            for (int p=0; p<4; ++p) {
+              const int8_t* x = taps[p][tap] + c0;
+              for (int j=0; j<len; ++j) {
+                sums[p] += (x[j] + input_offset) * w[j];
+              }
+            }
+          }
+#ifdef CNN_SPARSE_AVX2
+          for (int p=0; p<4; ++p) {
+            sums[p] += sparse_sum_epi32(acc[p]);
+          }
+#endif
+          for (int p=0; p<pixels; ++p) {
+            output_values[output_shape.offset(b, out_y, out_x + p, out_ch)] =
+              requantize(sums[p] + bias_values[out_ch], output_multiplier[out_ch], output_shift[out_ch],
+                         output_offset, activation_min, activation_max);
+          }
+        }
+      }
+    }
+  }
+}
+
+inline
+void Conv2D_int8_int8(
+  const Shape input_shape, const int8_t* input_values,
+  const Shape filter_shape, const BlockSparseFilter& filter,
+  const int32_t* bias_values,
+  const Shape output_shape, int8_t* output_values,
+  const int stride_height, const int stride_width,
+  const int padding_height, const int padding_width,
+  const int32_t input_offset, const int32_t output_offset,
+  const int32_t* output_multiplier, const int32_t* output_shift,
+  const int32_t activation_min, const int32_t activation_max
+  )
+{
+  Conv2D_int8_int8(
+    input_shape, input_values,
+    filter_shape, filter,
+    bias_values,
+    output_shape, output_values,
+    stride_height, stride_width,
+    padding_height, padding_width,
+    input_offset, output_offset,
+    output_multiplier, output_shift,
+    activation_min, activation_max,
+    Rect(0, 0, output_shape.width, output_shape.height));
+}
+
+// run_layer with the layer's filter replaced by its sparse form
+inline
+void run_layer(
+  const ConvLayer_int8& layer,
+  const BlockSparseFilter& filter,
+  const int8_t* input_values,
+  int8_t* output_values,
+  const Rect& output_rect)
+{
+  assert(layer.type == LayerType::Conv2D);
+  Conv2D_int8_int8(
+    layer.input_shape, input_values,
+    layer.filter_shape, filter,
+    layer.bias_values,
+    layer.output_shape, output_values,
+    layer.stride_height, layer.stride_width,
+    layer.padding_height, layer.padding_width,
+    layer.input_offset, layer.output_offset,
+    &layer.output_multiplier[0], &layer.output_shift[0],
+    layer.activation_min, layer.activation_max,
+    output_rect);
+}
+
+inline
+void run_layer(
+  const ConvLayer_int8& layer,
+  const BlockSparseFilter& filter,
+  const int8_t* input_values,
+  int8_t* output_values)
+{
+  run_layer(layer, filter, input_values, output_values,
+            Rect(0, 0, layer.output_shape.width, layer.output_shape.height));
+}
+
+// run_layers with every layer that has a sparse filter (out_depth > 0, as
+// load_conv_chain leaves them) run on it, the others dense
+inline
+void run_layers(
+  const std::vector<ConvLayer_int8>& layers,
+  const std::vector<BlockSparseFilter>& sparse_filters,
+  int batch,
+  const int8_t* input_values,
+  int8_t* output_values,
+  std::vector<int8_t>& scratch)
+{
+  assert(sparse_filters.size() == layers.size());
+  run_layers(layers, batch, input_values, output_values, scratch,
+             [&](size_t i, const ConvLayer_int8& layer, const int8_t* input, int8_t* output) {
+    if (sparse_filters[i].out_depth > 0) {
+      run_layer(layer, sparse_filters[i], input, output);
+    }else {
+      run_layer(layer, input, output);
+    }
+  });
+}
@@ -0,0 +1,330 @@
+#pragma once
+
+#include <assert.h>
+#include <type_traits>
+#include <vector>
+#include <algorithm>
+
+#include "cnn.h"
+
+// Winograd F(m x m, 3x3) for the floating point Conv2D template, 3x3 stride
+// 1 only. Every (m+2)x(m+2) input tile becomes an element-wise product of
+// transformed tiles, one GEMM per element over the channels :
+// F(2x2, 3x3) uses 16 multiplies per 4 outputs instead of 36 (2.25x),
+// F(4x4, 3x3) 36 per 16 instead of 144 (4x), with larger rounding errors.
+
+// transform matrices, row major, in double so 1/6 is exact enough for
+// T = double as well
+struct WinogradMatrices
+{
+  int m;              // output tile size
+  int a;              // input tile size, m + 2
+  const double* BT;   // a x a, input transform
+  const double* G;    // a x 3, filter transform
+  const double* AT;   // m x a, output transform
+};
+
+inline
+WinogradMatrices winograd_matrices(int m)
+{
+  static const double BT2[] = {
+    1,  0, -1,  0,
+    0,  1,  1,  0,
+    0, -1,  1,  0,
+    0,  1,  0, -1,
+  };
+  static const double G2[] = {
+    1.0,  0.0, 0.0,
+    0.5,  0.5, 0.5,
+    0.5, -0.5, 0.5,
+    0.0,  0.0, 1.0,
+  };
+  static const double AT2[] = {
+    1,  1,  1,  0,
+    0,  1, -1, -1,
+  };
+  static const double BT4[] = {
+    4,  0, -5,  0, 1, 0,
+    0, -4, -4,  1, 1, 0,
+    0,  4, -4, -1, 1, 0,
+    0, -2, -1,  2, 1, 0,
+    0,  2, -1, -2, 1, 0,
+    0,  4,  0, -5, 0, 1,
+  };
+  static const double G4[] = {
+     1.0 / 4,        0.0,       0.0,
+    -1.0 / 6,  -1.0 / 6, -1.0 / 6,
+    -1.0 / 6,   1.0 / 6, -1.0 / 6,
+     1.0 / 24,  1.0 / 12, 1.0 / 6,
+     1.0 / 24, -1.0 / 12, 1.0 / 6,
+          0.0,       0.0,      1.0,
+  };
+  static const double AT4[] = {
+    1, 1,  1, 1,  1, 0,
+    0, 1, -1, 2, -2, 0,
+    0, 1,  1, 4,  4, 0,
+    0, 1, -1, 8, -8, 1,
+  };
+  assert(m == 2 || m == 4);
+  WinogradMatrices w;
+  w.m = m;
+  w.a = m + 2;
+  w.BT = (m == 2) ? BT2 : BT4;
+  w.G = (m == 2) ? G2 : G4;
+  w.AT = (m == 2) ? AT2 : AT4;
+  return w;
+}
+
+inline
+bool winograd_applicable(const Shape& filter_shape, int stride_height, int stride_width)
+{
+  return filter_shape.height == 3 && filter_shape.width == 3
+    && stride_height == 1 && stride_width == 1
+    && filter_shape.layout == TensorLayout::NHWC;
+}
+
+// filter transformed once at prepare time, G g G^T per (in, out) channel pair
+template <typename T>
+struct WinogradFilter
+{
+  int m;
+  int input_depth;
+  int output_depth;
+  std::vector<T> values;  // a*a x input_depth x output_depth
+};
+
+template <typename T>
+void winograd_transform_filter_float(
+  const Shape filter_shape, const T* filter_values,
+  int m,
+  WinogradFilter<T>& filter)
+{
+  static_assert(std::is_floating_point<T>::value, "Winograd needs a floating point type");
+  assert(filter_shape.height == 3 && filter_shape.width == 3);
+  const WinogradMatrices w = winograd_matrices(m);
+  const int a = w.a;
+  const int input_depth = filter_shape.channel;
+  const int output_depth = filter_shape.number;
+  filter.m = m;
+  filter.input_depth = input_depth;
+  filter.output_depth = output_depth;
+  filter.values.assign((size_t)a * a * input_depth * output_depth, T(0));
+  for (int oc=0; oc<output_depth; ++oc) {
+    for (int ic=0; ic<input_depth; ++ic) {
+      T g[3][3];
+      for (int y=0; y<3; ++y) {
+        for (int x=0; x<3; ++x) {
+          g[y][x] = filter_values[filter_shape.offset(oc, y, x, ic)];
+        }
+      }
+      // Gg : a x 3
+      double gg[8][3];
+      for (int i=0; i<a; ++i) {
+        for (int x=0; x<3; ++x) {
+          gg[i][x] = w.G[i * 3 + 0] * g[0][x] + w.G[i * 3 + 1] * g[1][x] + w.G[i * 3 + 2] * g[2][x];
+        }
+      }
+      for (int i=0; i<a; ++i) {
+        for (int j=0; j<a; ++j) {
+          const T u = (T)(gg[i][0] * w.G[j * 3 + 0] + gg[i][1] * w.G[j * 3 + 1] + gg[i][2] * w.G[j * 3 + 2]);
+          filter.values[((size_t)(i * a + j) * input_depth + ic) * output_depth + oc] = u;
+        }
+      }
+    }
+  }
+}
+
+// Conv2D of a 3x3 stride 1 filter through a prepared WinogradFilter, same
+// arguments and results as Conv2D apart from rounding. NHWC only.
+// Tiles are processed tiles_per_block at a time : the tile transforms run
+// over the channels of a tile at once, then each of the a*a elements is one
+// (tiles x input_depth) * (input_depth x output_depth) GEMM. The tiles start
+// at the corner of output_rect and nothing outside it is written, so bands
+// of rows can run on different threads.
+template <typename T>
+void Conv2D_winograd(
+  const Shape input_shape, const T* input_values,
+  const WinogradFilter<T>& filter,
+  const T* bias_values,
+  const Shape output_shape, T* output_values,
+  const int padding_height, const int padding_width,
+  const Rect& output_rect,
+  const int tiles_per_block = 16
+  )
+{
+  static_assert(std::is_floating_point<T>::value, "Winograd needs a floating point type");
+  assert(input_shape.layout == TensorLayout::NHWC);
+  assert(output_shape.layout == TensorLayout::NHWC);
+  assert(input_shape.channel == filter.input_depth);
+  assert(output_shape.channel == filter.output_depth);
+  assert(tiles_per_block >= 1);
+  assert(output_rect.x0 >= 0 && output_rect.x1 <= output_shape.width);
+  assert(output_rect.y0 >= 0 && output_rect.y1 <= output_shape.height);
+  const WinogradMatrices w = winograd_matrices(filter.m);
+  const int m = w.m;
+  const int a = w.a;
+  const int aa = a * a;
+  const int input_width = input_shape.width;
+  const int input_height = input_shape.height;
+  const int input_depth = input_shape.channel;
+  const int output_height = output_shape.height;
+  const int output_width = output_shape.width;
+  const int output_depth = output_shape.channel;
+  const int tiles_x = (output_rect.x1 - output_rect.x0 + m - 1) / m;
+  const int tiles_y = (output_rect.y1 - output_rect.y0 + m - 1) / m;
+  const int num_tiles = tiles_x * tiles_y;
+
+  std::vector<T> d((size_t)aa * input_depth);        // input tile, [a*a][in]
+  std::vector<T> tmp((size_t)aa * std::max(input_depth, output_depth));
+  std::vector<T> v((size_t)aa * tiles_per_block * input_depth);   // [a*a][tile][in]
+  std::vector<T> mm((size_t)aa * tiles_per_block * output_depth); // [a*a][tile][out]
+
+  for (int n=0; n<input_shape.number; ++n) {
+    const T* input = input_values + (size_t)n * input_height * input_width * input_depth;
+    T* output = output_values + (size_t)n * output_height * output_width * output_depth;
+    for (int t0=0; t0<num_tiles; t0+=tiles_per_block) {
+      const int nt = std::min(tiles_per_block, num_tiles - t0);
+
+      // input transform, B^T d B
+      for (int t=0; t<nt; ++t) {
+        const int ty = (t0 + t) / tiles_x;
+        const int tx = (t0 + t) % tiles_x;
+        const int in_y0 = output_rect.y0 + ty * m - padding_height;
+        const int in_x0 = output_rect.x0 + tx * m - padding_width;
+        for (int y=0; y<a; ++y) {
+          const int in_y = in_y0 + y;
+          for (int x=0; x<a; ++x) {
+            const int in_x = in_x0 + x;
+            T* dst = &d[(size_t)(y * a + x) * input_depth];
+            if (in_y < 0 || in_y >= input_height || in_x < 0 || in_x >= input_width) {
+              std::fill(dst, dst + input_depth, T(0));
+            }else {
+              const T* src = input + ((size_t)in_y * input_width + in_x) * input_depth;
+              std::copy(src, src + input_depth, dst);
+            }
+          }
+        }
+        // rows : tmp[i][x] = sum_y BT[i][y] d[y][x]
+        std::fill(tmp.begin(), tmp.begin() + (size_t)aa * input_depth, T(0));
+        for (int i=0; i<a; ++i) {
+          for (int y=0; y<a; ++y) {
+            const T b = w.BT[i * a + y];
+            if (b == 0) {
+              continue;
+            }
+            for (int x=0; x<a; ++x) {
+              const T* src = &d[(size_t)(y * a + x) * input_depth];
+              T* dst = &tmp[(size_t)(i * a + x) * input_depth];
+              for (int c=0; c<input_depth; ++c) {
+                dst[c] += b * src[c];
+              }
+            }
+          }
+        }
+        // columns : v[i][j] = sum_x tmp[i][x] BT[j][x]
+        for (int i=0; i<a; ++i) {
+          for (int j=0; j<a; ++j) {
+            T* dst = &v[((size_t)(i * a + j) * tiles_per_block + t) * input_depth];
+            std::fill(dst, dst + input_depth, T(0));
+            for (int x=0; x<a; ++x) {
+              const T b = w.BT[j * a + x];
+              if (b == 0) {
+                continue;
+              }
+              const T* src = &tmp[(size_t)(i * a + x) * input_depth];
+              for (int c=0; c<input_depth; ++c) {
+                dst[c] += b * src[c];
+              }
+            }
+          }
+        }
+      }
+
+      // element-wise products, one GEMM per element
+      for (int e=0; e<aa; ++e) {
+        const T* u = &filter.values[(size_t)e * input_depth * output_depth];
+        const T* ve = &v[(size_t)e * tiles_per_block * input_depth];
+        T* me = &mm[(size_t)e * tiles_per_block * output_depth];
+        std::fill(me, me + (size_t)nt * output_depth, T(0));
+        for (int ic=0; ic<input_depth; ++ic) {
+          const T* urow = u + (size_t)ic * output_depth;
+          for (int t=0; t<nt; ++t) {
+            const T x = ve[(size_t)t * input_depth + ic];
+            T* dst = me + (size_t)t * output_depth;
+            for (int oc=0; oc<output_depth; ++oc) {
+              dst[oc] += x * urow[oc];
+            }
+          }
+        }
+      }
+
+      // output transform, A^T M A, plus bias
+      for (int t=0; t<nt; ++t) {
+        const int ty = (t0 + t) / tiles_x;
+        const int tx = (t0 + t) % tiles_x;
+        // rows : tmp[i][x] = sum_y AT[i][y] M[y][x]
+        std::fill(tmp.begin(), tmp.begin() + (size_t)m * a * output_depth, T(0));
+        for (int i=0; i<m; ++i) {
+          for (int y=0; y<a; ++y) {
+            const T at = w.AT[i * a + y];
+            if (at == 0) {
+              continue;
+            }
+            for (int x=0; x<a; ++x) {
+              const T* src = &mm[((size_t)(y * a + x) * tiles_per_block + t) * output_depth];
+              T* dst = &tmp[(size_t)(i * a + x) * output_depth];
+              for (int c=0; c<output_depth; ++c) {
+                dst[c] += at * src[c];
+              }
+            }
+          }
+        }
+        // columns, written straight to the output
+        for (int i=0; i<m; ++i) {
+          const int out_y = output_rect.y0 + ty * m + i;
+          if (out_y >= output_rect.y1) {
+            break;
+          }
+          for (int j=0; j<m; ++j) {
+            const int out_x = output_rect.x0 + tx * m + j;
+            if (out_x >= output_rect.x1) {
+              break;
+            }
+            T* dst = output + ((size_t)out_y * output_width + out_x) * output_depth;
+            std::copy(bias_values, bias_values + output_depth, dst);
+            for (int x=0; x<a; ++x) {
+              const T at = w.AT[j * a + x];
+              if (at == 0) {
+                continue;
+              }
+              const T* src = &tmp[(size_t)(i * a + x) * output_depth];
+              for (int c=0; c<output_depth; ++c) {
+                dst[c] += at * src[c];
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename T>
+void Conv2D_winograd(
+  const Shape input_shape, const T* input_values,
+  const WinogradFilter<T>& filter,
+  const T* bias_values,
+  const Shape output_shape, T* output_values,
+  const int padding_height, const int padding_width,
+  const int tiles_per_block = 16
+  )
+{
+  Conv2D_winograd(
+    input_shape, input_values,
+    filter,
+    bias_values,
+    output_shape, output_values,
+    padding_height, padding_width,
+    Rect(0, 0, output_shape.width, output_shape.height),
+    tiles_per_block);
+}
@@ -0,0 +1,231 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <vector>
+#include <algorithm>
+
+#if defined(__AVX512VBMI2__) && defined(__AVX512BW__)
+#define COMPRESSED_ACTIVATIONS_VBMI2
+#include <immintrin.h>
+#endif
+
+#include "cnn.h"
+#include "trace.h"
+
+// An int8 NHWC activation stored as, per tile of 64 bytes of a row, a
+// bitmap of the bytes that differ from the zero point followed by just those
+// bytes. Activations clamped to the zero point (ReLU, ReLU6) shrink to a bit
+// per value, cutting what a layer writes and the next one reads.
+//
+// Rows are written in order, a band at a time, and read back a band at a
+// time in any order : each row records where its values start.
+class CompressedActivations
+{
+public:
+  static const int TILE = 64;
+
+  CompressedActivations()
+    :
+    zero_(0),
+    row_bytes_(0),
+    tiles_per_row_(0),
+    rows_written_(0)
+  {
+  }
+
+  // empties the buffer for an activation of shape whose zero point is zero
+  void reset(const Shape& shape, int8_t zero) {
+    assert(shape.layout == TensorLayout::NHWC);
+    shape_ = shape;
+    zero_ = zero;
+    row_bytes_ = shape.width * shape.channel;
+    tiles_per_row_ = (row_bytes_ + TILE - 1) / TILE;
+    const size_t rows = (size_t)shape.number * shape.height;
+    // sized for the worst case once, only what is written gets touched
+    masks_.resize(rows * tiles_per_row_);
+    row_start_.resize(rows + 1);
+    values_.resize(rows * row_bytes_);
+    row_start_[0] = 0;
+    rows_written_ = 0;
+  }
+
+  // encodes rows [y0, y1) of image b, which must follow the rows written so far
+  void write_rows(int b, int y0, int y1, const int8_t* rows) {
+    size_t row = (size_t)b * shape_.height + y0;
+    assert(row == rows_written_);
+    for (int y=y0; y<y1; ++y, ++row) {
+      const int8_t* src = &rows[(size_t)(y - y0) * row_bytes_];
+      uint64_t* mask = &masks_[row * tiles_per_row_];
+      int8_t* dst = &values_[row_start_[row]];
+      size_t n = 0;
+      for (int t=0; t<tiles_per_row_; ++t) {
+        const int len = std::min(TILE, row_bytes_ - t * TILE);
+        n += encode_tile(src + t * TILE, len, &mask[t], dst + n);
+      }
+      row_start_[row + 1] = row_start_[row] + (uint32_t)n;
+    }
+    rows_written_ = row;
+  }
+
+  // decodes rows [y0, y1) of image b, already written
+  void read_rows(int b, int y0, int y1, int8_t* rows) const {
+    size_t row = (size_t)b * shape_.height + y0;
+    assert(row + (y1 - y0) <= rows_written_);
+    for (int y=y0; y<y1; ++y, ++row) {
+      int8_t* dst = &rows[(size_t)(y - y0) * row_bytes_];
+      const uint64_t* mask = &masks_[row * tiles_per_row_];
+      const int8_t* src = &values_[row_start_[row]];
+      size_t n = 0;
+      for (int t=0; t<tiles_per_row_; ++t) {
+        const int len = std::min(TILE, row_bytes_ - t * TILE);
+        n += decode_tile(mask[t], src + n, len, dst + t * TILE);
+      }
+    }
+  }
+
+  const Shape& shape() const { return shape_; }
+  size_t row_bytes() const { return row_bytes_; }
+
+  // bytes the written rows take : bitmaps, row starts and values
+  size_t compressed_bytes() const {
+    return rows_written_ * (tiles_per_row_ * sizeof(uint64_t) + sizeof(uint32_t)) + row_start_[rows_written_];
+  }
+
+  size_t plain_bytes() const {
+    return rows_written_ * row_bytes_;
+  }
+
+private:
+  // writes the bytes of src other than the zero point to dst, returns their count
+  size_t encode_tile(const int8_t* src, int len, uint64_t* mask, int8_t* dst) const {
+#ifdef COMPRESSED_ACTIVATIONS_VBMI2
+    const __mmask64 valid = (len == TILE) ? ~(__mmask64)0 : (((__mmask64)1 << len) - 1);
+    const __m512i v = _mm512_maskz_loadu_epi8(valid, src);
+    const __mmask64 m = _mm512_mask_cmpneq_epi8_mask(valid, v, _mm512_set1_epi8(zero_));
+    _mm512_mask_compressstoreu_epi8(dst, m, v);
+    *mask = m;
+    return (size_t)_mm_popcnt_u64(m);
+#else
+    uint64_t m = 0;
+    size_t n = 0;
+    for (int i=0; i<len; ++i) {
+      const bool keep = src[i] != zero_;
+      dst[n] = src[i];
+      n += keep;
+      m |= (uint64_t)keep << i;
+    }
+    *mask = m;
+    return n;
+#endif
+  }
+
+  // the inverse of encode_tile, returns the count of values read
+  size_t decode_tile(uint64_t mask, const int8_t* src, int len, int8_t* dst) const {
+#ifdef COMPRESSED_ACTIVATIONS_VBMI2
+    const __mmask64 valid = (len == TILE) ? ~(__mmask64)0 : (((__mmask64)1 << len) - 1);
+    const __m512i v = _mm512_mask_expandloadu_epi8(_mm512_set1_epi8(zero_), mask, src);
+    _mm512_mask_storeu_epi8(dst, valid, v);
+    return (size_t)_mm_popcnt_u64(mask);
+#else
+    size_t n = 0;
+    for (int i=0; i<len; ++i) {
+      const bool keep = (mask >> i) & 1;
+      dst[i] = keep ? src[n] : zero_;
+      n += keep;
+    }
+    return n;
+#endif
+  }
+
+  Shape shape_;
+  int8_t zero_;
+  int row_bytes_;
+  int tiles_per_row_;
+  size_t rows_written_;
+  std::vector<uint64_t> masks_;
+  std::vector<uint32_t> row_start_;
+  std::vector<int8_t> values_;
+};
+
+// buffers run_layers_compressed keeps between calls
+struct CompressedChainScratch
+{
+  CompressedActivations activations[2];
+  std::vector<int8_t> window;   // decoded input rows of a band
+  std::vector<int8_t> band;     // output rows of a band, before encoding
+  std::vector<size_t> compressed_bytes; // per intermediate activation, last run
+  std::vector<size_t> plain_bytes;
+};
+
+// run_layers keeping the intermediate activations compressed. Each layer
+// runs band_rows output rows at a time : the input rows the band needs are
+// decoded into a small window, and the band is encoded as soon as it is
+// computed, so plain activations stay in cache and only the compressed
+// ones go out to memory. The output is the same as run_layers.
+inline
+void run_layers_compressed(
+  const std::vector<ConvLayer_int8>& layers,
+  int batch,
+  const int8_t* input_values,
+  int8_t* output_values,
+  CompressedChainScratch& scratch,
+  int band_rows = 4)
+{
+  assert(!layers.empty());
+  assert(batch >= 1);
+  assert(band_rows >= 1);
+  scratch.compressed_bytes.assign(layers.size() - 1, 0);
+  scratch.plain_bytes.assign(layers.size() - 1, 0);
+  for (size_t i=0; i<layers.size(); ++i) {
+    const ConvLayer_int8& layer = layers[i];
+    const bool first = (i == 0);
+    const bool last = (i + 1 == layers.size());
+    const Shape& in = layer.input_shape;
+    const Shape& out = layer.output_shape;
+    const size_t in_row = (size_t)in.width * in.channel;
+    const size_t out_row = (size_t)out.width * out.channel;
+    const CompressedActivations& source = scratch.activations[(i + 1) % 2];
+    CompressedActivations& sink = scratch.activations[i % 2];
+    if (!last) {
+      Shape shape = out;
+      shape.number = batch;
+      sink.reset(shape, (int8_t)layer.output_offset);
+      scratch.band.resize(band_rows * out_row);
+    }
+    TRACE_SCOPE_ARG("layer", i);
+    for (int b=0; b<batch; ++b) {
+      for (int y0=0; y0<out.height; y0+=band_rows) {
+        const int y1 = std::min(out.height, y0 + band_rows);
+        // input rows of the band, the layer viewed on just them
+        const int r0 = std::max(0, y0 * layer.stride_height - layer.padding_height);
+        const int r1 = std::min(in.height, (y1 - 1) * layer.stride_height - layer.padding_height + layer.filter_shape.height);
+        ConvLayer_int8 view = layer;
+        view.input_shape.number = 1;
+        view.input_shape.height = r1 - r0;
+        view.output_shape.number = 1;
+        view.output_shape.height = y1 - y0;
+        view.padding_height = layer.padding_height + r0 - y0 * layer.stride_height;
+        const int8_t* input;
+        if (first) {
+          input = &input_values[((size_t)b * in.height + r0) * in_row];
+        }else {
+          scratch.window.resize((r1 - r0) * in_row);
+          source.read_rows(b, r0, r1, &scratch.window[0]);
+          input = &scratch.window[0];
+        }
+        if (last) {
+          run_layer(view, input, &output_values[((size_t)b * out.height + y0) * out_row]);
+        }else {
+          run_layer(view, input, &scratch.band[0]);
+          sink.write_rows(b, y0, y1, &scratch.band[0]);
+        }
+      }
+    }
+    if (!last) {
+      scratch.compressed_bytes[i] = sink.compressed_bytes();
+      scratch.plain_bytes[i] = sink.plain_bytes();
+    }
+  }
+}
@@ -0,0 +1,659 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#define CONV_PLAN_AVX2
+#include <immintrin.h>
+#endif
+
+#include "cnn.h"
+
+// Algorithms a quantized Conv2D can run with. DepthwiseConv2D always runs
+// direct.
+enum class ConvAlgorithm {
+  direct,       // Conv2D_int8_int8 / DepthwiseConv2D_int8_int8
+  im2col_gemm,  // patches of an output row copied out, then a GEMM
+  gemm_1x1,     // 1x1 stride 1 : the NHWC input already is the GEMM operand
+  winograd,     // F(2x2, 3x3), 3x3 stride 1
+};
+
+const int NUM_CONV_ALGORITHMS = 4;
+
+inline
+const char* conv_algorithm_name(ConvAlgorithm algorithm)
+{
+  switch (algorithm) {
+  case ConvAlgorithm::direct: return "direct";
+  case ConvAlgorithm::im2col_gemm: return "im2col";
+  case ConvAlgorithm::gemm_1x1: return "gemm1x1";
+  case ConvAlgorithm::winograd: return "winograd";
+  default: return "?";
+  }
+}
+
+inline
+bool conv_algorithm_applicable(const ConvLayer_int8& layer, ConvAlgorithm algorithm)
+{
+  if (algorithm == ConvAlgorithm::direct) {
+    return true;
+  }
+  if (layer.type != LayerType::Conv2D || layer.input_shape.layout != TensorLayout::NHWC) {
+    return false;
+  }
+  const Shape& f = layer.filter_shape;
+  switch (algorithm) {
+  case ConvAlgorithm::im2col_gemm:
+    // the padding value -input_offset must be an int8
+    return layer.input_offset >= -127 && layer.input_offset <= 128;
+  case ConvAlgorithm::gemm_1x1:
+    return f.height == 1 && f.width == 1 && layer.stride_height == 1 && layer.stride_width == 1
+      && layer.padding_height == 0 && layer.padding_width == 0;
+  case ConvAlgorithm::winograd:
+    // transformed input * filter summed over the depth stays within int32
+    return f.height == 3 && f.width == 3 && layer.stride_height == 1 && layer.stride_width == 1
+      && layer.input_shape.channel <= 1024
+      && layer.input_offset >= -127 && layer.input_offset <= 128;
+  default:
+    return false;
+  }
+}
+
+// multiplies an algorithm executes and the bytes it moves beyond the
+// direct kernel (im2col patches, transformed Winograd tiles)
+struct ConvWork
+{
+  int64_t macs;
+  int64_t bytes;
+};
+
+inline
+ConvWork conv_work(const ConvLayer_int8& layer, ConvAlgorithm algorithm)
+{
+  const Shape& in = layer.input_shape;
+  const Shape& out = layer.output_shape;
+  const Shape& f = layer.filter_shape;
+  ConvWork w;
+  w.macs = layer.macs();
+  w.bytes = 0;
+  switch (algorithm) {
+  case ConvAlgorithm::im2col_gemm:
+    // written once, read once per output channel block
+    w.bytes = 2LL * out.number * out.height * out.width * f.height * f.width * in.channel;
+    break;
+  case ConvAlgorithm::winograd: {
+    const int64_t tiles = (int64_t)out.number * ((out.height + 1) / 2) * ((out.width + 1) / 2);
+    w.macs = tiles * 16 * in.channel * out.channel;
+    // int16 transformed tiles, written and read
+    w.bytes = tiles * 16 * in.channel * 2 * 2;
+    break;
+  }
+  default:
+    break;
+  }
+  return w;
+}
+
+// seconds = seconds_per_mac[algorithm] * macs + seconds_per_byte * bytes,
+// with seconds_per_mac_depthwise for DepthwiseConv2D (direct only)
+//
+// The defaults are rough figures for scalar code on a desktop x86;
+// calibrate() replaces the per-MAC figures with ones fitted to timings of
+// given layers on this machine.
+struct ConvCostModel
+{
+  double seconds_per_mac[NUM_CONV_ALGORITHMS];
+  double seconds_per_mac_depthwise;
+  double seconds_per_byte;
+
+  ConvCostModel()
+    :
+    seconds_per_mac_depthwise(2.0e-9),
+    seconds_per_byte(0.1e-9)
+  {
+    seconds_per_mac[(int)ConvAlgorithm::direct] = 2.0e-9;
+    seconds_per_mac[(int)ConvAlgorithm::im2col_gemm] = 0.5e-9;
+    seconds_per_mac[(int)ConvAlgorithm::gemm_1x1] = 0.4e-9;
+    seconds_per_mac[(int)ConvAlgorithm::winograd] = 0.6e-9;
+  }
+
+  double estimate(const ConvLayer_int8& layer, ConvAlgorithm algorithm) const {
+    const ConvWork w = conv_work(layer, algorithm);
+    const double per_mac = (layer.type == LayerType::DepthwiseConv2D)
+      ? seconds_per_mac_depthwise : seconds_per_mac[(int)algorithm];
+    return per_mac * w.macs + seconds_per_byte * w.bytes;
+  }
+
+  // the applicable algorithm of the lowest estimate
+  ConvAlgorithm select(const ConvLayer_int8& layer) const {
+    ConvAlgorithm best = ConvAlgorithm::direct;
+    double best_seconds = estimate(layer, best);
+    for (int i=1; i<NUM_CONV_ALGORITHMS; ++i) {
+      const ConvAlgorithm a = (ConvAlgorithm)i;
+      if (conv_algorithm_applicable(layer, a)) {
+        const double s = estimate(layer, a);
+        if (s < best_seconds) {
+          best = a;
+          best_seconds = s;
+        }
+      }
+    }
+    return best;
+  }
+
+  void calibrate(const std::vector<ConvLayer_int8>& layers, int repetitions = 1);
+};
+
+// An algorithm chosen for a layer, with what it precomputes from the
+// filter. Like ConvLayer_int8 it points into the layer's filter values.
+struct ConvPlan
+{
+  ConvAlgorithm algorithm;
+  double estimated_seconds;
+  std::vector<int32_t> bias;              // GEMM : bias + input_offset * filter sum
+  std::vector<int16_t> winograd_filter;   // out_channels x 16 x in_channels
+  bool skip_zero_inputs;                  // gemm_1x1 : see gemm_int8_requantize_skip_zero
+
+  ConvPlan()
+    :
+    algorithm(ConvAlgorithm::direct),
+    estimated_seconds(0),
+    skip_zero_inputs(false)
+  {
+  }
+};
+
+// Winograd F(2x2, 3x3) on integers : with G scaled by 2 the filter
+// transform stays integral and the output is 4 times the convolution.
+//
+//       | 2  0  0 |        | 1  0 -1  0 |
+//   G = | 1  1  1 |  B^T = | 0  1  1  0 |  A^T = | 1  1  1  0 |
+//       | 1 -1  1 |        | 0 -1  1  0 |        | 0  1 -1 -1 |
+//       | 0  0  2 |        | 0  1  0 -1 |
+inline
+void winograd_transform_filter(const ConvLayer_int8& layer, std::vector<int16_t>& transformed)
+{
+  const int out_depth = layer.filter_shape.number;
+  const int depth = layer.filter_shape.channel;
+  transformed.resize((size_t)out_depth * 16 * depth);
+  for (int n=0; n<out_depth; ++n) {
+    for (int c=0; c<depth; ++c) {
+      int g[3][3];
+      for (int y=0; y<3; ++y) {
+        for (int x=0; x<3; ++x) {
+          g[y][x] = layer.filter_values[layer.filter_shape.offset(n, y, x, c)];
+        }
+      }
+      // Gg : 4x3
+      int t[4][3];
+      for (int x=0; x<3; ++x) {
+        t[0][x] = 2 * g[0][x];
+        t[1][x] = g[0][x] + g[1][x] + g[2][x];
+        t[2][x] = g[0][x] - g[1][x] + g[2][x];
+        t[3][x] = 2 * g[2][x];
+      }
+      // (Gg)G^T : 4x4
+      for (int y=0; y<4; ++y) {
+        int16_t* u = &transformed[((size_t)n * 16 + y * 4) * depth + c];
+        u[0 * depth] = (int16_t)(2 * t[y][0]);
+        u[1 * depth] = (int16_t)(t[y][0] + t[y][1] + t[y][2]);
+        u[2 * depth] = (int16_t)(t[y][0] - t[y][1] + t[y][2]);
+        u[3 * depth] = (int16_t)(2 * t[y][2]);
+      }
+    }
+  }
+}
+
+inline
+ConvPlan make_conv_plan(const ConvLayer_int8& layer, ConvAlgorithm algorithm, double estimated_seconds = 0)
+{
+  assert(conv_algorithm_applicable(layer, algorithm));
+  ConvPlan plan;
+  plan.algorithm = algorithm;
+  plan.estimated_seconds = estimated_seconds;
+  if (algorithm == ConvAlgorithm::im2col_gemm || algorithm == ConvAlgorithm::gemm_1x1) {
+    // sum f * (x + offset) = sum f * x + offset * sum f
+    const int out_depth = layer.filter_shape.number;
+    const int size = layer.filter_shape.height * layer.filter_shape.width * layer.filter_shape.channel;
+    plan.bias.resize(out_depth);
+    for (int n=0; n<out_depth; ++n) {
+      int32_t sum = 0;
+      for (int k=0; k<size; ++k) {
+        sum += layer.filter_values[n * size + k];
+      }
+      plan.bias[n] = layer.bias_values[n] + layer.input_offset * sum;
+    }
+  }else if (algorithm == ConvAlgorithm::winograd) {
+    winograd_transform_filter(layer, plan.winograd_filter);
+  }
+  return plan;
+}
+
+// the algorithm of the lowest estimate, prepared
+inline
+ConvPlan plan_conv(const ConvLayer_int8& layer, const ConvCostModel& model)
+{
+  const ConvAlgorithm algorithm = model.select(layer);
+  return make_conv_plan(layer, algorithm, model.estimate(layer, algorithm));
+}
+
+// out[m][n] = requantize(a[m] . filter[n] + bias[n]) for rows rows of a,
+// filter being the layer's out_channels x depth filter in its OHWI order
+inline
+void gemm_int8_requantize(
+  const ConvLayer_int8& layer,
+  const int32_t* bias,
+  const int8_t* a, int rows, int depth,
+  int8_t* out)
+{
+  const int out_depth = layer.output_shape.channel;
+  const int8_t* filter = layer.filter_values;
+  // filter rows of a block stay in L2 while all rows of a pass over them
+  const int block = std::max(4, (64 * 1024) / std::max(depth, 1));
+  for (int n0=0; n0<out_depth; n0+=block) {
+    const int n1 = std::min(out_depth, n0 + block);
+    for (int m=0; m<rows; ++m) {
+      const int8_t* am = &a[(size_t)m * depth];
+      int8_t* om = &out[(size_t)m * out_depth];
+      int n = n0;
+      // 4 filter rows per pass, each input value loaded once for them
+      for (; n+4<=n1; n+=4) {
+        const int8_t* f0 = &filter[(size_t)n * depth];
+        const int8_t* f1 = f0 + depth;
+        const int8_t* f2 = f1 + depth;
+        const int8_t* f3 = f2 + depth;
+        int32_t sums[4] = {0, 0, 0, 0};
+        for (int k=0; k<depth; ++k) {
+          const int32_t x = am[k];
+          sums[0] += x * f0[k];
+          sums[1] += x * f1[k];
+          sums[2] += x * f2[k];
+          sums[3] += x * f3[k];
+        }
+        for (int j=0; j<4; ++j) {
+          om[n + j] = requantize(sums[j] + bias[n + j], layer.output_multiplier[n + j], layer.output_shift[n + j],
+                                 layer.output_offset, layer.activation_min, layer.activation_max);
+        }
+      }
+      for (; n<n1; ++n) {
+        const int8_t* fn = &filter[(size_t)n * depth];
+        int32_t sum = 0;
+        for (int k=0; k<depth; ++k) {
+          sum += am[k] * fn[k];
+        }
+        om[n] = requantize(sum + bias[n], layer.output_multiplier[n], layer.output_shift[n],
+                           layer.output_offset, layer.activation_min, layer.activation_max);
+      }
+    }
+  }
+}
+
+// the receptive fields of output row out_y of image b, one patch of
+// filter height * width * input channels per output pixel, in the filter's
+// HWI order. Padding contributes pad + input_offset = 0.
+inline
+void im2col_row(const ConvLayer_int8& layer, const int8_t* input_values, int b, int out_y, int8_t* patches)
+{
+  const Shape& in = layer.input_shape;
+  const int fh = layer.filter_shape.height;
+  const int fw = layer.filter_shape.width;
+  assert(layer.input_offset >= -127 && layer.input_offset <= 128);
+  const int8_t pad = (int8_t)(-layer.input_offset);
+  const int in_y_start = out_y * layer.stride_height - layer.padding_height;
+  int8_t* p = patches;
+  for (int out_x=0; out_x<layer.output_shape.width; ++out_x) {
+    const int in_x_start = out_x * layer.stride_width - layer.padding_width;
+    for (int fy=0; fy<fh; ++fy) {
+      const int in_y = in_y_start + fy;
+      for (int fx=0; fx<fw; ++fx) {
+        const int in_x = in_x_start + fx;
+        if (in_y < 0 || in_y >= in.height || in_x < 0 || in_x >= in.width) {
+          memset(p, pad, in.channel);
+        }else {
+          memcpy(p, &input_values[in.offset(b, in_y, in_x, 0)], in.channel);
+        }
+        p += in.channel;
+      }
+    }
+  }
+}
+
+inline
+void run_conv_im2col(const ConvLayer_int8& layer, const ConvPlan& plan, const int8_t* input_values, int8_t* output_values)
+{
+  const Shape& out = layer.output_shape;
+  const int depth = layer.filter_shape.height * layer.filter_shape.width * layer.input_shape.channel;
+  // one output row of patches at a time
+  std::vector<int8_t> patches((size_t)out.width * depth);
+  for (int b=0; b<out.number; ++b) {
+    for (int out_y=0; out_y<out.height; ++out_y) {
+      im2col_row(layer, input_values, b, out_y, &patches[0]);
+      gemm_int8_requantize(layer, &plan.bias[0], &patches[0], out.width, depth,
+                           &output_values[out.offset(b, out_y, 0, 0)]);
+    }
+  }
+}
+
+// input channels are checked for zero skipping in groups of 8
+const int ZERO_SKIP_GROUP = 8;
+
+// one bit per group of a row, set when the group holds a value other than
+// zero (the zero point, -input_offset)
+inline
+void zero_skip_mask(const int8_t* row, int groups, int8_t zero, uint64_t* mask)
+{
+  uint64_t zeros;
+  memset(&zeros, (uint8_t)zero, 8);
+  for (int w=0; w<(groups + 63) / 64; ++w) {
+    mask[w] = 0;
+  }
+  for (int g=0; g<groups; ++g) {
+    uint64_t v;
+    memcpy(&v, row + g * ZERO_SKIP_GROUP, 8);
+    mask[g >> 6] |= (uint64_t)(v != zeros) << (g & 63);
+  }
+}
+
+// fraction of the groups of the input that are all zero, what
+// gemm_int8_requantize_skip_zero skips
+inline
+double zero_group_fraction(const ConvLayer_int8& layer, const int8_t* input_values)
+{
+  const int depth = layer.input_shape.channel;
+  const int groups = depth / ZERO_SKIP_GROUP;
+  const int64_t rows = (int64_t)layer.input_shape.number * layer.input_shape.height * layer.input_shape.width;
+  if (groups == 0 || rows == 0) {
+    return 0;
+  }
+  std::vector<uint64_t> mask((groups + 63) / 64);
+  int64_t zero = 0;
+  for (int64_t m=0; m<rows; ++m) {
+    zero_skip_mask(&input_values[m * depth], groups, (int8_t)(-layer.input_offset), &mask[0]);
+    for (int g=0; g<groups; ++g) {
+      zero += !((mask[g >> 6] >> (g & 63)) & 1);
+    }
+  }
+  return zero / (double)(rows * groups);
+}
+
+// gemm_int8_requantize for a 1x1 layer, skipping the groups of 8 input
+// channels of a row that are all the zero point, as a ReLU clamp to
+// activation_min leaves many : they add nothing to sum f * (x + input_offset).
+// The kept groups of a row are gathered first, with the offset added;
+// channels past the last whole group are always summed.
+inline
+void gemm_int8_requantize_skip_zero(
+  const ConvLayer_int8& layer,
+  const int8_t* a, int rows,
+  int8_t* out)
+{
+  const int depth = layer.input_shape.channel;
+  const int out_depth = layer.output_shape.channel;
+  const int groups = depth / ZERO_SKIP_GROUP;
+  const int32_t offset = layer.input_offset;
+  assert(offset >= -127 && offset <= 128);
+  const int8_t* filter = layer.filter_values;
+
+  // one row gathered at a time, into buffers each thread keeps between calls
+  static thread_local std::vector<uint64_t> mask_buffer;
+  static thread_local std::vector<int16_t> x_buffer;
+  static thread_local std::vector<int32_t> column_buffer;
+  mask_buffer.resize((groups + 63) / 64 + 1);
+  x_buffer.resize((size_t)groups * ZERO_SKIP_GROUP + 1);
+  column_buffer.resize((size_t)groups + 1);
+  uint64_t* mask = &mask_buffer[0];
+  int16_t* x = &x_buffer[0];
+  int32_t* c = &column_buffer[0];
+
+  // filter rows of a block stay in L2 while all rows of a pass over them,
+  // each row regathered per block : depth bytes against the block's MACs
+  const int block = std::max(4, (64 * 1024) / std::max(depth, 1));
+  for (int n0=0; n0<out_depth; n0+=block) {
+    const int n1 = std::min(out_depth, n0 + block);
+    for (int m=0; m<rows; ++m) {
+      const int8_t* am = &a[(size_t)m * depth];
+      zero_skip_mask(am, groups, (int8_t)(-offset), mask);
+      int kept = 0;
+      for (int g=0; g<groups; ++g) {
+        if (!((mask[g >> 6] >> (g & 63)) & 1))
+          continue;
+        c[kept] = g * ZERO_SKIP_GROUP;
+        for (int i=0; i<ZERO_SKIP_GROUP; ++i) {
+          x[kept * ZERO_SKIP_GROUP + i] = (int16_t)(am[c[kept] + i] + offset);
+        }
+        ++kept;
+      }
+      int8_t* om = &out[(size_t)m * out_depth];
+      for (int n=n0; n<n1; n+=4) {
+        // a short last block repeats its last row and drops the result
+        const int nf = std::min(4, n1 - n);
+        const int8_t* f[4];
+        for (int j=0; j<4; ++j) {
+          f[j] = &filter[(size_t)(n + std::min(j, nf - 1)) * depth];
+        }
+        int32_t sums[4] = {0, 0, 0, 0};
+        int i = 0;
+#ifdef CONV_PLAN_AVX2
+        // two groups per vpmaddwd
+        __m256i acc[4];
+        for (int j=0; j<4; ++j) {
+          acc[j] = _mm256_setzero_si256();
+        }
+        for (; i+2<=kept; i+=2) {
+          const __m256i xv = _mm256_loadu_si256((const __m256i*)&x[i * ZERO_SKIP_GROUP]);
+          for (int j=0; j<4; ++j) {
+            const __m128i w = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(f[j] + c[i])),
+                                                 _mm_loadl_epi64((const __m128i*)(f[j] + c[i + 1])));
+            acc[j] = _mm256_add_epi32(acc[j], _mm256_madd_epi16(xv, _mm256_cvtepi8_epi16(w)));
+          }
+        }
+        for (int j=0; j<4; ++j) {
+          __m128i v = _mm_add_epi32(_mm256_castsi256_si128(acc[j]), _mm256_extracti128_si256(acc[j], 1));
+          v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+          v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+          sums[j] = _mm_cvtsi128_si32(v);
+        }
+#endif
+        for (; i<kept; ++i) {
+          for (int j=0; j<4; ++j) {
+            const int8_t* fj = f[j] + c[i];
+            for (int k=0; k<ZERO_SKIP_GROUP; ++k) {
+              sums[j] += x[i * ZERO_SKIP_GROUP + k] * fj[k];
+            }
+          }
+        }
+        for (int k=groups*ZERO_SKIP_GROUP; k<depth; ++k) {
+          for (int j=0; j<4; ++j) {
+            sums[j] += (am[k] + offset) * f[j][k];
+          }
+        }
+        for (int j=0; j<nf; ++j) {
+          om[n + j] = requantize(sums[j] + layer.bias_values[n + j],
+                                 layer.output_multiplier[n + j], layer.output_shift[n + j],
+                                 layer.output_offset, layer.activation_min, layer.activation_max);
+        }
+      }
+    }
+  }
+}
+
+inline
+void run_conv_gemm_1x1(const ConvLayer_int8& layer, const ConvPlan& plan, const int8_t* input_values, int8_t* output_values)
+{
+  const Shape& in = layer.input_shape;
+  const Shape& out = layer.output_shape;
+  const int rows = out.height * out.width;
+  for (int b=0; b<out.number; ++b) {
+    if (plan.skip_zero_inputs) {
+      gemm_int8_requantize_skip_zero(layer, &input_values[in.offset(b, 0, 0, 0)], rows,
+                                     &output_values[out.offset(b, 0, 0, 0)]);
+    }else {
+      gemm_int8_requantize(layer, &plan.bias[0], &input_values[in.offset(b, 0, 0, 0)], rows, in.channel,
+                           &output_values[out.offset(b, 0, 0, 0)]);
+    }
+  }
+}
+
+inline
+void run_conv_winograd(const ConvLayer_int8& layer, const ConvPlan& plan, const int8_t* input_values, int8_t* output_values)
+{
+  const Shape& in = layer.input_shape;
+  const Shape& out = layer.output_shape;
+  const int depth = in.channel;
+  const int out_depth = out.channel;
+  std::vector<int16_t> d(16 * depth);  // input tile + offset, 4x4 x depth
+  std::vector<int16_t> v(16 * depth);  // B^T d B
+  for (int b=0; b<out.number; ++b) {
+    for (int out_y=0; out_y<out.height; out_y+=2) {
+      for (int out_x=0; out_x<out.width; out_x+=2) {
+        const int in_y0 = out_y - layer.padding_height;
+        const int in_x0 = out_x - layer.padding_width;
+        for (int y=0; y<4; ++y) {
+          for (int x=0; x<4; ++x) {
+            int16_t* dyx = &d[(y * 4 + x) * depth];
+            const int in_y = in_y0 + y;
+            const int in_x = in_x0 + x;
+            if (in_y < 0 || in_y >= in.height || in_x < 0 || in_x >= in.width) {
+              std::fill(dyx, dyx + depth, (int16_t)0);
+            }else {
+              const int8_t* src = &input_values[in.offset(b, in_y, in_x, 0)];
+              for (int c=0; c<depth; ++c) {
+                dyx[c] = (int16_t)(src[c] + layer.input_offset);
+              }
+            }
+          }
+        }
+        // columns then rows, each element of a row of B^T picks two inputs
+        int16_t t[16];
+        for (int c=0; c<depth; ++c) {
+          int16_t e[16];
+          for (int i=0; i<16; ++i) {
+            e[i] = d[i * depth + c];
+          }
+          for (int x=0; x<4; ++x) {
+            t[0 * 4 + x] = e[0 * 4 + x] - e[2 * 4 + x];
+            t[1 * 4 + x] = e[1 * 4 + x] + e[2 * 4 + x];
+            t[2 * 4 + x] = e[2 * 4 + x] - e[1 * 4 + x];
+            t[3 * 4 + x] = e[1 * 4 + x] - e[3 * 4 + x];
+          }
+          for (int y=0; y<4; ++y) {
+            v[(y * 4 + 0) * depth + c] = t[y * 4 + 0] - t[y * 4 + 2];
+            v[(y * 4 + 1) * depth + c] = t[y * 4 + 1] + t[y * 4 + 2];
+            v[(y * 4 + 2) * depth + c] = t[y * 4 + 2] - t[y * 4 + 1];
+            v[(y * 4 + 3) * depth + c] = t[y * 4 + 1] - t[y * 4 + 3];
+          }
+        }
+        for (int n=0; n<out_depth; ++n) {
+          const int16_t* u = &plan.winograd_filter[(size_t)n * 16 * depth];
+          int32_t m[16];
+          for (int i=0; i<16; ++i) {
+            const int16_t* ui = &u[i * depth];
+            const int16_t* vi = &v[i * depth];
+            int32_t sum = 0;
+            for (int c=0; c<depth; ++c) {
+              sum += ui[c] * vi[c];
+            }
+            m[i] = sum;
+          }
+          // A^T m A, 4 times the convolution
+          int64_t r[2][4];
+          for (int x=0; x<4; ++x) {
+            r[0][x] = (int64_t)m[0 * 4 + x] + m[1 * 4 + x] + m[2 * 4 + x];
+            r[1][x] = (int64_t)m[1 * 4 + x] - m[2 * 4 + x] - m[3 * 4 + x];
+          }
+          for (int y=0; y<2 && out_y + y < out.height; ++y) {
+            const int64_t s[2] = {
+              r[y][0] + r[y][1] + r[y][2],
+              r[y][1] - r[y][2] - r[y][3],
+            };
+            for (int x=0; x<2 && out_x + x < out.width; ++x) {
+              const int32_t sum = (int32_t)(s[x] / 4) + layer.bias_values[n];
+              output_values[out.offset(b, out_y + y, out_x + x, n)] =
+                requantize(sum, layer.output_multiplier[n], layer.output_shift[n],
+                           layer.output_offset, layer.activation_min, layer.activation_max);
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+// runs the layer with the plan's algorithm, same output as run_layer
+inline
+void run_conv(const ConvLayer_int8& layer, const ConvPlan& plan, const int8_t* input_values, int8_t* output_values)
+{
+  switch (plan.algorithm) {
+  case ConvAlgorithm::im2col_gemm:
+    run_conv_im2col(layer, plan, input_values, output_values);
+    break;
+  case ConvAlgorithm::gemm_1x1:
+    run_conv_gemm_1x1(layer, plan, input_values, output_values);
+    break;
+  case ConvAlgorithm::winograd:
+    run_conv_winograd(layer, plan, input_values, output_values);
+    break;
+  default:
+    run_layer(layer, input_values, output_values);
+    break;
+  }
+}
+
+// Times every applicable algorithm on every layer (random input, best of
+// repetitions) and fits each algorithm's seconds per MAC, and the
+// depthwise one, by least squares over its layers after taking off the byte
+// term. Figures no layer exercises are kept.
+inline
+void ConvCostModel::calibrate(const std::vector<ConvLayer_int8>& layers, int repetitions)
+{
+  // the last slot fits the depthwise figure
+  double num[NUM_CONV_ALGORITHMS + 1] = {0};
+  double den[NUM_CONV_ALGORITHMS + 1] = {0};
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<int> dist(-128, 127);
+  std::vector<int8_t> input;
+  std::vector<int8_t> output;
+  for (size_t i=0; i<layers.size(); ++i) {
+    const ConvLayer_int8& layer = layers[i];
+    input.resize(layer.input_shape.num_elements());
+    output.resize(layer.output_shape.num_elements());
+    for (size_t j=0; j<input.size(); ++j) {
+      input[j] = (int8_t)dist(rng);
+    }
+    for (int a=0; a<NUM_CONV_ALGORITHMS; ++a) {
+      const ConvAlgorithm algorithm = (ConvAlgorithm)a;
+      if (!conv_algorithm_applicable(layer, algorithm)) {
+        continue;
+      }
+      const ConvPlan plan = make_conv_plan(layer, algorithm);
+      double best = 0;
+      for (int r=0; r<std::max(1, repetitions); ++r) {
+        const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        run_conv(layer, plan, &input[0], &output[0]);
+        const double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        if (r == 0 || s < best) {
+          best = s;
+        }
+      }
+      const ConvWork w = conv_work(layer, algorithm);
+      const double compute = std::max(0.0, best - seconds_per_byte * w.bytes);
+      const int slot = (layer.type == LayerType::DepthwiseConv2D) ? NUM_CONV_ALGORITHMS : a;
+      num[slot] += compute * w.macs;
+      den[slot] += (double)w.macs * w.macs;
+    }
+  }
+  for (int a=0; a<NUM_CONV_ALGORITHMS; ++a) {
+    if (den[a] > 0) {
+      seconds_per_mac[a] = num[a] / den[a];
+    }
+  }
+  if (den[NUM_CONV_ALGORITHMS] > 0) {
+    seconds_per_mac_depthwise = num[NUM_CONV_ALGORITHMS] / den[NUM_CONV_ALGORITHMS];
+  }
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX2__))
+#define FLOAT16_F16C
+#include <immintrin.h>
+#endif
+
+// 16 bit storage types for weights and activations. Arithmetic converts to
+// float, so kernels keep a float accumulator (Accumulator<T>::type) and
+// round once when storing. float16 is IEEE binary16, bfloat16 the upper half
+// of a float : same range as float, 8 bits of precision.
+
+// round to nearest even, overflow to infinity, NaN kept
+inline
+uint16_t float_to_half_bits(float value)
+{
+  uint32_t x;
+  memcpy(&x, &value, 4);
+  const uint16_t sign = (uint16_t)((x >> 16) & 0x8000);
+  x &= 0x7fffffff;
+  if (x >= 0x7f800000) {
+    return sign | 0x7c00 | (x > 0x7f800000 ? 0x200 : 0);
+  }
+  if (x >= 0x477ff000) {
+    // 65520 and up round past the largest half, 65504
+    return sign | 0x7c00;
+  }
+  if (x < 0x38800000) {
+    // below 2^-14 : subnormal half, in units of 2^-24
+    if (x <= 0x33000000) {
+      return sign;
+    }
+    const int shift = 126 - (int)(x >> 23);
+    const uint32_t m = (x & 0x7fffff) | 0x800000;
+    uint32_t r = m >> shift;
+    const uint32_t rem = m & ((1u << shift) - 1);
+    const uint32_t half = 1u << (shift - 1);
+    r += (rem > half || (rem == half && (r & 1))) ? 1 : 0;
+    return sign | (uint16_t)r;
+  }
+  // rebias the exponent from 127 to 15, then round off 13 mantissa bits
+  x -= 112u << 23;
+  x += 0xfff + ((x >> 13) & 1);
+  return sign | (uint16_t)(x >> 13);
+}
+
+inline
+float half_bits_to_float(uint16_t h)
+{
+  const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  uint32_t e = (h >> 10) & 0x1f;
+  uint32_t m = h & 0x3ff;
+  uint32_t x;
+  if (e == 0x1f) {
+    x = sign | 0x7f800000 | (m << 13);
+  }else if (e == 0) {
+    if (m == 0) {
+      x = sign;
+    }else {
+      // subnormal, normalized into a float
+      e = 113;
+      while (!(m & 0x400)) {
+        m <<= 1;
+        --e;
+      }
+      x = sign | (e << 23) | ((m & 0x3ff) << 13);
+    }
+  }else {
+    x = sign | ((e + 112) << 23) | (m << 13);
+  }
+  float value;
+  memcpy(&value, &x, 4);
+  return value;
+}
+
+// round to nearest even, NaN kept
+inline
+uint16_t float_to_bfloat16_bits(float value)
+{
+  uint32_t x;
+  memcpy(&x, &value, 4);
+  if ((x & 0x7fffffff) > 0x7f800000) {
+    return (uint16_t)((x >> 16) | 0x40);
+  }
+  x += 0x7fff + ((x >> 16) & 1);
+  return (uint16_t)(x >> 16);
+}
+
+inline
+float bfloat16_bits_to_float(uint16_t b)
+{
+  const uint32_t x = (uint32_t)b << 16;
+  float value;
+  memcpy(&value, &x, 4);
+  return value;
+}
+
+struct float16
+{
+  uint16_t bits;
+
+  float16() : bits(0) {}
+
+  explicit float16(float value) {
+#ifdef FLOAT16_F16C
+    bits = (uint16_t)_cvtss_sh(value, _MM_FROUND_TO_NEAREST_INT);
+#else
+    bits = float_to_half_bits(value);
+#endif
+  }
+
+  operator float() const {
+#ifdef FLOAT16_F16C
+    return _cvtsh_ss(bits);
+#else
+    return half_bits_to_float(bits);
+#endif
+  }
+};
+
+struct bfloat16
+{
+  uint16_t bits;
+
+  bfloat16() : bits(0) {}
+  explicit bfloat16(float value) : bits(float_to_bfloat16_bits(value)) {}
+  operator float() const { return bfloat16_bits_to_float(bits); }
+};
+
+// type the kernels sum T in
+template <typename T>
+struct Accumulator
+{
+  typedef T type;
+};
+
+template <>
+struct Accumulator<float16>
+{
+  typedef float type;
+};
+
+template <>
+struct Accumulator<bfloat16>
+{
+  typedef float type;
+};
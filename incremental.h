@@ -0,0 +1,281 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "cnn.h"
+#include "autotune.h"
+
+// Recomputes a chain of Conv2D / DepthwiseConv2D layers only where the input
+// frame changed. Each layer keeps its last output; a dirty input region is
+// projected through the layer's receptive field and only the output tiles it
+// touches are recomputed.
+
+inline
+int floor_div(int a, int b)
+{
+  assert(b > 0);
+  return (a >= 0) ? (a / b) : -((-a + b - 1) / b);
+}
+
+inline
+int ceil_div(int a, int b)
+{
+  return -floor_div(-a, b);
+}
+
+// output pixels whose receptive field overlaps in_rect
+inline
+Rect project_rect(const ConvLayer_int8& layer, const Rect& in_rect)
+{
+  if (in_rect.empty()) {
+    return Rect();
+  }
+  // out * stride - padding + f, 0 <= f < filter, lies inside [in0, in1)
+  const int fh = layer.filter_shape.height;
+  const int fw = layer.filter_shape.width;
+  Rect r;
+  r.y0 = ceil_div(in_rect.y0 + layer.padding_height - fh + 1, layer.stride_height);
+  r.y1 = floor_div(in_rect.y1 - 1 + layer.padding_height, layer.stride_height) + 1;
+  r.x0 = ceil_div(in_rect.x0 + layer.padding_width - fw + 1, layer.stride_width);
+  r.x1 = floor_div(in_rect.x1 - 1 + layer.padding_width, layer.stride_width) + 1;
+  return intersect(r, Rect(0, 0, layer.output_shape.width, layer.output_shape.height));
+}
+
+// Tile grid over one layer's output, one dirty flag per tile.
+class TileMask
+{
+public:
+  TileMask(int width = 0, int height = 0, int tile_size = 1)
+    :
+    width_(width),
+    height_(height),
+    tile_size_(tile_size),
+    cols_((width + tile_size - 1) / tile_size),
+    rows_((height + tile_size - 1) / tile_size),
+    flags_(cols_ * rows_, 0)
+  {
+  }
+
+  void clear() { std::fill(flags_.begin(), flags_.end(), 0); }
+  void fill() { std::fill(flags_.begin(), flags_.end(), 1); }
+
+  // marks every tile overlapping rect
+  void mark(const Rect& rect) {
+    if (rect.empty()) {
+      return;
+    }
+    const int tx1 = (rect.x1 + tile_size_ - 1) / tile_size_;
+    const int ty1 = (rect.y1 + tile_size_ - 1) / tile_size_;
+    for (int ty=rect.y0/tile_size_; ty<ty1; ++ty) {
+      for (int tx=rect.x0/tile_size_; tx<tx1; ++tx) {
+        flags_[ty * cols_ + tx] = 1;
+      }
+    }
+  }
+
+  int cols() const { return cols_; }
+  int rows() const { return rows_; }
+  bool dirty(int tx, int ty) const { return flags_[ty * cols_ + tx] != 0; }
+
+  Rect tile_rect(int tx, int ty) const {
+    return Rect(tx * tile_size_, ty * tile_size_,
+                std::min((tx + 1) * tile_size_, width_),
+                std::min((ty + 1) * tile_size_, height_));
+  }
+
+  int count() const {
+    int n = 0;
+    for (size_t i=0; i<flags_.size(); ++i) {
+      n += flags_[i];
+    }
+    return n;
+  }
+
+  // dirty tiles merged into horizontal runs
+  void get_rects(std::vector<Rect>& rects) const {
+    rects.clear();
+    for (int ty=0; ty<rows_; ++ty) {
+      for (int tx=0; tx<cols_; ) {
+        if (!dirty(tx, ty)) {
+          ++tx;
+          continue;
+        }
+        int tx_end = tx + 1;
+        while (tx_end < cols_ && dirty(tx_end, ty)) {
+          ++tx_end;
+        }
+        Rect r = tile_rect(tx, ty);
+        r.x1 = tile_rect(tx_end - 1, ty).x1;
+        rects.push_back(r);
+        tx = tx_end;
+      }
+    }
+  }
+
+private:
+  int width_;
+  int height_;
+  int tile_size_;
+  int cols_;
+  int rows_;
+  std::vector<uint8_t> flags_;
+};
+
+// Marks the tiles where cur differs from ref by more than threshold and
+// copies those tiles of cur into ref, so that ref always matches what the
+// cached activations were computed from.
+inline
+void diff_frames(
+  const Shape& shape,
+  int8_t* ref_values,
+  const int8_t* cur_values,
+  int threshold,
+  TileMask& mask)
+{
+  assert(shape.layout == TensorLayout::NHWC);
+  const int channel = shape.channel;
+  mask.clear();
+  for (int ty=0; ty<mask.rows(); ++ty) {
+    for (int tx=0; tx<mask.cols(); ++tx) {
+      const Rect r = mask.tile_rect(tx, ty);
+      const size_t row_bytes = (size_t)r.width() * channel;
+      bool changed = false;
+      for (int y=r.y0; y<r.y1 && !changed; ++y) {
+        const int offset = shape.offset(0, y, r.x0, 0);
+        const int8_t* a = ref_values + offset;
+        const int8_t* b = cur_values + offset;
+        if (memcmp(a, b, row_bytes) == 0) {
+          continue;
+        }
+        for (size_t i=0; i<row_bytes; ++i) {
+          if (abs(a[i] - b[i]) > threshold) {
+            changed = true;
+            break;
+          }
+        }
+      }
+      if (!changed) {
+        continue;
+      }
+      mask.mark(r);
+      for (int y=r.y0; y<r.y1; ++y) {
+        const int offset = shape.offset(0, y, r.x0, 0);
+        memcpy(ref_values + offset, cur_values + offset, row_bytes);
+      }
+    }
+  }
+}
+
+class IncrementalConvChain
+{
+public:
+  // threshold : per element difference treated as unchanged, 0 = exact
+  IncrementalConvChain(const std::vector<ConvLayer_int8>& layers, int tile_size = 8, int threshold = 0)
+    :
+    layers_(layers),
+    tile_size_(tile_size),
+    threshold_(threshold),
+    primed_(false),
+    last_macs_(0)
+  {
+    assert(!layers_.empty());
+    assert(tile_size_ > 0);
+    for (size_t i=1; i<layers_.size(); ++i) {
+      assert(layers_[i].input_shape.num_elements() == layers_[i-1].output_shape.num_elements());
+    }
+    const Shape& in = layers_[0].input_shape;
+    reference_.resize(in.num_elements());
+    input_mask_ = TileMask(in.width, in.height, tile_size_);
+    activations_.resize(layers_.size());
+    masks_.resize(layers_.size());
+    for (size_t i=0; i<layers_.size(); ++i) {
+      const Shape& out = layers_[i].output_shape;
+      activations_[i].resize(out.num_elements());
+      masks_[i] = TileMask(out.width, out.height, tile_size_);
+    }
+  }
+
+  // runs layer i's tiles with tunings[i]'s channel block (the dirty tiles
+  // replace its tiling), empty for the plain kernels
+  void set_tunings(const std::vector<ConvTuning>& tunings) {
+    assert(tunings.empty() || tunings.size() == layers_.size());
+    tunings_ = tunings;
+  }
+
+  // forgets the cached activations, next frame is computed in full
+  void reset() {
+    primed_ = false;
+  }
+
+  // returns the output of the last layer
+  const int8_t* process(const int8_t* frame) {
+    const Shape& in = layers_[0].input_shape;
+    if (!primed_) {
+      memcpy(&reference_[0], frame, reference_.size());
+      input_mask_.fill();
+      primed_ = true;
+    }else {
+      diff_frames(in, &reference_[0], frame, threshold_, input_mask_);
+    }
+
+    last_macs_ = 0;
+    const TileMask* in_mask = &input_mask_;
+    const int8_t* input = &reference_[0];
+    for (size_t i=0; i<layers_.size(); ++i) {
+      const ConvLayer_int8& layer = layers_[i];
+      TileMask& out_mask = masks_[i];
+      out_mask.clear();
+      in_mask->get_rects(rects_);
+      for (size_t j=0; j<rects_.size(); ++j) {
+        out_mask.mark(project_rect(layer, rects_[j]));
+      }
+      const int64_t macs_per_pixel = layer.macs() / ((int64_t)layer.output_shape.width * layer.output_shape.height);
+      int8_t* output = &activations_[i][0];
+      out_mask.get_rects(rects_);
+      for (size_t j=0; j<rects_.size(); ++j) {
+        const Rect& r = rects_[j];
+        TRACE_SCOPE_ARG("tile", i);
+        if (tunings_.empty()) {
+          run_layer(layer, input, output, r);
+        }else {
+          run_tile(layer, tunings_[i], input, output, r);
+        }
+        last_macs_ += macs_per_pixel * r.width() * r.height();
+      }
+      in_mask = &out_mask;
+      input = output;
+    }
+    return input;
+  }
+
+  const int8_t* output(size_t layer_idx) const { return &activations_[layer_idx][0]; }
+  const TileMask& input_mask() const { return input_mask_; }
+  const TileMask& output_mask(size_t layer_idx) const { return masks_[layer_idx]; }
+
+  // multiply-accumulates spent by the last process call
+  int64_t last_macs() const { return last_macs_; }
+
+  int64_t total_macs() const {
+    int64_t macs = 0;
+    for (size_t i=0; i<layers_.size(); ++i) {
+      macs += layers_[i].macs();
+    }
+    return macs;
+  }
+
+private:
+  std::vector<ConvLayer_int8> layers_;
+  std::vector<ConvTuning> tunings_;
+  int tile_size_;
+  int threshold_;
+  bool primed_;
+  int64_t last_macs_;
+  std::vector<int8_t> reference_;
+  TileMask input_mask_;
+  std::vector<std::vector<int8_t> > activations_;
+  std::vector<TileMask> masks_;
+  std::vector<Rect> rects_;
+};
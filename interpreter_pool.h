@@ -0,0 +1,171 @@
+#pragma once
+
+#include <assert.h>
+#include <memory>
+#include <algorithm>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include <tensorflow/lite/interpreter.h>
+#include <tensorflow/lite/kernels/register.h>
+#include <tensorflow/lite/model.h>
+
+// N interpreters built once over a single FlatBufferModel (mmap'd by
+// BuildFromFile), each with its tensors allocated and its thread count fixed,
+// handed out one request at a time.
+class InterpreterPool
+{
+public:
+  // Returns an interpreter to the pool when it goes out of scope.
+  class Handle
+  {
+  public:
+    Handle()
+      :
+      pool_(nullptr),
+      interpreter_(nullptr)
+    {
+    }
+
+    Handle(Handle&& other)
+      :
+      pool_(other.pool_),
+      interpreter_(other.interpreter_)
+    {
+      other.pool_ = nullptr;
+      other.interpreter_ = nullptr;
+    }
+
+    Handle& operator=(Handle&& other) {
+      if (this != &other) {
+        release();
+        pool_ = other.pool_;
+        interpreter_ = other.interpreter_;
+        other.pool_ = nullptr;
+        other.interpreter_ = nullptr;
+      }
+      return *this;
+    }
+
+    ~Handle() { release(); }
+
+    tflite::Interpreter* get() const { return interpreter_; }
+    tflite::Interpreter* operator->() const { return interpreter_; }
+    explicit operator bool() const { return interpreter_ != nullptr; }
+
+    void release() {
+      if (pool_) {
+        pool_->put(interpreter_);
+        pool_ = nullptr;
+        interpreter_ = nullptr;
+      }
+    }
+
+  private:
+    friend class InterpreterPool;
+    Handle(const Handle&);
+    Handle& operator=(const Handle&);
+
+    Handle(InterpreterPool* pool, tflite::Interpreter* interpreter)
+      :
+      pool_(pool),
+      interpreter_(interpreter)
+    {
+    }
+
+    InterpreterPool* pool_;
+    tflite::Interpreter* interpreter_;
+  };
+
+  // threads_per_interpreter : 0 = hardware threads divided among the pool
+  InterpreterPool(const char* model_path, size_t size, int threads_per_interpreter = 0)
+    :
+    threads_per_interpreter_(threads_per_interpreter)
+  {
+    assert(size > 0);
+    if (threads_per_interpreter_ <= 0) {
+      unsigned hw = std::thread::hardware_concurrency();
+      threads_per_interpreter_ = std::max(1, (int)(hw / size));
+    }
+    model_ = tflite::FlatBufferModel::BuildFromFile(model_path);
+    if (!model_) {
+      return;
+    }
+    for (size_t i=0; i<size; ++i) {
+      std::unique_ptr<tflite::Interpreter> interpreter;
+      tflite::InterpreterBuilder builder(*model_, resolver_);
+      if (builder(&interpreter) != kTfLiteOk || !interpreter) {
+        free_.clear();
+        interpreters_.clear();
+        return;
+      }
+      interpreter->SetNumThreads(threads_per_interpreter_);
+      if (interpreter->AllocateTensors() != kTfLiteOk) {
+        free_.clear();
+        interpreters_.clear();
+        return;
+      }
+      free_.push_back(interpreter.get());
+      interpreters_.push_back(std::move(interpreter));
+    }
+  }
+
+  ~InterpreterPool() {
+    // every handle must have been returned
+    assert(free_.size() == interpreters_.size());
+  }
+
+  // false if the model failed to load or an interpreter failed to build
+  bool ok() const { return !interpreters_.empty(); }
+
+  size_t size() const { return interpreters_.size(); }
+  int threads_per_interpreter() const { return threads_per_interpreter_; }
+  const tflite::FlatBufferModel& model() const { return *model_; }
+
+  // any interpreter, e.g. to read tensor shapes; not for running
+  const tflite::Interpreter* front() const { return interpreters_[0].get(); }
+
+  // blocks until an interpreter is free
+  Handle acquire() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (free_.empty()) {
+      cv_.wait(lock);
+    }
+    tflite::Interpreter* interpreter = free_.back();
+    free_.pop_back();
+    return Handle(this, interpreter);
+  }
+
+  // returns an empty handle if none is free
+  Handle try_acquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_.empty()) {
+      return Handle();
+    }
+    tflite::Interpreter* interpreter = free_.back();
+    free_.pop_back();
+    return Handle(this, interpreter);
+  }
+
+private:
+  InterpreterPool(const InterpreterPool&);
+  InterpreterPool& operator=(const InterpreterPool&);
+
+  void put(tflite::Interpreter* interpreter) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      free_.push_back(interpreter);
+    }
+    cv_.notify_one();
+  }
+
+  int threads_per_interpreter_;
+  std::unique_ptr<tflite::FlatBufferModel> model_;
+  tflite::ops::builtin::BuiltinOpResolver resolver_;
+  std::vector<std::unique_ptr<tflite::Interpreter> > interpreters_;
+  std::vector<tflite::Interpreter*> free_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+};
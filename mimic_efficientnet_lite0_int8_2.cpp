@@ -11,13 +11,7 @@
 #include "stb_image.h"
 
 #include "cnn.h"
-
-void offset_elements(uint8_t* input_data, int8_t* output_data, int num_elements, int offset)
-{
-  for (int i=0; i<num_elements; ++i) {
-    output_data[i] = input_data[i] - 128;
-  }
-}
+#include "preprocess.h"
 
 int calc_padding_same_size(int in_size, int stride)
 {
@@ -49,18 +43,15 @@ int main(int argc, char* argv[])
 
   const char* imageFilePath = argv[1];
 
-  int x,y,n;
-  unsigned char *data = stbi_load(imageFilePath, &x, &y, &n, 3);
-  if (!data) {
+  // Quantize node : uint8 -> int8 with the same scale
+  PreprocessParams params(Shape(1, 224, 224, 3), -128);
+  std::vector<int8_t> node0_output(params.output_shape.num_elements());
+  if (!preprocess_file(imageFilePath, params, &node0_output[0])) {
     printf("failed to load image : %s\n", imageFilePath);
     return 0;
   }
-
-  const int num_elements = x * y * n;
-  std::vector<int8_t> node0_output(num_elements);
-  int8_t* node0_output_data = &node0_output[0];
-  offset_elements(data, node0_output_data, num_elements, -128);
-  stbi_image_free(data);
+  const int x = params.output_shape.width;
+  const int y = params.output_shape.height;
 
   std::vector<int8_t> node1_input;
   std::vector<int8_t> node1_filter;
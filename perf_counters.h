@@ -0,0 +1,169 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+enum PerfCounter {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_L1D_MISSES,
+  PERF_LLC_MISSES,
+  PERF_BRANCH_MISSES,
+  PERF_NUM_COUNTERS,
+};
+
+// counts accumulated over one or more start / stop intervals
+struct PerfSample
+{
+  uint64_t values[PERF_NUM_COUNTERS];
+  uint64_t intervals;
+
+  PerfSample() { clear(); }
+
+  void clear() {
+    memset(values, 0, sizeof(values));
+    intervals = 0;
+  }
+
+  void add(const PerfSample& other) {
+    for (int i=0; i<PERF_NUM_COUNTERS; ++i) {
+      values[i] += other.values[i];
+    }
+    intervals += other.intervals;
+  }
+
+  double ipc() const {
+    return values[PERF_CYCLES] ? (double)values[PERF_INSTRUCTIONS] / values[PERF_CYCLES] : 0.0;
+  }
+
+  // misses per 1000 instructions
+  double mpki(PerfCounter counter) const {
+    return values[PERF_INSTRUCTIONS] ? 1000.0 * values[counter] / values[PERF_INSTRUCTIONS] : 0.0;
+  }
+};
+
+// A group of hardware counters (cycles, instructions, L1D / LLC read misses,
+// branch misses) counting the calling thread in user space, read together
+// around a region:
+//
+//   PerfCounters counters;
+//   counters.start();
+//   ... region ...
+//   counters.stop(sample);
+//
+// Counters the kernel or CPU does not provide (containers, VMs,
+// perf_event_paranoid > 2, non-Linux) are skipped; available() is false if
+// none could be opened, and start / stop then do nothing. Counts are scaled
+// when the kernel multiplexes the group. Threads started by the region (e.g.
+// TFLite workers) are not counted.
+class PerfCounters
+{
+public:
+  PerfCounters()
+    :
+    leader_(-1),
+    num_open_(0)
+  {
+    for (int i=0; i<PERF_NUM_COUNTERS; ++i) {
+      fds_[i] = -1;
+    }
+#ifdef __linux__
+    static const uint32_t types[PERF_NUM_COUNTERS] = {
+      PERF_TYPE_HARDWARE,
+      PERF_TYPE_HARDWARE,
+      PERF_TYPE_HW_CACHE,
+      PERF_TYPE_HW_CACHE,
+      PERF_TYPE_HARDWARE,
+    };
+    static const uint64_t configs[PERF_NUM_COUNTERS] = {
+      PERF_COUNT_HW_CPU_CYCLES,
+      PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+      PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+      PERF_COUNT_HW_BRANCH_MISSES,
+    };
+    for (int i=0; i<PERF_NUM_COUNTERS; ++i) {
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = types[i];
+      attr.config = configs[i];
+      attr.disabled = (leader_ == -1) ? 1 : 0;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      const int fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, leader_, 0);
+      if (fd < 0) {
+        continue;
+      }
+      if (leader_ == -1) {
+        leader_ = fd;
+      }
+      fds_[i] = fd;
+      order_[num_open_++] = i;
+    }
+#endif
+  }
+
+  ~PerfCounters() {
+#ifdef __linux__
+    for (int i=0; i<PERF_NUM_COUNTERS; ++i) {
+      if (fds_[i] >= 0 && fds_[i] != leader_) {
+        close(fds_[i]);
+      }
+    }
+    if (leader_ >= 0) {
+      close(leader_);
+    }
+#endif
+  }
+
+  bool available() const { return leader_ >= 0; }
+  bool has(PerfCounter counter) const { return fds_[counter] >= 0; }
+
+  void start() {
+#ifdef __linux__
+    if (leader_ >= 0) {
+      ioctl(leader_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+  }
+
+  // adds the counts since start() to sample
+  void stop(PerfSample& sample) {
+#ifdef __linux__
+    if (leader_ < 0) {
+      return;
+    }
+    ioctl(leader_, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    // nr, time_enabled, time_running, values[nr]
+    uint64_t data[3 + PERF_NUM_COUNTERS];
+    const ssize_t bytes = read(leader_, data, sizeof(data));
+    if (bytes < (ssize_t)(3 * sizeof(uint64_t)) || data[0] != (uint64_t)num_open_) {
+      return;
+    }
+    const double scale = (data[2] && data[2] < data[1]) ? (double)data[1] / data[2] : 1.0;
+    for (int i=0; i<num_open_; ++i) {
+      sample.values[order_[i]] += (uint64_t)(data[3 + i] * scale);
+    }
+    ++sample.intervals;
+#endif
+  }
+
+private:
+  PerfCounters(const PerfCounters&);
+  PerfCounters& operator=(const PerfCounters&);
+
+  int leader_;
+  int fds_[PERF_NUM_COUNTERS];
+  int order_[PERF_NUM_COUNTERS];  // counter of each value in a group read
+  int num_open_;
+};
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <limits>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "cnn.h"
+#include "autotune.h"
+#include "conv_plan.h"
+#include "spsc_queue.h"
+
+// Splits costs into num_stages contiguous groups minimizing the most
+// expensive group. Returns num_stages + 1 boundaries, group i being
+// [bounds[i], bounds[i+1]). num_stages is clamped to costs.size().
+inline
+std::vector<size_t> partition_costs(const std::vector<int64_t>& costs, size_t num_stages)
+{
+  const size_t n = costs.size();
+  assert(n > 0);
+  const size_t k = std::max((size_t)1, std::min(num_stages, n));
+  std::vector<int64_t> prefix(n + 1, 0);
+  for (size_t i=0; i<n; ++i) {
+    prefix[i + 1] = prefix[i] + costs[i];
+  }
+  // best[s][i] : lowest max cost splitting the first i costs into s groups
+  const int64_t inf = std::numeric_limits<int64_t>::max();
+  std::vector<std::vector<int64_t> > best(k + 1, std::vector<int64_t>(n + 1, inf));
+  std::vector<std::vector<size_t> > split(k + 1, std::vector<size_t>(n + 1, 0));
+  best[0][0] = 0;
+  for (size_t s=1; s<=k; ++s) {
+    for (size_t i=s; i<=n; ++i) {
+      for (size_t j=s-1; j<i; ++j) {
+        if (best[s - 1][j] == inf) {
+          continue;
+        }
+        const int64_t cost = std::max(best[s - 1][j], prefix[i] - prefix[j]);
+        if (cost < best[s][i]) {
+          best[s][i] = cost;
+          split[s][i] = j;
+        }
+      }
+    }
+  }
+  std::vector<size_t> bounds(k + 1);
+  bounds[k] = n;
+  for (size_t s=k; s>0; --s) {
+    bounds[s - 1] = split[s][bounds[s]];
+  }
+  return bounds;
+}
+
+// The cost of each layer LayerPipeline balances, in nanoseconds : the
+// measured time of its tuning when every layer has one, else the model's
+// estimate for the kernel run_layer runs, else (no model) its MACs.
+inline
+std::vector<int64_t> layer_costs(
+  const std::vector<ConvLayer_int8>& layers,
+  const std::vector<ConvTuning>& tunings,
+  const ConvCostModel* model)
+{
+  bool measured = !tunings.empty();
+  for (size_t i=0; i<tunings.size(); ++i) {
+    measured = measured && tunings[i].seconds > 0;
+  }
+  std::vector<int64_t> costs(layers.size());
+  for (size_t i=0; i<layers.size(); ++i) {
+    if (measured) {
+      costs[i] = (int64_t)(tunings[i].seconds * 1e9);
+    }else if (model) {
+      costs[i] = (int64_t)(model->estimate(layers[i], ConvAlgorithm::direct) * 1e9);
+    }else {
+      costs[i] = layers[i].macs();
+    }
+  }
+  return costs;
+}
+
+// pins a thread to one cpu; false if not supported
+inline
+bool pin_thread(std::thread& thread, int cpu)
+{
+#ifdef _WIN32
+  return SetThreadAffinityMask(thread.native_handle(), (DWORD_PTR)1 << cpu) != 0;
+#elif defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+  return false;
+#endif
+}
+
+// Runs a Conv2D / DepthwiseConv2D chain as a pipeline of stages of roughly
+// equal layer_costs, one thread per stage, frames handed between stages through
+// lock-free queues. With every stage busy, throughput is bound by the slowest
+// stage instead of the whole chain.
+//
+// push() and pop() are each meant for a single thread; frames come out in
+// the order they went in. Layers run as tunings says, on their stage's
+// thread.
+class LayerPipeline
+{
+public:
+  // depth : frames in flight, pin : stage i runs on cpu i, tunings : one per
+  // layer or empty for the plain kernels, model : estimates the untimed
+  // layers for layer_costs
+  LayerPipeline(
+    const std::vector<ConvLayer_int8>& layers,
+    size_t num_stages,
+    size_t depth = 0,
+    bool pin = false,
+    const std::vector<ConvTuning>& tunings = std::vector<ConvTuning>(),
+    const ConvCostModel* model = nullptr)
+    :
+    layers_(layers),
+    tunings_(tunings)
+  {
+    assert(!layers_.empty());
+    assert(tunings_.empty() || tunings_.size() == layers_.size());
+    bounds_ = partition_costs(layer_costs(layers_, tunings_, model), num_stages);
+    const size_t stages = bounds_.size() - 1;
+    if (depth < stages + 1) {
+      depth = stages + 1;
+    }
+
+    // each frame ping-pongs between two buffers sized for the largest
+    // activation crossing a stage boundary
+    size_t max_elements = layers_[0].input_shape.num_elements();
+    for (size_t s=0; s<stages; ++s) {
+      max_elements = std::max(max_elements, (size_t)layers_[bounds_[s + 1] - 1].output_shape.num_elements());
+    }
+    frames_.resize(depth);
+    free_.reset(new SpscQueue<Frame*>(depth));
+    for (size_t i=0; i<depth; ++i) {
+      frames_[i].buffers[0].resize(max_elements);
+      frames_[i].buffers[1].resize(max_elements);
+      frames_[i].current = 0;
+      frames_[i].seconds.resize(stages);
+      free_->push(&frames_[i]);
+    }
+    for (size_t s=0; s<=stages; ++s) {
+      queues_.push_back(std::unique_ptr<SpscQueue<Frame*> >(new SpscQueue<Frame*>(depth)));
+    }
+    busy_seconds_.assign(stages, 0.0);
+    const size_t hw = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t s=0; s<stages; ++s) {
+      threads_.push_back(std::thread(&LayerPipeline::run_stage, this, s));
+      if (pin) {
+        pin_thread(threads_.back(), (int)(s % hw));
+      }
+    }
+  }
+
+  ~LayerPipeline() {
+    queues_[0]->push(nullptr);
+    for (size_t s=0; s<threads_.size(); ++s) {
+      threads_[s].join();
+    }
+  }
+
+  size_t num_stages() const { return bounds_.size() - 1; }
+
+  // layers [stage_begin(s), stage_begin(s + 1)) run in stage s
+  size_t stage_begin(size_t s) const { return bounds_[s]; }
+
+  int64_t stage_macs(size_t s) const {
+    int64_t macs = 0;
+    for (size_t i=bounds_[s]; i<bounds_[s + 1]; ++i) {
+      macs += layers_[i].macs();
+    }
+    return macs;
+  }
+
+  // time stage s spent on the frames popped so far
+  double busy_seconds(size_t s) const { return busy_seconds_[s]; }
+
+  // copies a frame of the first layer's input; waits for a free frame
+  void push(const int8_t* input) {
+    Frame* frame;
+    free_->pop(frame);
+    frame->current = 0;
+    memcpy(&frame->buffers[0][0], input, layers_[0].input_shape.num_elements());
+    queues_[0]->push(frame);
+  }
+
+  // waits for the oldest frame and copies the last layer's output
+  void pop(int8_t* output) {
+    Frame* frame;
+    queues_.back()->pop(frame);
+    memcpy(output, &frame->buffers[frame->current][0], layers_.back().output_shape.num_elements());
+    for (size_t s=0; s<busy_seconds_.size(); ++s) {
+      busy_seconds_[s] += frame->seconds[s];
+    }
+    free_->push(frame);
+  }
+
+private:
+  LayerPipeline(const LayerPipeline&);
+  LayerPipeline& operator=(const LayerPipeline&);
+
+  struct Frame
+  {
+    std::vector<int8_t> buffers[2];
+    int current;
+    std::vector<double> seconds;  // per stage
+  };
+
+  void run_stage(size_t s) {
+    const std::vector<ConvLayer_int8> layers(layers_.begin() + bounds_[s], layers_.begin() + bounds_[s + 1]);
+    const std::vector<ConvTuning> tunings = tunings_.empty()
+      ? std::vector<ConvTuning>()
+      : std::vector<ConvTuning>(tunings_.begin() + bounds_[s], tunings_.begin() + bounds_[s + 1]);
+    std::vector<int8_t> scratch;
+    for (;;) {
+      Frame* frame;
+      queues_[s]->pop(frame);
+      if (!frame) {
+        break;
+      }
+      TRACE_SCOPE_ARG("stage", s);
+      const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+      run_layers(layers, tunings, 1, &frame->buffers[frame->current][0], &frame->buffers[frame->current ^ 1][0], scratch, nullptr);
+      frame->seconds[s] = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+      frame->current ^= 1;
+      queues_[s + 1]->push(frame);
+    }
+    // pass the stop on
+    if (s + 1 < num_stages()) {
+      queues_[s + 1]->push(nullptr);
+    }
+  }
+
+  std::vector<ConvLayer_int8> layers_;
+  std::vector<ConvTuning> tunings_;
+  std::vector<size_t> bounds_;
+  std::vector<Frame> frames_;
+  std::unique_ptr<SpscQueue<Frame*> > free_;
+  std::vector<std::unique_ptr<SpscQueue<Frame*> > > queues_;  // queues_[s] feeds stage s
+  std::vector<double> busy_seconds_;  // written by pop()
+  std::vector<std::thread> threads_;
+};
@@ -0,0 +1,364 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <limits>
+#include <vector>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PREPROCESS_SSE2
+#include <emmintrin.h>
+#endif
+
+// the including file may have pulled in stb_image.h with STB_IMAGE_IMPLEMENTATION
+#ifndef STBI_INCLUDE_STB_IMAGE_H
+#include "stb_image.h"
+#endif
+
+#include "cnn.h"
+
+// Decode -> resize -> zero point shift in one pass, written straight into a
+// model input tensor. Resampling is separable with a triangle filter whose
+// support widens with the downscale factor, so large sources do not alias.
+
+struct PreprocessParams
+{
+  Shape output_shape;   // input tensor, NHWC or NCHW, number must be 1
+  int32_t offset;       // added to each resampled pixel, -128 turns uint8 into int8
+  float center_crop;    // 0 : stretch the whole image
+                        // otherwise the fraction of the largest centered region
+                        // with the output aspect ratio that is kept (e.g. 0.875)
+
+  PreprocessParams(const Shape& output_shape = Shape(), int32_t offset = 0, float center_crop = 0.0f)
+    :
+    output_shape(output_shape),
+    offset(offset),
+    center_crop(center_crop)
+  {
+  }
+};
+
+namespace preprocess_detail {
+
+enum { PRECISION = 14 };
+
+// source taps of each output pixel along one axis
+struct Contributors
+{
+  std::vector<int> first;
+  std::vector<int> count;
+  std::vector<int16_t> weights; // max_count per output pixel
+  int max_count;
+
+  void compute(int src_size, float src_begin, float src_length, int dst_size) {
+    const float scale = src_length / dst_size;
+    const float filter_scale = std::max(scale, 1.0f);
+    const float support = filter_scale;
+    max_count = (int)ceilf(support) * 2 + 3;
+    first.resize(dst_size);
+    count.resize(dst_size);
+    weights.assign((size_t)dst_size * max_count, 0);
+    std::vector<float> w(max_count);
+    for (int i=0; i<dst_size; ++i) {
+      const float center = src_begin + (i + 0.5f) * scale;
+      int x0 = std::max((int)floorf(center - support), 0);
+      int x1 = std::min((int)ceilf(center + support), src_size);
+      float total = 0.0f;
+      int n = 0;
+      for (int x=x0; x<x1 && n<max_count; ++x) {
+        float d = fabsf((x + 0.5f - center) / filter_scale);
+        float v = (d < 1.0f) ? (1.0f - d) : 0.0f;
+        w[n++] = v;
+        total += v;
+      }
+      // trim zero weight taps at both ends
+      int b = 0;
+      while (b < n - 1 && w[b] == 0.0f) {
+        ++b;
+      }
+      int e = n;
+      while (e > b + 1 && w[e - 1] == 0.0f) {
+        --e;
+      }
+      if (total == 0.0f) {
+        // degenerate, nearest pixel
+        b = 0;
+        e = 1;
+        w[0] = total = 1.0f;
+        x0 = std::min(std::max((int)center, 0), src_size - 1);
+      }
+      first[i] = x0 + b;
+      count[i] = e - b;
+      int16_t* dst = &weights[(size_t)i * max_count];
+      int sum = 0;
+      for (int k=b; k<e; ++k) {
+        int q = (int)lrintf(w[k] / total * (1 << PRECISION));
+        dst[k - b] = (int16_t)q;
+        sum += q;
+      }
+      // keep the weights summing to exactly one
+      dst[(e - b) / 2] += (int16_t)((1 << PRECISION) - sum);
+    }
+  }
+};
+
+inline
+int clamp_pixel(int32_t v)
+{
+  v = (v + (1 << (PRECISION - 1))) >> PRECISION;
+  return std::min(std::max(v, 0), 255);
+}
+
+template <int C>
+uint32_t load_pixel(const uint8_t* p)
+{
+  uint32_t v = p[0];
+  if (C > 1) v |= (uint32_t)p[1] << 8;
+  if (C > 2) v |= (uint32_t)p[2] << 16;
+  if (C > 3) v |= (uint32_t)p[3] << 24;
+  return v;
+}
+
+#ifdef PREPROCESS_SSE2
+template <int C>
+void resample_horizontal_sse2(
+  const uint8_t* src,
+  const Contributors& cx, int dst_width,
+  uint8_t* dst)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i half = _mm_set1_epi32(1 << (PRECISION - 1));
+  for (int x=0; x<dst_width; ++x) {
+    const uint8_t* s = src + cx.first[x] * C;
+    const int16_t* w = &cx.weights[(size_t)x * cx.max_count];
+    const int n = cx.count[x];
+    __m128i acc = half;
+    int k = 0;
+    // two taps per madd : (p0c0, p1c0), (p0c1, p1c1), ...
+    for (; k+2<=n; k+=2) {
+      __m128i p0 = _mm_unpacklo_epi8(_mm_cvtsi32_si128(load_pixel<C>(s + k * C)), zero);
+      __m128i p1 = _mm_unpacklo_epi8(_mm_cvtsi32_si128(load_pixel<C>(s + (k + 1) * C)), zero);
+      __m128i ww = _mm_set1_epi32((uint16_t)w[k] | ((uint32_t)(uint16_t)w[k + 1] << 16));
+      acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpacklo_epi16(p0, p1), ww));
+    }
+    if (k < n) {
+      __m128i p0 = _mm_unpacklo_epi8(_mm_cvtsi32_si128(load_pixel<C>(s + k * C)), zero);
+      __m128i ww = _mm_set1_epi32((uint16_t)w[k]);
+      acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpacklo_epi16(p0, zero), ww));
+    }
+    acc = _mm_srai_epi32(acc, PRECISION);
+    acc = _mm_packs_epi32(acc, acc);
+    acc = _mm_packus_epi16(acc, acc);
+    uint32_t v = (uint32_t)_mm_cvtsi128_si32(acc);
+    for (int c=0; c<C; ++c) {
+      dst[x * C + c] = (uint8_t)(v >> (c * 8));
+    }
+  }
+}
+#endif
+
+// one source row -> dst_width pixels
+inline
+void resample_horizontal(
+  const uint8_t* src, int channels,
+  const Contributors& cx, int dst_width,
+  uint8_t* dst)
+{
+#ifdef PREPROCESS_SSE2
+  switch (channels) {
+  case 1: resample_horizontal_sse2<1>(src, cx, dst_width, dst); return;
+  case 2: resample_horizontal_sse2<2>(src, cx, dst_width, dst); return;
+  case 3: resample_horizontal_sse2<3>(src, cx, dst_width, dst); return;
+  case 4: resample_horizontal_sse2<4>(src, cx, dst_width, dst); return;
+  }
+#endif
+  for (int x=0; x<dst_width; ++x) {
+    const uint8_t* s = src + cx.first[x] * channels;
+    const int16_t* w = &cx.weights[(size_t)x * cx.max_count];
+    const int n = cx.count[x];
+    for (int c=0; c<channels; ++c) {
+      int32_t sum = 0;
+      for (int k=0; k<n; ++k) {
+        sum += w[k] * s[k * channels + c];
+      }
+      dst[x * channels + c] = (uint8_t)clamp_pixel(sum);
+    }
+  }
+}
+
+template <typename T>
+T saturate(int v)
+{
+  v = std::max(v, (int)std::numeric_limits<T>::min());
+  v = std::min(v, (int)std::numeric_limits<T>::max());
+  return (T)v;
+}
+
+#ifdef PREPROCESS_SSE2
+inline __m128i pack_output(__m128i lo, __m128i hi, uint8_t*) { return _mm_packus_epi16(lo, hi); }
+inline __m128i pack_output(__m128i lo, __m128i hi, int8_t*) { return _mm_packs_epi16(lo, hi); }
+#endif
+
+// weighted sum of rows, + offset, saturated to T
+template <typename T>
+void resample_vertical(
+  const uint8_t* const* rows, const int16_t* w, int n,
+  int len, int32_t offset,
+  T* dst)
+{
+  int i = 0;
+#ifdef PREPROCESS_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i half = _mm_set1_epi32(1 << (PRECISION - 1));
+  const __m128i max_pixel = _mm_set1_epi16(255);
+  const __m128i offset16 = _mm_set1_epi16((int16_t)offset);
+  for (; i+16<=len; i+=16) {
+    __m128i acc0 = half, acc1 = half, acc2 = half, acc3 = half;
+    for (int k=0; k<n; k+=2) {
+      __m128i a = _mm_loadu_si128((const __m128i*)(rows[k] + i));
+      __m128i b;
+      __m128i ww;
+      if (k + 1 < n) {
+        b = _mm_loadu_si128((const __m128i*)(rows[k + 1] + i));
+        ww = _mm_set1_epi32((uint16_t)w[k] | ((uint32_t)(uint16_t)w[k + 1] << 16));
+      }else {
+        b = zero;
+        ww = _mm_set1_epi32((uint16_t)w[k]);
+      }
+      __m128i ab_lo = _mm_unpacklo_epi8(a, b);
+      __m128i ab_hi = _mm_unpackhi_epi8(a, b);
+      acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(_mm_unpacklo_epi8(ab_lo, zero), ww));
+      acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(_mm_unpackhi_epi8(ab_lo, zero), ww));
+      acc2 = _mm_add_epi32(acc2, _mm_madd_epi16(_mm_unpacklo_epi8(ab_hi, zero), ww));
+      acc3 = _mm_add_epi32(acc3, _mm_madd_epi16(_mm_unpackhi_epi8(ab_hi, zero), ww));
+    }
+    __m128i lo = _mm_packs_epi32(_mm_srai_epi32(acc0, PRECISION), _mm_srai_epi32(acc1, PRECISION));
+    __m128i hi = _mm_packs_epi32(_mm_srai_epi32(acc2, PRECISION), _mm_srai_epi32(acc3, PRECISION));
+    lo = _mm_min_epi16(_mm_max_epi16(lo, zero), max_pixel);
+    hi = _mm_min_epi16(_mm_max_epi16(hi, zero), max_pixel);
+    lo = _mm_adds_epi16(lo, offset16);
+    hi = _mm_adds_epi16(hi, offset16);
+    _mm_storeu_si128((__m128i*)(dst + i), pack_output(lo, hi, dst));
+  }
+#endif
+  for (; i<len; ++i) {
+    int32_t sum = 0;
+    for (int k=0; k<n; ++k) {
+      sum += w[k] * rows[k][i];
+    }
+    dst[i] = saturate<T>(clamp_pixel(sum) + offset);
+  }
+}
+
+inline
+void crop_region(
+  int src_width, int src_height,
+  int dst_width, int dst_height,
+  float center_crop,
+  float& x0, float& y0, float& width, float& height)
+{
+  x0 = 0.0f;
+  y0 = 0.0f;
+  width = (float)src_width;
+  height = (float)src_height;
+  if (center_crop <= 0.0f) {
+    return;
+  }
+  const float dst_aspect = (float)dst_width / dst_height;
+  if (width / height > dst_aspect) {
+    width = height * dst_aspect;
+  }else {
+    height = width / dst_aspect;
+  }
+  width *= center_crop;
+  height *= center_crop;
+  x0 = (src_width - width) * 0.5f;
+  y0 = (src_height - height) * 0.5f;
+}
+
+} // namespace preprocess_detail
+
+// src : interleaved pixels with output_shape.channel components
+template <typename T>
+void preprocess_image(
+  const uint8_t* src, int src_width, int src_height,
+  const PreprocessParams& params,
+  T* dst)
+{
+  using namespace preprocess_detail;
+  const Shape& shape = params.output_shape;
+  assert(shape.number == 1);
+  assert(src_width > 0 && src_height > 0);
+  const int channels = shape.channel;
+  const int dst_width = shape.width;
+  const int dst_height = shape.height;
+  const int row_len = dst_width * channels;
+
+  float crop_x, crop_y, crop_width, crop_height;
+  crop_region(src_width, src_height, dst_width, dst_height, params.center_crop,
+              crop_x, crop_y, crop_width, crop_height);
+  Contributors cx;
+  Contributors cy;
+  cx.compute(src_width, crop_x, crop_width, dst_width);
+  cy.compute(src_height, crop_y, crop_height, dst_height);
+
+  // horizontally resampled rows, only those some output row reads
+  const int row_begin = cy.first[0];
+  const int row_end = cy.first[dst_height - 1] + cy.count[dst_height - 1];
+  std::vector<uint8_t> tmp((size_t)(row_end - row_begin) * row_len);
+  const size_t src_stride = (size_t)src_width * channels;
+  for (int y=row_begin; y<row_end; ++y) {
+    resample_horizontal(src + y * src_stride, channels, cx, dst_width,
+                        &tmp[(size_t)(y - row_begin) * row_len]);
+  }
+
+  std::vector<T> planar_row;
+  if (shape.layout == TensorLayout::NCHW) {
+    planar_row.resize(row_len);
+  }
+  std::vector<const uint8_t*> rows(cy.max_count);
+  for (int y=0; y<dst_height; ++y) {
+    const int n = cy.count[y];
+    for (int k=0; k<n; ++k) {
+      rows[k] = &tmp[(size_t)(cy.first[y] + k - row_begin) * row_len];
+    }
+    const int16_t* w = &cy.weights[(size_t)y * cy.max_count];
+    if (shape.layout == TensorLayout::NHWC) {
+      resample_vertical(&rows[0], w, n, row_len, params.offset,
+                        dst + shape.offset(0, y, 0, 0));
+    }else {
+      resample_vertical(&rows[0], w, n, row_len, params.offset, &planar_row[0]);
+      for (int x=0; x<dst_width; ++x) {
+        for (int c=0; c<channels; ++c) {
+          dst[shape.offset(0, y, x, c)] = planar_row[x * channels + c];
+        }
+      }
+    }
+  }
+}
+
+template <typename T>
+bool preprocess_file(
+  const char* filepath,
+  const PreprocessParams& params,
+  T* dst)
+{
+  // let the JPEG decoder drop to 1/2, 1/4 or 1/8 resolution as long as the
+  // (cropped) source still covers the output
+  int min_x = params.output_shape.width;
+  int min_y = params.output_shape.height;
+  if (params.center_crop > 0.0f) {
+    min_x = (int)ceilf(min_x / params.center_crop);
+    min_y = (int)ceilf(min_y / params.center_crop);
+  }
+  int x, y, n;
+  unsigned char* data = stbi_load_scaled(filepath, &x, &y, &n, params.output_shape.channel, min_x, min_y);
+  if (!data) {
+    return false;
+  }
+  preprocess_image(data, x, y, params, dst);
+  stbi_image_free(data);
+  return true;
+}
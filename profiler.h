@@ -0,0 +1,466 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <chrono>
+
+#include <tensorflow/lite/interpreter.h>
+#include <tensorflow/lite/core/api/profiler.h>
+#include <tensorflow/lite/builtin_ops.h>
+#include <tensorflow/lite/builtin_op_data.h>
+
+#include "cnn.h"
+#include "tflite_util.h"
+#include "trace.h"
+#include "perf_counters.h"
+#include "roofline.h"
+#include "conv_plan.h"
+
+// Accumulates the wall time of each node's Invoke. Attach it with
+// interpreter->SetProfiler(); TFLite reports every operator as an
+// OPERATOR_INVOKE_EVENT with the node index as metadata. While tracing is on
+// every node also becomes a trace event named after its op. With counters
+// given, which must belong to the thread calling Invoke, each node's
+// hardware counts are accumulated too.
+class NodeProfiler : public tflite::Profiler
+{
+public:
+  explicit NodeProfiler(size_t num_nodes, PerfCounters* counters = nullptr)
+    :
+    counters_(counters),
+    seconds_(num_nodes, 0.0),
+    counts_(num_nodes, 0),
+    samples_(num_nodes)
+  {
+  }
+
+  uint32_t BeginEvent(const char* tag, EventType event_type,
+                      int64_t event_metadata1, int64_t event_metadata2) override {
+    if (event_type != EventType::OPERATOR_INVOKE_EVENT
+      || event_metadata1 < 0 || (size_t)event_metadata1 >= seconds_.size()) {
+      return 0;
+    }
+    Open e;
+    e.tag = tag;
+    e.node = (size_t)event_metadata1;
+    e.trace_begin = trace_enabled() ? trace_now() : 0;
+    e.start = std::chrono::steady_clock::now();
+    open_.push_back(e);
+    if (counters_) {
+      counters_->start();
+    }
+    return (uint32_t)open_.size();
+  }
+
+  void EndEvent(uint32_t event_handle) override {
+    if (event_handle == 0) {
+      return;
+    }
+    const Open& e = open_[event_handle - 1];
+    if (counters_) {
+      counters_->stop(samples_[e.node]);
+    }
+    seconds_[e.node] += std::chrono::duration<double>(std::chrono::steady_clock::now() - e.start).count();
+    ++counts_[e.node];
+    if (trace_enabled()) {
+      trace_complete(e.tag ? e.tag : "node", e.node, e.trace_begin, trace_now());
+    }
+    // operator events do not nest, reuse the slots
+    if (event_handle == open_.size()) {
+      open_.pop_back();
+    }
+  }
+
+  void reset() {
+    std::fill(seconds_.begin(), seconds_.end(), 0.0);
+    std::fill(counts_.begin(), counts_.end(), 0);
+    for (size_t i=0; i<samples_.size(); ++i) {
+      samples_[i].clear();
+    }
+  }
+
+  // total over the runs since reset()
+  double seconds(size_t node) const { return seconds_[node]; }
+  size_t count(size_t node) const { return counts_[node]; }
+  const PerfSample& counters(size_t node) const { return samples_[node]; }
+
+private:
+  struct Open
+  {
+    const char* tag;  // op name, static in TFLite
+    size_t node;
+    int64_t trace_begin;
+    std::chrono::steady_clock::time_point start;
+  };
+
+  PerfCounters* counters_;
+  std::vector<Open> open_;
+  std::vector<double> seconds_;
+  std::vector<size_t> counts_;
+  std::vector<PerfSample> samples_;
+};
+
+inline
+const char* builtin_op_name(int32_t builtin_code)
+{
+  switch (builtin_code) {
+  case kTfLiteBuiltinAdd: return "Add";
+  case kTfLiteBuiltinAveragePool2d: return "AveragePool2D";
+  case kTfLiteBuiltinConcatenation: return "Concatenation";
+  case kTfLiteBuiltinConv2d: return "Conv2D";
+  case kTfLiteBuiltinDepthwiseConv2d: return "DepthwiseConv2D";
+  case kTfLiteBuiltinDequantize: return "Dequantize";
+  case kTfLiteBuiltinFullyConnected: return "FullyConnected";
+  case kTfLiteBuiltinMaxPool2d: return "MaxPool2D";
+  case kTfLiteBuiltinMean: return "Mean";
+  case kTfLiteBuiltinMul: return "Mul";
+  case kTfLiteBuiltinPad: return "Pad";
+  case kTfLiteBuiltinQuantize: return "Quantize";
+  case kTfLiteBuiltinRelu: return "Relu";
+  case kTfLiteBuiltinRelu6: return "Relu6";
+  case kTfLiteBuiltinReshape: return "Reshape";
+  case kTfLiteBuiltinSoftmax: return "Softmax";
+  default: return "?";
+  }
+}
+
+inline
+std::string shape_string(const TfLiteIntArray* dims)
+{
+  std::string s;
+  char buff[16];
+  for (int i=0; i<dims->size; ++i) {
+    sprintf(buff, i ? "x%d" : "%d", dims->data[i]);
+    s += buff;
+  }
+  return s;
+}
+
+// multiply-accumulates of a node, 0 for ops that are not counted
+inline
+int64_t node_macs(const tflite::Interpreter* interpreter, const TfLiteNode& node, int32_t builtin_code)
+{
+  const TfLiteTensor* output = interpreter->tensor(node.outputs->data[0]);
+  int64_t output_elements = 1;
+  for (int i=0; i<output->dims->size; ++i) {
+    output_elements *= output->dims->data[i];
+  }
+  switch (builtin_code) {
+  case kTfLiteBuiltinConv2d: {
+    // filter : out_channels x h x w x in_channels
+    const TfLiteIntArray* f = interpreter->tensor(node.inputs->data[1])->dims;
+    return output_elements * f->data[1] * f->data[2] * f->data[3];
+  }
+  case kTfLiteBuiltinDepthwiseConv2d: {
+    const TfLiteIntArray* f = interpreter->tensor(node.inputs->data[1])->dims;
+    return output_elements * f->data[1] * f->data[2];
+  }
+  case kTfLiteBuiltinFullyConnected: {
+    // weights : units x depth
+    const TfLiteIntArray* w = interpreter->tensor(node.inputs->data[1])->dims;
+    return output_elements * w->data[1];
+  }
+  default:
+    return 0;
+  }
+}
+
+// MACs and bytes of a node, each tensor read or written once: input 0 as
+// the activation, the remaining inputs (filter, bias) as weights
+inline
+LayerTraffic node_traffic(const tflite::Interpreter* interpreter, const TfLiteNode& node, int32_t builtin_code)
+{
+  LayerTraffic t;
+  t.macs = node_macs(interpreter, node, builtin_code);
+  for (int i=0; i<node.inputs->size; ++i) {
+    const int idx = node.inputs->data[i];
+    if (idx < 0) {
+      continue; // optional input, e.g. no bias
+    }
+    const int64_t bytes = interpreter->tensor(idx)->bytes;
+    if (i == 0) {
+      t.input_bytes = bytes;
+    }else {
+      t.weight_bytes += bytes;
+    }
+  }
+  for (int i=0; i<node.outputs->size; ++i) {
+    t.output_bytes += interpreter->tensor(node.outputs->data[i])->bytes;
+  }
+  return t;
+}
+
+// true if the node has a cnn.h kernel: a per-channel int8 Conv2D /
+// DepthwiseConv2D without dilation, with int8 activations or int16 ones
+// (16x8, int64 bias) for cnn_int16.h
+inline
+bool has_native_kernel(const tflite::Interpreter* interpreter, const TfLiteNode& node, int32_t builtin_code)
+{
+  if (builtin_code != kTfLiteBuiltinConv2d && builtin_code != kTfLiteBuiltinDepthwiseConv2d) {
+    return false;
+  }
+  if (node.inputs->size != 3 || node.inputs->data[2] < 0) {
+    return false;
+  }
+  const TfLiteTensor* input = interpreter->tensor(node.inputs->data[0]);
+  const TfLiteTensor* filter = interpreter->tensor(node.inputs->data[1]);
+  const TfLiteTensor* bias = interpreter->tensor(node.inputs->data[2]);
+  const TfLiteTensor* output = interpreter->tensor(node.outputs->data[0]);
+  const bool int8 = input->type == kTfLiteInt8 && output->type == kTfLiteInt8;
+  const bool int16 = input->type == kTfLiteInt16 && output->type == kTfLiteInt16
+    && bias->type == kTfLiteInt64 && input->params.zero_point == 0 && output->params.zero_point == 0;
+  if (!(int8 || int16) || filter->type != kTfLiteInt8
+    || filter->quantization.type != kTfLiteAffineQuantization) {
+    return false;
+  }
+  // the kernels take one multiplier per output channel, a per-tensor scale
+  // is left to TFLite
+  const TfLiteAffineQuantization* filter_quantization = (const TfLiteAffineQuantization*)filter->quantization.params;
+  if (!filter_quantization || !filter_quantization->scale
+    || filter_quantization->scale->size != output->dims->data[output->dims->size - 1]) {
+    return false;
+  }
+  if (builtin_code == kTfLiteBuiltinConv2d) {
+    const TfLiteConvParams* params = (const TfLiteConvParams*)node.builtin_data;
+    return params->dilation_width_factor == 1 && params->dilation_height_factor == 1;
+  }
+  const TfLiteDepthwiseConvParams* params = (const TfLiteDepthwiseConvParams*)node.builtin_data;
+  return params->dilation_width_factor == 1 && params->dilation_height_factor == 1;
+}
+
+struct NodeProfile
+{
+  int node;
+  const char* op;
+  std::string input_shape;
+  std::string output_shape;
+  int64_t macs;
+  double seconds;         // average per Invoke
+  const char* algorithm;  // conv_plan.h choice, "sparse" or "int16", nullptr if no native kernel
+  double estimated_seconds;  // cost model estimate, 0 for sparse and int16 nodes
+  double native_seconds;  // planned kernel on the same input, < 0 if none
+  PerfSample counters;    // over all iterations, empty without counters
+  PerfSample native_counters;
+  // 1x1 layers : groups of 8 input channels all at the zero point, and
+  // gemm_1x1 with and without skipping them; seconds < 0 for other nodes
+  double zero_fraction;
+  double gemm_seconds;
+  double skip_seconds;
+};
+
+// average seconds of iterations calls of run(), the counters read around
+// each call into sample when given
+template <typename Run>
+double time_runs(const Run& run, int iterations, PerfCounters* counters = nullptr, PerfSample* sample = nullptr)
+{
+  const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  for (int j=0; j<iterations; ++j) {
+    if (counters) {
+      counters->start();
+    }
+    run();
+    if (counters) {
+      counters->stop(*sample);
+    }
+  }
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() / iterations;
+}
+
+// average seconds of iterations runs of the plan, with the counters as
+// time_runs
+inline
+double time_conv(const ConvLayer_int8& layer, const ConvPlan& plan, const int8_t* input, int8_t* output, int iterations,
+                 PerfCounters* counters = nullptr, PerfSample* sample = nullptr)
+{
+  return time_runs([&]() { run_conv(layer, plan, input, output); }, iterations, counters, sample);
+}
+
+// Runs Invoke iterations times (after one warm-up run) with a NodeProfiler
+// attached, then times the native kernel of every supported node on that
+// node's input as left by the last run. The kernel is the one plan_conv
+// picks with a cost model calibrated on those layers. The input tensor must
+// be filled. Conv2D nodes with a block sparse filter run the cnn_sparse.h
+// kernel instead and 16x8 nodes the cnn_int16.h ones, with no estimate.
+// On 1x1 layers gemm_1x1 is also timed skipping the input channels a ReLU
+// clamped to the zero point, which only real inputs show.
+// use_counters reads hardware counters around every node as well, at the
+// cost of a few system calls per node.
+inline
+std::vector<NodeProfile> profile_nodes(tflite::Interpreter* interpreter, int iterations, bool use_counters = false)
+{
+  assert(iterations >= 1);
+  const tflite::Subgraph& graph = interpreter->primary_subgraph();
+  const auto& nodes = graph.nodes_and_registration();
+  PerfCounters perf;
+  PerfCounters* counters = (use_counters && perf.available()) ? &perf : nullptr;
+  if (use_counters && !counters) {
+    printf("hardware counters unavailable, profiling time only\n");
+  }
+  NodeProfiler profiler(graph.nodes_size(), counters);
+  tflite::Profiler* prev = interpreter->GetProfiler();
+  interpreter->Invoke();
+  interpreter->SetProfiler(&profiler);
+  for (int i=0; i<iterations; ++i) {
+    interpreter->Invoke();
+  }
+  interpreter->SetProfiler(prev);
+
+  std::vector<NodeProfile> profiles;
+  std::vector<size_t> native;
+  std::vector<ConvLayer_int8> layers;
+  std::vector<size_t> native16;
+  std::vector<ConvLayer_int16> layers16;
+  const std::vector<int>& plan = interpreter->execution_plan();
+  for (size_t i=0; i<plan.size(); ++i) {
+    const int idx = plan[i];
+    const TfLiteNode& node = nodes[idx].first;
+    const int32_t code = nodes[idx].second.builtin_code;
+    NodeProfile p;
+    p.node = idx;
+    p.op = builtin_op_name(code);
+    p.input_shape = shape_string(interpreter->tensor(node.inputs->data[0])->dims);
+    p.output_shape = shape_string(interpreter->tensor(node.outputs->data[0])->dims);
+    p.macs = node_macs(interpreter, node, code);
+    p.seconds = profiler.count(idx) ? profiler.seconds(idx) / profiler.count(idx) : 0.0;
+    p.algorithm = nullptr;
+    p.estimated_seconds = 0.0;
+    p.native_seconds = -1.0;
+    p.zero_fraction = 0.0;
+    p.gemm_seconds = -1.0;
+    p.skip_seconds = -1.0;
+    p.counters = profiler.counters(idx);
+    if (has_native_kernel(interpreter, node, code)) {
+      if (interpreter->tensor(node.inputs->data[0])->type == kTfLiteInt16) {
+        layers16.push_back(ConvLayer_int16());
+        load_layer(interpreter, idx, layers16.back());
+        native16.push_back(profiles.size());
+      }else {
+        layers.push_back(ConvLayer_int8());
+        load_layer(interpreter, idx, layers.back());
+        native.push_back(profiles.size());
+      }
+    }
+    profiles.push_back(p);
+  }
+
+  ConvCostModel model;
+  model.calibrate(layers);
+  for (size_t i=0; i<native.size(); ++i) {
+    NodeProfile& p = profiles[native[i]];
+    const ConvLayer_int8& layer = layers[i];
+    const ConvPlan conv_plan = plan_conv(layer, model);
+    p.algorithm = conv_algorithm_name(conv_plan.algorithm);
+    p.estimated_seconds = conv_plan.estimated_seconds;
+    const TfLiteNode& node = nodes[p.node].first;
+    const int8_t* input = tflite::GetTensorData<int8_t>(interpreter->tensor(node.inputs->data[0]));
+    std::vector<int8_t> output(layer.output_shape.num_elements());
+    BlockSparseFilter sparse;
+    if (layer.type == LayerType::Conv2D && load_sparse_filter(interpreter, node, sparse)) {
+      // a pruned filter runs on the sparse kernel instead of the plan
+      p.algorithm = "sparse";
+      p.estimated_seconds = 0.0;
+      run_layer(layer, sparse, input, &output[0]);
+      p.native_seconds = time_runs([&]() { run_layer(layer, sparse, input, &output[0]); },
+                                   iterations, counters, &p.native_counters);
+    }else {
+      run_conv(layer, conv_plan, input, &output[0]);
+      p.native_seconds = time_conv(layer, conv_plan, input, &output[0], iterations, counters, &p.native_counters);
+    }
+
+    if (conv_algorithm_applicable(layer, ConvAlgorithm::gemm_1x1)) {
+      ConvPlan gemm = make_conv_plan(layer, ConvAlgorithm::gemm_1x1);
+      p.zero_fraction = zero_group_fraction(layer, input);
+      p.gemm_seconds = time_conv(layer, gemm, input, &output[0], iterations);
+      gemm.skip_zero_inputs = true;
+      run_conv(layer, gemm, input, &output[0]);
+      p.skip_seconds = time_conv(layer, gemm, input, &output[0], iterations);
+    }
+  }
+  for (size_t i=0; i<native16.size(); ++i) {
+    NodeProfile& p = profiles[native16[i]];
+    const ConvLayer_int16& layer = layers16[i];
+    p.algorithm = "int16";
+    const TfLiteNode& node = nodes[p.node].first;
+    const int16_t* input = tflite::GetTensorData<int16_t>(interpreter->tensor(node.inputs->data[0]));
+    std::vector<int16_t> output(layer.output_shape.num_elements());
+    run_layer(layer, input, &output[0]);
+    p.native_seconds = time_runs([&]() { run_layer(layer, input, &output[0]); },
+                                 iterations, counters, &p.native_counters);
+  }
+  return profiles;
+}
+
+// one row per node, GOPS counting a MAC as 2 ops. With counters, IPC and
+// misses per 1000 instructions follow the TFLite timing.
+inline
+void print_profile(const std::vector<NodeProfile>& profiles, FILE* out = stdout)
+{
+  double total = 0;
+  double native_total = 0;
+  double tflite_native_total = 0;
+  double gemm_total = 0;
+  double skip_total = 0;
+  bool counters = false;
+  for (size_t i=0; i<profiles.size(); ++i) {
+    counters |= (profiles[i].counters.intervals > 0);
+    total += profiles[i].seconds;
+    if (profiles[i].native_seconds >= 0) {
+      native_total += profiles[i].native_seconds;
+      tflite_native_total += profiles[i].seconds;
+    }
+    if (profiles[i].skip_seconds >= 0) {
+      gemm_total += profiles[i].gemm_seconds;
+      skip_total += profiles[i].skip_seconds;
+    }
+  }
+  fprintf(out, "%4s %-16s %-16s %-16s %12s %9s %7s %6s",
+          "node", "op", "input", "output", "MACs", "ms", "GOPS", "%");
+  if (counters) {
+    fprintf(out, " %5s %7s %7s %7s", "IPC", "L1D/ki", "LLC/ki", "br/ki");
+  }
+  fprintf(out, " %-8s %7s %9s %7s %7s", "algo", "est ms", "native ms", "GOPS", "speedup");
+  if (counters) {
+    fprintf(out, " %5s %7s", "IPC", "L1D/ki");
+  }
+  fprintf(out, " %6s %7s", "zero%", "skip");
+  fprintf(out, "\n");
+  for (size_t i=0; i<profiles.size(); ++i) {
+    const NodeProfile& p = profiles[i];
+    const double gops = p.seconds > 0 ? 2.0 * p.macs / p.seconds * 1e-9 : 0.0;
+    fprintf(out, "%4d %-16s %-16s %-16s %12lld %9.3f %7.2f %6.2f",
+            p.node, p.op, p.input_shape.c_str(), p.output_shape.c_str(), (long long)p.macs,
+            p.seconds * 1e3, gops, total > 0 ? 100.0 * p.seconds / total : 0.0);
+    if (counters) {
+      const PerfSample& c = p.counters;
+      fprintf(out, " %5.2f %7.2f %7.2f %7.2f",
+              c.ipc(), c.mpki(PERF_L1D_MISSES), c.mpki(PERF_LLC_MISSES), c.mpki(PERF_BRANCH_MISSES));
+    }
+    if (p.native_seconds >= 0) {
+      const double native_gops = p.native_seconds > 0 ? 2.0 * p.macs / p.native_seconds * 1e-9 : 0.0;
+      fprintf(out, " %-8s %7.3f %9.3f %7.2f %6.2fx",
+              p.algorithm, p.estimated_seconds * 1e3, p.native_seconds * 1e3, native_gops,
+              p.native_seconds > 0 ? p.seconds / p.native_seconds : 0.0);
+      if (counters) {
+        const PerfSample& c = p.native_counters;
+        fprintf(out, " %5.2f %7.2f", c.ipc(), c.mpki(PERF_L1D_MISSES));
+      }
+    }
+    if (p.skip_seconds >= 0) {
+      // gemm_1x1 time over the time skipping zero inputs
+      fprintf(out, " %6.1f %6.2fx", 100.0 * p.zero_fraction,
+              p.skip_seconds > 0 ? p.gemm_seconds / p.skip_seconds : 0.0);
+    }
+    fprintf(out, "\n");
+  }
+  fprintf(out, "total %.3f ms per Invoke", total * 1e3);
+  if (native_total > 0) {
+    fprintf(out, ", nodes with a native kernel : TFLite %.3f ms, native %.3f ms",
+            tflite_native_total * 1e3, native_total * 1e3);
+  }
+  if (skip_total > 0) {
+    fprintf(out, ", 1x1 gemm %.3f ms, skipping zero inputs %.3f ms", gemm_total * 1e3, skip_total * 1e3);
+  }
+  fprintf(out, "\n");
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+// Data a layer moves and the work it does, to place it on a roofline.
+struct LayerTraffic
+{
+  int64_t macs;
+  int64_t weight_bytes;   // filter and bias
+  int64_t input_bytes;
+  int64_t output_bytes;
+
+  LayerTraffic()
+    :
+    macs(0),
+    weight_bytes(0),
+    input_bytes(0),
+    output_bytes(0)
+  {
+  }
+
+  int64_t bytes() const { return weight_bytes + input_bytes + output_bytes; }
+
+  // ops (2 per MAC) per byte, assuming every byte is moved once
+  double intensity() const {
+    return bytes() ? 2.0 * macs / bytes() : 0.0;
+  }
+};
+
+// Compute roof and memory roof. A layer whose intensity is above the ridge
+// point can at best reach peak_gops (compute bound); below it, bandwidth
+// times intensity (memory bound).
+struct Roofline
+{
+  double peak_gops;       // int8 ops per ns
+  double bandwidth_gbps;  // bytes per ns
+
+  Roofline(double peak_gops = 0.0, double bandwidth_gbps = 0.0)
+    :
+    peak_gops(peak_gops),
+    bandwidth_gbps(bandwidth_gbps)
+  {
+  }
+
+  // ops per byte where the roofs meet
+  double ridge() const { return bandwidth_gbps > 0 ? peak_gops / bandwidth_gbps : 0.0; }
+
+  double attainable_gops(double intensity) const {
+    return std::min(peak_gops, bandwidth_gbps * intensity);
+  }
+
+  bool compute_bound(double intensity) const { return intensity >= ridge(); }
+};
+
+// Single thread read bandwidth over a buffer much larger than the caches,
+// best of passes.
+inline
+double measure_bandwidth_gbps(size_t bytes = 256 << 20, int passes = 5)
+{
+  std::vector<uint64_t> buffer(bytes / sizeof(uint64_t));
+  for (size_t i=0; i<buffer.size(); ++i) {
+    buffer[i] = i;
+  }
+  double best = 0;
+  volatile uint64_t sink = 0;
+  for (int p=0; p<passes; ++p) {
+    const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for (size_t i=0; i+4<=buffer.size(); i+=4) {
+      s0 += buffer[i + 0];
+      s1 += buffer[i + 1];
+      s2 += buffer[i + 2];
+      s3 += buffer[i + 3];
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    sink = sink + s0 + s1 + s2 + s3;
+    if (seconds > 0) {
+      best = std::max(best, buffer.size() * sizeof(uint64_t) / seconds * 1e-9);
+    }
+  }
+  return best;
+}
+
+// Single thread int8 multiply-accumulate rate into int32 on L1 resident
+// data, as far as the compiler vectorizes it; best of passes. This is an
+// attainable peak for portable code, not the ISA's (VNNI etc.) peak.
+inline
+double measure_peak_int8_gops(int passes = 5)
+{
+  enum { N = 1024, REPS = 4096 };
+  std::vector<int8_t> a(N), b(N);
+  std::vector<int32_t> acc(N, 0);
+  for (int i=0; i<N; ++i) {
+    a[i] = (int8_t)(i * 7 - 64);
+    b[i] = (int8_t)(i * 13 + 5);
+  }
+  double best = 0;
+  for (int p=0; p<passes; ++p) {
+    const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (int r=0; r<REPS; ++r) {
+      // the rotating b index keeps the reps from being folded together
+      const int8_t* pb = &b[r & (N / 2 - 1)];
+      for (int i=0; i<N/2; ++i) {
+        acc[i] += a[i] * pb[i];
+      }
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    if (seconds > 0) {
+      best = std::max(best, 2.0 * (N / 2) * REPS / seconds * 1e-9);
+    }
+  }
+  volatile int32_t sink = 0;
+  for (int i=0; i<N; ++i) {
+    sink = sink + acc[i];
+  }
+  return best;
+}
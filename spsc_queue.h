@@ -0,0 +1,147 @@
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+// Bounded lock-free queue for exactly one producer and one consumer thread.
+// head_ is written only by the consumer and tail_ only by the producer, each
+// on its own cache line. The blocking push / pop spin briefly and then
+// sleep, so an idle stage does not keep a core busy.
+template <typename T>
+class SpscQueue
+{
+public:
+  // capacity is rounded up to a power of two
+  explicit SpscQueue(size_t capacity)
+    :
+    head_(0),
+    tail_(0),
+    producer_waiting_(false),
+    consumer_waiting_(false)
+  {
+    size_t n = 1;
+    while (n < capacity) {
+      n <<= 1;
+    }
+    buffer_.resize(n);
+    mask_ = n - 1;
+  }
+
+  size_t capacity() const { return buffer_.size(); }
+
+  bool try_push(const T& value) {
+    if (!push_slot(value)) {
+      return false;
+    }
+    wake(consumer_waiting_, not_empty_);
+    return true;
+  }
+
+  bool try_pop(T& value) {
+    if (!pop_slot(value)) {
+      return false;
+    }
+    wake(producer_waiting_, not_full_);
+    return true;
+  }
+
+  // spin, yielding the core, until there is room / a value, then sleep
+  void push(const T& value) {
+    for (int spins=0; !push_slot(value); ++spins) {
+      if (spins < SPIN_COUNT) {
+        std::this_thread::yield();
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(mutex_);
+      producer_waiting_.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      const bool pushed = push_slot(value);
+      if (!pushed) {
+        not_full_.wait(lock);
+      }
+      producer_waiting_.store(false, std::memory_order_relaxed);
+      if (pushed) {
+        break;
+      }
+    }
+    wake(consumer_waiting_, not_empty_);
+  }
+
+  void pop(T& value) {
+    for (int spins=0; !pop_slot(value); ++spins) {
+      if (spins < SPIN_COUNT) {
+        std::this_thread::yield();
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(mutex_);
+      consumer_waiting_.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      const bool popped = pop_slot(value);
+      if (!popped) {
+        not_empty_.wait(lock);
+      }
+      consumer_waiting_.store(false, std::memory_order_relaxed);
+      if (popped) {
+        break;
+      }
+    }
+    wake(producer_waiting_, not_full_);
+  }
+
+private:
+  SpscQueue(const SpscQueue&);
+  SpscQueue& operator=(const SpscQueue&);
+
+  enum { SPIN_COUNT = 100 };
+
+  bool push_slot(const T& value) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == buffer_.size()) {
+      return false;
+    }
+    buffer_[tail & mask_] = value;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop_slot(T& value) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    value = buffer_[head & mask_];
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // the fences pair with the waiter's : either it sees the index just
+  // stored or this sees its flag and wakes it
+  void wake(std::atomic<bool>& waiting, std::condition_variable& cv) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting.load(std::memory_order_relaxed)) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      cv.notify_one();
+    }
+  }
+
+  // padding rather than alignas, so heap allocated queues (plain new in
+  // C++11) still keep the indices on separate cache lines
+  enum { CACHE_LINE = 64 };
+  char pad0_[CACHE_LINE];
+  std::atomic<size_t> head_;
+  char pad1_[CACHE_LINE - sizeof(std::atomic<size_t>)];
+  std::atomic<size_t> tail_;
+  char pad2_[CACHE_LINE - sizeof(std::atomic<size_t>)];
+  std::vector<T> buffer_;
+  size_t mask_;
+  std::atomic<bool> producer_waiting_;
+  std::atomic<bool> consumer_waiting_;
+  std::mutex mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+};
@@ -48,6 +48,7 @@ LICENSE
 
 RECENT REVISION HISTORY:
 
+      local         reduced resolution jpeg decode (stbi_load_scaled)
       2.26  (2020-07-13) many minor fixes
       2.25  (2020-02-02) fix warnings
       2.24  (2020-02-02) fix warnings; thread-local failure_reason and flip_vertically
@@ -398,6 +399,16 @@ STBIDEF stbi_uc *stbi_load_from_file  (FILE *f, int *x, int *y, int *channels_in
 // for stbi_load_from_file, file pointer is left pointing immediately after image
 #endif
 
+// Reduced-resolution load: JPEGs are decoded with a 1/2, 1/4 or 1/8 scaled
+// IDCT, picking the smallest scale that is still at least min_x by min_y, so
+// the full-resolution image is never materialized. Other formats load at
+// full size. *x and *y report the decoded (possibly reduced) size.
+STBIDEF stbi_uc *stbi_load_from_memory_scaled(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, int min_x, int min_y);
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_uc *stbi_load_scaled          (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels, int min_x, int min_y);
+STBIDEF stbi_uc *stbi_load_from_file_scaled(FILE *f, int *x, int *y, int *channels_in_file, int desired_channels, int min_x, int min_y);
+#endif
+
 #ifndef STBI_NO_GIF
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp);
 #endif
@@ -557,8 +568,8 @@ STBIDEF int   stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const ch
 #include <string.h>
 #include <limits.h>
 
-#if !defined(STBI_NO_LINEAR) || !defined(STBI_NO_HDR)
-#include <math.h>  // ldexp, pow
+#if !defined(STBI_NO_LINEAR) || !defined(STBI_NO_HDR) || !defined(STBI_NO_JPEG)
+#include <math.h>  // ldexp, pow, cos (scaled jpeg idct)
 #endif
 
 #ifndef STBI_NO_STDIO
@@ -781,6 +792,8 @@ typedef struct
 
    stbi_uc *img_buffer, *img_buffer_end;
    stbi_uc *img_buffer_original, *img_buffer_original_end;
+
+   int scaled_min_x, scaled_min_y; // requested minimum size for scaled decode, 0 = full size
 } stbi__context;
 
 
@@ -792,6 +805,7 @@ static void stbi__start_mem(stbi__context *s, stbi_uc const *buffer, int len)
    s->io.read = NULL;
    s->read_from_callbacks = 0;
    s->callback_already_read = 0;
+   s->scaled_min_x = s->scaled_min_y = 0;
    s->img_buffer = s->img_buffer_original = (stbi_uc *) buffer;
    s->img_buffer_end = s->img_buffer_original_end = (stbi_uc *) buffer+len;
 }
@@ -804,6 +818,7 @@ static void stbi__start_callbacks(stbi__context *s, stbi_io_callbacks *c, void *
    s->buflen = sizeof(s->buffer_start);
    s->read_from_callbacks = 1;
    s->callback_already_read = 0;
+   s->scaled_min_x = s->scaled_min_y = 0;
    s->img_buffer = s->img_buffer_original = s->buffer_start;
    stbi__refill_buffer(s);
    s->img_buffer_original_end = s->img_buffer_end;
@@ -1326,6 +1341,31 @@ STBIDEF stbi_uc *stbi_load_from_file(FILE *f, int *x, int *y, int *comp, int req
    return result;
 }
 
+STBIDEF stbi_uc *stbi_load_scaled(char const *filename, int *x, int *y, int *comp, int req_comp, int min_x, int min_y)
+{
+   FILE *f = stbi__fopen(filename, "rb");
+   unsigned char *result;
+   if (!f) return stbi__errpuc("can't fopen", "Unable to open file");
+   result = stbi_load_from_file_scaled(f,x,y,comp,req_comp,min_x,min_y);
+   fclose(f);
+   return result;
+}
+
+STBIDEF stbi_uc *stbi_load_from_file_scaled(FILE *f, int *x, int *y, int *comp, int req_comp, int min_x, int min_y)
+{
+   unsigned char *result;
+   stbi__context s;
+   stbi__start_file(&s,f);
+   s.scaled_min_x = min_x;
+   s.scaled_min_y = min_y;
+   result = stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
+   if (result) {
+      // need to 'unget' all the characters in the IO buffer
+      fseek(f, - (int) (s.img_buffer_end - s.img_buffer), SEEK_CUR);
+   }
+   return result;
+}
+
 STBIDEF stbi__uint16 *stbi_load_from_file_16(FILE *f, int *x, int *y, int *comp, int req_comp)
 {
    stbi__uint16 *result;
@@ -1380,6 +1420,15 @@ STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *u
    return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
 }
 
+STBIDEF stbi_uc *stbi_load_from_memory_scaled(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, int min_x, int min_y)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   s.scaled_min_x = min_x;
+   s.scaled_min_y = min_y;
+   return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
+}
+
 #ifndef STBI_NO_GIF
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp)
 {
@@ -1913,6 +1962,8 @@ typedef struct
       stbi_uc *linebuf;
       short   *coeff;   // progressive only
       int      coeff_w, coeff_h; // number of 8x8 coefficient blocks
+      int      hshift, vshift;   // scaled decode: block is (8>>hshift) x (8>>vshift) pixels
+      int      hs, vs;           // upsampling left for the resampler
    } img_comp[4];
 
    stbi__uint32   code_buffer; // jpeg entropy-coded buffer
@@ -1933,6 +1984,11 @@ typedef struct
    int scan_n, order[4];
    int restart_interval, todo;
 
+// scaled decode: image is reduced by 1<<scale_shift, scaled_idct[s] is the
+// (8>>s)-point inverse DCT matrix
+   int scale_shift;
+   float scaled_idct[4][8][8];
+
 // kernels
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
    void (*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
@@ -2838,6 +2894,80 @@ static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
 
 #endif // STBI_NEON
 
+// reduced size IDCT: an N-point inverse DCT over the lowest coefficients in
+// each direction, which approximates the block average of the full 8x8 IDCT
+static void stbi__idct_block_scaled(stbi__jpeg *z, int hshift, int vshift, stbi_uc *out, int out_stride, short data[64])
+{
+   int i,j,u,v, nw = 8 >> hshift, nh = 8 >> vshift;
+   float tmp[8][8];
+   if (nw == 1 && nh == 1) {
+      out[0] = stbi__clamp(((data[0] + 4) >> 3) + 128);
+      return;
+   }
+   // rows: tmp[v][x] = sum_u M[x][u] F[v][u]
+   for (v=0; v < nh; ++v)
+      for (i=0; i < nw; ++i) {
+         float t = 0;
+         for (u=0; u < nw; ++u)
+            t += z->scaled_idct[hshift][i][u] * data[v*8+u];
+         tmp[v][i] = t;
+      }
+   // columns
+   for (j=0; j < nh; ++j, out += out_stride)
+      for (i=0; i < nw; ++i) {
+         float t = 128.5f;
+         for (v=0; v < nh; ++v)
+            t += z->scaled_idct[vshift][j][v] * tmp[v][i];
+         out[i] = stbi__clamp((int) floor(t));
+      }
+}
+
+static int stbi__log2_small(int n)
+{
+   return n == 1 ? 0 : n == 2 ? 1 : n == 4 ? 2 : -1;
+}
+
+// picks each component's IDCT size so that subsampled components come out
+// at (or closer to) the reduced image resolution instead of being upsampled
+static void stbi__jpeg_setup_scale(stbi__jpeg *z, int h_max, int v_max, int shift)
+{
+   int i,s,x,u;
+   z->scale_shift = shift;
+   for (s=0; s < 4; ++s) {
+      int n = 8 >> s;
+      for (x=0; x < n; ++x)
+         for (u=0; u < n; ++u)
+            z->scaled_idct[s][x][u] = (float) ((u ? 0.5 : 0.5 / sqrt(2.0)) * cos((2*x+1) * u * 3.14159265358979323846 / (2*n)));
+   }
+   for (i=0; i < z->s->img_n; ++i) {
+      int hs = h_max / z->img_comp[i].h, vs = v_max / z->img_comp[i].v;
+      int lh = stbi__log2_small(hs), lv = stbi__log2_small(vs);
+      z->img_comp[i].hshift = shift;
+      z->img_comp[i].vshift = shift;
+      if (h_max % z->img_comp[i].h == 0 && lh >= 0) {
+         z->img_comp[i].hshift = shift > lh ? shift - lh : 0;
+         hs >>= shift - z->img_comp[i].hshift;
+      }
+      if (v_max % z->img_comp[i].v == 0 && lv >= 0) {
+         z->img_comp[i].vshift = shift > lv ? shift - lv : 0;
+         vs >>= shift - z->img_comp[i].vshift;
+      }
+      z->img_comp[i].hs = hs;
+      z->img_comp[i].vs = vs;
+   }
+}
+
+// idct the block at block coordinates (bx,by) of component n
+static void stbi__jpeg_idct(stbi__jpeg *z, int n, int bx, int by, short data[64])
+{
+   int hshift = z->img_comp[n].hshift, vshift = z->img_comp[n].vshift;
+   stbi_uc *out = z->img_comp[n].data + z->img_comp[n].w2*by*(8>>vshift) + bx*(8>>hshift);
+   if (hshift == 0 && vshift == 0)
+      z->idct_block_kernel(out, z->img_comp[n].w2, data);
+   else
+      stbi__idct_block_scaled(z, hshift, vshift, out, z->img_comp[n].w2, data);
+}
+
 #define STBI__MARKER_none  0xff
 // if there's a pending marker from the entropy stream, return that
 // otherwise, fetch from the stream and get a marker. if there's no
@@ -2890,7 +3020,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                int ha = z->img_comp[n].ha;
                if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               stbi__jpeg_idct(z, n, i, j, data);
                // every data block is an MCU, so countdown the restart interval
                if (--z->todo <= 0) {
                   if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2914,11 +3044,11 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                   // by the basic H and V specified for the component
                   for (y=0; y < z->img_comp[n].v; ++y) {
                      for (x=0; x < z->img_comp[n].h; ++x) {
-                        int x2 = (i*z->img_comp[n].h + x)*8;
-                        int y2 = (j*z->img_comp[n].v + y)*8;
+                        int x2 = (i*z->img_comp[n].h + x);
+                        int y2 = (j*z->img_comp[n].v + y);
                         int ha = z->img_comp[n].ha;
                         if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                        z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
+                        stbi__jpeg_idct(z, n, x2, y2, data);
                      }
                   }
                }
@@ -3015,7 +3145,7 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
                stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               stbi__jpeg_idct(z, n, i, j, data);
             }
          }
       }
@@ -3227,6 +3357,20 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       if (z->img_comp[i].v > v_max) v_max = z->img_comp[i].v;
    }
 
+   // largest reduction that keeps the image at least the requested size
+   {
+      int shift = 0;
+      if (s->scaled_min_x > 0 || s->scaled_min_y > 0) {
+         for (shift=3; shift > 0; --shift) {
+            stbi__uint32 sx = (s->img_x + (1u << shift) - 1) >> shift;
+            stbi__uint32 sy = (s->img_y + (1u << shift) - 1) >> shift;
+            if (sx >= (stbi__uint32) s->scaled_min_x && sy >= (stbi__uint32) s->scaled_min_y)
+               break;
+         }
+      }
+      stbi__jpeg_setup_scale(z, h_max, v_max, shift);
+   }
+
    // compute interleaved mcu info
    z->img_h_max = h_max;
    z->img_v_max = v_max;
@@ -3247,8 +3391,8 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       //
       // img_mcu_x, img_mcu_y: <=17 bits; comp[i].h and .v are <=4 (checked earlier)
       // so these muls can't overflow with 32-bit ints (which we require)
-      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * (8 >> z->img_comp[i].hshift);
+      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * (8 >> z->img_comp[i].vshift);
       z->img_comp[i].coeff = 0;
       z->img_comp[i].raw_coeff = 0;
       z->img_comp[i].linebuf = NULL;
@@ -3258,10 +3402,10 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       // align blocks for idct using mmx/sse
       z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
       if (z->progressive) {
-         // w2, h2 are multiples of 8 (see above)
-         z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
-         z->img_comp[i].coeff_h = z->img_comp[i].h2 / 8;
-         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].w2, z->img_comp[i].h2, sizeof(short), 15);
+         // w2, h2 are multiples of the block size (see above)
+         z->img_comp[i].coeff_w = z->img_comp[i].w2 >> (3 - z->img_comp[i].hshift);
+         z->img_comp[i].coeff_h = z->img_comp[i].h2 >> (3 - z->img_comp[i].vshift);
+         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].coeff_w * 8, z->img_comp[i].coeff_h * 8, sizeof(short), 15);
          if (z->img_comp[i].raw_coeff == NULL)
             return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
          z->img_comp[i].coeff = (short*) (((size_t) z->img_comp[i].raw_coeff + 15) & ~15);
@@ -3342,6 +3486,17 @@ static int stbi__decode_jpeg_image(stbi__jpeg *j)
    }
    if (j->progressive)
       stbi__jpeg_finish(j);
+   if (j->scale_shift) {
+      // from here on everything works on the reduced planes
+      int k, shift = j->scale_shift;
+      j->s->img_x = (j->s->img_x + (1u << shift) - 1) >> shift;
+      j->s->img_y = (j->s->img_y + (1u << shift) - 1) >> shift;
+      for (k=0; k < j->s->img_n; ++k) {
+         int hshift = j->img_comp[k].hshift, vshift = j->img_comp[k].vshift;
+         j->img_comp[k].x = (j->img_comp[k].x + (1 << hshift) - 1) >> hshift;
+         j->img_comp[k].y = (j->img_comp[k].y + (1 << vshift) - 1) >> vshift;
+      }
+   }
    return 1;
 }
 
@@ -3799,8 +3954,8 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
          z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(z->s->img_x + 3);
          if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
 
-         r->hs      = z->img_h_max / z->img_comp[k].h;
-         r->vs      = z->img_v_max / z->img_comp[k].v;
+         r->hs      = z->img_comp[k].hs;
+         r->vs      = z->img_comp[k].vs;
          r->ystep   = r->vs >> 1;
          r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
          r->ypos    = 0;
@@ -3926,6 +4081,7 @@ static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int re
    stbi__jpeg* j = (stbi__jpeg*) stbi__malloc(sizeof(stbi__jpeg));
    STBI_NOTUSED(ri);
    j->s = s;
+   j->scale_shift = 0;
    stbi__setup_jpeg(j);
    result = load_jpeg_image(j, x,y,comp,req_comp);
    STBI_FREE(j);
@@ -0,0 +1,114 @@
+#include "doctest.h"
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+#include "async_inference.h"
+
+namespace {
+
+typedef AsyncInference<int, int> Async;
+
+// output = sum and product of the two inputs, fails on negative input
+bool sum_product(const int* input, int* output)
+{
+  if (input[0] < 0) {
+    return false;
+  }
+  output[0] = input[0] + input[1];
+  output[1] = input[0] * input[1];
+  return true;
+}
+
+} // namespace
+
+TEST_CASE("AsyncInference completes futures")
+{
+  Async async(2, 2, 3, sum_product);
+  std::vector<std::future<Async::Result> > results;
+  for (int i=0; i<20; ++i) {
+    int input[2] = { i, 3 };
+    results.push_back(async.submit(input));
+  }
+  for (int i=0; i<20; ++i) {
+    Async::Result r = results[i].get();
+    REQUIRE(r.status == Async::DONE);
+    REQUIRE(r.output.size() == 2);
+    CHECK(r.output[0] == i + 3);
+    CHECK(r.output[1] == i * 3);
+  }
+
+  int bad[2] = { -1, 0 };
+  Async::Result r = async.submit(bad).get();
+  CHECK(r.status == Async::FAILED);
+  CHECK(r.output.empty());
+}
+
+TEST_CASE("AsyncInference calls back with the request id")
+{
+  std::atomic<int> done(0);
+  std::atomic<int> wrong(0);
+  std::vector<Async::RequestId> ids(10);
+  std::vector<Async::RequestId> called(10);
+  {
+    Async async(2, 2, 2, sum_product);
+    for (int i=0; i<10; ++i) {
+      int input[2] = { i, i };
+      ids[i] = async.submit(input, [&done, &wrong, &called, i](Async::RequestId id, const Async::Result& r) {
+        if (r.status != Async::DONE || r.output[1] != i * i) {
+          ++wrong;
+        }
+        called[i] = id;
+        ++done;
+      });
+    }
+    // the destructor runs what is still queued
+  }
+  CHECK(done == 10);
+  CHECK(wrong == 0);
+  for (int i=1; i<10; ++i) {
+    CHECK(ids[i] != ids[0]);
+  }
+  CHECK(called == ids);
+}
+
+TEST_CASE("AsyncInference cancels requests that have not started")
+{
+  // the single worker blocks on the first request until released
+  std::atomic<bool> started(false);
+  std::atomic<bool> release(false);
+  Async async(2, 2, 1, [&](const int* input, int* output) {
+    started = true;
+    while (!release) {
+      std::this_thread::yield();
+    }
+    return sum_product(input, output);
+  });
+
+  int input[2] = { 1, 2 };
+  Async::RequestId first, second, third;
+  std::future<Async::Result> r1 = async.submit(input, &first);
+  while (!started) {
+    std::this_thread::yield();
+  }
+  std::future<Async::Result> r2 = async.submit(input, &second);
+  bool cancelled_callback = false;
+  third = async.submit(input, [&cancelled_callback](Async::RequestId, const Async::Result& r) {
+    cancelled_callback = (r.status == Async::CANCELLED);
+  });
+  CHECK(async.pending() == 2);
+
+  CHECK_FALSE(async.cancel(first));  // running
+  CHECK(async.cancel(second));
+  CHECK_FALSE(async.cancel(second));
+  CHECK(async.cancel(third));
+  CHECK(cancelled_callback);
+  CHECK(r2.get().status == Async::CANCELLED);
+  CHECK(async.pending() == 0);
+
+  release = true;
+  Async::Result r = r1.get();
+  CHECK(r.status == Async::DONE);
+  CHECK(r.output[0] == 3);
+}
@@ -0,0 +1,148 @@
+#include "doctest.h"
+
+#include <stdio.h>
+#include <random>
+
+#include "autotune.h"
+#include "incremental.h"
+#include "pipeline.h"
+#include "test_layers.h"
+
+TEST_CASE("run_layer_tuned matches run_layer")
+{
+  std::mt19937 rng(1);
+  TestLayer layers[3];
+  // 11 output channels leave a short last block for every block size
+  make_layer(layers[0], LayerType::Conv2D, Shape(1, 17, 13, 5), 3, 2, 1, 11, rng);
+  make_layer(layers[1], LayerType::Conv2D, Shape(1, 9, 9, 16), 1, 1, 0, 24, rng);
+  make_layer(layers[2], LayerType::DepthwiseConv2D, Shape(1, 15, 15, 12), 5, 1, 2, 12, rng);
+  const ConvTuning tunings[] = {
+    ConvTuning(),
+    ConvTuning(0, 0, 2),
+    ConvTuning(0, 0, 4),
+    ConvTuning(0, 0, 8),
+    ConvTuning(1, 0, 4),
+    ConvTuning(3, 4, 8),
+    ConvTuning(2, 0, 4, 3),
+    ConvTuning(1, 3, 1, 4),
+  };
+  ThreadPool pool(3);
+  std::uniform_int_distribution<int> dist(-128, 127);
+  for (int i=0; i<3; ++i) {
+    const ConvLayer_int8& l = layers[i].layer;
+    std::vector<int8_t> input(l.input_shape.num_elements());
+    for (size_t j=0; j<input.size(); ++j) {
+      input[j] = (int8_t)dist(rng);
+    }
+    std::vector<int8_t> expected(l.output_shape.num_elements());
+    run_layer(l, &input[0], &expected[0]);
+    for (size_t t=0; t<sizeof(tunings)/sizeof(tunings[0]); ++t) {
+      std::vector<int8_t> output(expected.size(), 0);
+      run_layer_tuned(l, tunings[t], &input[0], &output[0], &pool);
+      CAPTURE(i);
+      CAPTURE(t);
+      CHECK(output == expected);
+    }
+  }
+}
+
+TEST_CASE("ConvAutotuner caches per CPU and round trips through a file")
+{
+  std::mt19937 rng(2);
+  TestLayer a, b;
+  make_layer(a, LayerType::Conv2D, Shape(1, 8, 8, 8), 1, 1, 0, 16, rng);
+  make_layer(b, LayerType::DepthwiseConv2D, Shape(1, 8, 8, 8), 3, 1, 1, 8, rng);
+  ThreadPool pool(1);
+  const char* path = "test_autotune_cache.txt";
+
+  ConvAutotuner tuner("cpu A");
+  ConvTuning t;
+  CHECK(!tuner.find(a.layer, t));
+  const ConvTuning tuned = tuner.tune(a.layer, &pool);
+  CHECK(tuned.seconds > 0);
+  CHECK(tuner.num_tuned() == 1);
+  tuner.tune(a.layer, &pool);
+  CHECK(tuner.num_tuned() == 1);
+  tuner.tune(b.layer, &pool);
+  CHECK(tuner.num_tuned() == 2);
+  REQUIRE(tuner.save(path));
+
+  ConvAutotuner loaded("cpu A");
+  REQUIRE(loaded.load(path));
+  CHECK(loaded.size() == 2);
+  REQUIRE(loaded.find(a.layer, t));
+  CHECK(t.tile_height == tuned.tile_height);
+  CHECK(t.tile_width == tuned.tile_width);
+  CHECK(t.channel_block == tuned.channel_block);
+  CHECK(t.threads == tuned.threads);
+  loaded.tune(a.layer, &pool);
+  CHECK(loaded.num_tuned() == 0);
+
+  // another CPU tunes again but keeps the first one's entries
+  ConvAutotuner other("cpu B");
+  REQUIRE(other.load(path));
+  CHECK(!other.find(a.layer, t));
+  other.tune(a.layer, &pool);
+  CHECK(other.num_tuned() == 1);
+  CHECK(other.size() == 3);
+  remove(path);
+}
+
+TEST_CASE("chain runners with loaded tunings match run_layers")
+{
+  std::mt19937 rng(3);
+  TestLayer t[3];
+  make_layer(t[0], LayerType::Conv2D, Shape(1, 16, 16, 3), 3, 2, 1, 11, rng);
+  make_layer(t[1], LayerType::DepthwiseConv2D, t[0].layer.output_shape, 3, 1, 1, 11, rng);
+  make_layer(t[2], LayerType::Conv2D, t[1].layer.output_shape, 1, 1, 0, 8, rng);
+  std::vector<ConvLayer_int8> layers;
+  for (int i=0; i<3; ++i) {
+    layers.push_back(t[i].layer);
+  }
+  // as loaded from a cache : blocked channels, small tiles, several threads;
+  // the depthwise layer was never tuned
+  ConvAutotuner tuner("cpu A");
+  const char* path = "test_autotune_chain.txt";
+  FILE* f = fopen(path, "w");
+  REQUIRE(f);
+  fprintf(f, "cpu A\t%s\t3 5 4 2 0.001\n", layer_key(layers[0]).c_str());
+  fprintf(f, "cpu A\t%s\t0 0 8 1 0.001\n", layer_key(layers[2]).c_str());
+  fclose(f);
+  REQUIRE(tuner.load(path));
+  remove(path);
+  const std::vector<ConvTuning> tunings = tuner.tunings(layers);
+  REQUIRE(tunings.size() == 3);
+  CHECK(tunings[0].channel_block == 4);
+  CHECK(tunings[1].channel_block == 1);
+  CHECK(tunings[2].channel_block == 8);
+
+  std::uniform_int_distribution<int> dist(-128, 127);
+  const int batch = 2;
+  std::vector<int8_t> input(layers[0].input_shape.num_elements() * batch);
+  for (size_t i=0; i<input.size(); ++i) {
+    input[i] = (int8_t)dist(rng);
+  }
+  const size_t out_len = layers.back().output_shape.num_elements();
+  std::vector<int8_t> expected(out_len * batch);
+  std::vector<int8_t> scratch;
+  run_layers(layers, batch, &input[0], &expected[0], scratch);
+
+  ThreadPool pool(1);
+  std::vector<int8_t> output(expected.size(), 0);
+  run_layers(layers, tunings, batch, &input[0], &output[0], scratch, &pool);
+  CHECK(output == expected);
+
+  IncrementalConvChain chain(layers);
+  chain.set_tunings(tunings);
+  CHECK(std::equal(expected.begin(), expected.begin() + out_len, chain.process(&input[0])));
+
+  LayerPipeline pipeline(layers, 2, 0, false, tunings);
+  for (int b=0; b<batch; ++b) {
+    pipeline.push(&input[b * layers[0].input_shape.num_elements()]);
+  }
+  for (int b=0; b<batch; ++b) {
+    std::vector<int8_t> out(out_len);
+    pipeline.pop(&out[0]);
+    CHECK(std::equal(out.begin(), out.end(), expected.begin() + b * out_len));
+  }
+}
@@ -0,0 +1,66 @@
+#include "doctest.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "batch_loader.h"
+#include "stb_image_write.h"
+
+TEST_CASE("BatchLoader returns images in list order")
+{
+  // images of different sizes and a missing file in between
+  std::vector<std::string> paths;
+  for (int i=0; i<9; ++i) {
+    char name[64];
+    sprintf(name, "test_batch_loader_%d.png", i);
+    paths.push_back(name);
+    if (i == 4) {
+      continue;
+    }
+    const int width = 20 + i * 7;
+    const int height = 30 - i;
+    std::vector<uint8_t> pixels(width * height * 3);
+    for (size_t j=0; j<pixels.size(); ++j) {
+      pixels[j] = (uint8_t)(j * (i + 1));
+    }
+    REQUIRE(stbi_write_png(name, width, height, 3, &pixels[0], width * 3));
+  }
+
+  PreprocessParams params(Shape(1, 16, 16, 3), -128);
+  const size_t n = params.output_shape.num_elements();
+  for (int prefetch=1; prefetch<=4; prefetch+=3) {
+    BatchLoader<int8_t> loader(paths, params, 3, prefetch);
+    CHECK(loader.size() == paths.size());
+    BatchLoader<int8_t>::Item item;
+    size_t count = 0;
+    std::vector<int8_t> expected(n);
+    while (loader.next(item)) {
+      CHECK(item.index == count);
+      CHECK(item.path == paths[count]);
+      if (count == 4) {
+        CHECK(!item.ok);
+        CHECK(item.error != nullptr);
+      }else {
+        REQUIRE(item.ok);
+        REQUIRE(item.data.size() == n);
+        preprocess_file(paths[count].c_str(), params, &expected[0]);
+        CHECK(item.data == expected);
+      }
+      ++count;
+    }
+    CHECK(count == paths.size());
+    CHECK(!loader.next(item));
+  }
+
+  // destroyed before everything is consumed
+  {
+    BatchLoader<int8_t> loader(paths, params, 2, 4);
+    BatchLoader<int8_t>::Item item;
+    CHECK(loader.next(item));
+  }
+
+  for (size_t i=0; i<paths.size(); ++i) {
+    remove(paths[i].c_str());
+  }
+}
@@ -0,0 +1,114 @@
+#include "doctest.h"
+
+#include <thread>
+
+#include "batcher.h"
+
+namespace {
+
+// output = input * 2 plus the batch size in the last element
+bool double_values(const int* input, size_t batch_size, int* output)
+{
+  for (size_t i=0; i<batch_size; ++i) {
+    output[i * 3 + 0] = input[i * 2 + 0] * 2;
+    output[i * 3 + 1] = input[i * 2 + 1] * 2;
+    output[i * 3 + 2] = (int)batch_size;
+  }
+  return true;
+}
+
+// fails batches holding a negative input
+bool fail_negative(const int* input, size_t batch_size, int* output)
+{
+  for (size_t i=0; i<batch_size * 2; ++i) {
+    if (input[i] < 0) {
+      return false;
+    }
+  }
+  return double_values(input, batch_size, output);
+}
+
+} // namespace
+
+TEST_CASE("DynamicBatcher fills batches up to max_batch")
+{
+  DynamicBatcher<int, int> batcher(2, 3, 4, std::chrono::seconds(10), double_values);
+  std::vector<std::future<std::vector<int> > > results;
+  for (int i=0; i<8; ++i) {
+    int input[2] = { i, -i };
+    results.push_back(batcher.submit(input));
+  }
+  for (int i=0; i<8; ++i) {
+    std::vector<int> out = results[i].get();
+    REQUIRE(out.size() == 3);
+    CHECK(out[0] == i * 2);
+    CHECK(out[1] == -i * 2);
+    CHECK(out[2] == 4);
+  }
+  CHECK(batcher.batches() == 2);
+  CHECK(batcher.average_batch() == 4.0);
+}
+
+TEST_CASE("DynamicBatcher runs a partial batch after max_wait")
+{
+  DynamicBatcher<int, int> batcher(2, 3, 16, std::chrono::milliseconds(5), double_values);
+  int input[2] = { 3, 4 };
+  std::vector<int> out = batcher.submit(input).get();
+  CHECK(out[0] == 6);
+  CHECK(out[1] == 8);
+  CHECK(out[2] == 1);
+
+  // concurrent callers each get their own slice back
+  std::vector<std::thread> threads;
+  bool ok[4] = {};
+  for (int t=0; t<4; ++t) {
+    threads.push_back(std::thread([&batcher, &ok, t]() {
+      bool all = true;
+      for (int i=0; i<50; ++i) {
+        int in[2] = { t * 1000 + i, i };
+        std::vector<int> r = batcher.submit(in).get();
+        all &= (r[0] == in[0] * 2 && r[1] == in[1] * 2 && r[2] >= 1 && r[2] <= 16);
+      }
+      ok[t] = all;
+    }));
+  }
+  for (int t=0; t<4; ++t) {
+    threads[t].join();
+    CHECK(ok[t]);
+  }
+}
+
+TEST_CASE("DynamicBatcher fails every request of a failed batch")
+{
+  DynamicBatcher<int, int> batcher(2, 3, 2, std::chrono::seconds(10), fail_negative);
+  int good[2] = { 1, 2 };
+  int bad[2] = { 3, -4 };
+  std::future<std::vector<int> > first = batcher.submit(good);
+  std::future<std::vector<int> > second = batcher.submit(bad);
+  CHECK_THROWS_AS(first.get(), std::runtime_error);
+  CHECK_THROWS_AS(second.get(), std::runtime_error);
+  // the next batch is unaffected
+  std::future<std::vector<int> > third = batcher.submit(good);
+  std::future<std::vector<int> > fourth = batcher.submit(good);
+  CHECK(third.get()[0] == 2);
+  CHECK(fourth.get()[1] == 4);
+}
+
+TEST_CASE("DynamicBatcher fills inputs in place")
+{
+  DynamicBatcher<int, int> batcher(2, 3, 2, std::chrono::seconds(10), double_values);
+  const int values[2][2] = { { 5, 6 }, { 7, 8 } };
+  std::future<std::vector<int> > results[2];
+  for (int i=0; i<2; ++i) {
+    results[i] = batcher.submit([&values, i](int* input) {
+      input[0] = values[i][0];
+      input[1] = values[i][1];
+    });
+  }
+  for (int i=0; i<2; ++i) {
+    std::vector<int> out = results[i].get();
+    CHECK(out[0] == values[i][0] * 2);
+    CHECK(out[1] == values[i][1] * 2);
+    CHECK(out[2] == 2);
+  }
+}
@@ -0,0 +1,269 @@
+#include "doctest.h"
+
+#include <math.h>
+#include <algorithm>
+#include <random>
+
+#include "cnn_float.h"
+
+namespace {
+
+struct FloatLayer
+{
+  bool depthwise;
+  Shape input_shape;
+  Shape filter_shape;
+  Shape output_shape;
+  int stride;
+  int padding;
+  std::vector<float> input;
+  std::vector<float> filter;
+  std::vector<float> bias;
+
+  FloatLayer(bool depthwise, const Shape& input_shape, int filter_size, int stride, int padding, int output_channels,
+             std::mt19937& rng)
+    :
+    depthwise(depthwise),
+    input_shape(input_shape),
+    stride(stride),
+    padding(padding)
+  {
+    const int depth = depthwise ? input_shape.channel : output_channels;
+    filter_shape = depthwise
+      ? Shape(1, filter_size, filter_size, depth)
+      : Shape(depth, filter_size, filter_size, input_shape.channel);
+    output_shape = Shape(input_shape.number,
+                         (input_shape.height + 2 * padding - filter_size) / stride + 1,
+                         (input_shape.width + 2 * padding - filter_size) / stride + 1,
+                         depth);
+    std::uniform_real_distribution<float> value(-1, 1);
+    input.resize(input_shape.num_elements());
+    filter.resize(filter_shape.num_elements());
+    bias.resize(depth);
+    for (size_t i=0; i<input.size(); ++i) {
+      input[i] = value(rng);
+    }
+    for (size_t i=0; i<filter.size(); ++i) {
+      filter[i] = value(rng);
+    }
+    for (size_t i=0; i<bias.size(); ++i) {
+      bias[i] = value(rng);
+    }
+  }
+
+  // the scalar templates
+  std::vector<float> reference() const {
+    std::vector<float> output(output_shape.num_elements());
+    if (depthwise) {
+      DepthwiseConv2D<float>(input_shape, &input[0], filter_shape, &filter[0], &bias[0],
+                             output_shape, &output[0], stride, stride, padding, padding);
+    }else {
+      Conv2D<float>(input_shape, &input[0], filter_shape, &filter[0], &bias[0],
+                    output_shape, &output[0], stride, stride, padding, padding);
+    }
+    return output;
+  }
+
+  // the float overloads, on a pool when given one
+  std::vector<float> run(ThreadPool* pool) const {
+    std::vector<float> output(output_shape.num_elements());
+    if (depthwise) {
+      DepthwiseConv2D(input_shape, &input[0], filter_shape, &filter[0], &bias[0],
+                      output_shape, &output[0], stride, stride, padding, padding, pool);
+    }else {
+      Conv2D(input_shape, &input[0], filter_shape, &filter[0], &bias[0],
+             output_shape, &output[0], stride, stride, padding, padding, pool);
+    }
+    return output;
+  }
+};
+
+double max_error(const std::vector<float>& a, const std::vector<float>& b)
+{
+  double error = 0;
+  for (size_t i=0; i<a.size(); ++i) {
+    error = std::max(error, fabs((double)a[i] - (double)b[i]));
+  }
+  return error;
+}
+
+template <typename T>
+std::vector<T> narrow(const std::vector<float>& v)
+{
+  std::vector<T> r(v.size());
+  for (size_t i=0; i<v.size(); ++i) {
+    r[i] = T(v[i]);
+  }
+  return r;
+}
+
+template <typename T>
+std::vector<float> widen(const std::vector<T>& v)
+{
+  return std::vector<float>(v.begin(), v.end());
+}
+
+// Runs the layer with T storage, on a pool when given one, with the
+// template when reference is set. The result is within one rounding to T
+// of the float result on the same rounded inputs : the sums stay in float.
+template <typename T>
+bool within_rounding(FloatLayer layer, ThreadPool* pool, bool reference, double epsilon)
+{
+  const std::vector<T> input = narrow<T>(layer.input);
+  const std::vector<T> filter = narrow<T>(layer.filter);
+  const std::vector<T> bias = narrow<T>(layer.bias);
+  layer.input = widen(input);
+  layer.filter = widen(filter);
+  layer.bias = widen(bias);
+  const std::vector<float> expected = layer.reference();
+
+  std::vector<T> output(layer.output_shape.num_elements());
+  const int s = layer.stride;
+  const int p = layer.padding;
+  if (reference && layer.depthwise) {
+    DepthwiseConv2D<T>(layer.input_shape, &input[0], layer.filter_shape, &filter[0], &bias[0],
+                       layer.output_shape, &output[0], s, s, p, p);
+  }else if (reference) {
+    Conv2D<T>(layer.input_shape, &input[0], layer.filter_shape, &filter[0], &bias[0],
+              layer.output_shape, &output[0], s, s, p, p);
+  }else if (layer.depthwise) {
+    DepthwiseConv2D(layer.input_shape, &input[0], layer.filter_shape, &filter[0], &bias[0],
+                    layer.output_shape, &output[0], s, s, p, p, pool);
+  }else {
+    Conv2D(layer.input_shape, &input[0], layer.filter_shape, &filter[0], &bias[0],
+           layer.output_shape, &output[0], s, s, p, p, pool);
+  }
+  for (size_t i=0; i<output.size(); ++i) {
+    if (fabs((float)output[i] - expected[i]) > fabs(expected[i]) * epsilon + 1e-5) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+TEST_CASE("float Conv2D matches the template")
+{
+  std::mt19937 rng(1);
+  ThreadPool pool(3);
+  // channel counts that leave partial vector blocks, widths that leave
+  // partial pixel groups, padding, stride 2 and a batch of 2
+  FloatLayer layers[] = {
+    FloatLayer(false, Shape(1, 9, 7, 5), 3, 1, 1, 37, rng),
+    FloatLayer(false, Shape(1, 11, 10, 3), 3, 2, 0, 16, rng),
+    FloatLayer(false, Shape(2, 6, 6, 24), 1, 1, 0, 40, rng),
+    FloatLayer(false, Shape(1, 13, 13, 8), 5, 2, 2, 9, rng),
+  };
+  for (size_t i=0; i<sizeof(layers)/sizeof(layers[0]); ++i) {
+    const FloatLayer& l = layers[i];
+    const std::vector<float> expected = l.reference();
+    CHECK(max_error(l.run(nullptr), expected) < 1e-5);
+    CHECK(max_error(l.run(&pool), expected) < 1e-5);
+
+    // packed once, run twice
+    PackedFilter<float> packed;
+    pack_filter_float(l.filter_shape, &l.filter[0], &l.bias[0], packed);
+    std::vector<float> output(l.output_shape.num_elements());
+    Conv2D(l.input_shape, &l.input[0], l.filter_shape, packed,
+           l.output_shape, &output[0], l.stride, l.stride, l.padding, l.padding,
+           Rect(0, 0, l.output_shape.width, l.output_shape.height));
+    CHECK(max_error(output, expected) < 1e-5);
+    std::fill(output.begin(), output.end(), 0.0f);
+    Conv2D(l.input_shape, &l.input[0], l.filter_shape, packed,
+           l.output_shape, &output[0], l.stride, l.stride, l.padding, l.padding, &pool);
+    CHECK(max_error(output, expected) < 1e-5);
+  }
+}
+
+TEST_CASE("float DepthwiseConv2D matches the template")
+{
+  std::mt19937 rng(2);
+  ThreadPool pool(3);
+  FloatLayer layers[] = {
+    FloatLayer(true, Shape(1, 9, 7, 21), 3, 1, 1, 0, rng),
+    FloatLayer(true, Shape(1, 14, 15, 48), 5, 2, 2, 0, rng),
+    FloatLayer(true, Shape(2, 5, 6, 3), 3, 1, 0, 0, rng),
+  };
+  for (size_t i=0; i<sizeof(layers)/sizeof(layers[0]); ++i) {
+    const std::vector<float> expected = layers[i].reference();
+    CHECK(max_error(layers[i].run(nullptr), expected) < 1e-5);
+    CHECK(max_error(layers[i].run(&pool), expected) < 1e-5);
+  }
+}
+
+TEST_CASE("float Conv2D writes only output_rect")
+{
+  std::mt19937 rng(3);
+  FloatLayer layer(false, Shape(1, 8, 8, 4), 3, 1, 1, 20, rng);
+  const std::vector<float> expected = layer.reference();
+  std::vector<float> output(layer.output_shape.num_elements(), 1000.0f);
+  const Rect rect(1, 2, 6, 5);
+  Conv2D(layer.input_shape, &layer.input[0], layer.filter_shape, &layer.filter[0], &layer.bias[0],
+         layer.output_shape, &output[0], 1, 1, 1, 1, rect);
+  for (int y=0; y<8; ++y) {
+    for (int x=0; x<8; ++x) {
+      const bool inside = x >= rect.x0 && x < rect.x1 && y >= rect.y0 && y < rect.y1;
+      for (int c=0; c<20; ++c) {
+        const int i = layer.output_shape.offset(0, y, x, c);
+        if (inside) {
+          CHECK(fabs(output[i] - expected[i]) < 1e-5);
+        }else {
+          CHECK(output[i] == 1000.0f);
+        }
+      }
+    }
+  }
+}
+
+TEST_CASE("float Conv2D runs a prepared Winograd filter")
+{
+  std::mt19937 rng(5);
+  ThreadPool pool(3);
+  // 3x3 stride 1 goes through Conv2D_winograd, on bands of rows with the
+  // pool; stride 2 ignores the transform
+  FloatLayer layers[] = {
+    FloatLayer(false, Shape(1, 13, 11, 8), 3, 1, 1, 20, rng),
+    FloatLayer(false, Shape(2, 9, 10, 5), 3, 1, 0, 7, rng),
+    FloatLayer(false, Shape(1, 11, 10, 3), 3, 2, 1, 16, rng),
+  };
+  for (size_t i=0; i<sizeof(layers)/sizeof(layers[0]); ++i) {
+    const FloatLayer& l = layers[i];
+    const std::vector<float> expected = l.reference();
+    PackedFilter<float> packed;
+    pack_filter_float(l.filter_shape, &l.filter[0], &l.bias[0], packed);
+    pack_filter_winograd(l.filter_shape, 4, packed);
+    std::vector<float> output(l.output_shape.num_elements());
+    Conv2D(l.input_shape, &l.input[0], l.filter_shape, packed,
+           l.output_shape, &output[0], l.stride, l.stride, l.padding, l.padding,
+           Rect(0, 0, l.output_shape.width, l.output_shape.height));
+    CHECK(max_error(output, expected) < 2e-4);
+    std::fill(output.begin(), output.end(), 0.0f);
+    Conv2D(l.input_shape, &l.input[0], l.filter_shape, packed,
+           l.output_shape, &output[0], l.stride, l.stride, l.padding, l.padding, &pool);
+    CHECK(max_error(output, expected) < 2e-4);
+  }
+}
+
+TEST_CASE("float16 and bfloat16 storage sum in float")
+{
+  std::mt19937 rng(4);
+  ThreadPool pool(2);
+  FloatLayer layers[] = {
+    FloatLayer(false, Shape(1, 9, 7, 5), 3, 1, 1, 37, rng),
+    FloatLayer(false, Shape(2, 6, 6, 24), 1, 1, 0, 40, rng),
+    FloatLayer(true, Shape(1, 9, 7, 21), 3, 1, 1, 0, rng),
+    FloatLayer(true, Shape(1, 14, 15, 48), 5, 2, 2, 0, rng),
+  };
+  // half an ulp : 2^-11 and 2^-8
+  const double half_epsilon = 1.0 / 2048;
+  const double bfloat_epsilon = 1.0 / 256;
+  for (size_t i=0; i<sizeof(layers)/sizeof(layers[0]); ++i) {
+    CHECK(within_rounding<float16>(layers[i], nullptr, true, half_epsilon));
+    CHECK(within_rounding<float16>(layers[i], nullptr, false, half_epsilon));
+    CHECK(within_rounding<float16>(layers[i], &pool, false, half_epsilon));
+    CHECK(within_rounding<bfloat16>(layers[i], nullptr, true, bfloat_epsilon));
+    CHECK(within_rounding<bfloat16>(layers[i], nullptr, false, bfloat_epsilon));
+    CHECK(within_rounding<bfloat16>(layers[i], &pool, false, bfloat_epsilon));
+  }
+}
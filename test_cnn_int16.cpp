@@ -0,0 +1,201 @@
+#include "doctest.h"
+
+#include <math.h>
+#include <random>
+
+#include "cnn_int16.h"
+
+namespace {
+
+struct Int16Layer
+{
+  ConvLayer_int16 layer;
+  std::vector<int16_t> input;
+  std::vector<int8_t> filter;
+  std::vector<int64_t> bias;
+
+  Int16Layer(bool depthwise, const Shape& input_shape, int filter_size, int stride, int padding, int output_channels,
+             std::mt19937& rng)
+  {
+    const int depth = depthwise ? input_shape.channel : output_channels;
+    layer.type = depthwise ? LayerType::DepthwiseConv2D : LayerType::Conv2D;
+    layer.input_shape = input_shape;
+    layer.filter_shape = depthwise
+      ? Shape(1, filter_size, filter_size, depth)
+      : Shape(depth, filter_size, filter_size, input_shape.channel);
+    layer.output_shape = Shape(input_shape.number,
+                               (input_shape.height + 2 * padding - filter_size) / stride + 1,
+                               (input_shape.width + 2 * padding - filter_size) / stride + 1,
+                               depth);
+    layer.stride_height = layer.stride_width = stride;
+    layer.padding_height = layer.padding_width = padding;
+    std::uniform_int_distribution<int> activation(-32768, 32767);
+    std::uniform_int_distribution<int> weight(-128, 127);
+    std::uniform_int_distribution<int> multiplier(1 << 30, 0x7fffffff);
+    std::uniform_int_distribution<int> shift(14, 20);
+    input.resize(input_shape.num_elements());
+    filter.resize(layer.filter_shape.num_elements());
+    bias.resize(depth);
+    for (size_t i=0; i<input.size(); ++i) {
+      input[i] = (int16_t)activation(rng);
+    }
+    for (size_t i=0; i<filter.size(); ++i) {
+      filter[i] = (int8_t)weight(rng);
+    }
+    for (size_t i=0; i<bias.size(); ++i) {
+      bias[i] = (int64_t)activation(rng) << 8;
+    }
+    layer.output_multiplier.resize(depth);
+    layer.output_shift.resize(depth);
+    for (int i=0; i<depth; ++i) {
+      layer.output_multiplier[i] = multiplier(rng);
+      layer.output_shift[i] = shift(rng);
+    }
+    layer.filter_values = &filter[0];
+    layer.bias_values = &bias[0];
+  }
+
+  // straight loops summing in int64
+  std::vector<int16_t> reference() const {
+    const Shape& is = layer.input_shape;
+    const Shape& fs = layer.filter_shape;
+    const Shape& os = layer.output_shape;
+    const bool depthwise = layer.type == LayerType::DepthwiseConv2D;
+    std::vector<int16_t> output(os.num_elements());
+    for (int b=0; b<os.number; ++b) {
+      for (int y=0; y<os.height; ++y) {
+        for (int x=0; x<os.width; ++x) {
+          for (int oc=0; oc<os.channel; ++oc) {
+            int64_t sum = bias[oc];
+            for (int fy=0; fy<fs.height; ++fy) {
+              const int in_y = y * layer.stride_height - layer.padding_height + fy;
+              for (int fx=0; fx<fs.width; ++fx) {
+                const int in_x = x * layer.stride_width - layer.padding_width + fx;
+                if (in_y < 0 || in_y >= is.height || in_x < 0 || in_x >= is.width)
+                  continue;
+                if (depthwise) {
+                  sum += input[is.offset(b, in_y, in_x, oc)] * filter[fs.offset(0, fy, fx, oc)];
+                  continue;
+                }
+                for (int ic=0; ic<is.channel; ++ic) {
+                  sum += input[is.offset(b, in_y, in_x, ic)] * filter[fs.offset(oc, fy, fx, ic)];
+                }
+              }
+            }
+            output[os.offset(b, y, x, oc)] = requantize_int16(sum, layer.output_multiplier[oc], layer.output_shift[oc],
+                                                              layer.activation_min, layer.activation_max);
+          }
+        }
+      }
+    }
+    return output;
+  }
+
+  std::vector<int16_t> run() const {
+    std::vector<int16_t> output(layer.output_shape.num_elements());
+    run_layer(layer, &input[0], &output[0]);
+    return output;
+  }
+};
+
+} // namespace
+
+TEST_CASE("requantize_int16 rounds the scaled sum")
+{
+  std::mt19937 rng(1);
+  // small enough for the product to be exact in a double
+  std::uniform_int_distribution<int64_t> sum(-((int64_t)1 << 37), (int64_t)1 << 37);
+  std::uniform_int_distribution<int> multiplier(1 << 30, 0x7fff0000);
+  std::uniform_int_distribution<int> shift(0, 31);
+  for (int i=0; i<10000; ++i) {
+    const int64_t s = sum(rng);
+    const int32_t m0 = multiplier(rng);
+    const int32_t n = shift(rng);
+    // the 16 bit multiplier keeps 15 bits of precision
+    const double reduced = floor((m0 + 32768.0) / 65536.0);
+    const double expected = std::max(-32768.0, std::min(32767.0, floor(s * reduced / ldexp(1, 15 + n) + 0.5)));
+    CHECK(requantize_int16(s, m0, n, -32768, 32767) == expected);
+  }
+  CHECK(requantize_int16(-100, 1 << 30, 0, 0, 32767) == 0);
+  CHECK(requantize_int16((int64_t)1 << 40, 1 << 30, 0, -32768, 32767) == 32767);
+}
+
+TEST_CASE("16x8 Conv2D matches int64 loops")
+{
+  std::mt19937 rng(2);
+  // output channel counts that leave a short block, padding, stride 2, a
+  // batch of 2, and rows long enough to flush the int32 lanes mid row
+  Int16Layer layers[] = {
+    Int16Layer(false, Shape(1, 9, 7, 5), 3, 1, 1, 37, rng),
+    Int16Layer(false, Shape(1, 11, 10, 19), 3, 2, 0, 16, rng),
+    Int16Layer(false, Shape(2, 6, 6, 24), 1, 1, 0, 6, rng),
+    Int16Layer(false, Shape(1, 3, 3, 4100), 1, 1, 0, 5, rng),
+    Int16Layer(false, Shape(1, 5, 5, 1500), 3, 1, 1, 3, rng),
+  };
+  for (size_t i=0; i<sizeof(layers)/sizeof(layers[0]); ++i) {
+    CHECK(layers[i].run() == layers[i].reference());
+  }
+}
+
+TEST_CASE("16x8 Conv2D sums worst case inputs without overflow")
+{
+  std::mt19937 rng(3);
+  Int16Layer layer(false, Shape(1, 2, 2, 8200), 1, 1, 0, 4, rng);
+  for (size_t i=0; i<layer.input.size(); ++i) {
+    layer.input[i] = -32768;
+  }
+  for (size_t i=0; i<layer.filter.size(); ++i) {
+    layer.filter[i] = -128;
+  }
+  // 8200 * 2^22 is past int32, the shift brings it back into range
+  for (int i=0; i<4; ++i) {
+    layer.bias[i] = 0;
+    layer.layer.output_multiplier[i] = 1 << 30;
+    layer.layer.output_shift[i] = 20;
+  }
+  const std::vector<int16_t> output = layer.run();
+  CHECK(output == layer.reference());
+  CHECK(output[0] == 16400);
+}
+
+TEST_CASE("16x8 DepthwiseConv2D matches int64 loops")
+{
+  std::mt19937 rng(4);
+  // channel counts with and without a 16 channel tail, odd and even tap counts
+  Int16Layer layers[] = {
+    Int16Layer(true, Shape(1, 9, 7, 21), 3, 1, 1, 0, rng),
+    Int16Layer(true, Shape(1, 14, 15, 48), 5, 2, 2, 0, rng),
+    Int16Layer(true, Shape(2, 5, 6, 3), 3, 1, 0, 0, rng),
+    Int16Layer(true, Shape(1, 6, 6, 32), 2, 2, 0, 0, rng),
+  };
+  for (size_t i=0; i<sizeof(layers)/sizeof(layers[0]); ++i) {
+    CHECK(layers[i].run() == layers[i].reference());
+  }
+}
+
+TEST_CASE("16x8 kernels write only output_rect")
+{
+  std::mt19937 rng(5);
+  Int16Layer layers[] = {
+    Int16Layer(false, Shape(1, 8, 8, 20), 3, 1, 1, 12, rng),
+    Int16Layer(true, Shape(1, 8, 8, 20), 3, 1, 1, 0, rng),
+  };
+  const Rect rect(1, 2, 6, 5);
+  for (size_t i=0; i<sizeof(layers)/sizeof(layers[0]); ++i) {
+    const Shape& os = layers[i].layer.output_shape;
+    const std::vector<int16_t> expected = layers[i].reference();
+    std::vector<int16_t> output(os.num_elements(), 12345);
+    run_layer(layers[i].layer, &layers[i].input[0], &output[0], rect);
+    bool match = true;
+    for (int y=0; y<os.height; ++y) {
+      for (int x=0; x<os.width; ++x) {
+        const bool inside = x >= rect.x0 && x < rect.x1 && y >= rect.y0 && y < rect.y1;
+        for (int c=0; c<os.channel; ++c) {
+          const int j = os.offset(0, y, x, c);
+          match = match && output[j] == (inside ? expected[j] : 12345);
+        }
+      }
+    }
+    CHECK(match);
+  }
+}
@@ -0,0 +1,137 @@
+#include "doctest.h"
+
+#include <math.h>
+#include <random>
+
+#include "cnn_int4.h"
+#include "test_layers.h"
+
+namespace {
+
+struct Int4Layer
+{
+  TestLayer t;
+  std::vector<int8_t> input;
+
+  // weights drawn from [-weight_max - 1, weight_max]
+  Int4Layer(const Shape& input_shape, int filter_size, int stride, int padding, int output_channels,
+            int weight_max, std::mt19937& rng)
+  {
+    make_layer(t, LayerType::Conv2D, input_shape, filter_size, stride, padding, output_channels, rng, true, 9, 3, -5);
+    std::uniform_int_distribution<int> weight(-weight_max - 1, weight_max);
+    for (size_t i=0; i<t.filter.size(); ++i) {
+      t.filter[i] = (int8_t)weight(rng);
+    }
+    std::uniform_int_distribution<int> activation(-128, 127);
+    input.resize(input_shape.num_elements());
+    for (size_t i=0; i<input.size(); ++i) {
+      input[i] = (int8_t)activation(rng);
+    }
+  }
+
+  std::vector<int8_t> direct() const {
+    std::vector<int8_t> output(t.layer.output_shape.num_elements());
+    run_layer(t.layer, &input[0], &output[0]);
+    return output;
+  }
+
+  std::vector<int8_t> int4(const Int4Filter& packed) const {
+    std::vector<int8_t> output(t.layer.output_shape.num_elements());
+    Conv2D_int4(t.layer, packed, &input[0], &output[0]);
+    return output;
+  }
+};
+
+} // namespace
+
+TEST_CASE("pack_filter_int4 packs nibbles in blocks of 32")
+{
+  std::mt19937 rng(1);
+  Int4Layer l(Shape(1, 2, 2, 70), 1, 1, 0, 3, 7, rng);
+  Int4Filter packed;
+  pack_filter_int4(l.t.layer, packed);
+  CHECK(packed.row_bytes == 48);
+  // half the int8 filter, plus the padding of the last block
+  CHECK(packed.values.size() == 3 * 48);
+  for (int n=0; n<3; ++n) {
+    CHECK(packed.scales[n] == 1.0f);
+    for (int k=0; k<70; ++k) {
+      CHECK(int4_value(packed.row(n), k) == l.t.filter[n * 70 + k]);
+    }
+  }
+}
+
+TEST_CASE("Conv2D_int4 matches the int8 kernel on int4 weights")
+{
+  std::mt19937 rng(2);
+  // 1x1 GEMMs with depth tails and depths below a block, row and output
+  // channel counts that leave partial blocks, and im2col layers with
+  // padding and stride 2
+  Int4Layer layers[] = {
+    Int4Layer(Shape(1, 7, 7, 96), 1, 1, 0, 24, 7, rng),
+    Int4Layer(Shape(1, 6, 5, 16), 1, 1, 0, 9, 7, rng),
+    Int4Layer(Shape(1, 5, 5, 24), 1, 1, 0, 7, 7, rng),
+    Int4Layer(Shape(2, 5, 3, 40), 1, 1, 0, 13, 7, rng),
+    Int4Layer(Shape(1, 3, 3, 5), 1, 1, 0, 6, 7, rng),
+    Int4Layer(Shape(1, 9, 7, 16), 3, 1, 1, 10, 7, rng),
+    Int4Layer(Shape(1, 11, 10, 3), 3, 2, 0, 32, 7, rng),
+  };
+  for (size_t i=0; i<sizeof(layers)/sizeof(layers[0]); ++i) {
+    Int4Filter packed;
+    pack_filter_int4(layers[i].t.layer, packed);
+    CHECK(layers[i].int4(packed) == layers[i].direct());
+  }
+}
+
+TEST_CASE("pack_filter_int4 folds the channel scales into the requantization")
+{
+  std::mt19937 rng(3);
+  Int4Layer l(Shape(1, 6, 6, 48), 1, 1, 0, 20, 127, rng);
+  Int4Filter packed;
+  pack_filter_int4(l.t.layer, packed);
+
+  // the int8 kernel run on the rounded weights with the folded parameters
+  // computes the same thing
+  Int4Layer rounded = l;
+  std::vector<int32_t> bias(20);
+  for (int n=0; n<20; ++n) {
+    CHECK(packed.scales[n] > 1.0f);
+    for (int k=0; k<48; ++k) {
+      const int q = int4_value(packed.row(n), k);
+      CHECK(fabs(q * packed.scales[n] - l.t.filter[n * 48 + k]) <= packed.scales[n] * 0.5 + 1e-4);
+      rounded.t.filter[n * 48 + k] = (int8_t)q;
+    }
+    bias[n] = (int32_t)lrint(l.t.bias[n] / (double)packed.scales[n]);
+    const double real = ldexp((double)l.t.layer.output_multiplier[n], -31 - l.t.layer.output_shift[n]) * packed.scales[n];
+    const double folded = ldexp((double)packed.output_multiplier[n], -31 - packed.output_shift[n]);
+    CHECK(fabs(folded / real - 1) < 1e-8);
+  }
+  rounded.t.layer.filter_values = &rounded.t.filter[0];
+  rounded.t.layer.bias_values = &bias[0];
+  rounded.t.layer.output_multiplier = packed.output_multiplier;
+  rounded.t.layer.output_shift = packed.output_shift;
+  CHECK(l.int4(packed) == rounded.direct());
+}
+
+TEST_CASE("pack_filter_int4 clamps a scale that would fold the multiplier to 1")
+{
+  std::mt19937 rng(4);
+  // even weights in [-16, 14] want a scale of 16 / 7, a multiplier of 0.5
+  // allows just under 2, which still divides them exactly
+  Int4Layer l(Shape(1, 5, 5, 24), 3, 1, 1, 6, 7, rng);
+  for (size_t i=0; i<l.t.filter.size(); ++i) {
+    l.t.filter[i] = (int8_t)(l.t.filter[i] * 2);
+  }
+  for (size_t i=0; i<l.t.bias.size(); ++i) {
+    l.t.bias[i] *= 2;
+  }
+  l.t.layer.output_shift.assign(6, 0);
+  Int4Filter packed;
+  pack_filter_int4(l.t.layer, packed);
+  for (int n=0; n<6; ++n) {
+    CHECK(packed.scales[n] > 1.99f);
+    CHECK(packed.scales[n] < 2.0f);
+    CHECK(packed.output_shift[n] >= 0);
+  }
+  CHECK(l.int4(packed) == l.direct());
+}
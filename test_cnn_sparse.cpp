@@ -0,0 +1,128 @@
+#include "doctest.h"
+
+#include <random>
+
+#include "cnn_sparse.h"
+#include "test_layers.h"
+
+namespace {
+
+struct PrunedLayer
+{
+  TestLayer t;
+  std::vector<int8_t> input;
+
+  // blocks of block input channels are zeroed with probability sparsity
+  PrunedLayer(const Shape& input_shape, int filter_size, int stride, int padding, int output_channels,
+              int block, double sparsity, std::mt19937& rng)
+  {
+    make_layer(t, LayerType::Conv2D, input_shape, filter_size, stride, padding, output_channels, rng, true, 10);
+    prune_blocks(t.filter, input_shape.channel, block, sparsity, rng);
+    std::uniform_int_distribution<int> int8_dist(-128, 127);
+    input.resize(input_shape.num_elements());
+    for (size_t i=0; i<input.size(); ++i) {
+      input[i] = (int8_t)int8_dist(rng);
+    }
+  }
+
+  std::vector<int8_t> dense() const {
+    std::vector<int8_t> output(t.layer.output_shape.num_elements());
+    run_layer(t.layer, &input[0], &output[0]);
+    return output;
+  }
+
+  std::vector<int8_t> sparse(int block) const {
+    BlockSparseFilter sparse_filter;
+    make_block_sparse_filter(t.layer.filter_shape, t.layer.filter_values, block, sparse_filter);
+    std::vector<int8_t> output(t.layer.output_shape.num_elements());
+    run_layer(t.layer, sparse_filter, &input[0], &output[0]);
+    return output;
+  }
+};
+
+} // namespace
+
+TEST_CASE("make_block_sparse_filter keeps the nonzero blocks")
+{
+  // one output channel, 2 taps of 20 channels : blocks of 16 then 4
+  std::vector<int8_t> values(40, 0);
+  values[3] = 1;         // tap 0, block 0
+  values[20 + 17] = -2;  // tap 1, block 1
+  BlockSparseFilter filter;
+  make_block_sparse_filter(Shape(1, 1, 2, 20), &values[0], 16, filter);
+  REQUIRE(filter.num_blocks() == 2);
+  CHECK(filter.block_tap[0] == 0);
+  CHECK(filter.block_channel[0] == 0);
+  CHECK(filter.block_tap[1] == 1);
+  CHECK(filter.block_channel[1] == 16);
+  CHECK(filter.values.size() == 32);
+  CHECK(filter.values[3] == 1);
+  CHECK(filter.values[16 + 1] == -2);
+  // padding of the short block
+  CHECK(filter.values[16 + 4] == 0);
+  CHECK(filter.density() == 0.5);
+}
+
+TEST_CASE("block sparse Conv2D matches the dense kernel")
+{
+  std::mt19937 rng(1);
+  const int blocks[] = {4, 16};
+  for (int i=0; i<2; ++i) {
+    const int block = blocks[i];
+    // 1x1 GEMMs, depths that leave a short block, widths that leave a short
+    // pixel group, padding, stride 2 and a batch of 2
+    PrunedLayer layers[] = {
+      PrunedLayer(Shape(1, 7, 7, 96), 1, 1, 0, 24, block, 0.7, rng),
+      PrunedLayer(Shape(2, 5, 6, 40), 1, 1, 0, 13, block, 0.5, rng),
+      PrunedLayer(Shape(1, 9, 7, 18), 3, 1, 1, 10, block, 0.8, rng),
+      PrunedLayer(Shape(1, 11, 10, 32), 3, 2, 0, 8, block, 0.0, rng),
+      PrunedLayer(Shape(1, 4, 4, 16), 1, 1, 0, 5, block, 1.0, rng),
+    };
+    for (size_t j=0; j<sizeof(layers)/sizeof(layers[0]); ++j) {
+      CHECK(layers[j].sparse(block) == layers[j].dense());
+    }
+  }
+}
+
+TEST_CASE("block sparse Conv2D writes only output_rect")
+{
+  std::mt19937 rng(2);
+  PrunedLayer l(Shape(1, 8, 8, 32), 3, 1, 1, 6, 16, 0.5, rng);
+  BlockSparseFilter filter;
+  make_block_sparse_filter(l.t.layer.filter_shape, l.t.layer.filter_values, 16, filter);
+  const std::vector<int8_t> expected = l.dense();
+  std::vector<int8_t> output(expected.size(), 99);
+  const Rect rect(1, 2, 6, 5);
+  run_layer(l.t.layer, filter, &l.input[0], &output[0], rect);
+  bool match = true;
+  for (int y=0; y<8; ++y) {
+    for (int x=0; x<8; ++x) {
+      const bool inside = x >= rect.x0 && x < rect.x1 && y >= rect.y0 && y < rect.y1;
+      for (int c=0; c<6; ++c) {
+        const int i = l.t.layer.output_shape.offset(0, y, x, c);
+        match = match && output[i] == (inside ? expected[i] : 99);
+      }
+    }
+  }
+  CHECK(match);
+}
+
+TEST_CASE("run_layers runs the layers with a sparse filter on it")
+{
+  std::mt19937 rng(3);
+  PrunedLayer first(Shape(1, 8, 8, 32), 3, 1, 1, 16, 16, 0.6, rng);
+  PrunedLayer second(Shape(1, 8, 8, 16), 1, 1, 0, 24, 4, 0.5, rng);
+  std::vector<ConvLayer_int8> layers;
+  layers.push_back(first.t.layer);
+  layers.push_back(second.t.layer);
+  // the second filter left empty, so dense
+  std::vector<BlockSparseFilter> sparse_filters(2);
+  make_block_sparse_filter(first.t.layer.filter_shape, first.t.layer.filter_values, 16, sparse_filters[0]);
+
+  std::vector<int8_t> scratch;
+  std::vector<int8_t> expected(second.t.layer.output_shape.num_elements());
+  run_layers(layers, 1, &first.input[0], &expected[0], scratch);
+  std::vector<int8_t> output(expected.size());
+  run_layers(layers, sparse_filters, 1, &first.input[0], &output[0], scratch);
+  CHECK(output == expected);
+}
@@ -0,0 +1,133 @@
+#include "doctest.h"
+
+#include <math.h>
+#include <random>
+
+#include "cnn_winograd.h"
+
+namespace {
+
+// largest |winograd - direct| over the output, with direct the Conv2D loop
+template <typename T>
+double winograd_error(
+  int m,
+  const Shape& input_shape, int output_depth, int padding,
+  std::mt19937& rng)
+{
+  const Shape filter_shape(output_depth, 3, 3, input_shape.channel);
+  const Shape output_shape(1,
+                           input_shape.height + 2 * padding - 2,
+                           input_shape.width + 2 * padding - 2,
+                           output_depth);
+  std::uniform_real_distribution<T> value(-1, 1);
+  std::vector<T> input(input_shape.num_elements());
+  std::vector<T> filter(filter_shape.num_elements());
+  std::vector<T> bias(output_depth);
+  for (size_t i=0; i<input.size(); ++i) {
+    input[i] = value(rng);
+  }
+  for (size_t i=0; i<filter.size(); ++i) {
+    filter[i] = value(rng);
+  }
+  for (size_t i=0; i<bias.size(); ++i) {
+    bias[i] = value(rng);
+  }
+
+  std::vector<T> expected(output_shape.num_elements());
+  Conv2D(input_shape, &input[0],
+         filter_shape, &filter[0],
+         &bias[0],
+         output_shape, &expected[0],
+         1, 1,
+         padding, padding);
+
+  WinogradFilter<T> transformed;
+  winograd_transform_filter_float(filter_shape, &filter[0], m, transformed);
+  std::vector<T> output(output_shape.num_elements());
+  // a block size that does not divide the tile count
+  Conv2D_winograd(input_shape, &input[0],
+                  transformed,
+                  &bias[0],
+                  output_shape, &output[0],
+                  padding, padding,
+                  3);
+
+  double error = 0;
+  for (size_t i=0; i<output.size(); ++i) {
+    error = std::max(error, fabs((double)output[i] - (double)expected[i]));
+  }
+  return error;
+}
+
+} // namespace
+
+TEST_CASE("Conv2D_winograd F(2x2, 3x3) matches Conv2D")
+{
+  std::mt19937 rng(1);
+  // same and valid padding, output sizes that are not tile multiples
+  CHECK(winograd_error<float>(2, Shape(1, 9, 7, 16), 12, 1, rng) < 2e-5);
+  CHECK(winograd_error<float>(2, Shape(1, 8, 11, 5), 3, 0, rng) < 2e-5);
+  CHECK(winograd_error<double>(2, Shape(1, 9, 7, 16), 12, 1, rng) < 1e-12);
+}
+
+TEST_CASE("Conv2D_winograd F(4x4, 3x3) matches Conv2D")
+{
+  std::mt19937 rng(2);
+  // the 1/6 and 1/24 of the F(4x4) transforms cost about 4x the error
+  CHECK(winograd_error<float>(4, Shape(1, 9, 7, 16), 12, 1, rng) < 2e-4);
+  CHECK(winograd_error<float>(4, Shape(1, 14, 13, 5), 3, 0, rng) < 2e-4);
+  CHECK(winograd_error<double>(4, Shape(1, 9, 7, 16), 12, 1, rng) < 1e-12);
+}
+
+TEST_CASE("Conv2D_winograd writes only output_rect")
+{
+  std::mt19937 rng(3);
+  const Shape input_shape(1, 10, 9, 4);
+  const Shape filter_shape(6, 3, 3, 4);
+  const Shape output_shape(1, 10, 9, 6);
+  std::uniform_real_distribution<float> value(-1, 1);
+  std::vector<float> input(input_shape.num_elements());
+  std::vector<float> filter(filter_shape.num_elements());
+  std::vector<float> bias(6);
+  for (size_t i=0; i<input.size(); ++i) {
+    input[i] = value(rng);
+  }
+  for (size_t i=0; i<filter.size(); ++i) {
+    filter[i] = value(rng);
+  }
+  for (size_t i=0; i<bias.size(); ++i) {
+    bias[i] = value(rng);
+  }
+  std::vector<float> expected(output_shape.num_elements());
+  Conv2D(input_shape, &input[0], filter_shape, &filter[0], &bias[0],
+         output_shape, &expected[0], 1, 1, 1, 1);
+
+  WinogradFilter<float> transformed;
+  winograd_transform_filter_float(filter_shape, &filter[0], 4, transformed);
+  std::vector<float> output(output_shape.num_elements(), 1000.0f);
+  // neither corner on the tile grid of the whole output
+  const Rect rect(1, 3, 8, 9);
+  Conv2D_winograd(input_shape, &input[0], transformed, &bias[0],
+                  output_shape, &output[0], 1, 1, rect);
+  for (int y=0; y<output_shape.height; ++y) {
+    for (int x=0; x<output_shape.width; ++x) {
+      const bool inside = x >= rect.x0 && x < rect.x1 && y >= rect.y0 && y < rect.y1;
+      for (int c=0; c<output_shape.channel; ++c) {
+        const int i = output_shape.offset(0, y, x, c);
+        if (inside) {
+          CHECK(fabs(output[i] - expected[i]) < 2e-4);
+        }else {
+          CHECK(output[i] == 1000.0f);
+        }
+      }
+    }
+  }
+}
+
+TEST_CASE("winograd_applicable")
+{
+  CHECK(winograd_applicable(Shape(8, 3, 3, 4), 1, 1));
+  CHECK(!winograd_applicable(Shape(8, 3, 3, 4), 2, 2));
+  CHECK(!winograd_applicable(Shape(8, 1, 1, 4), 1, 1));
+  CHECK(!winograd_applicable(Shape(8, 5, 5, 4), 1, 1));
+}
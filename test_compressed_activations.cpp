@@ -0,0 +1,85 @@
+#include "doctest.h"
+
+#include <random>
+
+#include "compressed_activations.h"
+#include "test_layers.h"
+
+TEST_CASE("CompressedActivations decodes what it encodes")
+{
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<int> dist(-128, 127);
+  std::bernoulli_distribution zero(0.7);
+  // rows of 150 bytes : two full tiles and a short one
+  const Shape shape(2, 5, 10, 15);
+  const int8_t zero_point = -3;
+  std::vector<int8_t> plain(shape.num_elements());
+  for (size_t i=0; i<plain.size(); ++i) {
+    plain[i] = zero(rng) ? zero_point : (int8_t)dist(rng);
+  }
+  const size_t row = 150;
+  CompressedActivations a;
+  a.reset(shape, zero_point);
+  a.write_rows(0, 0, 2, &plain[0]);
+  a.write_rows(0, 2, 5, &plain[2 * row]);
+  a.write_rows(1, 0, 5, &plain[5 * row]);
+  CHECK(a.plain_bytes() == plain.size());
+  CHECK(a.compressed_bytes() < plain.size() / 2);
+
+  std::vector<int8_t> decoded(plain.size(), 99);
+  a.read_rows(1, 0, 5, &decoded[5 * row]);
+  a.read_rows(0, 0, 5, &decoded[0]);
+  CHECK(decoded == plain);
+  std::vector<int8_t> band(2 * row, 99);
+  a.read_rows(1, 2, 4, &band[0]);
+  CHECK(std::equal(band.begin(), band.end(), plain.begin() + 7 * row));
+
+  // nothing at the zero point costs more than plain, but decodes the same
+  std::vector<int8_t> dense(shape.num_elements(), 1);
+  a.reset(shape, zero_point);
+  a.write_rows(0, 0, 5, &dense[0]);
+  a.write_rows(1, 0, 5, &dense[5 * row]);
+  CHECK(a.compressed_bytes() > a.plain_bytes());
+  a.read_rows(0, 0, 5, &decoded[0]);
+  a.read_rows(1, 0, 5, &decoded[5 * row]);
+  CHECK(decoded == dense);
+}
+
+TEST_CASE("run_layers_compressed matches run_layers")
+{
+  std::mt19937 rng(2);
+  // padding, stride 2, a 5x5 filter, depthwise and a 1x1 projection
+  TestLayer layers[5];
+  make_layer(layers[0], LayerType::Conv2D, Shape(1, 23, 19, 3), 3, 2, 1, 16, rng, true, 12);
+  make_layer(layers[1], LayerType::DepthwiseConv2D, layers[0].layer.output_shape, 3, 1, 1, 16, rng, true, 12);
+  make_layer(layers[2], LayerType::Conv2D, layers[1].layer.output_shape, 1, 1, 0, 24, rng, true, 12);
+  make_layer(layers[3], LayerType::DepthwiseConv2D, layers[2].layer.output_shape, 5, 2, 2, 24, rng, true, 12);
+  make_layer(layers[4], LayerType::Conv2D, layers[3].layer.output_shape, 3, 1, 0, 8, rng, true, 12);
+  std::vector<ConvLayer_int8> chain;
+  for (int i=0; i<5; ++i) {
+    chain.push_back(layers[i].layer);
+  }
+  const int batch = 2;
+  std::uniform_int_distribution<int> dist(-128, 127);
+  std::vector<int8_t> input(chain.front().input_shape.num_elements() * batch);
+  for (size_t i=0; i<input.size(); ++i) {
+    input[i] = (int8_t)dist(rng);
+  }
+  std::vector<int8_t> expected(chain.back().output_shape.num_elements() * batch);
+  std::vector<int8_t> scratch;
+  run_layers(chain, batch, &input[0], &expected[0], scratch);
+
+  CompressedChainScratch compressed;
+  const int band_rows[] = {1, 3, 4, 100};
+  for (int i=0; i<4; ++i) {
+    std::vector<int8_t> output(expected.size(), 99);
+    run_layers_compressed(chain, batch, &input[0], &output[0], compressed, band_rows[i]);
+    CAPTURE(band_rows[i]);
+    CHECK(output == expected);
+  }
+  REQUIRE(compressed.compressed_bytes.size() == 4);
+  for (int i=0; i<4; ++i) {
+    CHECK(compressed.plain_bytes[i] == (size_t)chain[i].output_shape.num_elements() * batch);
+    CHECK(compressed.compressed_bytes[i] < compressed.plain_bytes[i]);
+  }
+}
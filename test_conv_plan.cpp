@@ -0,0 +1,126 @@
+#include "doctest.h"
+
+#include <random>
+
+#include "conv_plan.h"
+#include "test_layers.h"
+
+TEST_CASE("every applicable algorithm matches run_layer")
+{
+  std::mt19937 rng(1);
+  TestLayer layers[6];
+  make_layer(layers[0], LayerType::Conv2D, Shape(1, 9, 11, 5), 3, 1, 1, 7, rng, true, 10);
+  make_layer(layers[1], LayerType::Conv2D, Shape(2, 8, 7, 16), 3, 1, 0, 9, rng, true, 10);
+  make_layer(layers[2], LayerType::Conv2D, Shape(1, 10, 10, 24), 1, 1, 0, 40, rng, true, 10);
+  make_layer(layers[3], LayerType::Conv2D, Shape(1, 17, 15, 3), 5, 2, 2, 8, rng, true, 10);
+  make_layer(layers[4], LayerType::Conv2D, Shape(1, 12, 12, 8), 1, 2, 0, 4, rng, true, 10);
+  make_layer(layers[5], LayerType::DepthwiseConv2D, Shape(1, 9, 9, 6), 3, 1, 1, 6, rng, true, 10);
+  std::uniform_int_distribution<int> dist(-128, 127);
+  int checked[NUM_CONV_ALGORITHMS] = {0};
+  for (int i=0; i<6; ++i) {
+    const ConvLayer_int8& l = layers[i].layer;
+    std::vector<int8_t> input(l.input_shape.num_elements());
+    for (size_t j=0; j<input.size(); ++j) {
+      input[j] = (int8_t)dist(rng);
+    }
+    std::vector<int8_t> expected(l.output_shape.num_elements());
+    run_layer(l, &input[0], &expected[0]);
+    for (int a=0; a<NUM_CONV_ALGORITHMS; ++a) {
+      if (!conv_algorithm_applicable(l, (ConvAlgorithm)a)) {
+        continue;
+      }
+      const ConvPlan plan = make_conv_plan(l, (ConvAlgorithm)a);
+      std::vector<int8_t> output(expected.size(), 0);
+      run_conv(l, plan, &input[0], &output[0]);
+      CAPTURE(i);
+      CAPTURE(a);
+      CHECK(output == expected);
+      ++checked[a];
+    }
+  }
+  CHECK(checked[(int)ConvAlgorithm::direct] == 6);
+  CHECK(checked[(int)ConvAlgorithm::im2col_gemm] == 5);
+  CHECK(checked[(int)ConvAlgorithm::gemm_1x1] == 1);
+  CHECK(checked[(int)ConvAlgorithm::winograd] == 2);
+}
+
+TEST_CASE("ConvCostModel selects the cheapest applicable algorithm")
+{
+  std::mt19937 rng(2);
+  TestLayer conv3, conv1, dw;
+  make_layer(conv3, LayerType::Conv2D, Shape(1, 16, 16, 16), 3, 1, 1, 16, rng, true, 10);
+  make_layer(conv1, LayerType::Conv2D, Shape(1, 16, 16, 16), 1, 1, 0, 32, rng, true, 10);
+  make_layer(dw, LayerType::DepthwiseConv2D, Shape(1, 16, 16, 16), 3, 1, 1, 16, rng, true, 10);
+
+  ConvCostModel model;
+  CHECK(model.select(dw.layer) == ConvAlgorithm::direct);
+  // Winograd does 16 multiplies per 2x2 outputs instead of 36
+  CHECK(conv_work(conv3.layer, ConvAlgorithm::winograd).macs * 9 == conv3.layer.macs() * 4);
+
+  for (int a=0; a<NUM_CONV_ALGORITHMS; ++a) {
+    model.seconds_per_mac[a] = 1e-9;
+  }
+  model.seconds_per_mac[(int)ConvAlgorithm::gemm_1x1] = 0.1e-9;
+  CHECK(model.select(conv1.layer) == ConvAlgorithm::gemm_1x1);
+  CHECK(model.select(conv3.layer) == ConvAlgorithm::winograd);
+  model.seconds_per_mac[(int)ConvAlgorithm::direct] = 0.01e-9;
+  CHECK(model.select(conv3.layer) == ConvAlgorithm::direct);
+
+  const ConvPlan plan = plan_conv(conv1.layer, model);
+  CHECK(plan.algorithm == model.select(conv1.layer));
+  CHECK(plan.estimated_seconds == model.estimate(conv1.layer, plan.algorithm));
+
+  std::vector<ConvLayer_int8> layers;
+  layers.push_back(conv3.layer);
+  layers.push_back(conv1.layer);
+  layers.push_back(dw.layer);
+  ConvCostModel calibrated;
+  calibrated.seconds_per_mac_depthwise = 0;
+  calibrated.calibrate(layers);
+  for (int a=0; a<NUM_CONV_ALGORITHMS; ++a) {
+    CHECK(calibrated.seconds_per_mac[a] > 0);
+  }
+  CHECK(calibrated.seconds_per_mac_depthwise > 0);
+}
+
+TEST_CASE("gemm_1x1 skipping zero point inputs matches run_layer")
+{
+  std::mt19937 rng(3);
+  // depths with and without channels past the last group of 8, a batch of 2
+  TestLayer layers[3];
+  make_layer(layers[0], LayerType::Conv2D, Shape(1, 7, 7, 96), 1, 1, 0, 24, rng, true, 10);
+  make_layer(layers[1], LayerType::Conv2D, Shape(2, 5, 6, 43), 1, 1, 0, 13, rng, true, 10);
+  make_layer(layers[2], LayerType::Conv2D, Shape(1, 4, 4, 5), 1, 1, 0, 6, rng, true, 10);
+  std::uniform_int_distribution<int> dist(-128, 127);
+  std::bernoulli_distribution zero_group(0.6);
+  for (int i=0; i<3; ++i) {
+    const ConvLayer_int8& l = layers[i].layer;
+    // as after a ReLU : groups of 8 at the zero point, -input_offset
+    const int depth = l.input_shape.channel;
+    std::vector<int8_t> input(l.input_shape.num_elements());
+    for (size_t j=0; j<input.size(); j+=depth) {
+      for (int c0=0; c0<depth; c0+=8) {
+        const bool zero = zero_group(rng);
+        for (int c=c0; c<std::min(depth, c0 + 8); ++c) {
+          input[j + c] = zero ? -128 : (int8_t)dist(rng);
+        }
+      }
+    }
+    std::vector<int8_t> expected(l.output_shape.num_elements());
+    run_layer(l, &input[0], &expected[0]);
+    ConvPlan plan = make_conv_plan(l, ConvAlgorithm::gemm_1x1);
+    plan.skip_zero_inputs = true;
+    std::vector<int8_t> output(expected.size(), 0);
+    run_conv(l, plan, &input[0], &output[0]);
+    CAPTURE(i);
+    CHECK(output == expected);
+    if (depth >= 8) {
+      const double fraction = zero_group_fraction(l, &input[0]);
+      CHECK(fraction > 0.4);
+      CHECK(fraction < 0.8);
+    }
+  }
+
+  std::vector<int8_t> zeros(layers[0].layer.input_shape.num_elements(), -128);
+  CHECK(zero_group_fraction(layers[0].layer, &zeros[0]) == 1.0);
+}
@@ -0,0 +1,69 @@
+#include "doctest.h"
+
+#include <math.h>
+#include <limits>
+#include <random>
+
+#include "float16.h"
+
+TEST_CASE("float_to_half_bits rounds to nearest even")
+{
+  CHECK(float_to_half_bits(0.0f) == 0x0000);
+  CHECK(float_to_half_bits(-0.0f) == 0x8000);
+  CHECK(float_to_half_bits(1.0f) == 0x3c00);
+  CHECK(float_to_half_bits(-2.0f) == 0xc000);
+  CHECK(float_to_half_bits(65504.0f) == 0x7bff);
+  // halfway to 65536 rounds to even, which is infinity
+  CHECK(float_to_half_bits(65519.0f) == 0x7bff);
+  CHECK(float_to_half_bits(65520.0f) == 0x7c00);
+  CHECK(float_to_half_bits(std::numeric_limits<float>::infinity()) == 0x7c00);
+  // 1 + 2^-11 is halfway between 1 and 1 + 2^-10
+  CHECK(float_to_half_bits(1.0f + ldexpf(1, -11)) == 0x3c00);
+  CHECK(float_to_half_bits(1.0f + 3 * ldexpf(1, -11)) == 0x3c02);
+  // subnormals, 2^-24 is the smallest
+  CHECK(float_to_half_bits(ldexpf(1, -24)) == 0x0001);
+  CHECK(float_to_half_bits(ldexpf(1, -25)) == 0x0000);
+  CHECK(float_to_half_bits(ldexpf(3, -26)) == 0x0001);
+  CHECK(float_to_half_bits(ldexpf(1, -15)) == 0x0200);
+  const uint16_t nan = float_to_half_bits(std::numeric_limits<float>::quiet_NaN());
+  CHECK((nan & 0x7c00) == 0x7c00);
+  CHECK((nan & 0x3ff) != 0);
+}
+
+TEST_CASE("half_bits_to_float inverts float_to_half_bits")
+{
+  for (uint32_t h=0; h<0x10000; ++h) {
+    if ((h & 0x7c00) == 0x7c00 && (h & 0x3ff)) {
+      CHECK(isnan(half_bits_to_float((uint16_t)h)));
+      continue;
+    }
+    CHECK(float_to_half_bits(half_bits_to_float((uint16_t)h)) == h);
+  }
+  CHECK(half_bits_to_float(0x0001) == ldexpf(1, -24));
+  CHECK(half_bits_to_float(0x3555) == 0.333251953125f);
+}
+
+TEST_CASE("float16 matches the software conversion")
+{
+  // F16C when built with it
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> exponent(-28, 17);
+  for (int i=0; i<10000; ++i) {
+    const float value = (i & 1 ? -1.0f : 1.0f) * exp2f(exponent(rng));
+    const float16 h(value);
+    CHECK(h.bits == float_to_half_bits(value));
+    CHECK((float)h == half_bits_to_float(h.bits));
+  }
+}
+
+TEST_CASE("bfloat16 rounds to nearest even")
+{
+  CHECK(bfloat16(1.0f).bits == 0x3f80);
+  CHECK(bfloat16(-1.0f).bits == 0xbf80);
+  // 1 + 2^-8 is halfway between 1 and 1 + 2^-7
+  CHECK(bfloat16(1.0f + ldexpf(1, -8)).bits == 0x3f80);
+  CHECK(bfloat16(1.0f + 3 * ldexpf(1, -8)).bits == 0x3f82);
+  CHECK(bfloat16(3.0e38f).bits == 0x7f62);
+  CHECK(isnan((float)bfloat16(std::numeric_limits<float>::quiet_NaN())));
+  CHECK((float)bfloat16(0.15625f) == 0.15625f);
+}
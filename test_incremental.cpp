@@ -0,0 +1,107 @@
+#include "doctest.h"
+
+#include <random>
+
+#include "incremental.h"
+#include "test_layers.h"
+
+TEST_CASE("project_rect follows the receptive field")
+{
+  ConvLayer_int8 l;
+  l.input_shape = Shape(1, 16, 16, 1);
+  l.filter_shape = Shape(1, 3, 3, 1);
+  l.output_shape = Shape(1, 8, 8, 1);
+  l.stride_height = l.stride_width = 2;
+  l.padding_height = l.padding_width = 0;
+
+  // input pixel (4, 4) is read by outputs 1 (4 = 2 + 2) and 2 (4 = 4 + 0)
+  Rect r = project_rect(l, Rect(4, 4, 5, 5));
+  CHECK(r.x0 == 1);
+  CHECK(r.x1 == 3);
+  CHECK(r.y0 == 1);
+  CHECK(r.y1 == 3);
+
+  // clipped at the borders
+  r = project_rect(l, Rect(0, 0, 16, 16));
+  CHECK(r.x0 == 0);
+  CHECK(r.x1 == 8);
+  CHECK(r.y0 == 0);
+  CHECK(r.y1 == 8);
+}
+
+TEST_CASE("IncrementalConvChain matches full recomputation")
+{
+  std::mt19937 rng(1);
+  TestLayer layers[3];
+  make_layer(layers[0], LayerType::Conv2D, Shape(1, 32, 32, 3), 3, 2, 0, 8, rng);
+  make_layer(layers[1], LayerType::DepthwiseConv2D, layers[0].layer.output_shape, 3, 1, 1, 8, rng);
+  make_layer(layers[2], LayerType::Conv2D, layers[1].layer.output_shape, 1, 1, 0, 4, rng);
+  std::vector<ConvLayer_int8> chain_layers;
+  for (int i=0; i<3; ++i) {
+    chain_layers.push_back(layers[i].layer);
+  }
+
+  const Shape& input_shape = chain_layers[0].input_shape;
+  std::uniform_int_distribution<int> pixel(-128, 127);
+  std::vector<int8_t> frame(input_shape.num_elements());
+  for (size_t i=0; i<frame.size(); ++i) {
+    frame[i] = (int8_t)pixel(rng);
+  }
+
+  IncrementalConvChain chain(chain_layers, 4);
+  chain.process(&frame[0]);
+  CHECK(chain.last_macs() == chain.total_macs());
+
+  // unchanged frame does no work
+  chain.process(&frame[0]);
+  CHECK(chain.last_macs() == 0);
+
+  // small change near the bottom right corner
+  for (int y=25; y<28; ++y) {
+    for (int x=20; x<23; ++x) {
+      for (int c=0; c<3; ++c) {
+        frame[input_shape.offset(0, y, x, c)] = (int8_t)pixel(rng);
+      }
+    }
+  }
+  const int8_t* output = chain.process(&frame[0]);
+  CHECK(chain.last_macs() > 0);
+  CHECK(chain.last_macs() < chain.total_macs() / 2);
+
+  IncrementalConvChain full(chain_layers, 4);
+  const int8_t* expected = full.process(&frame[0]);
+  const Shape& output_shape = chain_layers.back().output_shape;
+  CHECK(std::equal(output, output + output_shape.num_elements(), expected));
+}
+
+TEST_CASE("run_layers on a batch matches single images")
+{
+  std::mt19937 rng(2);
+  TestLayer layers[3];
+  make_layer(layers[0], LayerType::Conv2D, Shape(1, 13, 11, 3), 3, 2, 1, 6, rng);
+  make_layer(layers[1], LayerType::DepthwiseConv2D, layers[0].layer.output_shape, 3, 1, 1, 6, rng);
+  make_layer(layers[2], LayerType::Conv2D, layers[1].layer.output_shape, 1, 1, 0, 5, rng);
+  std::vector<ConvLayer_int8> chain_layers;
+  for (int i=0; i<3; ++i) {
+    chain_layers.push_back(layers[i].layer);
+  }
+
+  const int batch = 3;
+  const int in_size = chain_layers[0].input_shape.num_elements();
+  const int out_size = chain_layers.back().output_shape.num_elements();
+  std::uniform_int_distribution<int> pixel(-128, 127);
+  std::vector<int8_t> input(in_size * batch);
+  for (size_t i=0; i<input.size(); ++i) {
+    input[i] = (int8_t)pixel(rng);
+  }
+
+  std::vector<int8_t> scratch;
+  std::vector<int8_t> batched(out_size * batch);
+  run_layers(chain_layers, batch, &input[0], &batched[0], scratch);
+
+  std::vector<int8_t> single(out_size);
+  for (int b=0; b<batch; ++b) {
+    run_layers(chain_layers, 1, &input[b * in_size], &single[0], scratch);
+    CHECK(std::equal(single.begin(), single.end(), batched.begin() + b * out_size));
+  }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <random>
+#include <vector>
+
+#include "cnn.h"
+
+// A random ConvLayer_int8 for the tests, owning its filter and bias.
+struct TestLayer
+{
+  std::vector<int8_t> filter;
+  std::vector<int32_t> bias;
+  ConvLayer_int8 layer;
+};
+
+// Small weights ([-8, 8], a bias of 100, a shift of 4) keep most outputs off
+// the clamps; full_range draws any int8 weight and biases in [-5000, 5000],
+// requantized with output_shift. The offsets default to those of an int8
+// model fed uint8 data.
+inline
+void make_layer(
+  TestLayer& t,
+  LayerType type,
+  const Shape& input_shape,
+  int filter_size, int stride, int padding, int output_channels,
+  std::mt19937& rng,
+  bool full_range = false,
+  int output_shift = 4,
+  int input_offset = 128,
+  int output_offset = -128)
+{
+  ConvLayer_int8& l = t.layer;
+  l.type = type;
+  l.input_shape = input_shape;
+  const int depth = (type == LayerType::Conv2D) ? output_channels : input_shape.channel;
+  l.filter_shape = (type == LayerType::Conv2D)
+    ? Shape(depth, filter_size, filter_size, input_shape.channel)
+    : Shape(1, filter_size, filter_size, depth);
+  l.output_shape = Shape(input_shape.number,
+                         (input_shape.height + 2 * padding - filter_size) / stride + 1,
+                         (input_shape.width + 2 * padding - filter_size) / stride + 1,
+                         depth);
+  l.stride_height = l.stride_width = stride;
+  l.padding_height = l.padding_width = padding;
+  l.input_offset = input_offset;
+  l.output_offset = output_offset;
+  std::uniform_int_distribution<int> w(full_range ? -128 : -8, full_range ? 127 : 8);
+  t.filter.resize(l.filter_shape.num_elements());
+  for (size_t i=0; i<t.filter.size(); ++i) {
+    t.filter[i] = (int8_t)w(rng);
+  }
+  if (full_range) {
+    std::uniform_int_distribution<int> bias(-5000, 5000);
+    t.bias.resize(depth);
+    for (int i=0; i<depth; ++i) {
+      t.bias[i] = bias(rng);
+    }
+  }else {
+    t.bias.assign(depth, 100);
+  }
+  l.filter_values = &t.filter[0];
+  l.bias_values = &t.bias[0];
+  l.output_multiplier.assign(depth, 1 << 30);
+  l.output_shift.assign(depth, output_shift);
+}
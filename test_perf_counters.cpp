@@ -0,0 +1,53 @@
+#include "doctest.h"
+
+#include "perf_counters.h"
+
+TEST_CASE("PerfCounters counts a loop or degrades to no-ops")
+{
+  PerfCounters counters;
+  PerfSample sample;
+  volatile uint64_t sum = 0;
+  counters.start();
+  for (int i=0; i<1000000; ++i) {
+    sum += i;
+  }
+  counters.stop(sample);
+
+  if (!counters.available()) {
+    // no counters here (container, VM or perf_event_paranoid)
+    CHECK(sample.intervals == 0);
+    CHECK(sample.values[PERF_CYCLES] == 0);
+    CHECK(sample.ipc() == 0.0);
+    return;
+  }
+  CHECK(sample.intervals == 1);
+  if (counters.has(PERF_INSTRUCTIONS)) {
+    // at least a load, add and store per iteration
+    CHECK(sample.values[PERF_INSTRUCTIONS] >= 1000000);
+  }
+  if (counters.has(PERF_CYCLES) && counters.has(PERF_INSTRUCTIONS)) {
+    CHECK(sample.ipc() > 0.0);
+  }
+
+  // a second interval accumulates
+  counters.start();
+  for (int i=0; i<1000000; ++i) {
+    sum += i;
+  }
+  counters.stop(sample);
+  CHECK(sample.intervals == 2);
+}
+
+TEST_CASE("PerfSample rates")
+{
+  PerfSample s;
+  s.values[PERF_CYCLES] = 2000;
+  s.values[PERF_INSTRUCTIONS] = 4000;
+  s.values[PERF_L1D_MISSES] = 40;
+  CHECK(s.ipc() == 2.0);
+  CHECK(s.mpki(PERF_L1D_MISSES) == 10.0);
+  PerfSample t = s;
+  t.add(s);
+  CHECK(t.values[PERF_INSTRUCTIONS] == 8000);
+  CHECK(t.ipc() == 2.0);
+}
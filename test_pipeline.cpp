@@ -0,0 +1,133 @@
+#include "doctest.h"
+
+#include <random>
+
+#include "pipeline.h"
+#include "test_layers.h"
+
+namespace {
+
+int64_t max_group(const std::vector<int64_t>& costs, const std::vector<size_t>& bounds)
+{
+  int64_t worst = 0;
+  for (size_t s=0; s+1<bounds.size(); ++s) {
+    int64_t sum = 0;
+    for (size_t i=bounds[s]; i<bounds[s + 1]; ++i) {
+      sum += costs[i];
+    }
+    worst = std::max(worst, sum);
+  }
+  return worst;
+}
+
+} // namespace
+
+TEST_CASE("partition_costs balances contiguous groups")
+{
+  std::vector<int64_t> costs = { 10, 10, 10, 10, 40, 5, 5, 5, 5 };
+  std::vector<size_t> bounds = partition_costs(costs, 3);
+  REQUIRE(bounds.size() == 4);
+  CHECK(bounds[0] == 0);
+  CHECK(bounds[3] == costs.size());
+  CHECK(max_group(costs, bounds) == 40);
+
+  // one group, and more groups than costs
+  CHECK(partition_costs(costs, 1) == std::vector<size_t>({ 0, 9 }));
+  CHECK(partition_costs(std::vector<int64_t>({ 3, 1 }), 5) == std::vector<size_t>({ 0, 1, 2 }));
+
+  // matches brute force over every 2-cut split
+  std::mt19937 rng(3);
+  std::uniform_int_distribution<int> c(1, 100);
+  for (int trial=0; trial<20; ++trial) {
+    std::vector<int64_t> v(8);
+    for (size_t i=0; i<v.size(); ++i) {
+      v[i] = c(rng);
+    }
+    int64_t best = INT64_C(1) << 62;
+    for (size_t a=1; a<v.size(); ++a) {
+      for (size_t b=a+1; b<v.size(); ++b) {
+        best = std::min(best, max_group(v, std::vector<size_t>({ 0, a, b, v.size() })));
+      }
+    }
+    CHECK(max_group(v, partition_costs(v, 3)) == best);
+  }
+}
+
+TEST_CASE("layer_costs prefers measured times, then the model, then MACs")
+{
+  std::mt19937 rng(4);
+  TestLayer t[2];
+  make_layer(t[0], LayerType::Conv2D, Shape(1, 16, 16, 8), 3, 1, 1, 8, rng);
+  make_layer(t[1], LayerType::DepthwiseConv2D, t[0].layer.output_shape, 3, 1, 1, 0, rng);
+  std::vector<ConvLayer_int8> layers;
+  layers.push_back(t[0].layer);
+  layers.push_back(t[1].layer);
+
+  std::vector<ConvTuning> tunings(2);
+  CHECK(layer_costs(layers, tunings, nullptr) == std::vector<int64_t>({ layers[0].macs(), layers[1].macs() }));
+
+  ConvCostModel model;
+  std::vector<int64_t> costs = layer_costs(layers, tunings, &model);
+  CHECK(costs[0] == (int64_t)(model.estimate(layers[0], ConvAlgorithm::direct) * 1e9));
+  CHECK(costs[1] == (int64_t)(model.estimate(layers[1], ConvAlgorithm::direct) * 1e9));
+
+  // one untimed layer is enough to fall back to the model
+  tunings[0].seconds = 2e-3;
+  CHECK(layer_costs(layers, tunings, &model) == costs);
+  tunings[1].seconds = 5e-4;
+  CHECK(layer_costs(layers, tunings, &model) == std::vector<int64_t>({ 2000000, 500000 }));
+}
+
+TEST_CASE("LayerPipeline matches run_layers")
+{
+  std::mt19937 rng(5);
+  TestLayer t[5];
+  make_layer(t[0], LayerType::Conv2D, Shape(1, 24, 24, 3), 3, 2, 1, 8, rng);
+  make_layer(t[1], LayerType::DepthwiseConv2D, t[0].layer.output_shape, 3, 1, 1, 0, rng);
+  make_layer(t[2], LayerType::Conv2D, t[1].layer.output_shape, 3, 1, 1, 16, rng);
+  make_layer(t[3], LayerType::DepthwiseConv2D, t[2].layer.output_shape, 3, 2, 1, 0, rng);
+  make_layer(t[4], LayerType::Conv2D, t[3].layer.output_shape, 3, 1, 1, 4, rng);
+  std::vector<ConvLayer_int8> layers;
+  int64_t total_macs = 0;
+  for (int i=0; i<5; ++i) {
+    layers.push_back(t[i].layer);
+    total_macs += t[i].layer.macs();
+  }
+
+  const int num_frames = 12;
+  const size_t in_len = layers[0].input_shape.num_elements();
+  const size_t out_len = layers.back().output_shape.num_elements();
+  std::vector<int8_t> frames(in_len * num_frames);
+  std::uniform_int_distribution<int> px(-128, 127);
+  for (size_t i=0; i<frames.size(); ++i) {
+    frames[i] = (int8_t)px(rng);
+  }
+  std::vector<int8_t> expected(out_len * num_frames);
+  std::vector<int8_t> scratch;
+  for (int f=0; f<num_frames; ++f) {
+    run_layers(layers, 1, &frames[f * in_len], &expected[f * out_len], scratch);
+  }
+
+  for (size_t stages=1; stages<=4; ++stages) {
+    LayerPipeline pipeline(layers, stages, 3);
+    CHECK(pipeline.num_stages() == stages);
+    int64_t macs = 0;
+    for (size_t s=0; s<stages; ++s) {
+      macs += pipeline.stage_macs(s);
+    }
+    CHECK(macs == total_macs);
+
+    // a producer thread feeds frames while this thread drains them
+    std::thread producer([&]() {
+      for (int f=0; f<num_frames; ++f) {
+        pipeline.push(&frames[f * in_len]);
+      }
+    });
+    std::vector<int8_t> output(out_len * num_frames);
+    for (int f=0; f<num_frames; ++f) {
+      pipeline.pop(&output[f * out_len]);
+    }
+    producer.join();
+    CHECK(output == expected);
+  }
+}
@@ -0,0 +1,84 @@
+#include "doctest.h"
+
+#include "preprocess.h"
+
+TEST_CASE("preprocess_image same size copies with offset")
+{
+  const int width = 37;
+  const int height = 5;
+  std::vector<uint8_t> src(width * height * 3);
+  for (size_t i=0; i<src.size(); ++i) {
+    src[i] = (uint8_t)(i * 7);
+  }
+
+  PreprocessParams params(Shape(1, height, width, 3), -128);
+  std::vector<int8_t> dst(params.output_shape.num_elements());
+  preprocess_image(&src[0], width, height, params, &dst[0]);
+
+  bool same = true;
+  for (size_t i=0; i<src.size(); ++i) {
+    same &= (dst[i] == (int8_t)(src[i] - 128));
+  }
+  CHECK(same);
+}
+
+TEST_CASE("preprocess_image downscale keeps flat regions flat")
+{
+  const int width = 400;
+  const int height = 300;
+  std::vector<uint8_t> src(width * height * 3);
+  for (int i=0; i<width*height; ++i) {
+    src[i*3+0] = 10;
+    src[i*3+1] = 128;
+    src[i*3+2] = 250;
+  }
+
+  PreprocessParams params(Shape(1, 24, 24, 3), 0, 1.0f);
+  std::vector<uint8_t> dst(params.output_shape.num_elements());
+  preprocess_image(&src[0], width, height, params, &dst[0]);
+
+  bool flat = true;
+  for (int i=0; i<24*24; ++i) {
+    flat &= (dst[i*3+0] == 10 && dst[i*3+1] == 128 && dst[i*3+2] == 250);
+  }
+  CHECK(flat);
+}
+
+TEST_CASE("preprocess_image center crop and NCHW layout")
+{
+  // left and right thirds dark, center bright
+  const int width = 90;
+  const int height = 30;
+  std::vector<uint8_t> src(width * height);
+  for (int y=0; y<height; ++y) {
+    for (int x=0; x<width; ++x) {
+      src[y * width + x] = (x >= 30 && x < 60) ? 200 : 0;
+    }
+  }
+
+  PreprocessParams params(Shape(1, 10, 10, 1), 0, 0.5f);
+  std::vector<uint8_t> dst(100);
+  preprocess_image(&src[0], width, height, params, &dst[0]);
+  CHECK(*std::min_element(dst.begin(), dst.end()) == 200);
+
+  // gradient, NHWC and NCHW hold the same values
+  std::vector<uint8_t> rgb(64 * 48 * 3);
+  for (size_t i=0; i<rgb.size(); ++i) {
+    rgb[i] = (uint8_t)(i % 251);
+  }
+  PreprocessParams nhwc(Shape(1, 20, 18, 3), -128);
+  PreprocessParams nchw(Shape(1, 20, 18, 3, TensorLayout::NCHW), -128);
+  std::vector<int8_t> a(nhwc.output_shape.num_elements());
+  std::vector<int8_t> b(nchw.output_shape.num_elements());
+  preprocess_image(&rgb[0], 64, 48, nhwc, &a[0]);
+  preprocess_image(&rgb[0], 64, 48, nchw, &b[0]);
+  bool same = true;
+  for (int y=0; y<20; ++y) {
+    for (int x=0; x<18; ++x) {
+      for (int c=0; c<3; ++c) {
+        same &= (a[nhwc.output_shape.offset(0, y, x, c)] == b[nchw.output_shape.offset(0, y, x, c)]);
+      }
+    }
+  }
+  CHECK(same);
+}
@@ -0,0 +1,34 @@
+#include "doctest.h"
+
+#include "roofline.h"
+
+TEST_CASE("LayerTraffic intensity")
+{
+  LayerTraffic t;
+  CHECK(t.intensity() == 0.0);
+  // 1x1 conv 56x56x24 -> 56x56x144
+  t.macs = 56 * 56 * 24 * 144;
+  t.weight_bytes = 24 * 144 + 144 * 4;
+  t.input_bytes = 56 * 56 * 24;
+  t.output_bytes = 56 * 56 * 144;
+  CHECK(t.bytes() == 4032 + 75264 + 451584);
+  CHECK(t.intensity() == doctest::Approx(2.0 * 10838016 / 530880));
+}
+
+TEST_CASE("Roofline bounds")
+{
+  Roofline roof(100.0, 20.0);
+  CHECK(roof.ridge() == 5.0);
+  CHECK(roof.attainable_gops(1.0) == 20.0);
+  CHECK(roof.attainable_gops(5.0) == 100.0);
+  CHECK(roof.attainable_gops(50.0) == 100.0);
+  CHECK(!roof.compute_bound(4.9));
+  CHECK(roof.compute_bound(5.0));
+  CHECK(Roofline().ridge() == 0.0);
+}
+
+TEST_CASE("roofs measure something")
+{
+  CHECK(measure_bandwidth_gbps(16 << 20, 2) > 0.0);
+  CHECK(measure_peak_int8_gops(2) > 0.0);
+}
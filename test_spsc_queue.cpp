@@ -0,0 +1,78 @@
+#include "doctest.h"
+
+#include <thread>
+#include <chrono>
+
+#include "spsc_queue.h"
+
+TEST_CASE("SpscQueue capacity and wrap around")
+{
+  SpscQueue<int> q(5);
+  CHECK(q.capacity() == 8);
+  int v;
+  CHECK(!q.try_pop(v));
+  for (int round=0; round<3; ++round) {
+    for (int i=0; i<8; ++i) {
+      CHECK(q.try_push(round * 8 + i));
+    }
+    CHECK(!q.try_push(-1));
+    for (int i=0; i<8; ++i) {
+      REQUIRE(q.try_pop(v));
+      CHECK(v == round * 8 + i);
+    }
+    CHECK(!q.try_pop(v));
+  }
+}
+
+TEST_CASE("SpscQueue keeps order across threads")
+{
+  const int n = 100000;
+  SpscQueue<int> q(16);
+  std::thread producer([&]() {
+    for (int i=0; i<n; ++i) {
+      q.push(i);
+    }
+  });
+  bool in_order = true;
+  for (int i=0; i<n; ++i) {
+    int v;
+    q.pop(v);
+    in_order &= (v == i);
+  }
+  producer.join();
+  CHECK(in_order);
+}
+
+TEST_CASE("SpscQueue pop sleeps until a value arrives")
+{
+  SpscQueue<int> q(2);
+  bool in_order = true;
+  std::thread consumer([&]() {
+    for (int i=0; i<3; ++i) {
+      int v;
+      q.pop(v);
+      in_order &= (v == i);
+    }
+  });
+  // long enough for the consumer to give up spinning and wait
+  for (int i=0; i<3; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    q.push(i);
+  }
+  consumer.join();
+  CHECK(in_order);
+  // a full queue : push sleeps until the consumer makes room
+  for (int i=0; i<2; ++i) {
+    q.push(i);
+  }
+  std::thread producer([&]() {
+    q.push(2);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  int v;
+  for (int i=0; i<3; ++i) {
+    q.pop(v);
+    CHECK(v == i);
+  }
+  producer.join();
+}
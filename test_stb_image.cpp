@@ -0,0 +1,111 @@
+#include "doctest.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "stb_image.h"
+#include "stb_image_write.h"
+
+namespace {
+
+void append_bytes(void* context, void* data, int size)
+{
+  std::vector<uint8_t>& buf = *(std::vector<uint8_t>*)context;
+  buf.insert(buf.end(), (uint8_t*)data, (uint8_t*)data + size);
+}
+
+// smooth colour gradient with a soft blob, so the low frequencies dominate
+std::vector<uint8_t> encode_test_jpeg(int width, int height, int quality)
+{
+  std::vector<uint8_t> pixels(width * height * 3);
+  for (int y=0; y<height; ++y) {
+    for (int x=0; x<width; ++x) {
+      const int dx = x - width / 3;
+      const int dy = y - height / 2;
+      const int blob = std::max(0, 80 - (dx * dx + dy * dy) / 64);
+      uint8_t* p = &pixels[(y * width + x) * 3];
+      p[0] = (uint8_t)(x * 255 / width);
+      p[1] = (uint8_t)std::min(255, y * 200 / height + blob);
+      p[2] = (uint8_t)(128 + (x - y) * 64 / width);
+    }
+  }
+  std::vector<uint8_t> jpeg;
+  stbi_write_jpg_to_func(append_bytes, &jpeg, width, height, 3, &pixels[0], quality);
+  return jpeg;
+}
+
+// largest difference between the scaled decode and a box filtered full decode
+int max_box_error(const uint8_t* full, int width, int height,
+                  const uint8_t* scaled, int scaled_width, int scaled_height, int factor)
+{
+  int max_err = 0;
+  for (int y=0; y<scaled_height; ++y) {
+    for (int x=0; x<scaled_width; ++x) {
+      for (int c=0; c<3; ++c) {
+        int sum = 0;
+        int count = 0;
+        for (int fy=0; fy<factor; ++fy) {
+          for (int fx=0; fx<factor; ++fx) {
+            const int sx = x * factor + fx;
+            const int sy = y * factor + fy;
+            if (sx < width && sy < height) {
+              sum += full[(sy * width + sx) * 3 + c];
+              ++count;
+            }
+          }
+        }
+        const int err = abs(sum / count - scaled[(y * scaled_width + x) * 3 + c]);
+        max_err = std::max(max_err, err);
+      }
+    }
+  }
+  return max_err;
+}
+
+void check_scaled_decode(int quality)
+{
+  const int width = 203;
+  const int height = 150;
+  std::vector<uint8_t> jpeg = encode_test_jpeg(width, height, quality);
+  REQUIRE(!jpeg.empty());
+
+  int w, h, n;
+  uint8_t* full = stbi_load_from_memory(&jpeg[0], (int)jpeg.size(), &w, &h, &n, 3);
+  REQUIRE(full);
+  CHECK(w == width);
+  CHECK(h == height);
+
+  // no minimum, or one the full image only just meets, decodes at full size
+  uint8_t* same = stbi_load_from_memory_scaled(&jpeg[0], (int)jpeg.size(), &w, &h, &n, 3, width, height);
+  REQUIRE(same);
+  CHECK(w == width);
+  CHECK(std::equal(full, full + width * height * 3, same));
+  stbi_image_free(same);
+
+  for (int shift=1; shift<=3; ++shift) {
+    const int factor = 1 << shift;
+    const int expected_width = (width + factor - 1) / factor;
+    const int expected_height = (height + factor - 1) / factor;
+    uint8_t* scaled = stbi_load_from_memory_scaled(&jpeg[0], (int)jpeg.size(), &w, &h, &n, 3,
+                                                   expected_width, expected_height - 1);
+    REQUIRE(scaled);
+    CHECK(w == expected_width);
+    CHECK(h == expected_height);
+    CHECK(max_box_error(full, width, height, scaled, w, h, factor) <= 12);
+    stbi_image_free(scaled);
+  }
+  stbi_image_free(full);
+}
+
+} // namespace
+
+TEST_CASE("stbi_load_from_memory_scaled 4:4:4")
+{
+  check_scaled_decode(95);
+}
+
+TEST_CASE("stbi_load_from_memory_scaled 4:2:0")
+{
+  check_scaled_decode(80);
+}
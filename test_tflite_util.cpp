@@ -0,0 +1,96 @@
+#include "doctest.h"
+
+#include <vector>
+#include <initializer_list>
+
+// needs the TensorFlow Lite headers, the library is not linked
+#include "tflite_util.h"
+
+namespace {
+
+// a TfLiteIntArray over owned storage : the size, then the values
+struct IntArray
+{
+  std::vector<int> storage;
+
+  IntArray(std::initializer_list<int> values)
+    :
+    storage(1, (int)values.size())
+  {
+    storage.insert(storage.end(), values.begin(), values.end());
+  }
+
+  TfLiteIntArray* get() {
+    return (TfLiteIntArray*)&storage[0];
+  }
+};
+
+} // namespace
+
+TEST_CASE("load_sparse_filter decodes TFLite's block sparsity")
+{
+  // 2 output channels, 1x2 taps of 8 input channels in blocks of 4. The
+  // dense filter, block by block :
+  //   channel 0 : tap 0 [0 0 0 0 | 1 2 3 4], tap 1 [0 0 0 0 | 0 0 0 0]
+  //   channel 1 : tap 0 [5 6 7 8 | 9 1 2 3], tap 1 [0 0 0 0 | 4 5 6 7]
+  std::vector<int8_t> dense(2 * 2 * 8, 0);
+  const int8_t blocks[4][4] = {{1, 2, 3, 4}, {5, 6, 7, 8}, {9, 1, 2, 3}, {4, 5, 6, 7}};
+  const int offsets[4] = {4, 16, 20, 28};
+  std::vector<int8_t> values;
+  for (int i=0; i<4; ++i) {
+    for (int j=0; j<4; ++j) {
+      dense[offsets[i] + j] = blocks[i][j];
+      values.push_back(blocks[i][j]);
+    }
+  }
+
+  // OHWI with the input channels split into blocks : O, H, W dense, the
+  // channel blocks CSR over the (O, H, W) rows, the block dense
+  IntArray dims({2, 1, 2, 8});
+  IntArray traversal_order({0, 1, 2, 3, 4});
+  IntArray block_map({3});
+  IntArray segments({0, 1, 1, 3, 4});
+  IntArray indices({1, 0, 1, 1});
+  TfLiteDimensionMetadata dim_metadata[5] = {};
+  dim_metadata[0].format = kTfLiteDimDense;
+  dim_metadata[0].dense_size = 2;
+  dim_metadata[1].format = kTfLiteDimDense;
+  dim_metadata[1].dense_size = 1;
+  dim_metadata[2].format = kTfLiteDimDense;
+  dim_metadata[2].dense_size = 2;
+  dim_metadata[3].format = kTfLiteDimSparseCSR;
+  dim_metadata[3].array_segments = segments.get();
+  dim_metadata[3].array_indices = indices.get();
+  dim_metadata[4].format = kTfLiteDimDense;
+  dim_metadata[4].dense_size = 4;
+  TfLiteSparsity sparsity = {};
+  sparsity.traversal_order = traversal_order.get();
+  sparsity.block_map = block_map.get();
+  sparsity.dim_metadata = dim_metadata;
+  sparsity.dim_metadata_size = 5;
+  TfLiteTensor tensor = {};
+  tensor.type = kTfLiteInt8;
+  tensor.dims = dims.get();
+  tensor.data.raw = (char*)&values[0];
+  tensor.sparsity = &sparsity;
+
+  BlockSparseFilter filter;
+  REQUIRE(load_sparse_filter(&tensor, filter));
+  BlockSparseFilter expected;
+  make_block_sparse_filter(Shape(2, 1, 2, 8), &dense[0], 4, expected);
+  CHECK(filter.out_depth == 2);
+  CHECK(filter.taps == 2);
+  CHECK(filter.input_depth == 8);
+  CHECK(filter.block == 4);
+  CHECK(filter.row_start == expected.row_start);
+  CHECK(filter.block_tap == expected.block_tap);
+  CHECK(filter.block_channel == expected.block_channel);
+  CHECK(filter.values == expected.values);
+
+  // anything but the block layout above is left to the dense kernels
+  block_map.storage[1] = 0;
+  CHECK(!load_sparse_filter(&tensor, filter));
+  tensor.sparsity = nullptr;
+  CHECK(!load_sparse_filter(&tensor, filter));
+  CHECK(filter.values == expected.values);
+}
@@ -0,0 +1,89 @@
+#include "doctest.h"
+
+#include <stdio.h>
+#include <string>
+#include <thread>
+
+#include "trace.h"
+#include "thread_pool.h"
+
+namespace {
+
+std::string read_file(const char* path)
+{
+  std::string s;
+  FILE* f = fopen(path, "r");
+  if (!f) {
+    return s;
+  }
+  char buff[4096];
+  size_t n;
+  while ((n = fread(buff, 1, sizeof(buff), f)) > 0) {
+    s.append(buff, n);
+  }
+  fclose(f);
+  return s;
+}
+
+size_t count(const std::string& s, const std::string& what)
+{
+  size_t n = 0;
+  for (size_t pos=s.find(what); pos!=std::string::npos; pos=s.find(what, pos + 1)) {
+    ++n;
+  }
+  return n;
+}
+
+} // namespace
+
+TEST_CASE("trace records scopes per thread")
+{
+  const char* path = "test_trace_output.json";
+  {
+    TRACE_SCOPE("before start");
+  }
+  trace_start();
+  {
+    TRACE_SCOPE_ARG("outer", 7);
+    TRACE_SCOPE("inner");
+  }
+  {
+    ThreadPool pool(3);
+    for (int i=0; i<10; ++i) {
+      pool.enqueue([]() { TRACE_SCOPE("work"); });
+    }
+  }
+  trace_stop();
+  {
+    TRACE_SCOPE("after stop");
+  }
+  REQUIRE(trace_write(path));
+  const std::string json = read_file(path);
+  remove(path);
+
+  CHECK(json.find("{\"traceEvents\":[") == 0);
+  CHECK(count(json, "\"name\":\"outer\"") == 1);
+  CHECK(count(json, "\"args\":{\"arg\":7}") == 1);
+  CHECK(count(json, "\"name\":\"inner\"") == 1);
+  CHECK(count(json, "\"name\":\"work\"") == 10);
+  CHECK(count(json, "\"name\":\"task\"") == 10);
+  CHECK(count(json, "before start") == 0);
+  CHECK(count(json, "after stop") == 0);
+  CHECK(count(json, "\"dropped\":0") == 1);
+}
+
+TEST_CASE("trace drops events past the capacity")
+{
+  const char* path = "test_trace_output.json";
+  trace_start(4);
+  for (int i=0; i<6; ++i) {
+    TRACE_SCOPE_ARG("event", i);
+  }
+  trace_stop();
+  REQUIRE(trace_write(path));
+  const std::string json = read_file(path);
+  remove(path);
+
+  CHECK(count(json, "\"name\":\"event\"") == 4);
+  CHECK(count(json, "\"dropped\":2") == 1);
+}
@@ -0,0 +1,386 @@
+#pragma once
+
+#include <cmath>
+#include <string.h>
+#include <vector>
+
+#include <tensorflow/lite/interpreter.h>
+#include <tensorflow/lite/kernels/internal/tensor_ctypes.h>
+#include <tensorflow/lite/kernels/padding.h>
+#include <tensorflow/lite/builtin_ops.h>
+#include <tensorflow/lite/builtin_op_data.h>
+
+#include "cnn.h"
+#include "cnn_int16.h"
+#include "cnn_sparse.h"
+
+inline
+Shape toShape(const TfLiteIntArray* arr)
+{
+  assert(arr->size == 4);
+  Shape ret;
+  ret.number = arr->data[0];
+  ret.height = arr->data[1];
+  ret.width = arr->data[2];
+  ret.channel = arr->data[3];
+  return ret;
+}
+
+inline
+void quantize_filter_scale(
+  float input_scale,
+  float output_scale,
+  const TfLiteFloatArray* filter_scale,
+  std::vector<int32_t>& output_multiplier,
+  std::vector<int32_t>& output_shift
+  )
+{
+  const size_t sz = filter_scale->size;
+  const float* data = filter_scale->data;
+  output_multiplier.resize(sz);
+  output_shift.resize(sz);
+  double io_scale = (double)input_scale / (double)output_scale;
+  for (size_t i=0; i<sz; ++i) {
+    double f = data[i];
+    f *= io_scale;
+    int shift;
+    double f2 = std::frexp(f, &shift);
+    int m0 = ((1 << 31) - 1) * f2;
+    int n = -shift;
+    output_multiplier[i] = m0;
+    output_shift[i] = n;
+  }
+}
+
+inline
+void calc_activation_range(
+  TfLiteFusedActivation activation,
+  float output_scale, int output_zero_point,
+  int32_t& activation_min, int32_t& activation_max,
+  int32_t quantized_min = -128, int32_t quantized_max = 127)
+{
+  activation_min = quantized_min;
+  activation_max = quantized_max;
+  if (activation == kTfLiteActRelu) {
+    activation_min = std::max(activation_min, (int32_t)output_zero_point);
+  }else if (activation == kTfLiteActRelu6) {
+    activation_min = std::max(activation_min, (int32_t)output_zero_point);
+    activation_max = std::min(activation_max, output_zero_point + (int32_t)std::round(6.0f / output_scale));
+  }else if (activation == kTfLiteActReluN1To1) {
+    activation_min = std::max(activation_min, output_zero_point + (int32_t)std::round(-1.0f / output_scale));
+    activation_max = std::min(activation_max, output_zero_point + (int32_t)std::round(1.0f / output_scale));
+  }
+}
+
+// fills the shapes, strides and paddings of layer from a Conv2D / DepthwiseConv2D
+// node, returns its fused activation
+template <typename Layer>
+TfLiteFusedActivation load_layer_geometry(
+  tflite::Interpreter* interpreter,
+  const TfLiteNode& node,
+  LayerType type,
+  Layer& layer)
+{
+  const TfLiteIntArray* node_inputs = node.inputs;
+  const TfLiteIntArray* node_outputs = node.outputs;
+  assert(node_inputs->size == 3);
+  assert(node_outputs->size == 1);
+  const TfLiteTensor* input_tensor = interpreter->tensor(node_inputs->data[0]);
+  const TfLiteTensor* filter_tensor = interpreter->tensor(node_inputs->data[1]);
+  const TfLiteTensor* bias_tensor = interpreter->tensor(node_inputs->data[2]);
+  const TfLiteTensor* output_tensor = interpreter->tensor(node_outputs->data[0]);
+
+  layer.type = type;
+  layer.input_shape = toShape(input_tensor->dims);
+  layer.filter_shape = toShape(filter_tensor->dims);
+  layer.output_shape = toShape(output_tensor->dims);
+  assert(bias_tensor->dims->size == 1);
+  assert(bias_tensor->dims->data[0] == layer.output_shape.channel);
+  assert(layer.input_shape.channel == layer.filter_shape.channel);
+  if (type == LayerType::Conv2D) {
+    assert(layer.filter_shape.number == layer.output_shape.channel);
+  }else {
+    assert(layer.filter_shape.number == 1);
+  }
+
+  int stride_width;
+  int stride_height;
+  int dilation_width_factor;
+  int dilation_height_factor;
+  TfLiteFusedActivation activation;
+  if (type == LayerType::Conv2D) {
+    const TfLiteConvParams* params = (const TfLiteConvParams*)node.builtin_data;
+    stride_width = params->stride_width;
+    stride_height = params->stride_height;
+    dilation_width_factor = params->dilation_width_factor;
+    dilation_height_factor = params->dilation_height_factor;
+    activation = params->activation;
+  }else {
+    const TfLiteDepthwiseConvParams* params = (const TfLiteDepthwiseConvParams*)node.builtin_data;
+    stride_width = params->stride_width;
+    stride_height = params->stride_height;
+    dilation_width_factor = params->dilation_width_factor;
+    dilation_height_factor = params->dilation_height_factor;
+    activation = params->activation;
+  }
+  assert(dilation_width_factor == 1 && dilation_height_factor == 1);
+
+  layer.stride_width = stride_width;
+  layer.stride_height = stride_height;
+  int padding_width_offset;
+  int padding_height_offset;
+  layer.padding_width = tflite::ComputePaddingWithOffset(stride_width, dilation_width_factor, layer.input_shape.width, layer.filter_shape.width, layer.output_shape.width, &padding_width_offset);
+  layer.padding_height = tflite::ComputePaddingWithOffset(stride_height, dilation_height_factor, layer.input_shape.height, layer.filter_shape.height, layer.output_shape.height, &padding_height_offset);
+  return activation;
+}
+
+// fills layer with the geometry and quantization of a Conv2D / DepthwiseConv2D node
+inline
+void load_layer(
+  tflite::Interpreter* interpreter,
+  const TfLiteNode& node,
+  LayerType type,
+  ConvLayer_int8& layer)
+{
+  const TfLiteTensor* input_tensor = interpreter->tensor(node.inputs->data[0]);
+  const TfLiteTensor* filter_tensor = interpreter->tensor(node.inputs->data[1]);
+  const TfLiteTensor* bias_tensor = interpreter->tensor(node.inputs->data[2]);
+  const TfLiteTensor* output_tensor = interpreter->tensor(node.outputs->data[0]);
+  const TfLiteFusedActivation activation = load_layer_geometry(interpreter, node, type, layer);
+
+  const TfLiteAffineQuantization* input_quantization_params = (const TfLiteAffineQuantization*)(input_tensor->quantization.params);
+  const TfLiteAffineQuantization* output_quantization_params = (const TfLiteAffineQuantization*)(output_tensor->quantization.params);
+  assert(input_quantization_params->scale->size == 1);
+  assert(output_quantization_params->scale->size == 1);
+  const TfLiteAffineQuantization* filter_quantization_params = (const TfLiteAffineQuantization*)(filter_tensor->quantization.params);
+  assert(filter_quantization_params->scale->size == layer.output_shape.channel);
+  assert(filter_quantization_params->zero_point->size == layer.output_shape.channel);
+
+  float input_scale = input_quantization_params->scale->data[0];
+  int input_zero_point = input_quantization_params->zero_point->data[0];
+  float output_scale = output_quantization_params->scale->data[0];
+  int output_zero_point = output_quantization_params->zero_point->data[0];
+
+  layer.input_offset = -input_zero_point;
+  layer.output_offset = output_zero_point;
+  calc_activation_range(activation, output_scale, output_zero_point,
+                        layer.activation_min, layer.activation_max);
+  quantize_filter_scale(
+    input_scale, output_scale,
+    filter_quantization_params->scale,
+    layer.output_multiplier, layer.output_shift);
+
+  layer.filter_values = tflite::GetTensorData<int8_t>(filter_tensor);
+  layer.bias_values = tflite::GetTensorData<int32_t>(bias_tensor);
+}
+
+// 16x8 variant : int16 activations with zero point 0 and int64 bias
+inline
+void load_layer(
+  tflite::Interpreter* interpreter,
+  const TfLiteNode& node,
+  LayerType type,
+  ConvLayer_int16& layer)
+{
+  const TfLiteTensor* input_tensor = interpreter->tensor(node.inputs->data[0]);
+  const TfLiteTensor* filter_tensor = interpreter->tensor(node.inputs->data[1]);
+  const TfLiteTensor* bias_tensor = interpreter->tensor(node.inputs->data[2]);
+  const TfLiteTensor* output_tensor = interpreter->tensor(node.outputs->data[0]);
+  assert(input_tensor->type == kTfLiteInt16 && output_tensor->type == kTfLiteInt16);
+  assert(filter_tensor->type == kTfLiteInt8 && bias_tensor->type == kTfLiteInt64);
+  const TfLiteFusedActivation activation = load_layer_geometry(interpreter, node, type, layer);
+
+  const TfLiteAffineQuantization* input_quantization_params = (const TfLiteAffineQuantization*)(input_tensor->quantization.params);
+  const TfLiteAffineQuantization* output_quantization_params = (const TfLiteAffineQuantization*)(output_tensor->quantization.params);
+  const TfLiteAffineQuantization* filter_quantization_params = (const TfLiteAffineQuantization*)(filter_tensor->quantization.params);
+  assert(filter_quantization_params->scale->size == layer.output_shape.channel);
+  assert(input_tensor->params.zero_point == 0 && output_tensor->params.zero_point == 0);
+
+  const float input_scale = input_quantization_params->scale->data[0];
+  const float output_scale = output_quantization_params->scale->data[0];
+  calc_activation_range(activation, output_scale, 0,
+                        layer.activation_min, layer.activation_max,
+                        -32768, 32767);
+  quantize_filter_scale(
+    input_scale, output_scale,
+    filter_quantization_params->scale,
+    layer.output_multiplier, layer.output_shift);
+
+  layer.filter_values = tflite::GetTensorData<int8_t>(filter_tensor);
+  layer.bias_values = tflite::GetTensorData<int64_t>(bias_tensor);
+}
+
+// Decodes a block sparse filter from TFLite's sparsity metadata : OHWI
+// traversed in order, the input channels split into blocks (block_map {3}),
+// the channel blocks CSR and everything else dense. Returns false, leaving
+// filter as it is, if the tensor is not stored so.
+inline
+bool load_sparse_filter(const TfLiteTensor* tensor, BlockSparseFilter& filter)
+{
+  const TfLiteSparsity* sparsity = tensor->sparsity;
+  if (!sparsity || tensor->type != kTfLiteInt8 || sparsity->dim_metadata_size != 5
+    || sparsity->block_map->size != 1 || sparsity->block_map->data[0] != 3) {
+    return false;
+  }
+  for (int i=0; i<5; ++i) {
+    if (sparsity->traversal_order->data[i] != i
+      || sparsity->dim_metadata[i].format != (i == 3 ? kTfLiteDimSparseCSR : kTfLiteDimDense)) {
+      return false;
+    }
+  }
+  const TfLiteDimensionMetadata* dims = sparsity->dim_metadata;
+  const TfLiteIntArray* segments = dims[3].array_segments;
+  const TfLiteIntArray* indices = dims[3].array_indices;
+  const int8_t* values = tflite::GetTensorData<int8_t>(tensor);
+  filter.out_depth = dims[0].dense_size;
+  filter.taps = dims[1].dense_size * dims[2].dense_size;
+  filter.input_depth = tensor->dims->data[3];
+  filter.block = dims[4].dense_size;
+  assert(segments->size == filter.out_depth * filter.taps + 1);
+  filter.row_start.assign(1, 0);
+  filter.block_tap.clear();
+  filter.block_channel.clear();
+  // one CSR row per (channel, tap), in order
+  for (int n=0; n<filter.out_depth; ++n) {
+    for (int tap=0; tap<filter.taps; ++tap) {
+      const int row = n * filter.taps + tap;
+      for (int i=segments->data[row]; i<segments->data[row + 1]; ++i) {
+        filter.block_tap.push_back(tap);
+        filter.block_channel.push_back(indices->data[i] * filter.block);
+      }
+    }
+    filter.row_start.push_back((int32_t)filter.block_tap.size());
+  }
+  filter.values.assign(values, values + (size_t)filter.num_blocks() * filter.block);
+  return true;
+}
+
+// The block sparse filter of a Conv2D node. The converter keeps a sparse
+// filter behind a Densify node, whose input then carries the metadata.
+// Returns false if the filter is dense.
+inline
+bool load_sparse_filter(
+  tflite::Interpreter* interpreter,
+  const TfLiteNode& node,
+  BlockSparseFilter& filter)
+{
+  const int filter_index = node.inputs->data[1];
+  const TfLiteTensor* tensor = interpreter->tensor(filter_index);
+  if (!tensor->sparsity) {
+    const tflite::Subgraph& graph = interpreter->primary_subgraph();
+    const auto& nodes = graph.nodes_and_registration();
+    for (size_t i=0; i<graph.nodes_size(); ++i) {
+      if (nodes[i].second.builtin_code == kTfLiteBuiltinDensify
+        && nodes[i].first.outputs->data[0] == filter_index) {
+        tensor = interpreter->tensor(nodes[i].first.inputs->data[0]);
+        break;
+      }
+    }
+  }
+  return load_sparse_filter(tensor, filter);
+}
+
+// returns false if the node is not a Conv2D / DepthwiseConv2D
+template <typename Layer>
+bool load_layer(
+  tflite::Interpreter* interpreter,
+  size_t node_idx,
+  Layer& layer)
+{
+  const tflite::Subgraph& graph = interpreter->primary_subgraph();
+  assert(node_idx < graph.nodes_size());
+  const auto& pair = graph.nodes_and_registration()[node_idx];
+  const TfLiteNode& node = pair.first;
+  const TfLiteRegistration& node_reg = pair.second;
+  switch (node_reg.builtin_code) {
+  case kTfLiteBuiltinConv2d:
+    load_layer(interpreter, node, LayerType::Conv2D, layer);
+    return true;
+  case kTfLiteBuiltinDepthwiseConv2d:
+    load_layer(interpreter, node, LayerType::DepthwiseConv2D, layer);
+    return true;
+  default:
+    return false;
+  }
+}
+
+// consecutive Conv2D / DepthwiseConv2D nodes from first_node, each one
+// consuming only the output of the previous. With sparse_filters given it
+// gets one filter per layer, empty (out_depth 0) where the filter is dense.
+inline
+std::vector<ConvLayer_int8> load_conv_chain(
+  tflite::Interpreter* interpreter,
+  size_t first_node,
+  std::vector<BlockSparseFilter>* sparse_filters = nullptr)
+{
+  if (sparse_filters) {
+    sparse_filters->clear();
+  }
+  std::vector<ConvLayer_int8> layers;
+  const tflite::Subgraph& graph = interpreter->primary_subgraph();
+  const auto& nodes = graph.nodes_and_registration();
+  int prev_output = -1;
+  for (size_t i=first_node; i<graph.nodes_size(); ++i) {
+    const TfLiteNode& node = nodes[i].first;
+    if (prev_output != -1 && node.inputs->data[0] != prev_output) {
+      break;
+    }
+    ConvLayer_int8 layer;
+    if (!load_layer(interpreter, i, layer)) {
+      break;
+    }
+    // the output must not feed any other node (e.g. a residual Add)
+    bool shared = false;
+    for (size_t j=i+2; j<graph.nodes_size() && !shared; ++j) {
+      const TfLiteIntArray* inputs = nodes[j].first.inputs;
+      for (int k=0; k<inputs->size; ++k) {
+        if (inputs->data[k] == node.outputs->data[0]) {
+          shared = true;
+        }
+      }
+    }
+    layers.push_back(layer);
+    if (sparse_filters) {
+      sparse_filters->push_back(BlockSparseFilter());
+      if (layer.type == LayerType::Conv2D) {
+        load_sparse_filter(interpreter, node, sparse_filters->back());
+      }
+    }
+    prev_output = node.outputs->data[0];
+    if (shared) {
+      break;
+    }
+  }
+  return layers;
+}
+
+// Runs batch_size images through the model, e.g. as a DynamicBatcher
+// runner. The first input is resized (and the tensors reallocated) only when
+// the batch size changes.
+template <typename In, typename Out>
+bool invoke_batch(
+  tflite::Interpreter* interpreter,
+  const In* input,
+  size_t batch_size,
+  Out* output)
+{
+  const int input_index = interpreter->inputs()[0];
+  TfLiteTensor* input_tensor = interpreter->tensor(input_index);
+  if (input_tensor->dims->data[0] != (int)batch_size) {
+    std::vector<int> dims(input_tensor->dims->data, input_tensor->dims->data + input_tensor->dims->size);
+    dims[0] = (int)batch_size;
+    if (interpreter->ResizeInputTensor(input_index, dims) != kTfLiteOk
+      || interpreter->AllocateTensors() != kTfLiteOk) {
+      return false;
+    }
+    input_tensor = interpreter->tensor(input_index);
+  }
+  assert(input_tensor->bytes % (batch_size * sizeof(In)) == 0);
+  memcpy(input_tensor->data.raw, input, input_tensor->bytes);
+  if (interpreter->Invoke() != kTfLiteOk) {
+    return false;
+  }
+  const TfLiteTensor* output_tensor = interpreter->tensor(interpreter->outputs()[0]);
+  memcpy(output, output_tensor->data.raw, output_tensor->bytes);
+  return true;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <assert.h>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#include "trace.h"
+
+// Fixed set of worker threads running queued tasks in FIFO order.
+// The destructor finishes the queued tasks before joining.
+class ThreadPool
+{
+public:
+  explicit ThreadPool(size_t num_threads)
+    :
+    stop_(false)
+  {
+    if (num_threads == 0) {
+      num_threads = 1;
+    }
+    threads_.reserve(num_threads);
+    for (size_t i=0; i<num_threads; ++i) {
+      threads_.push_back(std::thread(&ThreadPool::worker, this));
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for (size_t i=0; i<threads_.size(); ++i) {
+      threads_[i].join();
+    }
+  }
+
+  void enqueue(const std::function<void()>& task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      assert(!stop_);
+      tasks_.push_back(task);
+    }
+    cv_.notify_one();
+  }
+
+  size_t size() const { return threads_.size(); }
+
+  // number of hardware threads, at least 1
+  static size_t hardware_threads() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+  }
+
+private:
+  ThreadPool(const ThreadPool&);
+  ThreadPool& operator=(const ThreadPool&);
+
+  void worker() {
+    for (;;) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stop_ && tasks_.empty()) {
+          cv_.wait(lock);
+        }
+        if (tasks_.empty()) {
+          return;
+        }
+        task.swap(tasks_.front());
+        tasks_.pop_front();
+      }
+      TRACE_SCOPE("task");
+      task();
+    }
+  }
+
+  std::vector<std::thread> threads_;
+  std::deque<std::function<void()> > tasks_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_;
+};
+
+// Runs task(i) for every i in [0, count), round-robin over the calling
+// thread and threads - 1 pool workers, and returns when all are done.
+// Without a pool everything runs on the caller.
+template <typename Task>
+void parallel_for(ThreadPool* pool, int threads, int count, const Task& task)
+{
+  threads = pool ? std::max(1, std::min(threads, count)) : 1;
+  auto work = [&](int first) {
+    for (int i=first; i<count; i+=threads) {
+      task(i);
+    }
+  };
+  std::vector<std::future<void> > done;
+  for (int t=1; t<threads; ++t) {
+    std::shared_ptr<std::promise<void> > promise(new std::promise<void>());
+    done.push_back(promise->get_future());
+    pool->enqueue([&work, t, promise]() {
+      work(t);
+      promise->set_value();
+    });
+  }
+  work(0);
+  for (size_t i=0; i<done.size(); ++i) {
+    done[i].wait();
+  }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <assert.h>
+#include <vector>
+#include <algorithm>
+
+#include <tensorflow/lite/c/common.h>
+
+// Top-k classes of a classifier output, scores dequantized to float.
+
+// element i of data, laid out like tensor, as a float score
+inline
+float output_score(const TfLiteTensor* tensor, const void* data, int i)
+{
+  float scale = 1.0f;
+  int zero_point = 0;
+  if (tensor->quantization.type == kTfLiteAffineQuantization) {
+    const TfLiteAffineQuantization* q = (const TfLiteAffineQuantization*)tensor->quantization.params;
+    scale = q->scale->data[0];
+    zero_point = q->zero_point->data[0];
+  }
+  switch (tensor->type) {
+  case kTfLiteUInt8:
+    return (((const uint8_t*)data)[i] - zero_point) * scale;
+  case kTfLiteInt8:
+    return (((const int8_t*)data)[i] - zero_point) * scale;
+  case kTfLiteFloat32:
+    return ((const float*)data)[i];
+  default:
+    assert(false);
+    return 0.0f;
+  }
+}
+
+// number of classes in the last dimension
+inline
+int num_classes(const TfLiteTensor* tensor)
+{
+  return tensor->dims->data[tensor->dims->size - 1];
+}
+
+// k best classes of data (default: the tensor's own buffer), highest score
+// first, ties broken by the lower class index
+inline
+int top_k(
+  const TfLiteTensor* tensor,
+  int k,
+  int* classes,
+  float* scores,
+  const void* data = nullptr)
+{
+  if (!data) {
+    data = tensor->data.raw_const;
+  }
+  const int n = num_classes(tensor);
+  k = std::min(k, n);
+  std::vector<float> all(n);
+  std::vector<int> indexes(n);
+  for (int i=0; i<n; ++i) {
+    all[i] = output_score(tensor, data, i);
+    indexes[i] = i;
+  }
+  std::partial_sort(indexes.begin(), indexes.begin() + k, indexes.end(),
+                    [&all](int a, int b) { return all[a] > all[b] || (all[a] == all[b] && a < b); });
+  for (int i=0; i<k; ++i) {
+    classes[i] = indexes[i];
+    scores[i] = all[indexes[i]];
+  }
+  return k;
+}
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+
+// Timeline of begin / end events exported as Chrome trace JSON, viewable in
+// chrome://tracing or Perfetto.
+//
+// Each thread appends to its own fixed size buffer, created the first time
+// it records while tracing is on, so recording takes no lock and never
+// allocates. Events past the capacity are dropped and counted. While tracing
+// is off a TRACE_SCOPE costs one load and branch on entry and one on exit.
+//
+// trace_start / trace_stop / trace_write must not overlap with threads
+// recording events; call them between runs.
+
+struct TraceEvent
+{
+  const char* name;   // must outlive the trace, e.g. a literal
+  int64_t arg;        // shown under args, -1 = none
+  int64_t begin;      // ns since trace_start
+  int64_t end;
+};
+
+class TraceBuffer
+{
+public:
+  TraceBuffer(int tid, size_t capacity)
+    :
+    tid_(tid),
+    events_(capacity),
+    size_(0),
+    dropped_(0)
+  {
+  }
+
+  // called only by the owning thread
+  void add(const char* name, int64_t arg, int64_t begin, int64_t end) {
+    const size_t n = size_.load(std::memory_order_relaxed);
+    if (n == events_.size()) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    TraceEvent& e = events_[n];
+    e.name = name;
+    e.arg = arg;
+    e.begin = begin;
+    e.end = end;
+    size_.store(n + 1, std::memory_order_release);
+  }
+
+  void reset(size_t capacity) {
+    events_.resize(capacity);
+    size_.store(0, std::memory_order_relaxed);
+    dropped_.store(0, std::memory_order_relaxed);
+  }
+
+  int tid() const { return tid_; }
+  size_t size() const { return size_.load(std::memory_order_acquire); }
+  size_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+  const TraceEvent& event(size_t i) const { return events_[i]; }
+
+private:
+  TraceBuffer(const TraceBuffer&);
+  TraceBuffer& operator=(const TraceBuffer&);
+
+  int tid_;
+  std::vector<TraceEvent> events_;
+  std::atomic<size_t> size_;
+  std::atomic<size_t> dropped_;
+};
+
+namespace trace_detail {
+
+// a class template so the flag is defined in a header, constant initialized
+template <typename Dummy>
+struct Flags
+{
+  static std::atomic<bool> enabled;
+};
+
+template <typename Dummy>
+std::atomic<bool> Flags<Dummy>::enabled(false);
+
+struct Registry
+{
+  std::mutex mutex;
+  std::vector<std::unique_ptr<TraceBuffer> > buffers;
+  size_t capacity;
+  std::chrono::steady_clock::time_point origin;
+
+  Registry()
+    :
+    capacity(0)
+  {
+  }
+};
+
+inline
+Registry& registry()
+{
+  static Registry r;
+  return r;
+}
+
+} // namespace trace_detail
+
+inline
+bool trace_enabled()
+{
+  // acquire pairs with trace_start's origin; a plain load on x86
+  return trace_detail::Flags<void>::enabled.load(std::memory_order_acquire);
+}
+
+// ns since trace_start
+inline
+int64_t trace_now()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - trace_detail::registry().origin).count();
+}
+
+// the calling thread's buffer, created on first use
+inline
+TraceBuffer* trace_thread_buffer()
+{
+  static thread_local TraceBuffer* buffer = nullptr;
+  if (!buffer) {
+    trace_detail::Registry& r = trace_detail::registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.buffers.push_back(std::unique_ptr<TraceBuffer>(new TraceBuffer((int)r.buffers.size() + 1, r.capacity)));
+    buffer = r.buffers.back().get();
+  }
+  return buffer;
+}
+
+// records an event measured elsewhere; no-op while tracing is off
+inline
+void trace_complete(const char* name, int64_t arg, int64_t begin, int64_t end)
+{
+  if (trace_enabled()) {
+    trace_thread_buffer()->add(name, arg, begin, end);
+  }
+}
+
+// clears what was recorded and starts recording
+inline
+void trace_start(size_t events_per_thread = 1 << 16)
+{
+  trace_detail::Registry& r = trace_detail::registry();
+  {
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.capacity = events_per_thread;
+    for (size_t i=0; i<r.buffers.size(); ++i) {
+      r.buffers[i]->reset(events_per_thread);
+    }
+    r.origin = std::chrono::steady_clock::now();
+  }
+  trace_detail::Flags<void>::enabled.store(true, std::memory_order_release);
+}
+
+inline
+void trace_stop()
+{
+  trace_detail::Flags<void>::enabled.store(false, std::memory_order_release);
+}
+
+// writes the recorded events as a Chrome trace; returns false if the file
+// cannot be written
+inline
+bool trace_write(const char* path)
+{
+  FILE* f = fopen(path, "w");
+  if (!f) {
+    return false;
+  }
+  trace_detail::Registry& r = trace_detail::registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  size_t dropped = 0;
+  bool first = true;
+  fprintf(f, "{\"traceEvents\":[\n");
+  for (size_t i=0; i<r.buffers.size(); ++i) {
+    const TraceBuffer& b = *r.buffers[i];
+    dropped += b.dropped();
+    for (size_t j=0; j<b.size(); ++j) {
+      const TraceEvent& e = b.event(j);
+      fprintf(f, "%s{\"name\":\"", first ? "" : ",\n");
+      for (const char* p=e.name; *p; ++p) {
+        if (*p == '"' || *p == '\\') {
+          fputc('\\', f);
+        }
+        fputc(*p, f);
+      }
+      fprintf(f, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+              b.tid(), e.begin * 1e-3, (e.end - e.begin) * 1e-3);
+      if (e.arg >= 0) {
+        fprintf(f, ",\"args\":{\"arg\":%lld}", (long long)e.arg);
+      }
+      fprintf(f, "}");
+      first = false;
+    }
+  }
+  fprintf(f, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":%zu}}\n", dropped);
+  fclose(f);
+  return true;
+}
+
+// records the enclosing scope as one event
+class TraceScope
+{
+public:
+  explicit TraceScope(const char* name, int64_t arg = -1)
+    :
+    name_(nullptr)
+  {
+    if (trace_enabled()) {
+      name_ = name;
+      arg_ = arg;
+      begin_ = trace_now();
+    }
+  }
+
+  ~TraceScope() {
+    if (name_) {
+      trace_thread_buffer()->add(name_, arg_, begin_, trace_now());
+    }
+  }
+
+private:
+  TraceScope(const TraceScope&);
+  TraceScope& operator=(const TraceScope&);
+
+  const char* name_;
+  int64_t arg_;
+  int64_t begin_;
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_SCOPE_ARG(name, arg) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name, arg)